@@ -1,5 +1,6 @@
 # DO NOT EDIT, GENERATED BY SCRIPT
 set(llfio_HEADERS
+  "include/kvstore/detail/impl/kvstore.ipp"
   "include/kvstore/kvstore.hpp"
   "include/llfio.hpp"
   "include/llfio/llfio.hpp"
@@ -56,6 +57,7 @@ set(llfio_HEADERS
   "include/llfio/v2.0/detail/impl/reduce.ipp"
   "include/llfio/v2.0/detail/impl/safe_byte_ranges.ipp"
   "include/llfio/v2.0/detail/impl/storage_profile.ipp"
+  "include/llfio/v2.0/detail/impl/storage_profile_cache.ipp"
   "include/llfio/v2.0/detail/impl/test/null_multiplexer.ipp"
   "include/llfio/v2.0/detail/impl/traverse.ipp"
   "include/llfio/v2.0/detail/impl/windows/directory_handle.ipp"
@@ -102,6 +104,7 @@ set(llfio_HEADERS
   "include/llfio/v2.0/statfs.hpp"
   "include/llfio/v2.0/status_code.hpp"
   "include/llfio/v2.0/storage_profile.hpp"
+  "include/llfio/v2.0/storage_profile_cache.hpp"
   "include/llfio/v2.0/symlink_handle.hpp"
   "include/llfio/v2.0/utils.hpp"
   "include/llfio/version.hpp"
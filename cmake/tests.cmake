@@ -8,15 +8,18 @@ set(llfio_TESTS
   "test/tests/directory_handle_enumerate/kernel_directory_handle_enumerate.cpp.hpp"
   "test/tests/directory_handle_enumerate/runner.cpp"
   "test/tests/dynamic_thread_pool_group.cpp"
+  "test/tests/dynamic_thread_pool_group_schedstat.cpp"
   "test/tests/fast_random_file_handle.cpp"
   "test/tests/file_handle_create_close/kernel_file_handle.cpp.hpp"
   "test/tests/file_handle_create_close/runner.cpp"
   "test/tests/file_handle_lock_unlock.cpp"
   "test/tests/handle_adapter_xor.cpp"
+  "test/tests/io_trace_hook.cpp"
   "test/tests/issue0009.cpp"
   "test/tests/issue0027.cpp"
   "test/tests/issue0028.cpp"
   "test/tests/issue0073.cpp"
+  "test/tests/kvstore.cpp"
   "test/tests/large_pages.cpp"
   "test/tests/map_handle_create_close/kernel_map_handle.cpp.hpp"
   "test/tests/map_handle_create_close/runner.cpp"
@@ -30,6 +33,8 @@ set(llfio_TESTS
   "test/tests/section_handle_create_close/runner.cpp"
   "test/tests/shared_fs_mutex.cpp"
   "test/tests/statfs.cpp"
+  "test/tests/storage_profile.cpp"
+  "test/tests/storage_profile_cache.cpp"
   "test/tests/symlink_handle_create_close/kernel_symlink_handle.cpp.hpp"
   "test/tests/symlink_handle_create_close/runner.cpp"
   "test/tests/traverse.cpp"
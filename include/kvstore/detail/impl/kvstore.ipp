@@ -0,0 +1,1598 @@
+/* Standard key-value store for C++
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#include "../../kvstore.hpp"
+
+#include "../../../llfio/v2.0/algorithm/shared_fs_mutex/byte_ranges.hpp"
+#include "../../../llfio/v2.0/directory_handle.hpp"
+#include "../../../llfio/v2.0/mapped_file_handle.hpp"
+
+#include "quickcpplib/algorithm/hash.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+KVSTORE_V1_NAMESPACE_BEGIN
+
+namespace detail
+{
+  /* The `mapped_files` provider.
+
+  The store is a directory containing four files:
+
+  - `index`: A 4Kb header followed by a power of two sized open addressed hash table
+  of slots, linearly probed. Each slot is a 64 byte head followed by the key, padded
+  to 64 bytes. A slot, once claimed by a key, keeps that key until the store is cleared.
+  - `values`: An append only log of values, each aligned to 64 bytes. Values are never
+  modified once written, which is what lets readers return buffers pointing into the map.
+  Superseded values are not reclaimed until `clear()` rewinds the whole log.
+  - `ordered`: A 4Kb header followed by a sorted delta run of up to 4096 keys, followed by a
+  sorted base run of keys. New keys are merged into the delta run, which is merged into the
+  base run when full. The runs are updated within a seqlock, and let `match()` find the keys
+  with a given prefix in `O(log n)`.
+  - `lock`: The byte range lock file used to serialise writers across processes.
+
+  Each slot records the two most recent versions of its value as (monotonic count, offset,
+  length). Writers update a slot within a seqlock, so readers never take locks. A commit
+  takes the next monotonic count, appends all its values, updates all its slots, and only
+  then publishes the new count in the header. Snapshots pin the count at creation, and
+  only ever see versions at or before it. If both versions of a key are newer than a
+  snapshot's count, the snapshot is too old to read that key.
+
+  Whilst a commit updates its slots, the header records its count. A writer which dies
+  mid-commit leaves that count behind, and perhaps a slot's seqlock odd, so the next writer
+  to take the lock rolls the abandoned commit's slots back, and rebuilds the ordered index.
+
+  Snapshots and transactions hold a shared lock on byte 1 of the `lock` file, and `clear()`
+  refuses to run unless it can lock that byte exclusively. The index is never shrunk, and
+  values are only overwritten after `clear()` rewinds the log, when no snapshot exists, so
+  nothing ever referred to by a snapshot is unmapped or changed.
+
+  Rehashing a populated table in place would break lock free readers, so the table can only
+  be grown whilst the store is empty. A commit which would fill more than three quarters of
+  the slots fails with `errc::no_space_on_device`.
+  */
+  static constexpr uint64_t mapped_kvstore_magic = 0x31564b4f49464c4c;  // "LLFIOKV1"
+  static constexpr size_t mapped_kvstore_header_size = 4096;
+  static constexpr uint64_t mapped_kvstore_default_slots = 65536;
+  static constexpr uint64_t mapped_kvstore_values_granularity = 64 * 1024 * 1024;
+  static constexpr uint64_t mapped_kvstore_latest = (uint64_t) -1;  // a pin which sees every version
+  static constexpr uint64_t mapped_kvstore_reservation = (sizeof(size_t) >= 8) ? (uint64_t(1) << 40U) : (uint64_t(1) << 30U);
+  static constexpr uint64_t mapped_kvstore_clearing = (uint64_t) -1;                // the commit count recorded whilst clearing
+  static constexpr uint64_t mapped_kvstore_ordered_magic = 0x314f4b4f49464c4c;      // "LLFIOKO1"
+  static constexpr uint64_t mapped_kvstore_ordered_delta = 4096;                     // the capacity of the delta run
+  static constexpr uint64_t mapped_kvstore_ordered_granularity = 1024 * 1024;
+
+  struct mapped_kvstore_header
+  {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t slots;      // always a power of two
+    uint64_t slot_size;  // 64 + key size rounded up to 64
+    std::atomic<uint64_t> counter;
+    std::atomic<uint64_t> items;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> values_extent;
+    uint64_t items_quota;
+    uint64_t bytes_quota;
+    std::atomic<uint64_t> committing;  // the count of a commit updating its slots, zero if none
+  };
+
+  struct mapped_kvstore_ordered_header
+  {
+    uint64_t magic;
+    std::atomic<uint64_t> generation;  // odd whilst the runs are being modified
+    uint64_t base_count;
+    uint64_t delta_count;
+  };
+  static_assert(sizeof(mapped_kvstore_header) <= mapped_kvstore_header_size, "mapped_kvstore_header is too big");
+
+  struct mapped_kvstore_version
+  {
+    uint64_t counter{0};  // zero means no version
+    uint64_t offset{0};
+    uint64_t length{0};
+  };
+  struct mapped_kvstore_slot
+  {
+    std::atomic<uint64_t> seq;  // odd whilst the slot is being modified
+    uint64_t hash;              // zero if the slot has never been used
+    mapped_kvstore_version versions[2];
+    uint64_t created;  // the count of the first version of the key, zero if unknown
+    // The key follows
+  };
+  static_assert(sizeof(mapped_kvstore_slot) == 64, "mapped_kvstore_slot is not 64 bytes");
+
+  // A consistent copy of a slot, taken within its seqlock
+  struct mapped_kvstore_slot_copy
+  {
+    uint64_t index{0};
+    uint64_t hash{0};
+    mapped_kvstore_version versions[2];
+    uint64_t created{0};
+  };
+
+  inline uint64_t mapped_kvstore_round64(uint64_t v) noexcept { return (v + 63) & ~uint64_t(63); }
+
+  // State shared between a store and all its snapshots and transactions
+  struct mapped_kvstore_state
+  {
+    llfio::directory_handle dir;
+    llfio::mapped_file_handle index, values, ordered;  // ordered may not be open for read only users of old stores
+    llfio::optional<llfio::algorithm::shared_fs_mutex::byte_ranges> lockfile;
+    basic_key_value_store::caching caching{basic_key_value_store::caching::all};
+    bool writable{false};
+    std::mutex writerlock;  // byte range locks are per process on POSIX
+    std::mutex maplock;
+    std::atomic<size_t> index_mapped{0}, values_mapped{0}, ordered_mapped{0};
+    std::mutex pinlock;
+    size_t pins{0};                                                                            // snapshots and transactions in this process
+    llfio::optional<llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entities_guard> pinguard;  // held whilst pins is not zero
+
+    mapped_kvstore_header *header() const noexcept { return reinterpret_cast<mapped_kvstore_header *>(index.address()); }
+    mapped_kvstore_slot *slot(uint64_t idx) const noexcept
+    {
+      auto *h = header();
+      return reinterpret_cast<mapped_kvstore_slot *>(index.address() + mapped_kvstore_header_size + idx * h->slot_size);
+    }
+    static byte *key_of(mapped_kvstore_slot *s) noexcept { return reinterpret_cast<byte *>(s) + sizeof(mapped_kvstore_slot); }
+    mapped_kvstore_ordered_header *ordered_header() const noexcept { return reinterpret_cast<mapped_kvstore_ordered_header *>(ordered.address()); }
+    byte *ordered_delta() const noexcept { return ordered.address() + mapped_kvstore_header_size; }
+    byte *ordered_base() const noexcept { return ordered_delta() + mapped_kvstore_ordered_delta * header()->key_size; }
+    static uint64_t hash_of(basic_key_value_store::key_type key) noexcept
+    {
+      auto h = QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash::hash(reinterpret_cast<const char *>(key.data()), key.size());
+      // Zero marks an unused slot
+      return h.as_longlongs[0] | 1U;
+    }
+
+    // Ensures the local map of the index covers the table, which another process may have resized
+    result<void> map_index() noexcept
+    {
+      auto *h = header();
+      const size_t needed = static_cast<size_t>(mapped_kvstore_header_size + h->slots * h->slot_size);
+      if(needed <= index_mapped.load(std::memory_order_acquire))
+      {
+        return llfio::success();
+      }
+      std::lock_guard<std::mutex> g(maplock);
+      OUTCOME_TRY(auto &&length, index.update_map());
+      index_mapped.store(static_cast<size_t>(length), std::memory_order_release);
+      if(needed > length)
+      {
+        return llfio::errc::illegal_byte_sequence;
+      }
+      return llfio::success();
+    }
+    // Ensures the local map of the values covers `extent`, which may have been appended by another process
+    result<void> map_values(uint64_t extent) noexcept
+    {
+      if(extent <= values_mapped.load(std::memory_order_acquire))
+      {
+        return llfio::success();
+      }
+      std::lock_guard<std::mutex> g(maplock);
+      OUTCOME_TRY(auto &&length, values.update_map());
+      values_mapped.store(static_cast<size_t>(length), std::memory_order_release);
+      if(extent > length)
+      {
+        return llfio::errc::illegal_byte_sequence;
+      }
+      return llfio::success();
+    }
+
+    // Called when a snapshot or transaction is created, so clear() knows to refuse
+    result<void> pin() noexcept
+    {
+      std::lock_guard<std::mutex> g(pinlock);
+      if(pins == 0 && lockfile)
+      {
+        OUTCOME_TRY(auto &&guard, lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(1, false)));
+        pinguard.emplace(std::move(guard));
+      }
+      pins++;
+      return llfio::success();
+    }
+    void unpin() noexcept
+    {
+      std::lock_guard<std::mutex> g(pinlock);
+      if(--pins == 0)
+      {
+        pinguard.reset();
+      }
+    }
+
+    // Rolls back the slots of a commit abandoned by a writer which died. Must be called with the writer lock held.
+    result<void> repair() noexcept
+    {
+      OUTCOME_TRY(map_index());
+      auto *h = header();
+      const uint64_t committing = h->committing.load(std::memory_order_acquire);
+      if(committing == 0)
+      {
+        // A writer which died rebuilding the ordered index leaves its generation odd
+        if(ordered.is_valid() && (ordered_header()->generation.load(std::memory_order_acquire) & 1U) != 0)
+        {
+          return ordered_rebuild();
+        }
+        return llfio::success();
+      }
+      if(committing == mapped_kvstore_clearing)
+      {
+        return reset(h->slots);
+      }
+      // Counts not yet published belong to the abandoned commit
+      const uint64_t published = h->counter.load(std::memory_order_relaxed);
+      uint64_t items = 0, bytes = 0;
+      for(uint64_t idx = 0; idx < h->slots; idx++)
+      {
+        auto *s = slot(idx);
+        const uint64_t seq = s->seq.load(std::memory_order_relaxed);
+        const bool unpublished = s->versions[0].counter > published;
+        // A writer which died between copying the latest version and replacing it leaves it duplicated
+        const bool duplicated = s->versions[1].counter != 0 && s->versions[1].counter == s->versions[0].counter;
+        if((seq & 1U) != 0 || unpublished || duplicated || (s->hash != 0 && s->versions[0].counter == 0))
+        {
+          s->seq.store(seq | 1U, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_release);
+          if(unpublished)
+          {
+            s->versions[0] = s->versions[1];
+            s->versions[1] = {};
+          }
+          else if(duplicated)
+          {
+            s->versions[1] = {};
+          }
+          if(s->versions[0].counter == 0)
+          {
+            // The key was inserted by the abandoned commit
+            s->hash = 0;
+            s->created = 0;
+            memset(key_of(s), 0, static_cast<size_t>(h->key_size));
+          }
+          s->seq.store((seq | 1U) + 1, std::memory_order_release);
+        }
+        if(s->hash != 0)
+        {
+          items++;
+          bytes += s->versions[0].length;
+        }
+      }
+      // The abandoned commit may have inserted keys into the ordered index, or left it mid-update
+      OUTCOME_TRY(ordered_rebuild());
+      h->items.store(items, std::memory_order_relaxed);
+      h->bytes.store(bytes, std::memory_order_relaxed);
+      h->committing.store(0, std::memory_order_release);
+      return llfio::success();
+    }
+    /* Called by lock free readers which have seen a seqlock stay odd. Writers wait for the
+    writer lock, then repair any commit abandoned by a writer which died. Read only users
+    cannot take the writer lock, so fail if the seqlock stays odd for more than a second.
+    Must not be called with the writer lock held, which is why commit() repairs first.
+    */
+    result<void> writer_stalled(std::chrono::steady_clock::time_point since) noexcept
+    {
+      if(!writable)
+      {
+        if(std::chrono::steady_clock::now() - since > std::chrono::seconds(1))
+        {
+          return llfio::errc::state_not_recoverable;
+        }
+        return llfio::success();
+      }
+      std::lock_guard<std::mutex> g1(writerlock);
+      OUTCOME_TRY(auto &&g2, lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(0, true)));
+      (void) g2;
+      return repair();
+    }
+
+    // Ensures the local map of the ordered index covers `extent`, which another process may have grown
+    result<void> map_ordered(uint64_t extent) noexcept
+    {
+      if(extent <= ordered_mapped.load(std::memory_order_acquire))
+      {
+        return llfio::success();
+      }
+      std::lock_guard<std::mutex> g(maplock);
+      OUTCOME_TRY(auto &&length, ordered.update_map());
+      ordered_mapped.store(static_cast<size_t>(length), std::memory_order_release);
+      if(extent > length)
+      {
+        return llfio::errc::illegal_byte_sequence;
+      }
+      return llfio::success();
+    }
+    // Grows the ordered index to hold a base run of `count` keys. Must be called with the writer lock held.
+    result<void> ordered_reserve(uint64_t count) noexcept
+    {
+      const uint64_t needed = mapped_kvstore_header_size + (mapped_kvstore_ordered_delta + count) * header()->key_size;
+      std::lock_guard<std::mutex> g(maplock);
+      OUTCOME_TRY(auto &&extent, ordered.maximum_extent());
+      if(extent < needed)
+      {
+        OUTCOME_TRY(ordered.truncate((needed + mapped_kvstore_ordered_granularity - 1) & ~(mapped_kvstore_ordered_granularity - 1)));
+      }
+      ordered_mapped.store(static_cast<size_t>(ordered.map().length()), std::memory_order_release);
+      return llfio::success();
+    }
+    // Rebuilds the ordered index from the table. Must be called with the writer lock held.
+    result<void> ordered_rebuild() noexcept
+    {
+      if(!ordered.is_valid())
+      {
+        return llfio::success();
+      }
+      try
+      {
+        auto *h = header();
+        const size_t keysize = static_cast<size_t>(h->key_size);
+        std::vector<byte> keys;
+        std::vector<size_t> order;
+        for(uint64_t idx = 0; idx < h->slots; idx++)
+        {
+          auto *s = slot(idx);
+          if(s->hash != 0)
+          {
+            order.push_back(order.size());
+            keys.insert(keys.end(), key_of(s), key_of(s) + keysize);
+          }
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return memcmp(keys.data() + a * keysize, keys.data() + b * keysize, keysize) < 0; });
+        OUTCOME_TRY(ordered_reserve(order.size()));
+        auto *oh = ordered_header();
+        // Leave a generation left odd by a writer which died odd, so readers never see it even mid-rebuild
+        if((oh->generation.load(std::memory_order_acquire) & 1U) == 0)
+        {
+          oh->generation.fetch_add(1, std::memory_order_acq_rel);
+        }
+        byte *base = ordered_base();
+        for(size_t n = 0; n < order.size(); n++)
+        {
+          memcpy(base + n * keysize, keys.data() + order[n] * keysize, keysize);
+        }
+        oh->base_count = order.size();
+        oh->delta_count = 0;
+        oh->magic = mapped_kvstore_ordered_magic;
+        oh->generation.fetch_add(1, std::memory_order_release);
+        return llfio::success();
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+    }
+    /* Adds the `count` keys packed in `keys`, newly inserted by a commit, to the ordered index.
+    Must be called with the writer lock held. Cannot fail, as the commit has already reserved
+    the ordered index, and sized `merged` if the delta run would overflow.
+    */
+    void ordered_insert(const byte *keys, size_t *order, size_t count, std::vector<byte> &merged) noexcept
+    {
+      if(!ordered.is_valid() || count == 0)
+      {
+        return;
+      }
+      auto *oh = ordered_header();
+      const size_t keysize = static_cast<size_t>(header()->key_size);
+      std::sort(order, order + count, [&](size_t a, size_t b) { return memcmp(keys + a * keysize, keys + b * keysize, keysize) < 0; });
+      auto key = [&](size_t n) { return keys + order[n] * keysize; };
+      byte *delta = ordered_delta();
+      const uint64_t base_count = oh->base_count, delta_count = oh->delta_count;
+      oh->generation.fetch_add(1, std::memory_order_acq_rel);
+      if(delta_count + count > mapped_kvstore_ordered_delta)
+      {
+        byte *base = ordered_base(), *out = merged.data();
+        uint64_t b = 0, d = 0;
+        size_t k = 0;
+        while(b < base_count || d < delta_count || k < count)
+        {
+          const byte *next = (b < base_count) ? base + b * keysize : nullptr;
+          int from = 0;
+          if(d < delta_count && (next == nullptr || memcmp(delta + d * keysize, next, keysize) < 0))
+          {
+            next = delta + d * keysize;
+            from = 1;
+          }
+          if(k < count && (next == nullptr || memcmp(key(k), next, keysize) < 0))
+          {
+            next = key(k);
+            from = 2;
+          }
+          memcpy(out, next, keysize);
+          out += keysize;
+          if(from == 0)
+          {
+            b++;
+          }
+          else if(from == 1)
+          {
+            d++;
+          }
+          else
+          {
+            k++;
+          }
+        }
+        memcpy(base, merged.data(), static_cast<size_t>((base_count + delta_count + count) * keysize));
+        oh->base_count = base_count + delta_count + count;
+        oh->delta_count = 0;
+      }
+      else
+      {
+        // Merge into the delta from the back, so no temporary is needed
+        uint64_t d = delta_count, out = delta_count + count;
+        size_t k = count;
+        while(k > 0)
+        {
+          out--;
+          if(d > 0 && memcmp(key(k - 1), delta + (d - 1) * keysize, keysize) < 0)
+          {
+            d--;
+            memmove(delta + out * keysize, delta + d * keysize, keysize);
+          }
+          else
+          {
+            k--;
+            memcpy(delta + out * keysize, key(k), keysize);
+          }
+        }
+        oh->delta_count = delta_count + count;
+      }
+      oh->generation.fetch_add(1, std::memory_order_release);
+    }
+    /* Lock free, copies into `out` the least key in the ordered index greater than `from`, or
+    no less than it if `inclusive`, returning false if there is none.
+    */
+    result<bool> ordered_next(const byte *from, bool inclusive, byte *out) noexcept
+    {
+      auto *oh = ordered_header();
+      const size_t keysize = static_cast<size_t>(header()->key_size);
+      auto bound = [&](const byte *run, uint64_t count) -> const byte * {
+        uint64_t lo = 0, hi = count;
+        while(lo < hi)
+        {
+          const uint64_t mid = lo + (hi - lo) / 2;
+          const int c = memcmp(run + mid * keysize, from, keysize);
+          if(c < 0 || (c == 0 && !inclusive))
+          {
+            lo = mid + 1;
+          }
+          else
+          {
+            hi = mid;
+          }
+        }
+        return (lo < count) ? run + lo * keysize : nullptr;
+      };
+      std::chrono::steady_clock::time_point stalled;
+      for(size_t spins = 0;; spins++)
+      {
+        const uint64_t generation = oh->generation.load(std::memory_order_acquire);
+        if(generation & 1U)
+        {
+          OUTCOME_TRY(spin(spins, stalled));
+          continue;
+        }
+        const uint64_t base_count = oh->base_count, delta_count = std::min(oh->delta_count, mapped_kvstore_ordered_delta);
+        OUTCOME_TRY(map_ordered(mapped_kvstore_header_size + (mapped_kvstore_ordered_delta + base_count) * keysize));
+        const byte *b = bound(ordered_base(), base_count), *d = bound(ordered_delta(), delta_count);
+        const byte *next = (b == nullptr) ? d : (d == nullptr) ? b : (memcmp(d, b, keysize) < 0) ? d : b;
+        if(next != nullptr)
+        {
+          memcpy(out, next, keysize);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(generation == oh->generation.load(std::memory_order_relaxed))
+        {
+          return next != nullptr;
+        }
+      }
+    }
+    // Called by lock free readers each time they find a seqlock odd
+    result<void> spin(size_t spins, std::chrono::steady_clock::time_point &stalled) noexcept
+    {
+      if(spins == 1024)
+      {
+        stalled = std::chrono::steady_clock::now();
+      }
+      else if(spins > 1024 && (spins % 1024) == 0)
+      {
+        OUTCOME_TRY(writer_stalled(stalled));
+      }
+      std::this_thread::yield();
+      return llfio::success();
+    }
+
+    // Lock free lookup of a key, returning the index of its slot or of the empty slot which ends its probe
+    result<mapped_kvstore_slot_copy> find(basic_key_value_store::key_type key) noexcept
+    {
+      OUTCOME_TRY(map_index());
+      auto *h = header();
+      if(key.size() != h->key_size)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      const uint64_t hash = hash_of(key), mask = h->slots - 1;
+      mapped_kvstore_slot_copy ret;
+      for(uint64_t n = 0, idx = hash & mask; n < h->slots; n++, idx = (idx + 1) & mask)
+      {
+        auto *s = slot(idx);
+        bool keymatches;
+        std::chrono::steady_clock::time_point stalled;
+        for(size_t spins = 0;; spins++)
+        {
+          const uint64_t seq1 = s->seq.load(std::memory_order_acquire);
+          if(seq1 & 1U)
+          {
+            OUTCOME_TRY(spin(spins, stalled));
+            continue;
+          }
+          ret.index = idx;
+          ret.hash = s->hash;
+          memcpy(ret.versions, s->versions, sizeof(ret.versions));
+          ret.created = s->created;
+          keymatches = (ret.hash == hash) && 0 == memcmp(key_of(s), key.data(), key.size());
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if(seq1 == s->seq.load(std::memory_order_relaxed))
+          {
+            break;
+          }
+        }
+        if(ret.hash == 0 || keymatches)
+        {
+          return ret;
+        }
+      }
+      // The table is completely full, and the key was not found
+      ret.index = (uint64_t) -1;
+      ret.hash = 0;
+      return ret;
+    }
+
+    /* Returns the version of a slot visible at `pin`, if any. If the key existed at `pin`
+    but both retained versions are newer, sets `too_old`.
+    */
+    static const mapped_kvstore_version *visible(const mapped_kvstore_slot_copy &c, uint64_t pin, bool &too_old) noexcept
+    {
+      too_old = false;
+      if(c.hash == 0)
+      {
+        return nullptr;
+      }
+      if(c.versions[0].counter <= pin)
+      {
+        return &c.versions[0];
+      }
+      if(c.versions[1].counter != 0 && c.versions[1].counter <= pin)
+      {
+        return &c.versions[1];
+      }
+      // Without a second version, the key was created after pin. Slots from before `created`
+      // was recorded might have been either, so are assumed too old.
+      too_old = c.versions[1].counter != 0 && (c.created == 0 || c.created <= pin);
+      return nullptr;
+    }
+
+    // A pending update of a key, used by commit()
+    struct update
+    {
+      basic_key_value_store::key_type key;
+      llfio::span<const basic_key_value_store::const_buffer_type> value;
+    };
+    // The version of a key a transaction depends upon, zero meaning the key did not exist
+    struct dependency
+    {
+      basic_key_value_store::key_type key;
+      uint64_t counter;
+    };
+    // Atomically applies `updates`, whose keys must be unique, if every one of `dependencies` is still current
+    result<void> commit(llfio::span<const dependency> dependencies, llfio::span<const update> updates) noexcept
+    {
+      if(!writable)
+      {
+        return llfio::errc::permission_denied;
+      }
+      if(updates.empty())
+      {
+        return llfio::success();
+      }
+      std::lock_guard<std::mutex> g1(writerlock);
+      OUTCOME_TRY(auto &&g2, lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(0, true)));
+      (void) g2;
+      OUTCOME_TRY(repair());
+      for(auto &d : dependencies)
+      {
+        OUTCOME_TRY(auto &&c, find(d.key));
+        const uint64_t current = (c.hash != 0) ? c.versions[0].counter : 0;
+        if(current != d.counter)
+        {
+          return llfio::errc::resource_unavailable_try_again;
+        }
+      }
+      auto *h = header();
+      // First pass checks quotas and appends the values. Keys are unique within a commit.
+      uint64_t extent = h->values_extent.load(std::memory_order_relaxed), totalbytes = h->bytes.load(std::memory_order_relaxed);
+      uint64_t newitems = 0;
+      const uint64_t newcounter = h->counter.load(std::memory_order_relaxed) + 1;
+      std::vector<mapped_kvstore_version> versions;
+      try
+      {
+        versions.reserve(updates.size());
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+      for(auto &u : updates)
+      {
+        OUTCOME_TRY(auto &&c, find(u.key));
+        mapped_kvstore_version v;
+        v.counter = newcounter;
+        v.offset = extent;
+        for(auto &b : u.value)
+        {
+          v.length += b.size();
+        }
+        if(c.hash == 0)
+        {
+          const uint64_t items = h->items.load(std::memory_order_relaxed) + (++newitems);
+          if(c.index == (uint64_t) -1 || items > h->slots * 3 / 4 || (h->items_quota != 0 && items > h->items_quota))
+          {
+            return llfio::errc::no_space_on_device;
+          }
+        }
+        else
+        {
+          totalbytes -= c.versions[0].length;
+        }
+        totalbytes += v.length;
+        if(h->bytes_quota != 0 && totalbytes > h->bytes_quota)
+        {
+          return llfio::errc::no_space_on_device;
+        }
+        extent += mapped_kvstore_round64(v.length);
+        if(extent > values_mapped.load(std::memory_order_relaxed))
+        {
+          std::lock_guard<std::mutex> g3(maplock);
+          const uint64_t newlength = (extent + mapped_kvstore_values_granularity - 1) & ~(mapped_kvstore_values_granularity - 1);
+          if(newlength > values.capacity())
+          {
+            return llfio::errc::no_space_on_device;
+          }
+          OUTCOME_TRY(auto &&length, values.truncate(newlength));
+          values_mapped.store(static_cast<size_t>(length), std::memory_order_release);
+        }
+        byte *dest = values.address() + v.offset;
+        for(auto &b : u.value)
+        {
+          memcpy(dest, b.data(), b.size());
+          dest += b.size();
+        }
+        versions.push_back(v);
+      }
+      // Everything which can fail is done before any slot is updated
+      const size_t keysize = static_cast<size_t>(h->key_size);
+      std::vector<byte> inserted, merged;
+      std::vector<size_t> order;
+      try
+      {
+        inserted.reserve(static_cast<size_t>(newitems) * keysize);
+        order.reserve(static_cast<size_t>(newitems));
+        if(ordered.is_valid() && newitems > 0)
+        {
+          auto *oh = ordered_header();
+          OUTCOME_TRY(ordered_reserve(oh->base_count + oh->delta_count + newitems));
+          if(oh->delta_count + newitems > mapped_kvstore_ordered_delta)
+          {
+            merged.resize(static_cast<size_t>(oh->base_count + oh->delta_count + newitems) * keysize);
+          }
+        }
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+      const bool durable = (caching == basic_key_value_store::caching::reads || caching == basic_key_value_store::caching::reads_and_metadata || caching == basic_key_value_store::caching::safety_barriers);
+      if(durable)
+      {
+        OUTCOME_TRY(values.barrier({}, llfio::file_handle::barrier_kind::wait_data_only));
+      }
+      h->values_extent.store(extent, std::memory_order_relaxed);
+      h->committing.store(newcounter, std::memory_order_relaxed);
+      // Second pass updates the slots. Only this writer modifies the table, so finding each key
+      // again accounts for empty slots claimed earlier in this pass.
+      for(size_t n = 0; n < updates.size(); n++)
+      {
+        OUTCOME_TRY(auto &&c, find(updates[n].key));
+        auto *s = slot(c.index);
+        const uint64_t seq = s->seq.load(std::memory_order_relaxed);
+        s->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if(c.hash == 0)
+        {
+          memcpy(key_of(s), updates[n].key.data(), updates[n].key.size());
+          s->hash = hash_of(updates[n].key);
+          s->created = newcounter;
+          order.push_back(order.size());
+          inserted.insert(inserted.end(), updates[n].key.begin(), updates[n].key.end());
+        }
+        s->versions[1] = s->versions[0];
+        s->versions[0] = versions[n];
+        s->seq.store(seq + 2, std::memory_order_release);
+      }
+      ordered_insert(inserted.data(), order.data(), order.size(), merged);
+      // Publishing the new monotonic count makes the commit visible to snapshots
+      h->items.fetch_add(newitems, std::memory_order_relaxed);
+      h->bytes.store(totalbytes, std::memory_order_relaxed);
+      h->counter.store(newcounter, std::memory_order_release);
+      h->committing.store(0, std::memory_order_release);
+      if(durable)
+      {
+        OUTCOME_TRY(index.barrier({}, llfio::file_handle::barrier_kind::wait_data_only));
+      }
+      return llfio::success();
+    }
+
+    /* Empties the table, growing it to `slots` slots if larger. Must be called with the writer
+    lock held. Other users may still have the index mapped, so it is never shrunk, and slots
+    are emptied within their seqlocks. Values are left in place for any buffers still
+    referring to them.
+    */
+    result<void> reset(uint64_t slots) noexcept
+    {
+      auto *h = header();
+      // repair() finishes clearing for a writer which died doing so
+      if(h->committing.load(std::memory_order_acquire) != mapped_kvstore_clearing)
+      {
+        OUTCOME_TRY(repair());
+      }
+      if(slots > h->slots)
+      {
+        std::lock_guard<std::mutex> g(maplock);
+        const uint64_t length = mapped_kvstore_header_size + slots * h->slot_size;
+        OUTCOME_TRY(auto &&extent, index.maximum_extent());
+        if(extent < length)
+        {
+          OUTCOME_TRY(index.truncate(length));
+        }
+        index_mapped.store(static_cast<size_t>(index.map().length()), std::memory_order_release);
+      }
+      h->committing.store(mapped_kvstore_clearing, std::memory_order_relaxed);
+      for(uint64_t idx = 0; idx < h->slots; idx++)
+      {
+        auto *s = slot(idx);
+        const uint64_t seq = s->seq.load(std::memory_order_relaxed);
+        if(s->hash == 0 && (seq & 1U) == 0)
+        {
+          continue;
+        }
+        s->seq.store(seq | 1U, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memset(reinterpret_cast<byte *>(s) + sizeof(s->seq), 0, static_cast<size_t>(h->slot_size - sizeof(s->seq)));
+        s->seq.store((seq | 1U) + 1, std::memory_order_release);
+      }
+      if(ordered.is_valid())
+      {
+        auto *oh = ordered_header();
+        oh->generation.fetch_add(1, std::memory_order_acq_rel);
+        oh->base_count = 0;
+        oh->delta_count = 0;
+        oh->generation.fetch_add(1, std::memory_order_release);
+      }
+      h->slots = (slots > h->slots) ? slots : h->slots;
+      h->items.store(0, std::memory_order_relaxed);
+      h->bytes.store(0, std::memory_order_relaxed);
+      h->counter.fetch_add(1, std::memory_order_release);
+      h->committing.store(0, std::memory_order_release);
+      return llfio::success();
+    }
+  };
+
+  /* The store, snapshot and transaction implementations share everything except
+  how reads are recorded and how writes are applied, so are all this template.
+  */
+  template <class Base> class mapped_kvstore_impl : public Base
+  {
+  protected:
+    using key_type = basic_key_value_store::key_type;
+    using capacity_type = basic_key_value_store::capacity_type;
+    using extent_type = basic_key_value_store::extent_type;
+    using size_type = basic_key_value_store::size_type;
+    using mode = basic_key_value_store::mode;
+    using uri_type = basic_key_value_store::uri_type;
+    using buffers_type = basic_key_value_store::buffers_type;
+    using const_buffers_type = basic_key_value_store::const_buffers_type;
+    template <class T> using io_request = basic_key_value_store::io_request<T>;
+    template <class T> using io_result = basic_key_value_store::io_result<T>;
+
+    std::shared_ptr<mapped_kvstore_state> _s;
+    uint64_t _pin{mapped_kvstore_latest};
+    bool _pinned{false};
+
+    mapped_kvstore_impl(std::shared_ptr<mapped_kvstore_state> s, const uri_type &uri, uint64_t pin)
+        : _s(std::move(s))
+        , _pin(pin)
+    {
+      this->_uri = uri;
+      this->_key_size = static_cast<size_type>(_s->header()->key_size);
+    }
+    ~mapped_kvstore_impl()
+    {
+      if(_pinned)
+      {
+        _s->unpin();
+      }
+    }
+    result<void> _pin_state() noexcept
+    {
+      OUTCOME_TRY(_s->pin());
+      _pinned = true;
+      return llfio::success();
+    }
+
+    // Finds the version of a key visible to this store
+    result<mapped_kvstore_version> _find(key_type key) noexcept
+    {
+      OUTCOME_TRY(auto &&c, _s->find(key));
+      bool too_old;
+      const auto *v = mapped_kvstore_state::visible(c, _pin, too_old);
+      if(v == nullptr)
+      {
+        // kvstore_errc::snapshot_too_old
+        return too_old ? llfio::errc::identifier_removed : llfio::errc::no_such_file_or_directory;
+      }
+      return *v;
+    }
+    io_result<buffers_type> _read(io_request<buffers_type> reqs, const byte *value, extent_type length) noexcept
+    {
+      const byte *addr = value + reqs.offset;
+      extent_type togo = reqs.offset < length ? (length - reqs.offset) : 0;
+      for(size_t i = 0; i < reqs.buffers.size(); i++)
+      {
+        auto &req = reqs.buffers[i];
+        req = {const_cast<byte *>(addr), req.size()};
+        if(req.size() > togo)
+        {
+          req = {req.data(), static_cast<size_t>(togo)};
+          reqs.buffers = {reqs.buffers.data(), i + 1};
+          break;
+        }
+        addr += req.size();
+        togo -= req.size();
+      }
+      return reqs.buffers;
+    }
+    io_result<buffers_type> _read(io_request<buffers_type> reqs, const mapped_kvstore_version &v) noexcept
+    {
+      OUTCOME_TRY(_s->map_values(v.offset + v.length));
+      return _read(reqs, _s->values.address() + v.offset, v.length);
+    }
+
+  public:
+    virtual result<uri_type> uri() noexcept override { return this->_uri; }
+    virtual bool empty() const noexcept override { return _s->header()->items.load(std::memory_order_relaxed) == 0; }
+    virtual result<capacity_type> max_size() const noexcept override
+    {
+      auto *h = _s->header();
+      const uint64_t tablemax = h->slots * 3 / 4;
+      return capacity_type((h->items_quota != 0 && h->items_quota < tablemax) ? h->items_quota : tablemax);
+    }
+    virtual result<void> max_size(capacity_type quota) noexcept override
+    {
+      if(!_s->writable || _pin != mapped_kvstore_latest)
+      {
+        return llfio::errc::permission_denied;
+      }
+      const uint64_t items = (quota.as_longlongs[1] != 0) ? (uint64_t) -1 : quota.as_longlongs[0];
+      std::lock_guard<std::mutex> g1(_s->writerlock);
+      OUTCOME_TRY(auto &&g2, _s->lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(0, true)));
+      (void) g2;
+      auto *h = _s->header();
+      uint64_t slots = mapped_kvstore_default_slots;
+      while(slots * 3 / 4 < items)
+      {
+        slots <<= 1U;
+      }
+      if(slots > h->slots)
+      {
+        // Rehashing a populated table in place would break lock free readers
+        if(h->items.load(std::memory_order_relaxed) != 0)
+        {
+          return llfio::errc::operation_not_supported;
+        }
+        OUTCOME_TRY(_s->reset(slots));
+      }
+      h->items_quota = items;
+      return llfio::success();
+    }
+    virtual result<capacity_type> size() const noexcept override { return capacity_type(_s->header()->items.load(std::memory_order_relaxed)); }
+    virtual result<capacity_type> max_bytes_stored() const noexcept override
+    {
+      auto *h = _s->header();
+      return capacity_type((h->bytes_quota != 0) ? h->bytes_quota : (uint64_t) _s->values.capacity());
+    }
+    virtual result<void> max_bytes_stored(capacity_type quota) noexcept override
+    {
+      if(!_s->writable || _pin != mapped_kvstore_latest)
+      {
+        return llfio::errc::permission_denied;
+      }
+      _s->header()->bytes_quota = (quota.as_longlongs[1] != 0) ? (uint64_t) -1 : quota.as_longlongs[0];
+      return llfio::success();
+    }
+    virtual result<capacity_type> bytes_stored() const noexcept override { return capacity_type(_s->header()->bytes.load(std::memory_order_relaxed)); }
+    virtual result<extent_type> max_value_size() const noexcept override { return static_cast<extent_type>(_s->values.capacity()); }
+    virtual result<void> key_index_size(size_type bytes) noexcept override
+    {
+      // Keys are hashed whole, so there is no constant time filtering on a key prefix
+      if(bytes != 0)
+      {
+        return llfio::errc::operation_not_supported;
+      }
+      return llfio::success();
+    }
+    virtual result<void> clear() noexcept override
+    {
+      if(!_s->writable || _pin != mapped_kvstore_latest)
+      {
+        return llfio::errc::permission_denied;
+      }
+      std::lock_guard<std::mutex> g1(_s->writerlock);
+      OUTCOME_TRY(auto &&g2, _s->lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(0, true)));
+      (void) g2;
+      // Refuse whilst any snapshot or transaction, in this or another process, could see the keys disappear
+      std::lock_guard<std::mutex> g3(_s->pinlock);
+      if(_s->pins != 0)
+      {
+        return llfio::errc::device_or_resource_busy;
+      }
+      auto g4 = _s->lockfile->try_lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(1, true));
+      if(!g4)
+      {
+        if(g4.error() == llfio::errc::timed_out)
+        {
+          return llfio::errc::device_or_resource_busy;
+        }
+        return std::move(g4).error();
+      }
+      OUTCOME_TRY(_s->reset(_s->header()->slots));
+      // Nothing now refers to any value, so rewind the log and deallocate what it held
+      const uint64_t extent = _s->header()->values_extent.exchange(0, std::memory_order_relaxed);
+      if(extent > 0)
+      {
+        OUTCOME_TRY(_s->values.zero(0, extent));
+      }
+      return llfio::success();
+    }
+    virtual result<void> match(typename Base::filter_state_type &state, key_type mask = {}, key_type bits = {}) noexcept override
+    {
+      OUTCOME_TRY(_s->map_index());
+      auto *h = _s->header();
+      const size_t keysize = static_cast<size_t>(h->key_size), masklen = std::min(mask.size(), keysize);
+      auto matches = [&](const byte *key) {
+        for(size_t n = 0; n < masklen; n++)
+        {
+          const auto b = (n < bits.size()) ? bits[n] : byte(0);
+          if((key[n] & mask[n]) != (b & mask[n]))
+          {
+            return false;
+          }
+        }
+        return true;
+      };
+      // Keys which existed at the pin match, even if their value there is no longer retained
+      auto existed = [&](const mapped_kvstore_slot_copy &c) {
+        bool too_old;
+        return mapped_kvstore_state::visible(c, _pin, too_old) != nullptr || too_old;
+      };
+      // The leading one bits of the mask bound the keys which can match
+      size_t prefix = 0;
+      while(prefix < masklen && mask[prefix] == byte(0xff))
+      {
+        prefix++;
+      }
+      unsigned lead = 0;
+      for(unsigned bit = 0x80; prefix < masklen && bit != 0 && (static_cast<unsigned>(mask[prefix]) & bit) != 0; bit >>= 1U)
+      {
+        lead |= bit;
+      }
+      if(_s->ordered.is_valid() && (prefix > 0 || lead != 0))
+      {
+        if(state == (uint64_t) -1 || state > h->slots)
+        {
+          return llfio::errc::no_such_file_or_directory;
+        }
+        try
+        {
+          // Walk the ordered index from the least to the greatest key with the prefix
+          std::vector<byte> first(keysize, byte(0)), last(keysize, byte(0xff)), prev(keysize), next(keysize);
+          for(size_t n = 0; n < prefix; n++)
+          {
+            first[n] = last[n] = (n < bits.size()) ? bits[n] : byte(0);
+          }
+          if(prefix < keysize)
+          {
+            const unsigned b = (prefix < bits.size()) ? static_cast<unsigned>(bits[prefix]) : 0;
+            first[prefix] = static_cast<byte>(b & lead);
+            last[prefix] = static_cast<byte>((b & lead) | (~lead & 0xffU));
+          }
+          bool inclusive = true;
+          const byte *from = first.data();
+          if(state != 0)
+          {
+            memcpy(prev.data(), mapped_kvstore_state::key_of(_s->slot(state - 1)), keysize);
+            if(memcmp(prev.data(), first.data(), keysize) >= 0)
+            {
+              inclusive = false;
+              from = prev.data();
+            }
+          }
+          for(;;)
+          {
+            OUTCOME_TRY(auto &&found, _s->ordered_next(from, inclusive, next.data()));
+            if(!found || memcmp(next.data(), last.data(), keysize) > 0)
+            {
+              state = (uint64_t) -1;
+              return llfio::errc::no_such_file_or_directory;
+            }
+            prev.swap(next);
+            inclusive = false;
+            from = prev.data();
+            if(!matches(prev.data()))
+            {
+              continue;
+            }
+            OUTCOME_TRY(auto &&c, _s->find(key_type(prev.data(), keysize)));
+            if(c.hash != 0 && existed(c))
+            {
+              state = c.index + 1;
+              return llfio::success();
+            }
+          }
+        }
+        catch(...)
+        {
+          return llfio::error_from_exception();
+        }
+      }
+      for(uint64_t idx = state; idx < h->slots; idx++)
+      {
+        auto *s = _s->slot(idx);
+        if(s->hash == 0)
+        {
+          continue;
+        }
+        mapped_kvstore_slot_copy c;
+        c.hash = s->hash;
+        memcpy(c.versions, s->versions, sizeof(c.versions));
+        c.created = s->created;
+        if(existed(c) && matches(mapped_kvstore_state::key_of(s)))
+        {
+          state = idx + 1;
+          return llfio::success();
+        }
+      }
+      state = h->slots;
+      return llfio::errc::no_such_file_or_directory;
+    }
+    virtual result<key_type> matched_key(typename Base::filter_state_type state) const noexcept override
+    {
+      auto *h = _s->header();
+      if(state == 0 || state > h->slots)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      return key_type(mapped_kvstore_state::key_of(_s->slot(state - 1)), static_cast<size_t>(h->key_size));
+    }
+    virtual result<typename Base::handle_type> open(key_type /*unused*/, mode /*unused*/) noexcept override
+    {
+      // Values live inside a shared log, so have no file of their own to open
+      return llfio::errc::operation_not_supported;
+    }
+    virtual io_result<buffers_type> read(io_request<buffers_type> reqs, key_type key, llfio::deadline /*unused*/) noexcept override
+    {
+      OUTCOME_TRY(auto &&v, _find(key));
+      return _read(reqs, v);
+    }
+  };
+
+  class mapped_kvstore_transaction;
+
+  //! The `mapped_files` store, or a snapshot of one if pinned
+  class mapped_kvstore final : public mapped_kvstore_impl<basic_key_value_store>
+  {
+    friend class mapped_kvstore_transaction;
+
+  public:
+    mapped_kvstore(std::shared_ptr<mapped_kvstore_state> s, const uri_type &uri, uint64_t pin)
+        : mapped_kvstore_impl<basic_key_value_store>(std::move(s), uri, pin)
+    {
+    }
+
+    virtual io_result<const_buffers_type> write(key_type key, io_request<const_buffers_type> reqs, llfio::deadline /*unused*/) noexcept override
+    {
+      if(_pin != mapped_kvstore_latest)
+      {
+        return llfio::errc::permission_denied;
+      }
+      // Values are stable, so are always written whole
+      if(reqs.offset != 0)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      mapped_kvstore_state::update u{key, {reqs.buffers.data(), reqs.buffers.size()}};
+      OUTCOME_TRY(_s->commit({}, {&u, 1}));
+      return reqs.buffers;
+    }
+    virtual result<std::unique_ptr<basic_key_value_store>> snapshot() noexcept override;
+    virtual result<std::unique_ptr<transaction>> begin_transaction() noexcept override;
+  };
+
+  //! A transaction upon a `mapped_files` store, which reads from a snapshot
+  class mapped_kvstore_transaction final : public mapped_kvstore_impl<basic_key_value_store::transaction>
+  {
+    friend class mapped_kvstore;
+
+    struct pending
+    {
+      size_t key_offset, value_offset, value_length;
+    };
+    std::vector<byte> _keys, _values;                          // the keys and values written, packed
+    std::vector<pending> _writes;                              // the latest write for each key
+    std::unordered_multimap<uint64_t, size_t> _writes_index;  // the hash of each key written to its index in _writes
+    std::vector<byte> _dependency_keys;                        // the keys depended upon, packed
+    std::vector<uint64_t> _dependencies;                       // the version of each key depended upon
+    std::unordered_multimap<uint64_t, size_t> _dependencies_index;  // the hash of each key depended upon to its index in _dependencies
+    bool _committed{false};
+
+    pending *_find_write(key_type key) noexcept
+    {
+      if(key.size() != _key_size)
+      {
+        return nullptr;
+      }
+      auto range = _writes_index.equal_range(mapped_kvstore_state::hash_of(key));
+      for(auto it = range.first; it != range.second; ++it)
+      {
+        auto &w = _writes[it->second];
+        if(0 == memcmp(_keys.data() + w.key_offset, key.data(), key.size()))
+        {
+          return &w;
+        }
+      }
+      return nullptr;
+    }
+    result<void> _depend(key_type key) noexcept
+    {
+      if(key.size() != _key_size)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      const uint64_t hash = mapped_kvstore_state::hash_of(key);
+      auto range = _dependencies_index.equal_range(hash);
+      for(auto it = range.first; it != range.second; ++it)
+      {
+        if(0 == memcmp(_dependency_keys.data() + it->second * _key_size, key.data(), key.size()))
+        {
+          return llfio::success();
+        }
+      }
+      OUTCOME_TRY(auto &&c, _s->find(key));
+      bool too_old;
+      const auto *v = mapped_kvstore_state::visible(c, _pin, too_old);
+      if(too_old)
+      {
+        // The key has been updated since this transaction began, so it could never commit
+        return llfio::errc::resource_unavailable_try_again;
+      }
+      try
+      {
+        _dependencies_index.emplace(hash, _dependencies.size());
+        _dependency_keys.insert(_dependency_keys.end(), key.begin(), key.end());
+        _dependencies.push_back((v != nullptr) ? v->counter : 0);
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+      return llfio::success();
+    }
+
+  public:
+    mapped_kvstore_transaction(std::shared_ptr<mapped_kvstore_state> s, const uri_type &uri, uint64_t pin)
+        : mapped_kvstore_impl<basic_key_value_store::transaction>(std::move(s), uri, pin)
+    {
+    }
+
+    virtual io_result<buffers_type> read(io_request<buffers_type> reqs, key_type key, llfio::deadline /*unused*/) noexcept override
+    {
+      // Read your own writes
+      if(const auto *w = _find_write(key))
+      {
+        return _read(reqs, _values.data() + w->value_offset, w->value_length);
+      }
+      OUTCOME_TRY(_depend(key));
+      OUTCOME_TRY(auto &&v, _find(key));
+      return _read(reqs, v);
+    }
+    virtual io_result<const_buffers_type> write(key_type key, io_request<const_buffers_type> reqs, llfio::deadline /*unused*/) noexcept override
+    {
+      if(_committed)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      if(reqs.offset != 0 || key.size() != _key_size)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      try
+      {
+        pending w{0, _values.size(), 0};
+        for(auto &b : reqs.buffers)
+        {
+          _values.insert(_values.end(), b.data(), b.data() + b.size());
+          w.value_length += b.size();
+        }
+        if(auto *i = _find_write(key))
+        {
+          w.key_offset = i->key_offset;
+          *i = w;
+          return reqs.buffers;
+        }
+        w.key_offset = _keys.size();
+        _writes_index.emplace(mapped_kvstore_state::hash_of(key), _writes.size());
+        _keys.insert(_keys.end(), key.begin(), key.end());
+        _writes.push_back(w);
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+      return reqs.buffers;
+    }
+    virtual result<std::unique_ptr<basic_key_value_store>> snapshot() noexcept override
+    {
+      try
+      {
+        std::unique_ptr<mapped_kvstore> ret(new mapped_kvstore(_s, _uri, _pin));
+        OUTCOME_TRY(ret->_pin_state());
+        return std::unique_ptr<basic_key_value_store>(std::move(ret));
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+    }
+    virtual result<std::unique_ptr<transaction>> begin_transaction() noexcept override { return llfio::errc::operation_not_supported; }
+
+    virtual result<void> dependencies(span<key_type> keys) noexcept override
+    {
+      for(auto &key : keys)
+      {
+        OUTCOME_TRY(_depend(key));
+      }
+      return llfio::success();
+    }
+    virtual result<void> commit() noexcept override
+    {
+      if(_committed)
+      {
+        return llfio::errc::invalid_argument;
+      }
+      try
+      {
+        std::vector<mapped_kvstore_state::dependency> dependencies;
+        dependencies.reserve(_dependencies.size());
+        for(size_t n = 0; n < _dependencies.size(); n++)
+        {
+          dependencies.push_back({key_type(_dependency_keys.data() + n * _key_size, _key_size), _dependencies[n]});
+        }
+        std::vector<basic_key_value_store::const_buffer_type> buffers;
+        std::vector<mapped_kvstore_state::update> updates;
+        buffers.reserve(_writes.size());
+        updates.reserve(_writes.size());
+        for(auto &w : _writes)
+        {
+          buffers.push_back({_values.data() + w.value_offset, w.value_length});
+          updates.push_back({key_type(_keys.data() + w.key_offset, _key_size), {&buffers.back(), 1}});
+        }
+        OUTCOME_TRY(_s->commit(dependencies, updates));
+        _committed = true;
+        return llfio::success();
+      }
+      catch(...)
+      {
+        return llfio::error_from_exception();
+      }
+    }
+  };
+
+  inline result<std::unique_ptr<basic_key_value_store>> mapped_kvstore::snapshot() noexcept
+  {
+    try
+    {
+      std::unique_ptr<mapped_kvstore> ret(new mapped_kvstore(_s, _uri, _pin));
+      // Pin before reading the count, so clear() cannot run in between
+      OUTCOME_TRY(ret->_pin_state());
+      ret->_pin = (_pin != mapped_kvstore_latest) ? _pin : _s->header()->counter.load(std::memory_order_acquire);
+      return std::unique_ptr<basic_key_value_store>(std::move(ret));
+    }
+    catch(...)
+    {
+      return llfio::error_from_exception();
+    }
+  }
+  inline result<std::unique_ptr<basic_key_value_store::transaction>> mapped_kvstore::begin_transaction() noexcept
+  {
+    if(!_s->writable)
+    {
+      return llfio::errc::permission_denied;
+    }
+    try
+    {
+      std::unique_ptr<mapped_kvstore_transaction> ret(new mapped_kvstore_transaction(_s, _uri, _pin));
+      OUTCOME_TRY(ret->_pin_state());
+      ret->_pin = (_pin != mapped_kvstore_latest) ? _pin : _s->header()->counter.load(std::memory_order_acquire);
+      return std::unique_ptr<transaction>(std::move(ret));
+    }
+    catch(...)
+    {
+      return llfio::error_from_exception();
+    }
+  }
+
+  // Returns the directory path of a `file://` URI, or of a bare path
+  inline result<std::string> mapped_kvstore_path(const basic_key_value_store::uri_type &uri) noexcept
+  {
+    static constexpr char scheme[] = "file://";
+    if(uri.compare(0, sizeof(scheme) - 1, scheme) == 0)
+    {
+      return uri.substr(sizeof(scheme) - 1);
+    }
+    const auto colon = uri.find("://");
+    if(colon != basic_key_value_store::uri_type::npos)
+    {
+      return llfio::errc::protocol_not_supported;
+    }
+    if(uri.empty())
+    {
+      return llfio::errc::invalid_argument;
+    }
+    return uri;
+  }
+
+  inline int mapped_kvstore_score(const basic_key_value_store_info::uri_type &uri, basic_key_value_store::mode /*unused*/, basic_key_value_store::creation /*unused*/)
+  {
+    auto path = mapped_kvstore_path(uri);
+    if(!path)
+    {
+      return -1;
+    }
+    auto indexh = llfio::file_handle::file({}, path.value() + "/index");
+    if(!indexh)
+    {
+      return 1;
+    }
+    uint64_t magic = 0;
+    llfio::file_handle::buffer_type b{reinterpret_cast<byte *>(&magic), sizeof(magic)};
+    auto read = indexh.value().read({{&b, 1}, 0});
+    return (read && read.bytes_transferred() == sizeof(magic) && magic == mapped_kvstore_magic) ? 2 : 0;
+  }
+
+  inline result<std::unique_ptr<basic_key_value_store>> mapped_kvstore_create(const basic_key_value_store_info::uri_type &uri, basic_key_value_store::size_type key_size, basic_key_value_store::features _features,
+                                                                             basic_key_value_store::mode _mode, basic_key_value_store::creation _creation, basic_key_value_store::caching _caching)
+  {
+    using mode = basic_key_value_store::mode;
+    using creation = basic_key_value_store::creation;
+    OUTCOME_TRY(auto &&path, mapped_kvstore_path(uri));
+    try
+    {
+      auto s = std::make_shared<mapped_kvstore_state>();
+      s->writable = (_mode == mode::write);
+      s->caching = _caching;
+      const creation dircreation = (_creation == creation::open_existing) ? creation::open_existing : creation::if_needed;
+      OUTCOME_TRY(auto &&dir, llfio::directory_handle::directory({}, path, s->writable ? mode::write : mode::read, dircreation));
+      s->dir = std::move(dir);
+      const auto filecaching = (_caching == basic_key_value_store::caching::all) ? llfio::file_handle::caching::all : llfio::file_handle::caching::reads;
+      if(s->writable)
+      {
+        OUTCOME_TRY(auto &&lockfile, llfio::algorithm::shared_fs_mutex::byte_ranges::fs_mutex_byte_ranges(s->dir, "lock"));
+        s->lockfile.emplace(std::move(lockfile));
+      }
+      // Everything else happens with the writer lock held, so only one process initialises the store
+      std::unique_lock<std::mutex> g1(s->writerlock, std::defer_lock);
+      llfio::optional<llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entities_guard> g2;
+      if(s->writable)
+      {
+        g1.lock();
+        OUTCOME_TRY(auto &&g, s->lockfile->lock(llfio::algorithm::shared_fs_mutex::shared_fs_mutex::entity_type(0, true)));
+        g2.emplace(std::move(g));
+      }
+      const creation filecreation = !s->writable ? creation::open_existing : (_creation == creation::always_new) ? creation::if_needed : _creation;
+      // Reserving the address space up front means neither map ever moves, so readers can hold pointers into them
+      OUTCOME_TRY(auto &&index, llfio::mapped_file_handle::mapped_file(static_cast<size_t>(mapped_kvstore_reservation), s->dir, "index", _mode, filecreation, filecaching));
+      OUTCOME_TRY(auto &&values, llfio::mapped_file_handle::mapped_file(static_cast<size_t>(mapped_kvstore_reservation), s->dir, "values", _mode, filecreation, filecaching));
+      s->index = std::move(index);
+      s->values = std::move(values);
+      if(_creation == creation::always_new)
+      {
+        OUTCOME_TRY(s->index.truncate(0));
+        OUTCOME_TRY(s->values.truncate(0));
+      }
+      OUTCOME_TRY(auto &&indexlength, s->index.maximum_extent());
+      if(indexlength == 0)
+      {
+        if(!s->writable)
+        {
+          return llfio::errc::no_such_file_or_directory;
+        }
+        if(key_size == 0)
+        {
+          return llfio::errc::invalid_argument;
+        }
+        const uint64_t slot_size = sizeof(mapped_kvstore_slot) + mapped_kvstore_round64(key_size);
+        OUTCOME_TRY(s->index.truncate(mapped_kvstore_header_size + mapped_kvstore_default_slots * slot_size));
+        OUTCOME_TRY(s->values.truncate(0));
+        auto *h = s->header();
+        h->key_size = key_size;
+        h->slots = mapped_kvstore_default_slots;
+        h->slot_size = slot_size;
+        h->counter.store(0, std::memory_order_relaxed);
+        h->items.store(0, std::memory_order_relaxed);
+        h->bytes.store(0, std::memory_order_relaxed);
+        h->values_extent.store(0, std::memory_order_relaxed);
+        h->items_quota = 0;
+        h->bytes_quota = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = mapped_kvstore_magic;
+        OUTCOME_TRY(s->index.barrier({}, llfio::file_handle::barrier_kind::wait_all));
+      }
+      else
+      {
+        // The index must at least be large enough to map, before trusting anything in it
+        if(indexlength < mapped_kvstore_header_size || s->header()->magic != mapped_kvstore_magic)
+        {
+          return llfio::errc::illegal_byte_sequence;
+        }
+        if(key_size != 0 && key_size != s->header()->key_size)
+        {
+          return llfio::errc::invalid_argument;
+        }
+      }
+      s->index_mapped.store(static_cast<size_t>(s->index.map().length()), std::memory_order_release);
+      if(s->writable)
+      {
+        OUTCOME_TRY(auto &&ordered, llfio::mapped_file_handle::mapped_file(static_cast<size_t>(mapped_kvstore_reservation), s->dir, "ordered", _mode, creation::if_needed, filecaching));
+        s->ordered = std::move(ordered);
+        if(_creation == creation::always_new || _creation == creation::truncate_existing)
+        {
+          OUTCOME_TRY(s->ordered.truncate(0));
+        }
+        OUTCOME_TRY(s->ordered_reserve(0));
+        // Roll back any commit abandoned by a writer which died, and build the ordered index if new
+        OUTCOME_TRY(s->repair());
+        if(s->ordered_header()->magic != mapped_kvstore_ordered_magic)
+        {
+          OUTCOME_TRY(s->ordered_rebuild());
+        }
+      }
+      else
+      {
+        // Read only users of stores without an ordered index match by scanning the table
+        auto ordered = llfio::mapped_file_handle::mapped_file(static_cast<size_t>(mapped_kvstore_reservation), s->dir, "ordered", _mode, creation::open_existing, filecaching);
+        if(ordered && ordered.value().map().length() >= mapped_kvstore_header_size &&
+           reinterpret_cast<const mapped_kvstore_ordered_header *>(ordered.value().address())->magic == mapped_kvstore_ordered_magic)
+        {
+          s->ordered = std::move(ordered).value();
+          s->ordered_mapped.store(static_cast<size_t>(s->ordered.map().length()), std::memory_order_release);
+        }
+      }
+      OUTCOME_TRY(auto &&valueslength, s->values.maximum_extent());
+      s->values_mapped.store(static_cast<size_t>(valueslength), std::memory_order_release);
+      OUTCOME_TRY(s->map_index());
+      return std::unique_ptr<basic_key_value_store>(new mapped_kvstore(std::move(s), uri, mapped_kvstore_latest));
+    }
+    catch(...)
+    {
+      return llfio::error_from_exception();
+    }
+  }
+
+  inline span<const basic_key_value_store_info> kvstore_providers() noexcept
+  {
+    using features = basic_key_value_store::features;
+    static const basic_key_value_store_info providers[] = {
+    {"mapped_files", 1, 4096 - sizeof(mapped_kvstore_slot), 0, static_cast<basic_key_value_store_info::extent_type>(mapped_kvstore_reservation),  //
+     features::stable_values | features::stable_keys | features::atomic_snapshots | features::atomic_transactions,                                     //
+     mapped_kvstore_score, mapped_kvstore_create}                                                                                                       //
+    };
+    return providers;
+  }
+}  // namespace detail
+
+LLFIO_HEADERS_ONLY_FUNC_SPEC result<std::unique_ptr<basic_key_value_store>> create_kvstore(const basic_key_value_store::uri_type &uri, basic_key_value_store::size_type key_size, basic_key_value_store::features _features,
+                                                                                           basic_key_value_store::mode _mode, basic_key_value_store::creation _creation, basic_key_value_store::caching _caching)
+{
+  using features = basic_key_value_store::features;
+  static constexpr features all_features[] = {features::shared_memory, features::history,          features::stable_values,    features::stable_keys,
+                                              features::update_deltas, features::atomic_snapshots, features::atomic_transactions};
+  const basic_key_value_store_info *best = nullptr;
+  int bestscore = -1;
+  for(auto &provider : detail::kvstore_providers())
+  {
+    // Must provide all the features requested
+    bool provides = true;
+    for(auto f : all_features)
+    {
+      if(!!(_features & f) && !(provider.features & f))
+      {
+        provides = false;
+      }
+    }
+    if(!provides)
+    {
+      continue;
+    }
+    const int score = provider.score(uri, _mode, _creation);
+    if(score > bestscore)
+    {
+      best = &provider;
+      bestscore = score;
+    }
+  }
+  if(best == nullptr || bestscore < 0)
+  {
+    return llfio::errc::protocol_not_supported;
+  }
+  // A score of zero means something incompatible is already at the URI
+  if(bestscore == 0 && _creation != basic_key_value_store::creation::truncate_existing && _creation != basic_key_value_store::creation::always_new)
+  {
+    return llfio::errc::illegal_byte_sequence;
+  }
+  return best->create(uri, key_size, _features, _mode, _creation, _caching);
+}
+
+LLFIO_HEADERS_ONLY_FUNC_SPEC result<std::unique_ptr<basic_key_value_store>> open_kvstore(const basic_key_value_store::uri_type &uri, basic_key_value_store::mode _mode, basic_key_value_store::caching _caching)
+{
+  return create_kvstore(uri, 0, basic_key_value_store::features::none, _mode, basic_key_value_store::creation::open_existing, _caching);
+}
+
+LLFIO_HEADERS_ONLY_FUNC_SPEC result<span<basic_key_value_store_info>> enumerate_kvstores(span<basic_key_value_store_info> lst)
+{
+  auto providers = detail::kvstore_providers();
+  const size_t count = std::min(lst.size(), providers.size());
+  for(size_t n = 0; n < count; n++)
+  {
+    lst[n] = providers[n];
+  }
+  return lst.subspan(0, count);
+}
+
+KVSTORE_V1_NAMESPACE_END
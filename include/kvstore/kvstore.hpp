@@ -29,6 +29,8 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "quickcpplib/memory_resource.hpp"
 
+#include <memory>
+
 //! \file kvstore.hpp Provides the abstract interface for a key-value store.
 
 #if defined(LLFIO_UNSTABLE_VERSION) && !defined(LLFIO_DISABLE_ABI_PERMUTATION)
@@ -188,6 +190,11 @@ namespace traits
 
 /*! The error codes specific to `basic_key_value_store`. Note the `std::errc` equivalent
 codes may also be returned e.g. `std::errc::insufficient_disk_space`.
+
+The built-in providers currently report these using their nearest `errc` equivalent:
+`invalid_uri` as `errc::invalid_argument`, `unsupported_uri` as `errc::protocol_not_supported`,
+`unsupported_integrity` as `errc::operation_not_supported`, `transaction_aborted_collision`
+as `errc::resource_unavailable_try_again`, and `snapshot_too_old` as `errc::identifier_removed`.
 */
 enum class kvstore_errc
 {
@@ -196,8 +203,11 @@ enum class kvstore_errc
   unsupported_uri,                //!< The URI specified an unsupported scheme or mechanism.
   unsupported_integrity,          //!< The requested integrity level is not available for this device URI.
   transaction_aborted_collision,  //!< The transaction could not be committed due to dependent key update.
+  snapshot_too_old,               //!< The value of the key at the snapshot has since been replaced, and is no longer retained.
 };
 
+class basic_key_value_store;
+
 /*! \brief Information about an available key value store implementation.
 */
 struct basic_key_value_store_info
@@ -245,13 +255,14 @@ struct basic_key_value_store_info
   int (*score)(const uri_type &uri, handle_type::mode, handle_type::creation creation);
   /*! Construct a store implementation.
   */
-  result<basic_key_value_store> (*create)(const basic_key_value_store::uri_type &uri, size_type key_size, features _features, mode _mode, creation _creation, caching _caching);
+  result<std::unique_ptr<basic_key_value_store>> (*create)(const uri_type &uri, size_type key_size, struct features _features, mode _mode, creation _creation, caching _caching);
 };
 
 /*! \class basic_key_value_store
 \brief A possibly hardware-implemented basic key-value store.
 
-\warning This class has not been implemented nor will be any time soon. It is here for various folk to study the API design.
+Obtain a store using `create_kvstore()` or `open_kvstore()`. Stores, snapshots and transactions
+are polymorphic, and so are always returned inside a `std::unique_ptr`.
 
 Reference document https://www.snia.org/sites/default/files/technical_work/PublicReview/KV%20Storage%20API%200.16.pdf
 */
@@ -305,6 +316,7 @@ protected:
   capacity_type _items_quota{0}, _bytes_quota{0};
   allocator_type _allocator{};
 
+  basic_key_value_store() = default;
   // Cannot be copied
   basic_key_value_store(const basic_key_value_store &) = delete;
   basic_key_value_store &operator=(const basic_key_value_store &) = delete;
@@ -357,7 +369,10 @@ public:
   */
   virtual result<void> key_index_size(size_type bytes) noexcept = 0;
 
-  //! Clears the store, possibly more quickly than deleting every key. This call may be racy.
+  /*! Clears the store, possibly more quickly than deleting every key. This call may be racy.
+  Some store implementations refuse, with `errc::device_or_resource_busy`, whilst any snapshot
+  or transaction exists.
+  */
   virtual result<void> clear() noexcept = 0;
   //! The state type for performing a filtered match
   using filter_state_type = uint64_t;
@@ -372,6 +387,10 @@ public:
   initialised mask and bits causes matching of all keys in the store.
   */
   virtual result<void> match(filter_state_type &state, key_type mask = {}, key_type bits = {}) noexcept = 0;
+  /*! Returns the key last matched by `match()` for the given filter state. The key returned
+  remains valid until the store is cleared or destroyed.
+  */
+  virtual result<key_type> matched_key(filter_state_type state) const noexcept = 0;
 
   /*! Returns a handle type which gives access to a key's value. The lifetime of the
   returned handle *may* pin the key's value at the time of retrieval if this store
@@ -435,7 +454,9 @@ public:
 
   Note that if a store does not have `features::history`, one may find that retrieving a
   value from a snapshot may no longer be able to retrieve that value as it has since been
-  replaced. In this situation you will receive an error matching `errc::no_such_file_or_directory`.
+  replaced. In this situation you will receive `kvstore_errc::snapshot_too_old`, which
+  is distinct from the `errc::no_such_file_or_directory` of a key which did not exist at
+  the snapshot.
 
   It is never possible to read a value from a snapshot and get an updated value instead
   of the snapshotted value. This is why not all stores implement `features::snapshot`, as
@@ -445,7 +466,7 @@ public:
   If a store implementation does not implement `features::atomic_snapshot`, this function returns
   an error code comparing equal to `errc::operation_not_supported`.
   */
-  virtual result<basic_key_value_store> snapshot() noexcept = 0;
+  virtual result<std::unique_ptr<basic_key_value_store>> snapshot() noexcept = 0;
 
   class transaction;
   /*! Begin a transaction on this key value store.
@@ -459,11 +480,14 @@ public:
   If a store implementation does not implement `features::atomic_transactions`, this function returns
   an error code comparing equal to `errc::operation_not_supported`.
   */
-  virtual result<transaction> begin_transaction() noexcept = 0;
+  virtual result<std::unique_ptr<transaction>> begin_transaction() noexcept = 0;
 };
 
 class basic_key_value_store::transaction : public basic_key_value_store
 {
+protected:
+  transaction() = default;
+
 public:
   //! Indicate that there is a dependency on the snapshotted values of these keys without fetching any values.
   virtual result<void> dependencies(span<key_type> keys) noexcept = 0;
@@ -496,6 +520,18 @@ a store at `uri` with the specified key size and features. Guaranteed built-in p
     `store/01234/5678/90ab/cdef/latest` is the count of the latest value, its size, and if deltas need to be
     applied.
 
+    - `mapped_files`: The default provider. The URI names a directory holding an open addressed hash
+    table of keys in `index`, and an append only log of values in `values`, both of which are accessed
+    via `llfio::mapped_file_handle`. Readers never take locks, and read values directly from the map.
+    Writers are serialised across processes using `llfio::algorithm::shared_fs_mutex::byte_ranges`
+    on the file `lock`. Every commit increments a 64 bit monotonic count, and the previous version of
+    each value is retained, which implements `features::stable_values`, `features::stable_keys`,
+    `features::atomic_snapshots` and `features::atomic_transactions`. The hash table holds at most
+    three quarters of its slots, 49,152 keys by default, and can only be grown by `max_size()` whilst
+    the store is empty; commits which would exceed it fail with `errc::no_space_on_device`. The
+    values log is never compacted, so it grows with every update until `clear()` rewinds it, which
+    also invalidates any buffers previously returned by reads of the store itself.
+
     - `single_file`: Initially all keys and values are kept in memory. Upon first URI fetch after first creation,
     a single file is created comprising all the keys and values associatively mapped. This single file can be
     then be mapped as shared memory into multiple processes, thus enabling multiple concurrent C++ programs to
@@ -506,19 +542,20 @@ URIs may of course specify other sources of key value store than on the file sys
 registered system-wide implementations available to all programs. The local process may have registered
 additional implementations as well.
 */
-LLFIO_HEADERS_ONLY_FUNC_SPEC result<basic_key_value_store> create_kvstore(const basic_key_value_store::uri_type &uri,                                              //
-                                                                          basic_key_value_store::size_type key_size,                                               //
-                                                                          basic_key_value_store::features _features,                                               //
-                                                                          basic_key_value_store::mode _mode = basic_key_value_store::mode::write,                  //
-                                                                          basic_key_value_store::creation _creation = basic_key_value_store::creation::if_needed,  //
-                                                                          basic_key_value_store::caching _caching = basic_key_value_store::caching::all);
+LLFIO_HEADERS_ONLY_FUNC_SPEC result<std::unique_ptr<basic_key_value_store>> create_kvstore(const basic_key_value_store::uri_type &uri,                                              //
+                                                                                           basic_key_value_store::size_type key_size,                                               //
+                                                                                           basic_key_value_store::features _features,                                               //
+                                                                                           basic_key_value_store::mode _mode = basic_key_value_store::mode::write,                  //
+                                                                                           basic_key_value_store::creation _creation = basic_key_value_store::creation::if_needed,  //
+                                                                                           basic_key_value_store::caching _caching = basic_key_value_store::caching::all);
 /*! \brief Open an existing key value store. A convenience overload for `create_kvstore()`.
 */
-LLFIO_HEADERS_ONLY_FUNC_SPEC result<basic_key_value_store> open_kvstore(const basic_key_value_store::uri_type &uri,                              //
-                                                                        basic_key_value_store::mode _mode = basic_key_value_store::mode::write,  //
-                                                                        basic_key_value_store::caching _caching = basic_key_value_store::caching::all);
+LLFIO_HEADERS_ONLY_FUNC_SPEC result<std::unique_ptr<basic_key_value_store>> open_kvstore(const basic_key_value_store::uri_type &uri,                              //
+                                                                                         basic_key_value_store::mode _mode = basic_key_value_store::mode::write,  //
+                                                                                         basic_key_value_store::caching _caching = basic_key_value_store::caching::all);
 
-/*! \brief Fill an array with information about all the key value stores available to this process.
+/*! \brief Fill an array with information about all the key value stores available to this process,
+returning the portion of the array filled.
 */
 LLFIO_HEADERS_ONLY_FUNC_SPEC result<span<basic_key_value_store_info>> enumerate_kvstores(span<basic_key_value_store_info> lst);
 
@@ -587,4 +624,10 @@ LLFIO_HEADERS_ONLY_FUNC_SPEC const key_value_store<void *, llfio::section_handle
 
 KVSTORE_V1_NAMESPACE_END
 
+#if LLFIO_HEADERS_ONLY == 1 && !defined(DOXYGEN_SHOULD_SKIP_THIS)
+#define LLFIO_INCLUDED_BY_HEADER 1
+#include "detail/impl/kvstore.ipp"
+#undef LLFIO_INCLUDED_BY_HEADER
+#endif
+
 #endif
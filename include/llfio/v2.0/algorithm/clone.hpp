@@ -69,7 +69,9 @@ namespace algorithm
 
   Next, `file_handle::clone_extents()` with `emulate_if_unsupported = true` is
   called on the whole file content. This copies only the allocated extents in
-  blocks sized whatever is the large page size on this platform (2Mb on x64).
+  blocks of the `io_size` recommended by `storage_profile::recommended_parameters()`
+  for the destination if its device has a cached profile, otherwise in blocks sized
+  whatever is the large page size on this platform (2Mb on x64).
 
   Finally, if `preserve_timestamps` is true, the destination file handle is
   restamped with the metadata from the source file handle just before the
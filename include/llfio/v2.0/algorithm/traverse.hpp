@@ -149,7 +149,8 @@ namespace algorithm
   5. Loop, using the least deep available item in the stack, until the stack is empty.
 
   If `known_dirs_remaining` exceeds four, a threadpool of not more than `threads` threads
-  is spun up in order to traverse the hierarchy more quickly.
+  is spun up in order to traverse the hierarchy more quickly. If `threads` is zero, half of
+  `utils::effective_cpu_concurrency()` is used, with a minimum of four.
 
   This algorithm is therefore primarily a breadth-first algorithm, in that we proceed from
   root, level by level, to the tips. The number returned is the total number of directories
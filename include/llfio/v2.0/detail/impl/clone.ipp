@@ -23,6 +23,7 @@ Distributed under the Boost Software License, Version 1.0.
 */
 
 #include "../../algorithm/clone.hpp"
+#include "../../storage_profile_cache.hpp"
 
 LLFIO_V2_NAMESPACE_BEGIN
 
@@ -92,7 +93,16 @@ namespace algorithm
     {
       return errc::no_space_on_device;
     }
-    OUTCOME_TRY(auto &&copied, src.clone_extents_to(dest, d, force_copy_now, true));
+    // Copy in the chunk size the destination device was profiled as preferring, if it was
+    size_t blocksize = 0;
+    {
+      auto params = storage_profile::recommended_parameters(dest);
+      if(params && params.value().profiled)
+      {
+        blocksize = params.value().io_size;
+      }
+    }
+    OUTCOME_TRY(auto &&copied, src.clone_extents_to({(file_handle::extent_type) -1, (file_handle::extent_type) -1}, dest, 0, d, force_copy_now, true, blocksize));
     failed = false;
     return copied.length;
   }
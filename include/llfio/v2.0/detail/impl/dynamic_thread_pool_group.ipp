@@ -26,10 +26,14 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "../../file_handle.hpp"
 #include "../../statfs.hpp"
+#include "../../storage_profile_cache.hpp"
+#include "../../utils.hpp"
 
+#include "quickcpplib/algorithm/small_prng.hpp"
 #include "quickcpplib/spinlock.hpp"
 
 #include <atomic>
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -38,6 +42,10 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include <iostream>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #ifndef LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
 #if LLFIO_FORCE_USE_LIBDISPATCH
 #include <dispatch/dispatch.h>
@@ -59,10 +67,25 @@ Distributed under the Boost Software License, Version 1.0.
 #error dynamic_thread_pool_group requires Grand Central Dispatch (libdispatch) on non-Linux POSIX.
 #endif
 #include <dirent.h> /* Defines DT_* constants */
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/syscall.h>
+#include <time.h>
 
 #include <condition_variable>
 #include <thread>
+
+/* If 1, the native Linux thread pool decides when to add and remove kernel threads
+by sampling the on-CPU time of its own worker threads from their `schedstat` every
+few milliseconds, and by a PSI trigger on `/proc/pressure/cpu`, instead of by
+periodically scanning every thread in the process via `/proc/self/task`. A sampler
+thread takes the samples whilst work is queued, so blocked workers get replaced
+even when every worker is blocked.
+*/
+#ifndef LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+#define LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT 0
+#endif
 #endif
 
 #define LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING 0
@@ -250,20 +273,177 @@ namespace detail
     }
   };
 #endif
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  /* A fixed capacity Chase-Lev work stealing deque, using the memory orderings
+  from "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê, Pop,
+  Cohen and Zappa Nardelli (2013). Only the owning worker thread may call `push()`
+  and `pop()`, any thread may call `steal()`.
+  */
+  template <size_t Capacity> struct global_dynamic_thread_pool_impl_work_stealing_deque
+  {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    // Padded rather than alignas() as these are dynamically allocated, and we don't require C++ 17 aligned new
+    std::atomic<ptrdiff_t> top{0};
+    char _padding1[64 - sizeof(std::atomic<ptrdiff_t>)];
+    std::atomic<ptrdiff_t> bottom{0};
+    char _padding2[64 - sizeof(std::atomic<ptrdiff_t>)];
+    std::atomic<dynamic_thread_pool_group::work_item *> buffer[Capacity];
+
+    // Owner only. Returns false if the deque is full.
+    bool push(dynamic_thread_pool_group::work_item *p) noexcept
+    {
+      const auto b = bottom.load(std::memory_order_relaxed);
+      const auto t = top.load(std::memory_order_acquire);
+      if(b - t >= (ptrdiff_t) Capacity)
+      {
+        return false;
+      }
+      buffer[b & (Capacity - 1)].store(p, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return true;
+    }
+    // Owner only. Takes the most recently pushed item.
+    dynamic_thread_pool_group::work_item *pop() noexcept
+    {
+      const auto b = bottom.load(std::memory_order_relaxed) - 1;
+      bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto t = top.load(std::memory_order_relaxed);
+      if(t > b)
+      {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      auto *ret = buffer[b & (Capacity - 1)].load(std::memory_order_relaxed);
+      if(t == b)
+      {
+        // Last item, so race any thieves for it
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+          ret = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+      }
+      return ret;
+    }
+    // Any thread. Takes the least recently pushed item, returning null only if the deque was seen empty.
+    dynamic_thread_pool_group::work_item *steal() noexcept
+    {
+      for(;;)
+      {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = bottom.load(std::memory_order_acquire);
+        if(t >= b)
+        {
+          return nullptr;
+        }
+        auto *ret = buffer[t & (Capacity - 1)].load(std::memory_order_relaxed);
+        if(top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+          return ret;
+        }
+        // Lost the race to another thief or the owner, retry
+      }
+    }
+    bool empty() const noexcept { return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed); }
+  };
+#endif
+  /* A lock free ring buffer of the most recent trace events. Each slot has a sequence
+  number which is odd whilst being written, and `2 * index + 2` once written, so readers
+  can detect and skip slots being concurrently overwritten. The event is stored as relaxed
+  atomic words, as a reader may copy it whilst it is being overwritten.
+  */
+  struct global_dynamic_thread_pool_impl_trace_ring
+  {
+    static_assert(std::is_trivially_copyable<dynamic_thread_pool_group::trace_event>::value, "trace_event must be trivially copyable");
+    static constexpr size_t event_words = (sizeof(dynamic_thread_pool_group::trace_event) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    struct slot_t
+    {
+      std::atomic<uint64_t> seq{0};
+      std::atomic<uint64_t> event[event_words];
+    };
+    const size_t mask;
+    std::atomic<uint64_t> write_index{0};
+    std::unique_ptr<slot_t[]> slots;
+
+    explicit global_dynamic_thread_pool_impl_trace_ring(size_t capacity)
+        : mask(capacity - 1)
+        , slots(new slot_t[capacity])
+    {
+      assert((capacity & (capacity - 1)) == 0);
+    }
+    void push(const dynamic_thread_pool_group::trace_event &event) noexcept
+    {
+      const auto idx = write_index.fetch_add(1, std::memory_order_relaxed);
+      auto &slot = slots[idx & mask];
+      uint64_t words[event_words] = {};
+      memcpy(words, &event, sizeof(event));
+      slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for(size_t n = 0; n < event_words; n++)
+      {
+        slot.event[n].store(words[n], std::memory_order_relaxed);
+      }
+      slot.seq.store(2 * idx + 2, std::memory_order_release);
+    }
+    void read(std::vector<dynamic_thread_pool_group::trace_event> &out) const
+    {
+      const auto end = write_index.load(std::memory_order_acquire);
+      const auto begin = (end > mask + 1) ? (end - mask - 1) : 0;
+      out.reserve(out.size() + (size_t)(end - begin));
+      for(auto idx = begin; idx < end; idx++)
+      {
+        auto &slot = slots[idx & mask];
+        const auto seq = slot.seq.load(std::memory_order_acquire);
+        if(seq != 2 * idx + 2)
+        {
+          continue;  // not yet written, or already overwritten
+        }
+        uint64_t words[event_words];
+        for(size_t n = 0; n < event_words; n++)
+        {
+          words[n] = slot.event[n].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.seq.load(std::memory_order_relaxed) != seq)
+        {
+          continue;  // overwritten whilst being read
+        }
+        dynamic_thread_pool_group::trace_event event;
+        memcpy(&event, words, sizeof(event));
+        out.push_back(event);
+      }
+    }
+  };
   struct global_dynamic_thread_pool_impl_workqueue_item
   {
     const size_t nesting_level;
+    const dynamic_thread_pool_group::priority_class priority;
     std::shared_ptr<global_dynamic_thread_pool_impl_workqueue_item> next;
     std::unordered_set<dynamic_thread_pool_group_impl *> items;  // Do NOT use without holding workqueue_lock
 
-    explicit global_dynamic_thread_pool_impl_workqueue_item(size_t _nesting_level, std::shared_ptr<global_dynamic_thread_pool_impl_workqueue_item> &&preceding)
+    explicit global_dynamic_thread_pool_impl_workqueue_item(size_t _nesting_level, dynamic_thread_pool_group::priority_class _priority,
+                                                            std::shared_ptr<global_dynamic_thread_pool_impl_workqueue_item> &&preceding)
         : nesting_level(_nesting_level)
+        , priority(_priority)
         , next(preceding)
     {
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+      for(auto &i : deques)
+      {
+        i.store(nullptr, std::memory_order_relaxed);
+      }
+#endif
     }
 
 #if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
-    static constexpr unsigned TOTAL_NEXTACTIVES = 1;
+    // Worker threads beyond this many have no local deque, and use only the injection queue
+    static constexpr unsigned TOTAL_WORKER_DEQUES = 256;
+    // NUMA nodes or L3 caches beyond this many are folded together
+    static constexpr unsigned TOTAL_CPU_DOMAINS = 64;
+    using work_stealing_deque_type = global_dynamic_thread_pool_impl_work_stealing_deque<512>;
     struct next_active_base_t
     {
       std::atomic<unsigned> count{0};
@@ -281,113 +461,189 @@ namespace detail
     struct alignas(64) next_active_work_t : next_active_base_t
     {
       char _padding[64 - sizeof(next_active_base_t)];  // 40 bytes?
-    } next_actives[TOTAL_NEXTACTIVES];
+    };
     static_assert(sizeof(next_active_work_t) == 64, "next_active_work_t is not a cacheline");
+    // Total work items queued at this nesting level, across the injection queues and all worker deques
+    alignas(64) std::atomic<unsigned> active_count{0};
+    // Work submitted from outside the pool, or which overflowed a worker deque, per CPU domain
+    next_active_work_t injected[TOTAL_CPU_DOMAINS];
+    // Per worker thread deques, lazily allocated by their owning worker thread
+    std::atomic<work_stealing_deque_type *> deques[TOTAL_WORKER_DEQUES];
     next_active_base_t next_timer_relative, next_timer_absolute;
 
-    dynamic_thread_pool_group::work_item *next_active(unsigned &count, size_t threadidx)
+    // True if no groups use this, and no work remains queued within it
+    bool empty() const noexcept
     {
-      if(TOTAL_NEXTACTIVES > 1)
+      return items.empty() && active_count.load(std::memory_order_relaxed) == 0 && next_timer_relative.count.load(std::memory_order_relaxed) == 0 &&
+             next_timer_absolute.count.load(std::memory_order_relaxed) == 0;
+    }
+
+    ~global_dynamic_thread_pool_impl_workqueue_item()
+    {
+      for(auto &i : deques)
       {
-        threadidx &= (TOTAL_NEXTACTIVES - 1);
-        const size_t original_threadidx = threadidx;
-        bool all_empty = true;
-        for(;;)
+        auto *dq = i.exchange(nullptr, std::memory_order_relaxed);
+        if(dq != nullptr)
         {
-          next_active_base_t &x = next_actives[threadidx];
-          if(x.count.load(std::memory_order_relaxed) > 0)
-          {
-            all_empty = false;
-            if(x.lock.try_lock())
-            {
-              auto *ret = x.front;
-              if(ret != nullptr)
-              {
-                x.front = ret->_next_scheduled;
-                count = x.count.fetch_sub(1, std::memory_order_relaxed);
-                if(x.front == nullptr)
-                {
-                  assert(x.back == ret);
-                  x.back = nullptr;
-                }
-                ret->_next_scheduled = nullptr;
-                x.lock.unlock();
-                return ret;
-              }
-              x.lock.unlock();
-            }
-          }
-          if(++threadidx >= TOTAL_NEXTACTIVES)
-          {
-            threadidx = 0;
-          }
-          if(threadidx == original_threadidx)
-          {
-            if(all_empty)
-            {
-              return nullptr;
-            }
-            all_empty = true;
-          }
+          assert(dq->empty());
+          delete dq;
         }
       }
-      else
+    }
+
+    // Who is asking for work, and what else is out there
+    struct next_active_context_t
+    {
+      unsigned dequeidx;                          // the asking worker's deque, or -1 if none
+      unsigned domain;                            // the asking worker's CPU domain
+      unsigned domains;                           // how many CPU domains there are
+      unsigned deques_inuse;                      // one more than the highest deque index in use
+      const std::atomic<unsigned> *deque_domains;  // the CPU domain of each deque's owner
+    };
+
+  private:
+    dynamic_thread_pool_group::work_item *_pop_injected(next_active_work_t &x)
+    {
+      if(x.count.load(std::memory_order_relaxed) == 0)
       {
-        next_active_base_t &x = next_actives[0];
-        if(x.count.load(std::memory_order_relaxed) > 0)
+        return nullptr;
+      }
+      x.lock.lock();
+      auto *ret = x.front;
+      if(ret != nullptr)
+      {
+        x.front = ret->_next_scheduled;
+        x.count.fetch_sub(1, std::memory_order_relaxed);
+        if(x.front == nullptr)
         {
-          x.lock.lock();
-          auto *ret = x.front;
-          if(ret != nullptr)
+          assert(x.back == ret);
+          x.back = nullptr;
+        }
+        ret->_next_scheduled = nullptr;
+        active_count.fetch_sub(1, std::memory_order_relaxed);
+      }
+      x.lock.unlock();
+      return ret;
+    }
+    // Steal from the deques of other workers either within, or not within, the asking worker's CPU domain
+    dynamic_thread_pool_group::work_item *_steal(const next_active_context_t &ctx, bool same_domain)
+    {
+      if(ctx.deques_inuse == 0)
+      {
+        return nullptr;
+      }
+      unsigned idx = QUICKCPPLIB_NAMESPACE::algorithm::small_prng::thread_local_prng()() % ctx.deques_inuse;
+      for(unsigned n = 0; n < ctx.deques_inuse; n++)
+      {
+        if(idx != ctx.dequeidx && (ctx.domains == 1 || (ctx.deque_domains[idx].load(std::memory_order_relaxed) == ctx.domain) == same_domain))
+        {
+          auto *dq = deques[idx].load(std::memory_order_acquire);
+          if(dq != nullptr)
           {
-            x.front = ret->_next_scheduled;
-            count = x.count.fetch_sub(1, std::memory_order_relaxed);
-            if(x.front == nullptr)
+            auto *ret = dq->steal();
+            if(ret != nullptr)
             {
-              assert(x.back == ret);
-              x.back = nullptr;
+              active_count.fetch_sub(1, std::memory_order_relaxed);
+              return ret;
             }
-            ret->_next_scheduled = nullptr;
-            x.lock.unlock();
-            return ret;
           }
-          x.lock.unlock();
+        }
+        if(++idx >= ctx.deques_inuse)
+        {
+          idx = 0;
         }
       }
       return nullptr;
     }
 
-  private:
-    next_active_base_t &_choose_next_active()
+  public:
+    /* Preference order is most recently pushed in our own deque (cache hot), then
+    our CPU domain's injection queue in FIFO order, then stealing the least recently
+    pushed from the deque of a randomly chosen other worker in our CPU domain. Only if
+    all of those are empty do we look at the injection queues and deques of other
+    CPU domains.
+    */
+    dynamic_thread_pool_group::work_item *next_active(const next_active_context_t &ctx)
     {
-      unsigned idx = (unsigned) -1, max_count = (unsigned) -1;
-      for(unsigned n = 0; n < TOTAL_NEXTACTIVES; n++)
+      if(active_count.load(std::memory_order_relaxed) == 0)
       {
-        auto c = next_actives[n].count.load(std::memory_order_relaxed);
-        if(c < max_count)
+        return nullptr;
+      }
+      dynamic_thread_pool_group::work_item *ret = nullptr;
+      if(ctx.dequeidx < TOTAL_WORKER_DEQUES)
+      {
+        auto *dq = deques[ctx.dequeidx].load(std::memory_order_relaxed);
+        if(dq != nullptr)
         {
-          idx = n;
-          max_count = c;
+          ret = dq->pop();
+          if(ret != nullptr)
+          {
+            active_count.fetch_sub(1, std::memory_order_relaxed);
+            return ret;
+          }
         }
       }
-      for(;;)
+      if((ret = _pop_injected(injected[ctx.domain])) != nullptr)
+      {
+        return ret;
+      }
+      if(ctx.domains == 1)
+      {
+        return _steal(ctx, true);
+      }
+      if((ret = _steal(ctx, true)) != nullptr)
+      {
+        return ret;
+      }
+      // Our CPU domain is idle, so now look elsewhere
+      for(unsigned n = 1; n < ctx.domains; n++)
       {
-        if(next_actives[idx].lock.try_lock())
+        if((ret = _pop_injected(injected[(ctx.domain + n) % ctx.domains])) != nullptr)
         {
-          return next_actives[idx];
+          return ret;
         }
-        if(++idx >= TOTAL_NEXTACTIVES)
+      }
+      if((ret = _steal(ctx, false)) != nullptr)
+      {
+        return ret;
+      }
+      // The CPU domain count may have just shrunk, so make sure nothing is stranded in a now unused injection queue
+      for(unsigned n = ctx.domains; n < TOTAL_CPU_DOMAINS; n++)
+      {
+        if((ret = _pop_injected(injected[n])) != nullptr)
         {
-          idx = 0;
+          return ret;
         }
       }
+      return nullptr;
     }
 
-  public:
-    void append_active(dynamic_thread_pool_group::work_item *p)
+    /* Threadsafe. Pushes onto the calling worker's own deque if it has one and it isn't
+    full, else onto the injection queue of the CPU domain specified.
+    */
+    void append_active(dynamic_thread_pool_group::work_item *p, unsigned dequeidx, unsigned domain)
     {
-      next_active_base_t &x = _choose_next_active();
+      active_count.fetch_add(1, std::memory_order_relaxed);
+      if(dequeidx < TOTAL_WORKER_DEQUES)
+      {
+        auto *dq = deques[dequeidx].load(std::memory_order_relaxed);
+        if(dq == nullptr)
+        {
+          dq = new(std::nothrow) work_stealing_deque_type;
+          if(dq != nullptr)
+          {
+            deques[dequeidx].store(dq, std::memory_order_release);
+          }
+        }
+        if(dq != nullptr && dq->push(p))
+        {
+          return;
+        }
+      }
+      auto &x = injected[domain % TOTAL_CPU_DOMAINS];
+      x.lock.lock();
       x.count.fetch_add(1, std::memory_order_relaxed);
+      p->_next_scheduled = nullptr;
       if(x.back == nullptr)
       {
         assert(x.front == nullptr);
@@ -395,25 +651,28 @@ namespace detail
         x.lock.unlock();
         return;
       }
-      p->_next_scheduled = nullptr;
       x.back->_next_scheduled = p;
       x.back = p;
       x.lock.unlock();
     }
-    void prepend_active(dynamic_thread_pool_group::work_item *p)
+
+    // Owner only. Moves everything in the calling worker's deque onto the injection queue of its CPU domain.
+    void drain_deque(unsigned dequeidx, unsigned domain)
     {
-      next_active_base_t &x = _choose_next_active();
-      x.count.fetch_add(1, std::memory_order_relaxed);
-      if(x.front == nullptr)
+      if(dequeidx >= TOTAL_WORKER_DEQUES)
       {
-        assert(x.back == nullptr);
-        x.front = x.back = p;
-        x.lock.unlock();
         return;
       }
-      p->_next_scheduled = x.front;
-      x.front = p;
-      x.lock.unlock();
+      auto *dq = deques[dequeidx].load(std::memory_order_relaxed);
+      if(dq == nullptr)
+      {
+        return;
+      }
+      while(auto *p = dq->pop())
+      {
+        active_count.fetch_sub(1, std::memory_order_relaxed);
+        append_active(p, (unsigned) -1, domain);
+      }
     }
 
     // x must be LOCKED on entry
@@ -537,8 +796,191 @@ namespace detail
         next_timer_absolute.lock.unlock();
       }
     }
+#else
+    bool empty() const noexcept { return items.empty(); }
 #endif
   };
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  // A set of CPUs within which work preferentially stays
+  struct global_dynamic_thread_pool_impl_cpu_domain
+  {
+    cpu_set_t cpus;
+    unsigned cpucount{0};
+    int numa_node{-1};
+  };
+  inline ssize_t global_dynamic_thread_pool_impl_read_sysfs(char *buffer, size_t length, const char *path) noexcept
+  {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+      return -1;
+    }
+    auto bytesread = ::read(fd, buffer, length - 1);
+    ::close(fd);
+    if(bytesread < 0)
+    {
+      return -1;
+    }
+    buffer[bytesread] = 0;
+    return bytesread;
+  }
+  // Parses a sysfs list e.g. "0-3,8-11" into a cpu_set_t
+  inline bool global_dynamic_thread_pool_impl_read_cpulist(cpu_set_t &out, const char *path) noexcept
+  {
+    CPU_ZERO(&out);
+    char buffer[4096];
+    if(global_dynamic_thread_pool_impl_read_sysfs(buffer, sizeof(buffer), path) <= 0)
+    {
+      return false;
+    }
+    for(char *p = buffer; *p != 0 && *p != '\n';)
+    {
+      char *e = nullptr;
+      unsigned long first = strtoul(p, &e, 10), last = first;
+      if(e == p)
+      {
+        return false;
+      }
+      if(*e == '-')
+      {
+        p = e + 1;
+        last = strtoul(p, &e, 10);
+        if(e == p)
+        {
+          return false;
+        }
+      }
+      for(auto n = first; n <= last && n < CPU_SETSIZE; n++)
+      {
+        CPU_SET(n, &out);
+      }
+      p = e;
+      if(*p == ',')
+      {
+        p++;
+      }
+    }
+    return true;
+  }
+  /* Returns one domain per NUMA node or per L3 cache, restricted to the CPUs this
+  process may run upon. Always returns at least one domain, and never more than
+  `max_domains`.
+  */
+  inline std::vector<global_dynamic_thread_pool_impl_cpu_domain> global_dynamic_thread_pool_impl_discover_cpu_domains(dynamic_thread_pool_group::cpu_partitioning partitioning,
+                                                                                                                       unsigned max_domains)
+  {
+    using cpu_partitioning = dynamic_thread_pool_group::cpu_partitioning;
+    std::vector<global_dynamic_thread_pool_impl_cpu_domain> ret, nodes;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    // The main thread's affinity, as ours may have been set to a previous domain
+    if(-1 == ::sched_getaffinity(::getpid(), sizeof(allowed), &allowed))
+    {
+      posix_error().throw_exception();
+    }
+    char path[128];
+    if(partitioning != cpu_partitioning::none)
+    {
+      cpu_set_t online;
+      if(global_dynamic_thread_pool_impl_read_cpulist(online, "/sys/devices/system/node/online"))
+      {
+        for(int node = 0; node < CPU_SETSIZE; node++)
+        {
+          if(CPU_ISSET(node, &online))
+          {
+            global_dynamic_thread_pool_impl_cpu_domain d;
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            if(global_dynamic_thread_pool_impl_read_cpulist(d.cpus, path))
+            {
+              d.numa_node = node;
+              nodes.push_back(d);
+            }
+          }
+        }
+      }
+    }
+    if(partitioning == cpu_partitioning::numa_node)
+    {
+      ret = nodes;
+    }
+    else if(partitioning == cpu_partitioning::l3_cache)
+    {
+      cpu_set_t covered;
+      CPU_ZERO(&covered);
+      for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      {
+        if(!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &covered))
+        {
+          continue;
+        }
+        for(int index = 0; index < 16; index++)
+        {
+          char buffer[16];
+          snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+          if(global_dynamic_thread_pool_impl_read_sysfs(buffer, sizeof(buffer), path) <= 0)
+          {
+            break;
+          }
+          if(atoi(buffer) == 3)
+          {
+            global_dynamic_thread_pool_impl_cpu_domain d;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+            if(global_dynamic_thread_pool_impl_read_cpulist(d.cpus, path) && CPU_ISSET(cpu, &d.cpus))
+            {
+              CPU_OR(&covered, &covered, &d.cpus);
+              for(auto &node : nodes)
+              {
+                if(CPU_ISSET(cpu, &node.cpus))
+                {
+                  d.numa_node = node.numa_node;
+                  break;
+                }
+              }
+              ret.push_back(d);
+            }
+            break;
+          }
+        }
+      }
+    }
+    for(auto it = ret.begin(); it != ret.end();)
+    {
+      CPU_AND(&it->cpus, &it->cpus, &allowed);
+      it->cpucount = (unsigned) CPU_COUNT(&it->cpus);
+      if(it->cpucount == 0)
+      {
+        it = ret.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+    if(ret.empty())
+    {
+      global_dynamic_thread_pool_impl_cpu_domain d;
+      d.cpus = allowed;
+      d.cpucount = (unsigned) CPU_COUNT(&allowed);
+      if(nodes.size() == 1)
+      {
+        d.numa_node = nodes.front().numa_node;
+      }
+      ret.push_back(d);
+    }
+    while(ret.size() > max_domains)
+    {
+      auto &d = ret[ret.size() % max_domains];
+      CPU_OR(&d.cpus, &d.cpus, &ret.back().cpus);
+      d.cpucount = (unsigned) CPU_COUNT(&d.cpus);
+      if(d.numa_node != ret.back().numa_node)
+      {
+        d.numa_node = -1;
+      }
+      ret.pop_back();
+    }
+    return ret;
+  }
+#endif
   struct global_dynamic_thread_pool_impl
   {
     using _spinlock_type = QUICKCPPLIB_NAMESPACE::configurable_spinlock::spinlock<unsigned>;
@@ -549,6 +991,48 @@ namespace detail
       using std::unique_lock<_spinlock_type>::unique_lock;
     };
     std::shared_ptr<global_dynamic_thread_pool_impl_workqueue_item> workqueue;
+
+    // Ordered by priority class, then by nesting level, highest first. workqueue_lock must be held.
+    global_dynamic_thread_pool_impl_workqueue_item *_find_workqueue_item(workqueue_guard & /*unused*/, size_t nesting_level,
+                                                                         dynamic_thread_pool_group::priority_class priority) noexcept
+    {
+      for(auto *p = workqueue.get(); p != nullptr; p = p->next.get())
+      {
+        if(p->nesting_level == nesting_level && p->priority == priority)
+        {
+          return p;
+        }
+      }
+      return nullptr;
+    }
+    size_t _deepest_nesting_level(workqueue_guard & /*unused*/) const noexcept
+    {
+      size_t ret = 0;
+      for(auto *p = workqueue.get(); p != nullptr; p = p->next.get())
+      {
+        ret = std::max(ret, p->nesting_level);
+      }
+      return ret;
+    }
+    global_dynamic_thread_pool_impl_workqueue_item *_workqueue_item_for(workqueue_guard & /*unused*/, size_t nesting_level,
+                                                                        dynamic_thread_pool_group::priority_class priority)
+    {
+      std::shared_ptr<global_dynamic_thread_pool_impl_workqueue_item> *link = &workqueue;
+      for(; *link; link = &(*link)->next)
+      {
+        auto *p = link->get();
+        if(p->priority < priority || (p->priority == priority && p->nesting_level < nesting_level))
+        {
+          break;
+        }
+        if(p->priority == priority && p->nesting_level == nesting_level)
+        {
+          return p;
+        }
+      }
+      *link = std::make_shared<global_dynamic_thread_pool_impl_workqueue_item>(nesting_level, priority, std::move(*link));
+      return link->get();
+    }
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
     using threadh_type = void *;
     using grouph_type = dispatch_group_t;
@@ -576,7 +1060,26 @@ namespace detail
       global_dynamic_thread_pool()._timerthread(workitem, threadh);
     }
 #else
-    global_dynamic_thread_pool_impl_workqueue_item first_execute{(size_t) -1, {}};
+    // Newly submitted work, one queue per priority class, executed before other work of that priority class
+    struct first_execute_t
+    {
+      global_dynamic_thread_pool_impl_workqueue_item background{(size_t) -1, dynamic_thread_pool_group::priority_class::background, {}};
+      global_dynamic_thread_pool_impl_workqueue_item normal{(size_t) -1, dynamic_thread_pool_group::priority_class::normal, {}};
+      global_dynamic_thread_pool_impl_workqueue_item latency_critical{(size_t) -1, dynamic_thread_pool_group::priority_class::latency_critical, {}};
+
+      global_dynamic_thread_pool_impl_workqueue_item &operator[](dynamic_thread_pool_group::priority_class priority) noexcept
+      {
+        switch(priority)
+        {
+        case dynamic_thread_pool_group::priority_class::background:
+          return background;
+        case dynamic_thread_pool_group::priority_class::latency_critical:
+          return latency_critical;
+        default:
+          return normal;
+        }
+      }
+    } first_execute;
     using threadh_type = void *;
     using grouph_type = void *;
     std::mutex threadpool_lock;
@@ -591,6 +1094,32 @@ namespace detail
       std::condition_variable cond;
       std::chrono::steady_clock::time_point last_did_work;
       std::atomic<int> state{0};  // <0 = dead, 0 = sleeping/please die, 1 = busy
+      unsigned dequeidx{(unsigned) -1};  // index of this thread's work stealing deque within each nesting level
+      unsigned domain{0}, domain_generation{(unsigned) -1};  // the CPU domain this thread belongs to
+      bool affinitised{false};
+      uint32_t threadid{0};
+      uint32_t spin_ns{(uint32_t) -1};  // this thread's adaptive spin budget, (uint32_t) -1 means the maximum
+      bool wake_pending{false};         // a submitter has notified this sleeping thread, threadpool_lock must be held
+      // Written by this thread, read by pool_statistics()
+      std::atomic<uint64_t> busy_ns{0}, blocked_ns{0}, idle_ns{0};
+      std::chrono::steady_clock::time_point stats_since;  // start of the current busy or idle period
+      uint64_t stats_cputime_since{0};                    // this thread's CPU time at stats_since
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      int schedstat_fd{-1};                                      // this thread's /proc/thread-self/schedstat
+      std::atomic<std::chrono::steady_clock::rep> busy_since{0};  // when the current work item began, zero if none
+      // Only touched by the concurrency controller with threadpool_lock held
+      uint64_t schedstat_last_runtime{0};
+      std::chrono::steady_clock::time_point schedstat_last_sampled;
+      bool schedstat_blocked{false};
+
+      ~thread_t()
+      {
+        if(schedstat_fd >= 0)
+        {
+          ::close(schedstat_fd);
+        }
+      }
+#endif
     };
     struct threads_t
     {
@@ -598,7 +1127,125 @@ namespace detail
       thread_t *front{nullptr}, *back{nullptr};
     } threadpool_active, threadpool_sleeping;
     std::atomic<size_t> total_submitted_workitems{0}, threadpool_threads{0};
+    // Statistics of threads no longer in the pool
+    std::atomic<uint64_t> threads_added{0}, threads_removed{0}, exited_busy_ns{0}, exited_blocked_ns{0}, exited_idle_ns{0};
+
+    static uint64_t _thread_cputime_ns() noexcept
+    {
+      struct timespec ts
+      {
+      };
+      if(-1 == ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+      {
+        return 0;
+      }
+      return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    }
+    // Splits the time awake since stats_since into time on CPU and time blocked
+    static void _account_busy(thread_t *self, std::chrono::steady_clock::time_point now) noexcept
+    {
+      const auto cputime = _thread_cputime_ns();
+      const auto awake = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - self->stats_since).count();
+      const auto oncpu = std::min(awake, cputime - self->stats_cputime_since);
+      self->busy_ns.fetch_add(oncpu, std::memory_order_relaxed);
+      self->blocked_ns.fetch_add(awake - oncpu, std::memory_order_relaxed);
+      self->stats_since = now;
+      self->stats_cputime_since = cputime;
+    }
+    inline void _thread_exits(thread_t *self) noexcept;
+    // How many threads are executing background priority class work, and how many may
+    std::atomic<unsigned> background_executing{0}, background_concurrency_limit{(unsigned) -1};
     std::atomic<uint32_t> ms_sleep_for_more_work{20000};
+    std::atomic<uint32_t> us_spin_for_more_work{50};
+
+    /* An eventcount: submitters increment work_epoch after queuing work. A worker samples
+    it before looking for work, and having found none, spins until it changes or its spin
+    budget runs out, then parks on its condition variable unless it changed meanwhile.
+    Submitters only take threadpool_lock to wake a parked worker if no worker is spinning.
+    */
+    std::atomic<uint64_t> work_epoch{0};
+    std::atomic<unsigned> threads_spinning{0}, threads_parked{0};
+    inline bool _spin_for_work(thread_t *self, uint64_t epoch) noexcept;
+    inline void _wake_one_parked(size_t active_work_items) noexcept;
+
+    // Bitmap of worker deque indices currently owned by a worker thread
+    std::atomic<uint64_t> worker_deques_inuse[global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES / 64];
+    // One more than the highest worker deque index ever claimed, so stealing need not look further
+    std::atomic<unsigned> worker_deques_highwater{0};
+
+    unsigned _claim_worker_deque() noexcept
+    {
+      for(unsigned w = 0; w < global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES / 64; w++)
+      {
+        auto v = worker_deques_inuse[w].load(std::memory_order_relaxed);
+        while(v != (uint64_t) -1)
+        {
+          const auto bit = (unsigned) __builtin_ctzll(~v);
+          if(worker_deques_inuse[w].compare_exchange_weak(v, v | ((uint64_t) 1 << bit), std::memory_order_acquire, std::memory_order_relaxed))
+          {
+            const unsigned ret = w * 64 + bit;
+            for(auto hw = worker_deques_highwater.load(std::memory_order_relaxed);
+                hw < ret + 1 && !worker_deques_highwater.compare_exchange_weak(hw, ret + 1, std::memory_order_relaxed, std::memory_order_relaxed);)
+            {
+            }
+            return ret;
+          }
+        }
+      }
+      return (unsigned) -1;
+    }
+    inline void _release_worker_resources(thread_t *self) noexcept;
+
+    // CPU topology partitioning. Changes only with threadpool_lock held.
+    dynamic_thread_pool_group::cpu_partitioning partitioning{dynamic_thread_pool_group::cpu_partitioning::none};
+    std::vector<global_dynamic_thread_pool_impl_cpu_domain> cpu_domains;
+    std::atomic<unsigned> cpu_domains_count{1}, cpu_domains_generation{0};
+    std::atomic<int> cpu_domains_threads[global_dynamic_thread_pool_impl_workqueue_item::TOTAL_CPU_DOMAINS];
+    std::atomic<int> cpu_domains_numa_node[global_dynamic_thread_pool_impl_workqueue_item::TOTAL_CPU_DOMAINS];
+    std::atomic<uint8_t> cpu_to_domain[CPU_SETSIZE];
+    std::atomic<unsigned> worker_deque_domains[global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES];
+
+    void _set_cpu_domains(threadpool_guard & /*unused*/, dynamic_thread_pool_group::cpu_partitioning v,
+                          std::vector<global_dynamic_thread_pool_impl_cpu_domain> &&domains) noexcept
+    {
+      partitioning = v;
+      cpu_domains = std::move(domains);
+      if(cpu_domains.empty())
+      {
+        global_dynamic_thread_pool_impl_cpu_domain d;
+        CPU_ZERO(&d.cpus);
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+          CPU_SET(cpu, &d.cpus);
+        }
+        d.cpucount = std::max(1U, std::thread::hardware_concurrency());
+        cpu_domains.push_back(d);
+      }
+      for(auto &i : cpu_to_domain)
+      {
+        i.store(0, std::memory_order_relaxed);
+      }
+      for(unsigned n = 0; n < global_dynamic_thread_pool_impl_workqueue_item::TOTAL_CPU_DOMAINS; n++)
+      {
+        cpu_domains_threads[n].store(0, std::memory_order_relaxed);
+        cpu_domains_numa_node[n].store((n < cpu_domains.size()) ? cpu_domains[n].numa_node : -1, std::memory_order_relaxed);
+      }
+      for(unsigned n = 0; n < cpu_domains.size(); n++)
+      {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+          if(CPU_ISSET(cpu, &cpu_domains[n].cpus))
+          {
+            cpu_to_domain[cpu].store((uint8_t) n, std::memory_order_relaxed);
+          }
+        }
+      }
+      cpu_domains_count.store((unsigned) cpu_domains.size(), std::memory_order_relaxed);
+      // Causes every worker thread to choose its CPU domain anew
+      cpu_domains_generation.fetch_add(1, std::memory_order_release);
+    }
+
+    inline void _assign_cpu_domain(thread_t *self) noexcept;
 
     std::mutex threadmetrics_lock;
     struct threadmetrics_guard : std::unique_lock<std::mutex>
@@ -652,27 +1299,95 @@ namespace detail
     std::mutex proc_self_task_fd_lock;
     int proc_self_task_fd{-1};
 #endif
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+    std::atomic<std::chrono::steady_clock::rep> schedstat_last_updated{0}, psi_cpu_last_fired{0};
+    std::atomic<ssize_t> schedstat_excess_threads{0};  // threads the sampler found surplus, for workers to shed
+    int psi_cpu_fd{-1};  // a PSI trigger on /proc/pressure/cpu, if the kernel permits us one
+    // Samples the workers even when every one of them is blocked, and so cannot sample
+    std::thread schedstat_sampler;
+    std::mutex schedstat_sampler_lock;
+    std::condition_variable schedstat_sampler_cond;
+    bool schedstat_sampler_stop{false};
+#endif
 #endif
 
+    // Tracing, enabled if trace_ring is not null. Rings replaced are retired rather than
+    // freed, as other threads may still be writing into them.
+    std::atomic<global_dynamic_thread_pool_impl_trace_ring *> trace_ring{nullptr};
+    std::mutex trace_lock;
+    std::vector<std::unique_ptr<global_dynamic_thread_pool_impl_trace_ring>> trace_rings;
+    inline void _trace(dynamic_thread_pool_group::trace_event_kind kind, const dynamic_thread_pool_group *group,
+                       const dynamic_thread_pool_group::work_item *item) noexcept;
+    inline void _trace(dynamic_thread_pool_group::trace_event_kind kind, const dynamic_thread_pool_group *group, const dynamic_thread_pool_group::work_item *item,
+                       std::chrono::steady_clock::time_point now) noexcept;
+
     std::mutex io_aware_work_item_handles_lock;
     struct io_aware_work_item_handles_guard : std::unique_lock<std::mutex>
     {
       using std::unique_lock<std::mutex>::unique_lock;
     };
-    struct io_aware_work_item_statfs
+    // Per storage device congestion control state shared by all io_aware_work_item
+    // using handles on that device.
+    struct io_aware_work_item_device
     {
       size_t refcount{0};
       deadline default_deadline;
-      float average_busy{0}, average_queuedepth{0};
-      std::chrono::steady_clock::time_point last_updated;
+      float smoothed_latency{0};  // seconds, 7/8 + 1/8 moving average of block layer completion latency
+      float min_latency{0};       // seconds, the windowed minimum completion latency i.e. latency without queuing
+      bool probing_min_latency{false};
+      std::chrono::steady_clock::time_point last_updated, min_latency_updated;
       statfs_t statfs;
     };
-    std::unordered_map<fs_handle::unique_id_type, io_aware_work_item_statfs, fs_handle::unique_id_type_hasher> io_aware_work_item_handles;
+    std::unordered_map<uint64_t, io_aware_work_item_device> io_aware_work_item_handles;
 
     global_dynamic_thread_pool_impl()
     {
 #if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+      for(auto &i : worker_deques_inuse)
+      {
+        i.store(0, std::memory_order_relaxed);
+      }
+      for(auto &i : worker_deque_domains)
+      {
+        i.store(0, std::memory_order_relaxed);
+      }
+      {
+        std::vector<global_dynamic_thread_pool_impl_cpu_domain> domains;
+        try
+        {
+          domains = global_dynamic_thread_pool_impl_discover_cpu_domains(dynamic_thread_pool_group::cpu_partitioning::none,
+                                                                         global_dynamic_thread_pool_impl_workqueue_item::TOTAL_CPU_DOMAINS);
+        }
+        catch(...)
+        {
+        }
+        threadpool_guard g(threadpool_lock);
+        _set_cpu_domains(g, dynamic_thread_pool_group::cpu_partitioning::none, std::move(domains));
+      }
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      psi_cpu_fd = ::open("/proc/pressure/cpu", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+      if(psi_cpu_fd >= 0)
+      {
+        // Fire if any runnable task stalled awaiting a CPU for 100ms within a 2 second window.
+        // Unprivileged processes may only use windows which are multiples of two seconds.
+        static const char trigger[] = "some 100000 2000000";
+        if(::write(psi_cpu_fd, trigger, sizeof(trigger)) < 0)
+        {
+          ::close(psi_cpu_fd);
+          psi_cpu_fd = -1;
+        }
+      }
+      try
+      {
+        schedstat_sampler = std::thread([this] { _schedstat_sampler(); });
+      }
+      catch(...)
+      {
+        // drop failure, workers still sample whenever they finish a work item
+      }
+#else
       populate_threadmetrics(std::chrono::steady_clock::now());
+#endif
 #endif
     }
 
@@ -744,6 +1459,17 @@ namespace detail
 #if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
     inline void _execute_work(thread_t *self);
 
+    // Returns true if calling thread is to exit
+    bool _update_concurrency(std::chrono::steady_clock::time_point now)
+    {
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      (void) now;
+      return update_schedstat_metrics(true);
+#else
+      return populate_threadmetrics(now);
+#endif
+    }
+
     void _add_thread(threadpool_guard & /*unused*/)
     {
       thread_t *p = nullptr;
@@ -798,6 +1524,17 @@ namespace detail
 
     ~global_dynamic_thread_pool_impl()
     {
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32) && LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      if(schedstat_sampler.joinable())
+      {
+        {
+          std::lock_guard<std::mutex> g(schedstat_sampler_lock);
+          schedstat_sampler_stop = true;
+        }
+        schedstat_sampler_cond.notify_all();
+        schedstat_sampler.join();
+      }
+#endif
       {
         threadpool_guard g(threadpool_lock);
         while(threadpool_active.count > 0 || threadpool_sleeping.count > 0)
@@ -830,7 +1567,164 @@ namespace detail
         proc_self_task_fd = -1;
       }
 #endif
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      if(psi_cpu_fd >= 0)
+      {
+        ::close(psi_cpu_fd);
+        psi_cpu_fd = -1;
+      }
+#endif
+    }
+
+    // When the CPUs are saturated, background priority class work may occupy only a quarter of them
+    void _update_background_throttle(ssize_t threads_running, bool cpu_pressured) noexcept
+    {
+      const auto hardware_concurrency = utils::effective_cpu_concurrency();
+      const bool saturated = cpu_pressured || threads_running >= (ssize_t) hardware_concurrency;
+      background_concurrency_limit.store(saturated ? std::max(1U, hardware_concurrency / 4) : (unsigned) -1, std::memory_order_relaxed);
+    }
+
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+    /* Unlike populate_threadmetrics(), this only considers the threads in this pool.
+    Any pool thread which has been executing the same work item for an entire sample
+    period, but received less than a tenth of that period on CPU, is deemed blocked.
+    Called by workers after each work item, and by the sampler thread every sample
+    period whilst work is queued. Returns true if calling worker thread is to exit.
+    */
+    bool update_schedstat_metrics(bool is_worker)
+    {
+      static constexpr std::chrono::milliseconds sample_period(5);
+      if(is_worker)
+      {
+        // The sampler cannot exit on behalf of a surplus worker, so the next worker to come by does
+        for(auto excess = schedstat_excess_threads.load(std::memory_order_relaxed); excess > 0;)
+        {
+          if(schedstat_excess_threads.compare_exchange_weak(excess, excess - 1, std::memory_order_relaxed))
+          {
+            threadpool_guard g(threadpool_lock);
+            return threadpool_active.count > 1;
+          }
+        }
+      }
+      const auto now = std::chrono::steady_clock::now();
+      auto last_updated = schedstat_last_updated.load(std::memory_order_relaxed);
+      if(now.time_since_epoch().count() - last_updated < std::chrono::duration_cast<std::chrono::steady_clock::duration>(sample_period).count())
+      {
+        return false;
+      }
+      if(!schedstat_last_updated.compare_exchange_strong(last_updated, now.time_since_epoch().count(), std::memory_order_relaxed))
+      {
+        return false;  // another thread is doing this
+      }
+      bool cpu_pressured = false;
+      if(psi_cpu_fd >= 0)
+      {
+        struct pollfd pfd;
+        pfd.fd = psi_cpu_fd;
+        pfd.events = POLLPRI;
+        pfd.revents = 0;
+        if(::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI) != 0)
+        {
+          psi_cpu_last_fired.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+        cpu_pressured = now - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(psi_cpu_last_fired.load(std::memory_order_relaxed))) <
+                        std::chrono::seconds(2);
+      }
+      // The CPU budget may be restricted by affinity or cgroup quota, and may change at any time
+      const auto min_hardware_concurrency = utils::effective_cpu_concurrency();
+      // If the CPUs are contended, don't permit any headroom above hardware concurrency
+      const auto max_hardware_concurrency = cpu_pressured ? min_hardware_concurrency : min_hardware_concurrency + 3;
+      threadpool_guard g(threadpool_lock);
+      ssize_t threadmetrics_running = 0;
+      for(auto *t = threadpool_active.front; t != nullptr; t = t->_next)
+      {
+        const auto busy_since = t->busy_since.load(std::memory_order_acquire);
+        if(busy_since == 0 || t->schedstat_fd < 0)
+        {
+          t->schedstat_last_sampled = {};
+          t->schedstat_blocked = false;
+          threadmetrics_running++;
+          continue;
+        }
+        if(t->schedstat_last_sampled == std::chrono::steady_clock::time_point() || now - t->schedstat_last_sampled >= sample_period)
+        {
+          char buffer[96];
+          auto bytesread = ::pread(t->schedstat_fd, buffer, sizeof(buffer) - 1, 0);
+          if(bytesread > 0)
+          {
+            buffer[bytesread] = 0;
+            const uint64_t runtime = strtoull(buffer, nullptr, 10);  // nanoseconds spent on CPU
+            if(t->schedstat_last_sampled != std::chrono::steady_clock::time_point() &&
+               std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(busy_since)) <= t->schedstat_last_sampled)
+            {
+              const auto elapsed = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - t->schedstat_last_sampled).count();
+              t->schedstat_blocked = (runtime - t->schedstat_last_runtime) * 10 < elapsed;
+            }
+            else
+            {
+              t->schedstat_blocked = false;
+            }
+            t->schedstat_last_runtime = runtime;
+            t->schedstat_last_sampled = now;
+          }
+        }
+        if(!t->schedstat_blocked)
+        {
+          threadmetrics_running++;
+        }
+      }
+      _update_background_throttle(threadmetrics_running, cpu_pressured);
+      // Adjust for the number of threads sleeping for more work
+      threadmetrics_running += threadpool_sleeping.count;
+      const auto desired_concurrency = std::min((ssize_t) min_hardware_concurrency, (ssize_t) total_submitted_workitems.load(std::memory_order_relaxed));
+      // Blocked threads don't count towards concurrency, so replace them up to a limit
+      auto toadd = std::max((ssize_t) 0, std::min(desired_concurrency - threadmetrics_running,
+                                                  (ssize_t) (4 * min_hardware_concurrency) - (ssize_t) threadpool_active.count));
+      auto toremove = std::max((ssize_t) 0, (ssize_t) threadmetrics_running - (ssize_t) max_hardware_concurrency);
+      if(toadd > 0)
+      {
+        _add_thread(g);
+      }
+      if(toremove > 0 && threadpool_active.count > 1)
+      {
+        if(!is_worker)
+        {
+          schedstat_excess_threads.store(toremove, std::memory_order_relaxed);
+          return false;
+        }
+        // Kill myself, but not if I'm the final thread who might need to run timers
+        schedstat_excess_threads.store(toremove - 1, std::memory_order_relaxed);
+        return true;
+      }
+      schedstat_excess_threads.store(0, std::memory_order_relaxed);
+      return false;
+    }
+
+    void _schedstat_sampler()
+    {
+      pthread_setname_np(pthread_self(), "LLFIO DYN TPG S");
+      std::unique_lock<std::mutex> g(schedstat_sampler_lock);
+      while(!schedstat_sampler_stop)
+      {
+        // Sample every sample period only while work is queued, as only then can all the workers be blocked
+        const bool queued = total_submitted_workitems.load(std::memory_order_relaxed) > 0;
+        schedstat_sampler_cond.wait_for(g, std::chrono::milliseconds(queued ? 5 : 100));
+        if(schedstat_sampler_stop)
+        {
+          break;
+        }
+        g.unlock();
+        try
+        {
+          (void) update_schedstat_metrics(false);
+        }
+        catch(...)
+        {
+        }
+        g.lock();
+      }
     }
+#endif
 
 #ifdef __linux__
     // You are guaranteed only one of these EVER executes at a time. Locking is probably overkill, but equally also probably harmless
@@ -918,13 +1812,15 @@ namespace detail
       }
       // if(updated > 0)
       {
-        static const auto min_hardware_concurrency = std::thread::hardware_concurrency();
-        static const auto max_hardware_concurrency = min_hardware_concurrency + 3;
+        // The CPU budget may be restricted by affinity or cgroup quota, and may change at any time
+        const auto min_hardware_concurrency = utils::effective_cpu_concurrency();
+        const auto max_hardware_concurrency = min_hardware_concurrency + 3;
         auto threadmetrics_running = (ssize_t) threadmetrics_queue.running;
         auto threadmetrics_blocked = (ssize_t) threadmetrics_queue.blocked;
         g.unlock();  // drop threadmetrics_lock
 
         threadpool_guard gg(threadpool_lock);
+        _update_background_throttle(threadmetrics_running, false);
         // Adjust for the number of threads sleeping for more work
         threadmetrics_running += threadpool_sleeping.count;
         threadmetrics_blocked -= threadpool_sleeping.count;
@@ -1216,6 +2112,7 @@ namespace detail
     inline result<void> submit(dynamic_thread_pool_group_impl_guard &g, dynamic_thread_pool_group_impl *group,
                                span<dynamic_thread_pool_group::work_item *> work) noexcept;
 
+    // Returns with g unlocked if stopped waiters were notified, as they may have destroyed the group
     inline void _work_item_done(dynamic_thread_pool_group_impl_guard &g, dynamic_thread_pool_group::work_item *i) noexcept;
 
     inline result<void> stop(dynamic_thread_pool_group_impl_guard &g, dynamic_thread_pool_group_impl *group, result<void> err) noexcept;
@@ -1229,6 +2126,11 @@ namespace detail
     dynamic_thread_pool_group::work_item *workitem{nullptr};
     global_dynamic_thread_pool_impl::threadh_type current_callback_instance{nullptr};
     size_t nesting_level{0};
+    uint32_t threadid{0};  // lazily filled in by global_dynamic_thread_pool_current_thread_id()
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+    unsigned dequeidx{(unsigned) -1};
+    unsigned cpudomain{0};
+#endif
   };
   LLFIO_HEADERS_ONLY_FUNC_SPEC global_dynamic_thread_pool_impl_thread_local_state_t &global_dynamic_thread_pool_thread_local_state() noexcept
   {
@@ -1241,6 +2143,51 @@ namespace detail
     static global_dynamic_thread_pool_impl impl;
     return impl;
   }
+
+  inline uint32_t global_dynamic_thread_pool_current_thread_id() noexcept
+  {
+    auto &tls = global_dynamic_thread_pool_thread_local_state();
+    if(tls.threadid == 0)
+    {
+#ifdef _WIN32
+      tls.threadid = (uint32_t) GetCurrentThreadId();
+#elif defined(__linux__)
+      tls.threadid = (uint32_t) ::syscall(SYS_gettid);
+#elif defined(__APPLE__)
+      uint64_t tid = 0;
+      ::pthread_threadid_np(nullptr, &tid);
+      tls.threadid = (uint32_t) tid;
+#else
+      tls.threadid = (uint32_t) std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+    }
+    return tls.threadid;
+  }
+
+  inline void global_dynamic_thread_pool_impl::_trace(dynamic_thread_pool_group::trace_event_kind kind, const dynamic_thread_pool_group *group,
+                                                      const dynamic_thread_pool_group::work_item *item) noexcept
+  {
+    // Only read the clock if tracing is enabled
+    if(trace_ring.load(std::memory_order_relaxed) != nullptr)
+    {
+      _trace(kind, group, item, std::chrono::steady_clock::now());
+    }
+  }
+  inline void global_dynamic_thread_pool_impl::_trace(dynamic_thread_pool_group::trace_event_kind kind, const dynamic_thread_pool_group *group,
+                                                      const dynamic_thread_pool_group::work_item *item, std::chrono::steady_clock::time_point now) noexcept
+  {
+    auto *ring = trace_ring.load(std::memory_order_acquire);
+    if(ring != nullptr)
+    {
+      dynamic_thread_pool_group::trace_event event;
+      event.timestamp = now;
+      event.kind = kind;
+      event.thread_id = global_dynamic_thread_pool_current_thread_id();
+      event.group = group;
+      event.item = item;
+      ring->push(event);
+    }
+  }
 }  // namespace detail
 
 
@@ -1263,6 +2210,7 @@ class dynamic_thread_pool_group_impl final : public dynamic_thread_pool_group
 
   mutable std::mutex _lock;
   size_t _nesting_level{0};
+  std::atomic<priority_class> _priority{priority_class::normal};
   struct workitems_t
   {
     size_t count{0};
@@ -1271,6 +2219,9 @@ class dynamic_thread_pool_group_impl final : public dynamic_thread_pool_group
   std::atomic<bool> _stopping{false}, _stopped{true}, _completing{false};
   std::atomic<int> _waits{0};
   result<void> _abnormal_completion_cause{success()};  // The cause of any abnormal group completion
+  _stopped_waiter *_stopped_waiters{nullptr};
+  // Statistics
+  std::atomic<uint64_t> _stats_executed{0}, _stats_wait_ns{0}, _stats_wait_max_ns{0}, _stats_execution_ns{0};
 
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
   dispatch_group_t _grouph;
@@ -1290,7 +2241,17 @@ public:
     try
     {
       auto &impl = detail::global_dynamic_thread_pool();
-      _nesting_level = detail::global_dynamic_thread_pool_thread_local_state().nesting_level;
+      auto &tls = detail::global_dynamic_thread_pool_thread_local_state();
+      _nesting_level = tls.nesting_level;
+      // Groups created from within work inherit the priority class of that work
+      if(tls.workitem != nullptr)
+      {
+        auto *parent = tls.workitem->_parent.load(std::memory_order_relaxed);
+        if(parent != nullptr)
+        {
+          _priority.store(parent->_priority.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+      }
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
       _grouph = dispatch_group_create();
       if(_grouph == nullptr)
@@ -1301,12 +2262,8 @@ public:
       InitializeThreadpoolEnvironment(_grouph);
 #endif
       detail::global_dynamic_thread_pool_impl::workqueue_guard g(impl.workqueue_lock);
-      // Append this group to the global work queue at its nesting level
-      if(!impl.workqueue || impl.workqueue->nesting_level <= _nesting_level)
-      {
-        impl.workqueue = std::make_shared<detail::global_dynamic_thread_pool_impl_workqueue_item>(_nesting_level, std::move(impl.workqueue));
-      }
-      impl.workqueue->items.insert(this);
+      // Append this group to the global work queue at its priority class and nesting level
+      impl._workqueue_item_for(g, _nesting_level, _priority.load(std::memory_order_relaxed))->items.insert(this);
       return success();
     }
     catch(...)
@@ -1319,6 +2276,9 @@ public:
   {
     LLFIO_LOG_FUNCTION_CALL(this);
     (void) wait();
+    {
+      detail::dynamic_thread_pool_group_impl_guard g(_lock);
+    }
     auto &impl = detail::global_dynamic_thread_pool();
     // detail::dynamic_thread_pool_group_impl_guard g1(_lock);
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
@@ -1335,16 +2295,13 @@ public:
     }
 #endif
     detail::global_dynamic_thread_pool_impl::workqueue_guard g2(impl.workqueue_lock);
-    assert(impl.workqueue->nesting_level >= _nesting_level);
-    for(auto *p = impl.workqueue.get(); p != nullptr; p = p->next.get())
+    auto *p = impl._find_workqueue_item(g2, _nesting_level, _priority.load(std::memory_order_relaxed));
+    assert(p != nullptr);
+    if(p != nullptr)
     {
-      if(p->nesting_level == _nesting_level)
-      {
-        p->items.erase(this);
-        break;
-      }
+      p->items.erase(this);
     }
-    while(impl.workqueue && impl.workqueue->items.empty())
+    while(impl.workqueue && impl.workqueue->empty())
     {
       impl.workqueue = std::move(impl.workqueue->next);
     }
@@ -1395,8 +2352,67 @@ public:
 
   virtual bool stopping() const noexcept override { return _stopping.load(std::memory_order_relaxed); }
 
+  virtual priority_class priority() const noexcept override { return _priority.load(std::memory_order_relaxed); }
+
+  virtual result<void> set_priority(priority_class v) noexcept override
+  {
+    LLFIO_LOG_FUNCTION_CALL(this);
+    try
+    {
+      auto &impl = detail::global_dynamic_thread_pool();
+      detail::global_dynamic_thread_pool_impl::workqueue_guard g(impl.workqueue_lock);
+      const auto old = _priority.load(std::memory_order_relaxed);
+      if(old == v)
+      {
+        return success();
+      }
+      /* Work already queued at the old priority class stays there, but all
+      work subsequently scheduled goes to the new priority class.
+      */
+      impl._workqueue_item_for(g, _nesting_level, v)->items.insert(this);
+      _priority.store(v, std::memory_order_relaxed);
+      auto *p = impl._find_workqueue_item(g, _nesting_level, old);
+      if(p != nullptr)
+      {
+        p->items.erase(this);
+      }
+      return success();
+    }
+    catch(...)
+    {
+      return error_from_exception();
+    }
+  }
+
   virtual bool stopped() const noexcept override { return _stopped.load(std::memory_order_relaxed); }
 
+  virtual group_statistics statistics() const noexcept override
+  {
+    group_statistics ret;
+    ret.priority = _priority.load(std::memory_order_relaxed);
+    ret.nesting_level = _nesting_level;
+    {
+      dynamic_thread_pool_group_impl_guard g(_lock);
+      ret.work_items_active = _work_items_active.count;
+    }
+    ret.work_items_executed = _stats_executed.load(std::memory_order_relaxed);
+    ret.total_wait_time = std::chrono::nanoseconds(_stats_wait_ns.load(std::memory_order_relaxed));
+    ret.max_wait_time = std::chrono::nanoseconds(_stats_wait_max_ns.load(std::memory_order_relaxed));
+    ret.total_execution_time = std::chrono::nanoseconds(_stats_execution_ns.load(std::memory_order_relaxed));
+    return ret;
+  }
+  void _record_execution(std::chrono::steady_clock::duration waited, std::chrono::steady_clock::duration executed) noexcept
+  {
+    const auto waited_ns = (uint64_t) std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    _stats_executed.fetch_add(1, std::memory_order_relaxed);
+    _stats_wait_ns.fetch_add(waited_ns, std::memory_order_relaxed);
+    _stats_execution_ns.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(executed).count(), std::memory_order_relaxed);
+    for(auto v = _stats_wait_max_ns.load(std::memory_order_relaxed);
+        v < waited_ns && !_stats_wait_max_ns.compare_exchange_weak(v, waited_ns, std::memory_order_relaxed, std::memory_order_relaxed);)
+    {
+    }
+  }
+
   virtual result<void> wait(deadline d = {}) const noexcept override
   {
     LLFIO_LOG_FUNCTION_CALL(this);
@@ -1408,6 +2424,24 @@ public:
     detail::dynamic_thread_pool_group_impl_guard g(_lock);  // lock group
     return impl.wait(g, true, const_cast<dynamic_thread_pool_group_impl *>(this), d);
   }
+
+protected:
+  virtual void _notify_when_stopped(_stopped_waiter *w) noexcept override
+  {
+    LLFIO_LOG_FUNCTION_CALL(this);
+    result<void> cause(success());
+    {
+      detail::dynamic_thread_pool_group_impl_guard g(_lock);  // lock group
+      if(_work_items_active.count > 0 || _completing.load(std::memory_order_relaxed))
+      {
+        w->_next = _stopped_waiters;
+        _stopped_waiters = w;
+        return;
+      }
+      cause = _abnormal_completion_cause;
+    }
+    w->_stopped(cause);
+  }
 };
 
 LLFIO_HEADERS_ONLY_MEMFUNC_SPEC size_t dynamic_thread_pool_group::current_nesting_level() noexcept
@@ -1422,26 +2456,256 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC dynamic_thread_pool_group::work_item *dynamic_th
 
 LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t dynamic_thread_pool_group::ms_sleep_for_more_work() noexcept
 {
-#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
-  return detail::global_dynamic_thread_pool().ms_sleep_for_more_work.load(std::memory_order_relaxed);
-#else
-  return 0;
-#endif
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  return detail::global_dynamic_thread_pool().ms_sleep_for_more_work.load(std::memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t dynamic_thread_pool_group::ms_sleep_for_more_work(uint32_t v) noexcept
+{
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  if(0 == v)
+  {
+    v = 1;
+  }
+  detail::global_dynamic_thread_pool().ms_sleep_for_more_work.store(v, std::memory_order_relaxed);
+  return v;
+#else
+  (void) v;
+  return 0;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t dynamic_thread_pool_group::us_spin_for_more_work() noexcept
+{
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  return detail::global_dynamic_thread_pool().us_spin_for_more_work.load(std::memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t dynamic_thread_pool_group::us_spin_for_more_work(uint32_t v) noexcept
+{
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  if(v > 1000000)
+  {
+    v = 1000000;
+  }
+  detail::global_dynamic_thread_pool().us_spin_for_more_work.store(v, std::memory_order_relaxed);
+  return v;
+#else
+  (void) v;
+  return 0;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC dynamic_thread_pool_group::cpu_partitioning dynamic_thread_pool_group::partitioning() noexcept
+{
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  auto &impl = detail::global_dynamic_thread_pool();
+  detail::global_dynamic_thread_pool_impl::threadpool_guard g(impl.threadpool_lock);
+  return impl.partitioning;
+#else
+  return cpu_partitioning::none;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<dynamic_thread_pool_group::cpu_partitioning> dynamic_thread_pool_group::partitioning(cpu_partitioning v) noexcept
+{
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+  try
+  {
+    auto domains =
+    detail::global_dynamic_thread_pool_impl_discover_cpu_domains(v, detail::global_dynamic_thread_pool_impl_workqueue_item::TOTAL_CPU_DOMAINS);
+    auto &impl = detail::global_dynamic_thread_pool();
+    detail::global_dynamic_thread_pool_impl::threadpool_guard g(impl.threadpool_lock);
+    impl._set_cpu_domains(g, v, std::move(domains));
+    return v;
+  }
+  catch(...)
+  {
+    return error_from_exception();
+  }
+#else
+  (void) v;
+  return cpu_partitioning::none;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<int> dynamic_thread_pool_group::numa_node_of(const void *addr) noexcept
+{
+#ifdef __linux__
+  int node = -1;
+  // MPOL_F_NODE | MPOL_F_ADDR, see get_mempolicy(2)
+  if(-1 == ::syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, 1 | 2))
+  {
+    return posix_error();
+  }
+  return node;
+#else
+  (void) addr;
+  return errc::operation_not_supported;
+#endif
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC size_t dynamic_thread_pool_group::_default_parallel_for_concurrency() noexcept
+{
+  return utils::effective_cpu_concurrency();
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<dynamic_thread_pool_group::pool_statistics_t> dynamic_thread_pool_group::pool_statistics() noexcept
+{
+  try
+  {
+    pool_statistics_t ret;
+#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
+    auto &impl = detail::global_dynamic_thread_pool();
+    detail::global_dynamic_thread_pool_impl::threadpool_guard g(impl.threadpool_lock);
+    ret.work_items_queued = impl.total_submitted_workitems.load(std::memory_order_relaxed);
+    ret.threads_added = impl.threads_added.load(std::memory_order_relaxed);
+    ret.threads_removed = impl.threads_removed.load(std::memory_order_relaxed);
+    ret.cpu_domains = impl.cpu_domains.size();
+    ret.busy_time = std::chrono::nanoseconds(impl.exited_busy_ns.load(std::memory_order_relaxed));
+    ret.blocked_time = std::chrono::nanoseconds(impl.exited_blocked_ns.load(std::memory_order_relaxed));
+    ret.idle_time = std::chrono::nanoseconds(impl.exited_idle_ns.load(std::memory_order_relaxed));
+    ret.threads.reserve(impl.threadpool_active.count + impl.threadpool_sleeping.count);
+    auto add = [&](detail::global_dynamic_thread_pool_impl::threads_t &list, bool sleeping) {
+      for(auto *t = list.front; t != nullptr; t = t->_next)
+      {
+        thread_statistics ts;
+        ts.thread_id = t->threadid;
+        ts.sleeping = sleeping;
+        ts.busy_time = std::chrono::nanoseconds(t->busy_ns.load(std::memory_order_relaxed));
+        ts.blocked_time = std::chrono::nanoseconds(t->blocked_ns.load(std::memory_order_relaxed));
+        ts.idle_time = std::chrono::nanoseconds(t->idle_ns.load(std::memory_order_relaxed));
+        ret.busy_time += ts.busy_time;
+        ret.blocked_time += ts.blocked_time;
+        ret.idle_time += ts.idle_time;
+        ret.threads.push_back(ts);
+      }
+    };
+    add(impl.threadpool_active, false);
+    add(impl.threadpool_sleeping, true);
+#endif
+    return ret;
+  }
+  catch(...)
+  {
+    return error_from_exception();
+  }
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<void> dynamic_thread_pool_group::trace_events(size_t capacity) noexcept
+{
+  try
+  {
+    auto &impl = detail::global_dynamic_thread_pool();
+    std::lock_guard<std::mutex> g(impl.trace_lock);
+    if(capacity == 0)
+    {
+      impl.trace_ring.store(nullptr, std::memory_order_release);
+      return success();
+    }
+    size_t rounded = 1;
+    while(rounded < capacity)
+    {
+      rounded <<= 1;
+    }
+    impl.trace_rings.push_back(std::make_unique<detail::global_dynamic_thread_pool_impl_trace_ring>(rounded));
+    impl.trace_ring.store(impl.trace_rings.back().get(), std::memory_order_release);
+    return success();
+  }
+  catch(...)
+  {
+    return error_from_exception();
+  }
+}
+
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::vector<dynamic_thread_pool_group::trace_event>> dynamic_thread_pool_group::traced_events() noexcept
+{
+  try
+  {
+    std::vector<trace_event> ret;
+    auto *ring = detail::global_dynamic_thread_pool().trace_ring.load(std::memory_order_acquire);
+    if(ring != nullptr)
+    {
+      ring->read(ret);
+    }
+    return ret;
+  }
+  catch(...)
+  {
+    return error_from_exception();
+  }
 }
 
-LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t dynamic_thread_pool_group::ms_sleep_for_more_work(uint32_t v) noexcept
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::string> dynamic_thread_pool_group::traced_events_as_chrome_json() noexcept
 {
-#if !LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD && !defined(_WIN32)
-  if(0 == v)
+  try
   {
-    v = 1;
+    OUTCOME_TRY(auto &&events, traced_events());
+    std::string ret("{\"traceEvents\":[");
+    // Chrome wants microseconds, we make them relative to the oldest event
+    const auto epoch = events.empty() ? std::chrono::steady_clock::time_point() : events.front().timestamp;
+    char buffer[256];
+    bool first = true;
+    for(auto &event : events)
+    {
+      const char *name = "", *ph = "i";
+      switch(event.kind)
+      {
+      case trace_event_kind::work_item_submitted:
+        name = "submitted";
+        break;
+      case trace_event_kind::work_item_begin:
+        name = "work_item";
+        ph = "B";
+        break;
+      case trace_event_kind::work_item_end:
+        name = "work_item";
+        ph = "E";
+        break;
+      case trace_event_kind::thread_added:
+        name = "thread_added";
+        break;
+      case trace_event_kind::thread_removed:
+        name = "thread_removed";
+        break;
+      case trace_event_kind::thread_sleep:
+        name = "sleep";
+        ph = "B";
+        break;
+      case trace_event_kind::thread_wake:
+        name = "sleep";
+        ph = "E";
+        break;
+      }
+      const double ts = std::chrono::duration_cast<std::chrono::nanoseconds>(event.timestamp - epoch).count() / 1000.0;
+      int written = snprintf(buffer, sizeof(buffer), R"(%s{"name":"%s","cat":"dynamic_thread_pool_group","ph":"%s","ts":%.3f,"pid":0,"tid":%u)", first ? "" : ",",
+                             name, ph, ts, (unsigned) event.thread_id);
+      ret.append(buffer, (size_t) written);
+      if(ph[0] == 'i')
+      {
+        ret.append(R"(,"s":"t")");
+      }
+      if(event.group != nullptr || event.item != nullptr)
+      {
+        written = snprintf(buffer, sizeof(buffer), R"(,"args":{"group":"%p","work_item":"%p"})", (const void *) event.group, (const void *) event.item);
+        ret.append(buffer, (size_t) written);
+      }
+      ret.push_back('}');
+      first = false;
+    }
+    ret.append("]}");
+    return ret;
+  }
+  catch(...)
+  {
+    return error_from_exception();
   }
-  detail::global_dynamic_thread_pool().ms_sleep_for_more_work.store(v, std::memory_order_relaxed);
-  return v;
-#else
-  (void) v;
-  return 0;
-#endif
 }
 
 LLFIO_HEADERS_ONLY_FUNC_SPEC result<dynamic_thread_pool_group_ptr> make_dynamic_thread_pool_group() noexcept
@@ -1465,20 +2729,50 @@ namespace detail
   {
     pthread_setname_np(pthread_self(), "LLFIO DYN TPG");
     self->last_did_work = std::chrono::steady_clock::now();
+    self->threadid = global_dynamic_thread_pool_current_thread_id();
+    self->stats_since = self->last_did_work;
+    self->stats_cputime_since = _thread_cputime_ns();
+    threads_added.fetch_add(1, std::memory_order_relaxed);
+    _trace(dynamic_thread_pool_group::trace_event_kind::thread_added, nullptr, nullptr, self->last_did_work);
     self->state.fetch_add(1, std::memory_order_release);  // busy
-    const unsigned mythreadidx = threadpool_threads.fetch_add(1, std::memory_order_release);
+    threadpool_threads.fetch_add(1, std::memory_order_release);
+    self->dequeidx = _claim_worker_deque();
+    global_dynamic_thread_pool_thread_local_state().dequeidx = self->dequeidx;
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+    self->schedstat_fd = ::open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC);
+    if(self->schedstat_fd < 0)
+    {
+      // Kernels before 3.17 lack /proc/thread-self
+      char path[64];
+      snprintf(path, sizeof(path), "/proc/self/task/%ld/schedstat", (long) syscall(SYS_gettid));
+      self->schedstat_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    }
+#endif
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
-    std::cout << "*** DTP " << self << " begins." << std::endl;
+    std::cout << "*** DTP " << self << " begins with deque " << self->dequeidx << "." << std::endl;
 #endif
     while(self->state.load(std::memory_order_relaxed) > 0)
     {
+      if(self->domain_generation != cpu_domains_generation.load(std::memory_order_relaxed))
+      {
+        _assign_cpu_domain(self);
+      }
+      const global_dynamic_thread_pool_impl_workqueue_item::next_active_context_t next_active_context{
+      self->dequeidx, self->domain, cpu_domains_count.load(std::memory_order_relaxed), worker_deques_highwater.load(std::memory_order_relaxed),
+      worker_deque_domains};
+      const auto epoch = work_epoch.load(std::memory_order_seq_cst);
       dynamic_thread_pool_group::work_item *workitem = nullptr;
-      bool workitem_is_timer = false;
+      bool workitem_is_timer = false, workitem_is_background = false;
       std::chrono::steady_clock::time_point now_steady, earliest_duration;
       std::chrono::system_clock::time_point now_system, earliest_absolute;
       // Start from highest priority work group, executing any timers due before selecting a work item
       {
         auto examine_wq = [&](global_dynamic_thread_pool_impl_workqueue_item &wq) -> dynamic_thread_pool_group::work_item * {
+          /* Of the timers which are due, execute the one which has been due the longest
+          first, irrespective of clock i.e. earliest deadline first. Due timers are
+          executed before any other work at this priority class and nesting level.
+          */
+          std::chrono::nanoseconds relative_overdue(-1), absolute_overdue(-1);
           if(wq.next_timer_relative.count.load(std::memory_order_relaxed) > 0)
           {
             if(now_steady == std::chrono::steady_clock::time_point())
@@ -1490,11 +2784,9 @@ namespace detail
             {
               if(wq.next_timer_relative.front->_timepoint1 <= now_steady)
               {
-                workitem = wq.next_timer<1>();  // unlocks wq.next_timer_relative.lock
-                workitem_is_timer = true;
-                return workitem;
+                relative_overdue = std::chrono::duration_cast<std::chrono::nanoseconds>(now_steady - wq.next_timer_relative.front->_timepoint1);
               }
-              if(earliest_duration == std::chrono::steady_clock::time_point() || wq.next_timer_relative.front->_timepoint1 < earliest_duration)
+              else if(earliest_duration == std::chrono::steady_clock::time_point() || wq.next_timer_relative.front->_timepoint1 < earliest_duration)
               {
                 earliest_duration = wq.next_timer_relative.front->_timepoint1;
               }
@@ -1512,39 +2804,78 @@ namespace detail
             {
               if(wq.next_timer_absolute.front->_timepoint2 <= now_system)
               {
-                workitem = wq.next_timer<2>();  // unlocks wq.next_timer_absolute.lock
-                workitem_is_timer = true;
-                return workitem;
+                absolute_overdue = std::chrono::duration_cast<std::chrono::nanoseconds>(now_system - wq.next_timer_absolute.front->_timepoint2);
               }
-              if(earliest_absolute == std::chrono::system_clock::time_point() || wq.next_timer_absolute.front->_timepoint2 < earliest_absolute)
+              else if(earliest_absolute == std::chrono::system_clock::time_point() || wq.next_timer_absolute.front->_timepoint2 < earliest_absolute)
               {
                 earliest_absolute = wq.next_timer_absolute.front->_timepoint2;
               }
             }
             wq.next_timer_absolute.lock.unlock();
           }
-          unsigned count = 0;
-          return wq.next_active(count, mythreadidx);
+          while(relative_overdue.count() >= 0 || absolute_overdue.count() >= 0)
+          {
+            if(relative_overdue >= absolute_overdue)
+            {
+              wq.next_timer_relative.lock.lock();
+              if(wq.next_timer_relative.front != nullptr && wq.next_timer_relative.front->_timepoint1 <= now_steady)
+              {
+                workitem = wq.next_timer<1>();  // unlocks wq.next_timer_relative.lock
+                workitem_is_timer = true;
+                return workitem;
+              }
+              wq.next_timer_relative.lock.unlock();
+              relative_overdue = std::chrono::nanoseconds(-1);  // another thread took it
+            }
+            else
+            {
+              wq.next_timer_absolute.lock.lock();
+              if(wq.next_timer_absolute.front != nullptr && wq.next_timer_absolute.front->_timepoint2 <= now_system)
+              {
+                workitem = wq.next_timer<2>();  // unlocks wq.next_timer_absolute.lock
+                workitem_is_timer = true;
+                return workitem;
+              }
+              wq.next_timer_absolute.lock.unlock();
+              absolute_overdue = std::chrono::nanoseconds(-1);  // another thread took it
+            }
+          }
+          return wq.next_active(next_active_context);
         };
-        workitem = examine_wq(first_execute);
-        if(workitem == nullptr)
+        workqueue_lock.lock();
+        auto lock_wq = workqueue;  // take shared_ptr to highest priority collection of work groups
+        workqueue_lock.unlock();
+        // Each priority class executes its newly submitted work first, then its work groups highest nesting level first
+        static constexpr dynamic_thread_pool_group::priority_class priority_classes[] = {dynamic_thread_pool_group::priority_class::latency_critical,
+                                                                                         dynamic_thread_pool_group::priority_class::normal,
+                                                                                         dynamic_thread_pool_group::priority_class::background};
+        for(const auto priority : priority_classes)
         {
-          workqueue_lock.lock();
-          auto lock_wq = workqueue;  // take shared_ptr to highest priority collection of work groups
-          workqueue_lock.unlock();
-          while(lock_wq)
+          // Under load, only so many threads may execute background work at a time
+          const bool is_background = (priority == dynamic_thread_pool_group::priority_class::background);
+          const bool throttled =
+          is_background && background_executing.load(std::memory_order_relaxed) >= background_concurrency_limit.load(std::memory_order_relaxed);
+          if(!throttled)
+          {
+            workitem = examine_wq(first_execute[priority]);
+          }
+          while(workitem == nullptr && lock_wq && lock_wq->priority == priority)
           {
-            workitem = examine_wq(*lock_wq);
-            if(workitem != nullptr)
+            if(!throttled)
             {
-              // workqueue_lock.lock();
-              // std::cout << "workitem = " << workitem << " nesting_level = " << wq.nesting_level << " count = " << count << std::endl;
-              // workqueue_lock.unlock();
-              break;
+              workitem = examine_wq(*lock_wq);
+            }
+            if(workitem == nullptr)
+            {
+              workqueue_lock.lock();
+              lock_wq = lock_wq->next;
+              workqueue_lock.unlock();
             }
-            workqueue_lock.lock();
-            lock_wq = lock_wq->next;
-            workqueue_lock.unlock();
+          }
+          if(workitem != nullptr)
+          {
+            workitem_is_background = is_background;
+            break;
           }
         }
       }
@@ -1552,9 +2883,14 @@ namespace detail
       {
         now_steady = std::chrono::steady_clock::now();
       }
-      // If there are no timers, and no work to do, time to either die or sleep
+      // If there are no timers, and no work to do, spin for a while, then time to either die or sleep
       if(workitem == nullptr)
       {
+        if(_spin_for_work(self, epoch))
+        {
+          continue;
+        }
+        now_steady = std::chrono::steady_clock::now();
         const std::chrono::steady_clock::duration max_sleep(std::chrono::milliseconds(ms_sleep_for_more_work.load(std::memory_order_relaxed)));
         if(now_steady - self->last_did_work >= max_sleep)
         {
@@ -1565,6 +2901,8 @@ namespace detail
           {
             _remove_from_list(threadpool_active, self);
             threadpool_threads.fetch_sub(1, std::memory_order_release);
+            _release_worker_resources(self);
+            _thread_exits(self);
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
             std::cout << "*** DTP " << self << " exits due to no new work for ms_sleep_for_more_work" << std::endl;
 #endif
@@ -1594,6 +2932,15 @@ namespace detail
           }
         }
         threadpool_guard g(threadpool_lock);
+        threads_parked.fetch_add(1, std::memory_order_seq_cst);
+        if(work_epoch.load(std::memory_order_seq_cst) != epoch)
+        {
+          // Work was submitted since we last looked, and the submitter may not have seen us parked
+          threads_parked.fetch_sub(1, std::memory_order_relaxed);
+          continue;
+        }
+        _account_busy(self, now_steady);
+        _trace(dynamic_thread_pool_group::trace_event_kind::thread_sleep, nullptr, nullptr, now_steady);
         _remove_from_list(threadpool_active, self);
         _append_to_list(threadpool_sleeping, self);
         self->state.fetch_sub(1, std::memory_order_release);
@@ -1614,13 +2961,22 @@ namespace detail
         self->state.fetch_add(1, std::memory_order_release);
         _remove_from_list(threadpool_sleeping, self);
         _append_to_list(threadpool_active, self);
+        threads_parked.fetch_sub(1, std::memory_order_relaxed);
+        self->wake_pending = false;
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
         std::cout << "*** DTP " << self << " wakes, state = " << self->state << std::endl;
 #endif
         g.unlock();
+        {
+          const auto woke = std::chrono::steady_clock::now();
+          self->idle_ns.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(woke - self->stats_since).count(), std::memory_order_relaxed);
+          self->stats_since = woke;
+          self->stats_cputime_since = _thread_cputime_ns();
+          _trace(dynamic_thread_pool_group::trace_event_kind::thread_wake, nullptr, nullptr, woke);
+        }
         try
         {
-          populate_threadmetrics(now_steady);
+          _update_concurrency(now_steady);
         }
         catch(...)
         {
@@ -1628,10 +2984,26 @@ namespace detail
         continue;
       }
       self->last_did_work = now_steady;
+      if(now_steady - self->stats_since >= std::chrono::milliseconds(100))
+      {
+        _account_busy(self, now_steady);
+      }
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
       std::cout << "*** DTP " << self << " executes work item " << workitem << std::endl;
 #endif
-      total_submitted_workitems.fetch_sub(1, std::memory_order_relaxed);
+      // If more work is queued than we can take, pass the wakeup on to one more worker
+      const auto queued_work_items = total_submitted_workitems.fetch_sub(1, std::memory_order_relaxed) - 1;
+      if(queued_work_items > 0 && threads_spinning.load(std::memory_order_seq_cst) == 0 && threads_parked.load(std::memory_order_seq_cst) > 0)
+      {
+        _wake_one_parked(queued_work_items);
+      }
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      self->busy_since.store(now_steady.time_since_epoch().count(), std::memory_order_release);
+#endif
+      if(workitem_is_background)
+      {
+        background_executing.fetch_add(1, std::memory_order_relaxed);
+      }
       if(workitem_is_timer)
       {
         _timerthread(workitem, nullptr);
@@ -1640,14 +3012,23 @@ namespace detail
       {
         _workerthread(workitem, nullptr);
       }
+      if(workitem_is_background)
+      {
+        background_executing.fetch_sub(1, std::memory_order_relaxed);
+      }
+#if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+      self->busy_since.store(0, std::memory_order_release);
+#endif
       // workitem->_internalworkh should be null, however workitem may also no longer exist
       try
       {
-        if(populate_threadmetrics(now_steady))
+        if(_update_concurrency(now_steady))
         {
+          _release_worker_resources(self);
           threadpool_guard g(threadpool_lock);
           _remove_from_list(threadpool_active, self);
           threadpool_threads.fetch_sub(1, std::memory_order_release);
+          _thread_exits(self);
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
           std::cout << "*** DTP " << self << " exits due to threadmetrics saying we exceed max concurrency" << std::endl;
 #endif
@@ -1660,12 +3041,181 @@ namespace detail
       {
       }
     }
+    _release_worker_resources(self);
+    _thread_exits(self);
     self->state.fetch_sub(2, std::memory_order_release);  // dead
     threadpool_threads.fetch_sub(1, std::memory_order_release);
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_PRINTING
     std::cout << "*** DTP " << self << " exits due to state request, state = " << self->state << std::endl;
 #endif
   }
+
+  inline bool global_dynamic_thread_pool_impl::_spin_for_work(thread_t *self, uint64_t epoch) noexcept
+  {
+    const uint32_t max_spin_ns = us_spin_for_more_work.load(std::memory_order_relaxed) * 1000;
+    if(self->spin_ns > max_spin_ns)
+    {
+      self->spin_ns = max_spin_ns;
+    }
+    if(self->spin_ns == 0)
+    {
+      if(max_spin_ns > 0 && (self->spin_ns = max_spin_ns / 64) == 0)
+      {
+        self->spin_ns = 1;
+      }
+      return false;
+    }
+    // No more than half the CPUs may spin at once
+    const unsigned max_spinning = std::max(1U, utils::effective_cpu_concurrency() / 2);
+    for(auto v = threads_spinning.load(std::memory_order_relaxed);;)
+    {
+      if(v >= max_spinning)
+      {
+        return false;
+      }
+      if(threads_spinning.compare_exchange_weak(v, v + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    const auto end = begin + std::chrono::nanoseconds(self->spin_ns);
+    bool found = false;
+    for(unsigned n = 1; !found; n++)
+    {
+      if(work_epoch.load(std::memory_order_seq_cst) != epoch)
+      {
+        found = true;
+        break;
+      }
+#if defined(__i386__) || defined(__x86_64__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      __asm__ __volatile__("yield");
+#endif
+      if((n & 63) == 0 && std::chrono::steady_clock::now() >= end)
+      {
+        break;
+      }
+    }
+    threads_spinning.fetch_sub(1, std::memory_order_seq_cst);
+    // Adapt: spins which find work double the budget, spins which do not halve it
+    if(found)
+    {
+      self->spin_ns = (self->spin_ns > max_spin_ns / 2) ? max_spin_ns : self->spin_ns * 2;
+    }
+    else
+    {
+      self->spin_ns /= 2;
+    }
+    return found;
+  }
+
+  inline void global_dynamic_thread_pool_impl::_wake_one_parked(size_t active_work_items) noexcept
+  {
+    threadpool_guard g(threadpool_lock);
+    if(threadpool_active.count == 0 && threadpool_sleeping.count == 0)
+    {
+      _add_thread(g);
+    }
+    else if(threadpool_sleeping.count > 0 && active_work_items > threadpool_active.count)
+    {
+      // Wake the most recently slept first, skipping any already being woken
+      for(auto *t = threadpool_sleeping.back; t != nullptr; t = t->_prev)
+      {
+        if(!t->wake_pending)
+        {
+          t->wake_pending = true;
+          t->last_did_work = std::chrono::steady_clock::now();  // prevent reap
+          t->cond.notify_one();
+          break;
+        }
+      }
+    }
+  }
+
+  inline void global_dynamic_thread_pool_impl::_thread_exits(thread_t *self) noexcept
+  {
+    const auto now = std::chrono::steady_clock::now();
+    if(self->state.load(std::memory_order_relaxed) > 0)
+    {
+      _account_busy(self, now);
+    }
+    else
+    {
+      self->idle_ns.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - self->stats_since).count(), std::memory_order_relaxed);
+    }
+    exited_busy_ns.fetch_add(self->busy_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    exited_blocked_ns.fetch_add(self->blocked_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    exited_idle_ns.fetch_add(self->idle_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    threads_removed.fetch_add(1, std::memory_order_relaxed);
+    _trace(dynamic_thread_pool_group::trace_event_kind::thread_removed, nullptr, nullptr, now);
+  }
+
+  inline void global_dynamic_thread_pool_impl::_assign_cpu_domain(thread_t *self) noexcept
+  {
+    threadpool_guard g(threadpool_lock);
+    const auto generation = cpu_domains_generation.load(std::memory_order_acquire);
+    if(self->domain_generation == generation)
+    {
+      return;
+    }
+    // Fewest threads per CPU wins
+    unsigned best = 0;
+    for(unsigned n = 1; n < cpu_domains.size(); n++)
+    {
+      if((int64_t) cpu_domains_threads[n].load(std::memory_order_relaxed) * cpu_domains[best].cpucount <
+         (int64_t) cpu_domains_threads[best].load(std::memory_order_relaxed) * cpu_domains[n].cpucount)
+      {
+        best = n;
+      }
+    }
+    cpu_domains_threads[best].fetch_add(1, std::memory_order_relaxed);
+    self->domain = best;
+    self->domain_generation = generation;
+    if(self->dequeidx < global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES)
+    {
+      worker_deque_domains[self->dequeidx].store(best, std::memory_order_relaxed);
+    }
+    global_dynamic_thread_pool_thread_local_state().cpudomain = best;
+    const bool affinitise = (partitioning != dynamic_thread_pool_group::cpu_partitioning::none);
+    if((affinitise || self->affinitised) && best < cpu_domains.size())
+    {
+      // Failure is harmless, work simply has less locality
+      (void) ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set_t), &cpu_domains[best].cpus);
+      self->affinitised = affinitise;
+    }
+  }
+
+  inline void global_dynamic_thread_pool_impl::_release_worker_resources(thread_t *self) noexcept
+  {
+    if(self->domain_generation == cpu_domains_generation.load(std::memory_order_relaxed))
+    {
+      cpu_domains_threads[self->domain].fetch_sub(1, std::memory_order_relaxed);
+    }
+    self->domain_generation = (unsigned) -1;
+    if(self->dequeidx >= global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES)
+    {
+      return;
+    }
+    // Anything still queued in my deques must be made visible to the remaining workers before I go
+    first_execute.latency_critical.drain_deque(self->dequeidx, self->domain);
+    first_execute.normal.drain_deque(self->dequeidx, self->domain);
+    first_execute.background.drain_deque(self->dequeidx, self->domain);
+    workqueue_lock.lock();
+    auto lock_wq = workqueue;
+    workqueue_lock.unlock();
+    while(lock_wq)
+    {
+      lock_wq->drain_deque(self->dequeidx, self->domain);
+      workqueue_lock.lock();
+      lock_wq = lock_wq->next;
+      workqueue_lock.unlock();
+    }
+    worker_deques_inuse[self->dequeidx / 64].fetch_and(~((uint64_t) 1 << (self->dequeidx % 64)), std::memory_order_release);
+    self->dequeidx = (unsigned) -1;
+    global_dynamic_thread_pool_thread_local_state().dequeidx = (unsigned) -1;
+  }
 #endif
 
   inline void global_dynamic_thread_pool_impl::_submit_work_item(bool submit_into_highest_priority, dynamic_thread_pool_group::work_item *workitem,
@@ -1758,69 +3308,120 @@ namespace detail
         SetThreadpoolTimer((PTP_TIMER) workitem->_internaltimerh, &ft, 0, slop);
 #else
         workqueue_guard gg(workqueue_lock);
-        for(auto *p = workqueue.get(); p != nullptr; p = p->next.get())
+        auto *p = _find_workqueue_item(gg, parent->_nesting_level, parent->_priority.load(std::memory_order_relaxed));
+        if(p != nullptr)
         {
-          if(p->nesting_level == parent->_nesting_level)
-          {
-            p->append_timer(workitem);
-            break;
-          }
+          p->append_timer(workitem);
         }
 #endif
       }
       else
       {
+        workitem->_timepoint_runnable = std::chrono::steady_clock::now();
+        _trace(dynamic_thread_pool_group::trace_event_kind::work_item_submitted, parent, workitem, workitem->_timepoint_runnable);
 #if LLFIO_DYNAMIC_THREAD_POOL_GROUP_USING_GCD
         intptr_t priority = DISPATCH_QUEUE_PRIORITY_LOW;
+        switch(parent->_priority.load(std::memory_order_relaxed))
+        {
+        case dynamic_thread_pool_group::priority_class::background:
+          priority = DISPATCH_QUEUE_PRIORITY_BACKGROUND;
+          break;
+        case dynamic_thread_pool_group::priority_class::latency_critical:
+          priority = DISPATCH_QUEUE_PRIORITY_HIGH;
+          break;
+        default:
         {
           global_dynamic_thread_pool_impl::workqueue_guard gg(workqueue_lock);
-          if(workqueue->nesting_level == parent->_nesting_level)
+          const auto deepest = _deepest_nesting_level(gg);
+          if(deepest == parent->_nesting_level)
           {
             priority = DISPATCH_QUEUE_PRIORITY_HIGH;
           }
-          else if(workqueue->nesting_level == parent->_nesting_level + 1)
+          else if(deepest == parent->_nesting_level + 1)
           {
             priority = DISPATCH_QUEUE_PRIORITY_DEFAULT;
           }
         }
+        }
         // std::cout << "*** submit " << workitem << std::endl;
         dispatch_group_async_f(parent->_grouph, dispatch_get_global_queue(priority, 0), workitem, _gcd_dispatch_callback);
 #elif defined(_WIN32)
         // Set the priority of the group according to distance from the top
         TP_CALLBACK_PRIORITY priority = TP_CALLBACK_PRIORITY_LOW;
+        switch(parent->_priority.load(std::memory_order_relaxed))
+        {
+        case dynamic_thread_pool_group::priority_class::background:
+          break;
+        case dynamic_thread_pool_group::priority_class::latency_critical:
+          priority = TP_CALLBACK_PRIORITY_HIGH;
+          break;
+        default:
         {
           global_dynamic_thread_pool_impl::workqueue_guard gg(workqueue_lock);
-          if(workqueue->nesting_level == parent->_nesting_level)
+          const auto deepest = _deepest_nesting_level(gg);
+          if(deepest == parent->_nesting_level)
           {
             priority = TP_CALLBACK_PRIORITY_HIGH;
           }
-          else if(workqueue->nesting_level == parent->_nesting_level + 1)
+          else if(deepest == parent->_nesting_level + 1)
           {
             priority = TP_CALLBACK_PRIORITY_NORMAL;
           }
         }
+        }
         SetThreadpoolCallbackPriority(parent->_grouph, priority);
         // std::cout << "*** submit " << workitem << std::endl;
         SubmitThreadpoolWork((PTP_WORK) workitem->_internalworkh);
 #else
+        /* If the calling thread is a pool worker, this goes onto its own deque, else the
+        injection queue of the CPU domain of the calling thread. Unless, that is, the work
+        item has a locality hint for a NUMA node elsewhere, in which case it goes onto the
+        injection queue of a CPU domain on that node.
+        */
+        auto &tls = global_dynamic_thread_pool_thread_local_state();
+        unsigned dequeidx = tls.dequeidx, domain = 0;
+        const auto domains = cpu_domains_count.load(std::memory_order_relaxed);
+        if(domains > 1)
+        {
+          if(dequeidx < global_dynamic_thread_pool_impl_workqueue_item::TOTAL_WORKER_DEQUES)
+          {
+            domain = tls.cpudomain;
+          }
+          else
+          {
+            const int cpu = ::sched_getcpu();
+            if(cpu >= 0 && cpu < CPU_SETSIZE)
+            {
+              domain = cpu_to_domain[cpu].load(std::memory_order_relaxed);
+            }
+          }
+          const int hint = workitem->_locality_hint;
+          if(hint >= 0 && cpu_domains_numa_node[domain].load(std::memory_order_relaxed) != hint)
+          {
+            for(unsigned n = 0; n < domains; n++)
+            {
+              if(cpu_domains_numa_node[n].load(std::memory_order_relaxed) == hint)
+              {
+                domain = n;
+                dequeidx = (unsigned) -1;
+                break;
+              }
+            }
+          }
+        }
         global_dynamic_thread_pool_impl::workqueue_guard gg(workqueue_lock);
         if(submit_into_highest_priority)
         {
-          // TODO: It would be super nice if we prepended this instead if it came from a timer
-          first_execute.append_active(workitem);
+          first_execute[parent->_priority.load(std::memory_order_relaxed)].append_active(workitem, dequeidx, domain);
           // std::cout << "append_active _nesting_level = " << parent->_nesting_level << std::endl;
         }
         else
         {
-          for(auto *p = workqueue.get(); p != nullptr; p = p->next.get())
+          auto *p = _find_workqueue_item(gg, parent->_nesting_level, parent->_priority.load(std::memory_order_relaxed));
+          if(p != nullptr)
           {
-            if(p->nesting_level == parent->_nesting_level)
-            {
-              // TODO: It would be super nice if we prepended this instead if it came from a timer
-              p->append_active(workitem);
-              // std::cout << "append_active _nesting_level = " << parent->_nesting_level << std::endl;
-              break;
-            }
+            p->append_active(workitem, dequeidx, domain);
+            // std::cout << "append_active _nesting_level = " << parent->_nesting_level << std::endl;
           }
         }
 #endif
@@ -1831,27 +3432,12 @@ namespace detail
       std::cout << "*** DTP submits work item " << workitem << std::endl;
 #endif
       const auto active_work_items = total_submitted_workitems.fetch_add(1, std::memory_order_relaxed) + 1;
-      if(!defer_pool_wake)
+      work_epoch.fetch_add(1, std::memory_order_seq_cst);
+      // A spinning worker will see the new epoch, otherwise wake exactly one parked worker
+      if(!defer_pool_wake && threads_spinning.load(std::memory_order_seq_cst) == 0 &&
+         (threads_parked.load(std::memory_order_seq_cst) > 0 || threadpool_threads.load(std::memory_order_acquire) == 0))
       {
-        {
-          threadpool_guard gg(threadpool_lock);
-          if(threadpool_active.count == 0 && threadpool_sleeping.count == 0)
-          {
-            _add_thread(gg);
-          }
-          else if(threadpool_sleeping.count > 0 && active_work_items > threadpool_active.count)
-          {
-            // Try to wake the most recently slept first
-            auto *t = threadpool_sleeping.back;
-            auto now = std::chrono::steady_clock::now();
-            for(size_t n = std::min(active_work_items - threadpool_active.count, threadpool_sleeping.count); n > 0; n--)
-            {
-              t->last_did_work = now;  // prevent reap
-              t->cond.notify_one();
-              t = t->_prev;
-            }
-          }
-        }
+        _wake_one_parked(active_work_items);
       }
 #endif
     }
@@ -1961,6 +3547,13 @@ namespace detail
       }
     }
 #endif
+    if(i->_release_when_done && i->_nextwork.load(std::memory_order_relaxed) == -1 && i->_internalworkh == nullptr && i->_internaltimerh == nullptr)
+    {
+      // It has no more work, so complete it now rather than when the whole group does
+      _remove_from_list(parent->_work_items_done, i);
+      i->_parent.store(nullptr, std::memory_order_release);
+      i->group_complete(parent->_abnormal_completion_cause);
+    }
     if(parent->_work_items_active.count == 0)
     {
       i = nullptr;
@@ -2027,6 +3620,23 @@ namespace detail
           }
         }
       }
+      if(parent->_work_items_active.count == 0 && parent->_stopped_waiters != nullptr)
+      {
+        /* Notify anything awaiting this group stopping, but not with the group locked.
+        A notified waiter may resume a coroutine which destroys the group, so the group
+        is neither touched nor relocked after unlocking, and `g` is returned unlocked.
+        */
+        auto *w = parent->_stopped_waiters;
+        parent->_stopped_waiters = nullptr;
+        const auto cause = parent->_abnormal_completion_cause;
+        g.unlock();
+        while(w != nullptr)
+        {
+          auto *n = w->_next;
+          w->_stopped(cause);
+          w = n;
+        }
+      }
     }
   }
 
@@ -2147,6 +3757,10 @@ namespace detail
           {
             // This item got cancelled before it started
             _work_item_done(g, group->_work_items_active.front);
+            if(!g.owns_lock())
+            {
+              g.lock();
+            }
           }
         }
         assert(!group->_stopping.load(std::memory_order_relaxed));
@@ -2323,8 +3937,13 @@ namespace detail
     tls.workitem = workitem;
     tls.current_callback_instance = selfthreadh;
     tls.nesting_level = parent->_nesting_level + 1;
+    const auto began = std::chrono::steady_clock::now();
+    _trace(dynamic_thread_pool_group::trace_event_kind::work_item_begin, parent, workitem, began);
     auto r = (*workitem)(workitem->_nextwork.load(std::memory_order_acquire));
     workitem->_nextwork.store(0, std::memory_order_release);  // call next() next time
+    const auto ended = std::chrono::steady_clock::now();
+    _trace(dynamic_thread_pool_group::trace_event_kind::work_item_end, parent, workitem, ended);
+    parent->_record_execution(began - workitem->_timepoint_runnable, ended - began);
     tls = old_thread_local_state;
     // std::cout << "*** _workerthread " << workitem << " ends with work " << workitem->_nextwork << std::endl;
     if(!r)
@@ -2395,22 +4014,22 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC dynamic_thread_pool_group::io_aware_work_item::i
           throw std::runtime_error("Supplied handle is not seekable");
         }
         auto *fh = static_cast<file_handle *>(h.h);
-        auto unique_id = fh->unique_id();
-        auto it = impl.io_aware_work_item_handles.find(unique_id);
+        auto device_id = (uint64_t) fh->st_dev();
+        auto it = impl.io_aware_work_item_handles.find(device_id);
         if(it == impl.io_aware_work_item_handles.end())
         {
-          it = impl.io_aware_work_item_handles.emplace(unique_id, detail::global_dynamic_thread_pool_impl::io_aware_work_item_statfs{}).first;
-          auto r = it->second.statfs.fill(*fh, statfs_t::want::iosinprogress | statfs_t::want::iosbusytime);
-          if(!r || it->second.statfs.f_iosinprogress == (uint32_t) -1)
+          it = impl.io_aware_work_item_handles.emplace(device_id, detail::global_dynamic_thread_pool_impl::io_aware_work_item_device{}).first;
+          auto r = it->second.statfs.fill(*fh, statfs_t::want::iosinprogress | statfs_t::want::ioslatency);
+          if(!r || it->second.statfs.f_iosinprogress == (uint32_t) -1 || std::isnan(it->second.statfs.f_ioslatency))
           {
             impl.io_aware_work_item_handles.erase(it);
             if(!r)
             {
               r.value();
             }
-            throw std::runtime_error("statfs::f_iosinprogress unavailable for supplied handle");
+            throw std::runtime_error("statfs::f_ioslatency unavailable for supplied handle");
           }
-          it->second.last_updated = std::chrono::steady_clock::now();
+          it->second.last_updated = it->second.min_latency_updated = std::chrono::steady_clock::now();
         }
         it->second.refcount++;
         h._internal = &*it;
@@ -2419,6 +4038,26 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC dynamic_thread_pool_group::io_aware_work_item::i
     }(hs))
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  // Scale the queuing latency thresholds to the slowest profiled device's unqueued latency
+  std::chrono::nanoseconds unqueued(0);
+  for(auto &h : _handles)
+  {
+    // Only files have storage profiles
+    if(!h.h->is_regular())
+    {
+      continue;
+    }
+    auto params = storage_profile::recommended_parameters(*static_cast<file_handle *>(h.h));
+    if(params && params.value().unqueued_read_latency != 0)
+    {
+      unqueued = std::max(unqueued, std::chrono::nanoseconds(params.value().unqueued_read_latency));
+    }
+  }
+  if(unqueued.count() > 0)
+  {
+    min_queuing_latency = std::max(std::chrono::microseconds(1), std::chrono::duration_cast<std::chrono::microseconds>(5 * unqueued));
+    max_queuing_latency = 4 * min_queuing_latency;
+  }
 }
 
 LLFIO_HEADERS_ONLY_MEMFUNC_SPEC dynamic_thread_pool_group::io_aware_work_item::~io_aware_work_item()
@@ -2448,57 +4087,89 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC intptr_t dynamic_thread_pool_group::io_aware_wor
     for(auto &h : _handles)
     {
       auto *i = (value_type *) h._internal;
-      if(std::chrono::duration_cast<std::chrono::milliseconds>(now - i->second.last_updated) >= std::chrono::milliseconds(100))
+      auto &dev = i->second;
+      if(std::chrono::duration_cast<std::chrono::milliseconds>(now - dev.last_updated) >= std::chrono::milliseconds(100))
       {
-        // auto old_iosinprogress = i->second.statfs.f_iosinprogress;
-        auto elapsed = now - i->second.last_updated;
-        (void) i->second.statfs.fill(*h.h, statfs_t::want::iosinprogress | statfs_t::want::iosbusytime);
-        i->second.last_updated = now;
-
-        if(elapsed > std::chrono::seconds(5))
-        {
-          i->second.average_busy = i->second.statfs.f_iosbusytime;
-          i->second.average_queuedepth = (float) i->second.statfs.f_iosinprogress;
-        }
-        else
-        {
-          i->second.average_busy = (i->second.average_busy * 0.9f) + (i->second.statfs.f_iosbusytime * 0.1f);
-          i->second.average_queuedepth = (i->second.average_queuedepth * 0.9f) + (i->second.statfs.f_iosinprogress * 0.1f);
-        }
-        if(i->second.average_busy < this->max_iosbusytime && i->second.average_queuedepth < this->min_iosinprogress)
+        auto elapsed = now - dev.last_updated;
+        (void) dev.statfs.fill(*h.h, statfs_t::want::iosinprogress | statfs_t::want::ioslatency);
+        dev.last_updated = now;
+        const float latency = dev.statfs.f_ioslatency;
+        if(latency == 0.0f && dev.statfs.f_iosinprogress == 0)
         {
-          i->second.default_deadline = std::chrono::seconds(0);  // remove pacing
+          dev.default_deadline = std::chrono::seconds(0);  // device is idle, remove pacing
+          dev.probing_min_latency = false;
         }
-        else if(i->second.average_queuedepth > this->max_iosinprogress)
+        else if(latency > 0.0f)
         {
-          if(0 == i->second.default_deadline.nsecs)
+          if(elapsed > std::chrono::seconds(5) || dev.smoothed_latency == 0.0f)
           {
-            i->second.default_deadline = std::chrono::milliseconds(1);  // start with 1ms, it'll reduce from there if needed
+            dev.smoothed_latency = latency;
           }
-          else if((i->second.default_deadline.nsecs >> 4) > 0)
+          else
           {
-            i->second.default_deadline.nsecs += i->second.default_deadline.nsecs >> 4;
+            dev.smoothed_latency = (dev.smoothed_latency * 0.875f) + (latency * 0.125f);
           }
-          else
+          /* As with BBR, the minimum latency is the device's service time without any
+          queuing. It expires after ten seconds as the device may have changed, in which
+          case we double pacing for one sampling interval to drain the queue, and take
+          whatever latency that yields as the new baseline.
+          */
+          if(dev.min_latency == 0.0f || latency < dev.min_latency || dev.probing_min_latency)
           {
-            i->second.default_deadline.nsecs++;
+            dev.min_latency = latency;
+            dev.min_latency_updated = now;
+            dev.probing_min_latency = false;
           }
-        }
-        else if(i->second.average_queuedepth < this->min_iosinprogress)
-        {
-          if(i->second.default_deadline.nsecs > (i->second.default_deadline.nsecs >> 4) && (i->second.default_deadline.nsecs >> 4) > 0)
+          else if(now - dev.min_latency_updated > std::chrono::seconds(10))
           {
-            i->second.default_deadline.nsecs -= i->second.default_deadline.nsecs >> 4;
+            dev.probing_min_latency = true;
           }
-          else if(i->second.default_deadline.nsecs > 1)
+          /* As with Vegas, the difference between smoothed and minimum latency is the time
+          i/o spends queued. Above `max_queuing_latency`, increase the pacing by 1/16th, or by
+          1/4 if we are far above. Below `min_queuing_latency`, decrease the pacing by 1/16th.
+          In between, hold steady.
+          */
+          const auto queuing = std::chrono::duration<float>(dev.smoothed_latency - dev.min_latency);
+          if(queuing > this->max_queuing_latency)
           {
-            i->second.default_deadline.nsecs--;
+            if(0 == dev.default_deadline.nsecs)
+            {
+              dev.default_deadline = std::chrono::milliseconds(1);  // start with 1ms, it'll reduce from there if needed
+            }
+            else if(queuing > 4 * this->max_queuing_latency && (dev.default_deadline.nsecs >> 2) > 0)
+            {
+              dev.default_deadline.nsecs += dev.default_deadline.nsecs >> 2;
+            }
+            else if((dev.default_deadline.nsecs >> 4) > 0)
+            {
+              dev.default_deadline.nsecs += dev.default_deadline.nsecs >> 4;
+            }
+            else
+            {
+              dev.default_deadline.nsecs++;
+            }
+          }
+          else if(queuing < this->min_queuing_latency)
+          {
+            if(dev.default_deadline.nsecs < 1000)
+            {
+              dev.default_deadline = std::chrono::seconds(0);  // remove pacing
+            }
+            else
+            {
+              dev.default_deadline.nsecs -= dev.default_deadline.nsecs >> 4;
+            }
           }
         }
       }
-      if(d.nsecs < i->second.default_deadline.nsecs)
+      deadline dd(dev.default_deadline);
+      if(dev.probing_min_latency && dd.nsecs > 0)
+      {
+        dd.nsecs <<= 1;
+      }
+      if(d.nsecs < dd.nsecs)
       {
-        d = i->second.default_deadline;
+        d = dd;
       }
     }
   }
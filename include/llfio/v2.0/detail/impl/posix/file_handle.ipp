@@ -47,6 +47,7 @@ result<file_handle> file_handle::file(const path_handle &base, file_handle::path
   result<file_handle> ret(file_handle(native_handle_type(), 0, 0, _caching, flags, nullptr));
   native_handle_type &nativeh = ret.value()._v;
   LLFIO_LOG_FUNCTION_CALL(&ret);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   nativeh.behaviour |= native_handle_type::disposition::file;
   OUTCOME_TRY(auto &&attribs, attribs_from_handle_mode_caching_and_flags(nativeh, _mode, _creation, _caching, flags));
   attribs &= ~O_NONBLOCK;
@@ -110,6 +111,7 @@ result<file_handle> file_handle::file(const path_handle &base, file_handle::path
   {
     fsync(nativeh.fd);
   }
+  LLFIO_LOG_IO_TRACE(open, ret.value(), 0, 0);
   return ret;
 }
 
@@ -434,7 +436,7 @@ result<std::vector<file_handle::extent_pair>> file_handle::extents() const noexc
 }
 
 result<file_handle::extent_pair> file_handle::clone_extents_to(file_handle::extent_pair extent, io_handle &dest_, io_handle::extent_type destoffset, deadline d,
-                                                               bool force_copy_now, bool emulate_if_unsupported) noexcept
+                                                               bool force_copy_now, bool emulate_if_unsupported, size_t _blocksize) noexcept
 {
   try
   {
@@ -470,7 +472,7 @@ result<file_handle::extent_pair> file_handle::clone_extents_to(file_handle::exte
       extent.length = mycurrentlength - extent.offset;
     }
     LLFIO_POSIX_DEADLINE_TO_SLEEP_INIT(d);
-    const extent_type blocksize = utils::file_buffer_default_size();
+    const extent_type blocksize = (_blocksize != 0) ? utils::round_up_to_page_size(static_cast<extent_type>(_blocksize), utils::page_size()) : utils::file_buffer_default_size();
     byte *buffer = nullptr;
     auto unbufferh = make_scope_exit([&]() noexcept {
       if(buffer != nullptr)
@@ -38,6 +38,8 @@ LLFIO_V2_NAMESPACE_BEGIN
 
 result<void> fs_handle::_fetch_inode() const noexcept
 {
+  // An implementation detail, not an operation of the program being traced
+  LLFIO_LOG_IO_TRACE_SUPPRESS();
   stat_t s(nullptr);
   OUTCOME_TRYV(s.fill(_get_handle(), stat_t::want::dev | stat_t::want::ino));
   _devid = s.st_dev;
@@ -355,6 +357,7 @@ result<void> fs_handle::link(const path_handle &base, path_view_type path, deadl
 result<void> fs_handle::unlink(deadline d) noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   auto &h = _get_handle();
   // Open our containing directory
   filesystem::path filename;
@@ -367,6 +370,7 @@ result<void> fs_handle::unlink(deadline d) noexcept
   {
     return posix_error();
   }
+  LLFIO_LOG_IO_TRACE(unlink, h, 0, 0);
   return success();
 }
 
@@ -132,6 +132,7 @@ result<handle::path_type> handle::current_path() const noexcept
 result<void> handle::close() noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(_v)
   {
 #ifndef NDEBUG
@@ -153,6 +154,7 @@ result<void> handle::close() noexcept
     {
       return posix_error();
     }
+    LLFIO_LOG_IO_TRACE(close, *this, 0, 0);
     _v = native_handle_type();
   }
   return success();
@@ -69,6 +69,7 @@ size_t io_handle::_do_max_buffers() const noexcept
 io_handle::io_result<io_handle::buffers_type> io_handle::_do_read(io_handle::io_request<io_handle::buffers_type> reqs, deadline d) noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(d && !_v.is_nonblocking())
   {
     return errc::not_supported;
@@ -145,6 +146,7 @@ io_handle::io_result<io_handle::buffers_type> io_handle::_do_read(io_handle::io_
       }
     } while(bytesread <= 0);
   }
+  LLFIO_LOG_IO_TRACE(read, *this, reqs.offset, bytesread);
   for(size_t i = 0; i < reqs.buffers.size(); i++)
   {
     auto &buffer = reqs.buffers[i];
@@ -165,6 +167,7 @@ io_handle::io_result<io_handle::buffers_type> io_handle::_do_read(io_handle::io_
 io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_write(io_handle::io_request<io_handle::const_buffers_type> reqs, deadline d) noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(d && !_v.is_nonblocking())
   {
     return errc::not_supported;
@@ -247,6 +250,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_write(io_hand
       }
     } while(byteswritten <= 0);
   }
+  LLFIO_LOG_IO_TRACE(write, *this, reqs.offset, byteswritten);
   for(size_t i = 0; i < reqs.buffers.size(); i++)
   {
     auto &buffer = reqs.buffers[i];
@@ -268,6 +272,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
 {
   (void) kind;
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(is_pipe() || is_socket())
   {
     return success();  // nothing was flushed
@@ -293,6 +298,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
     }
     if(-1 != ::sync_file_range(_v.fd, offset, bytes, flags))
     {
+      LLFIO_LOG_IO_TRACE(barrier_data, *this, reqs.offset, bytes);
       return {reqs.buffers};
     }
   }
@@ -304,6 +310,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
     {
       return posix_error();
     }
+    LLFIO_LOG_IO_TRACE(barrier_data, *this, reqs.offset, detail::io_trace_bytes(reqs.buffers));
     return {reqs.buffers};
   }
 #endif
@@ -313,6 +320,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
     // OS X fsync doesn't wait for the device to flush its buffers
     if(-1 == ::fsync(_v.fd))
       return posix_error();
+    LLFIO_LOG_IO_TRACE(barrier_data, *this, reqs.offset, detail::io_trace_bytes(reqs.buffers));
     return {std::move(reqs.buffers)};
   }
   // This is the fsync as on every other OS
@@ -324,6 +332,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
     return posix_error();
   }
 #endif
+  LLFIO_LOG_IO_TRACE(barrier_all, *this, reqs.offset, detail::io_trace_bytes(reqs.buffers));
   return {reqs.buffers};
 }
 
@@ -89,6 +89,7 @@ inline struct timespec from_timepoint(std::chrono::system_clock::time_point time
 LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> stat_t::fill(const handle &h, stat_t::want wanted) noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(&h);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   size_t ret = 0;
 #ifdef __linux__
   {
@@ -310,6 +311,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> stat_t::fill(const handle &h, sta
         st_compressed = static_cast<unsigned int>(s.stx_attributes & 0x0004 /*STATX_ATTR_COMPRESSED*/);
         ++ret;
       }
+      LLFIO_LOG_IO_TRACE(stat, h, 0, 0);
       return ret;
     }
     // std::cerr << "statx failed with " << strerror(errno) << std::endl;
@@ -473,6 +475,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> stat_t::fill(const handle &h, sta
       st_sparse = static_cast<unsigned int>((static_cast<handle::extent_type>(s.st_blocks) * 512) < static_cast<handle::extent_type>(s.st_size));
       ++ret;
     }
+    LLFIO_LOG_IO_TRACE(stat, h, 0, 0);
     return ret;
   }
 }
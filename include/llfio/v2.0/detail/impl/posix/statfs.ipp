@@ -319,17 +319,22 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> statfs_t::fill(const handle &h, s
     ++ret;
   }
 #endif
-  if(!!(wanted & want::iosinprogress) || !!(wanted & want::iosbusytime))
+  if(!!(wanted & want::iosinprogress) || !!(wanted & want::iosbusytime) || !!(wanted & want::ioslatency))
   {
     OUTCOME_TRY(auto &&ios, _fill_ios(h, f_mntfromname));
     if(!!(wanted & want::iosinprogress))
     {
-      f_iosinprogress = ios.first;
+      f_iosinprogress = ios.iosinprogress;
       ++ret;
     }
     if(!!(wanted & want::iosbusytime))
     {
-      f_iosbusytime = ios.second;
+      f_iosbusytime = ios.iosbusytime;
+      ++ret;
+    }
+    if(!!(wanted & want::ioslatency))
+    {
+      f_ioslatency = ios.ioslatency;
       ++ret;
     }
   }
@@ -338,7 +343,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> statfs_t::fill(const handle &h, s
 
 /******************************************* statfs_t ************************************************/
 
-LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fill_ios(const handle &h, const std::string & /*unused*/) noexcept
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<statfs_t::_ios_t> statfs_t::_fill_ios(const handle &h, const std::string & /*unused*/) noexcept
 {
   (void) h;
   try
@@ -365,10 +370,12 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
       {
         dev_t st_dev;
         size_t millis{0};
+        size_t ios{0}, ios_millis{0};
         std::chrono::steady_clock::time_point last_updated;
 
         uint32_t f_iosinprogress{0};
         float f_iosbusytime{0};
+        float f_ioslatency{0};
       };
       std::mutex lock;
       std::vector<item> items;
@@ -382,7 +389,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
         {
           if(std::chrono::duration_cast<std::chrono::milliseconds>(now - i.last_updated) < std::chrono::milliseconds(100))
           {
-            return {i.f_iosinprogress, i.f_iosbusytime};  // exit with old readings
+            return _ios_t{i.f_iosinprogress, i.f_iosbusytime, i.f_ioslatency};  // exit with old readings
           }
           break;
         }
@@ -421,8 +428,14 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
         /* Format is (https://www.kernel.org/doc/Documentation/iostats.txt):
         <dev id major> <dev id minor> <device name> 01 02 03 04 05 06 07 08 09 10  ...
 
+        Field 1 is reads completed, field 4 is milliseconds spent reading (cumulative).
+        Field 5 is writes completed, field 8 is milliseconds spent writing (cumulative).
         Field 9 is i/o's currently in progress.
         Field 10 is milliseconds spent doing i/o (cumulative).
+
+        Fields 4 and 8 sum the time from submission to completion of every
+        i/o, so their delta divided by the delta of fields 1 and 5 is the mean
+        completion latency of the i/o completed since the last reading.
         */
         auto match_line = [&](string_view sv) {
           int major = 0, minor = 0;
@@ -438,7 +451,9 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
             int major = 0, minor = 0;
             char devicename[64];
             size_t fields[12];
-            sscanf(sv.data(), "%d %d %s %*u %*u %*u %*u %*u %*u %*u %*u %zu %zu", &major, &minor, devicename, fields + 8, fields + 9);
+            sscanf(sv.data(), "%d %d %s %zu %*u %*u %zu %zu %*u %*u %zu %zu %zu", &major, &minor, devicename, fields + 0, fields + 3, fields + 4, fields + 7,
+                   fields + 8, fields + 9);
+            const size_t ios = fields[0] + fields[4], ios_millis = fields[3] + fields[7];
             std::lock_guard<std::mutex> g(last_reading.lock);
             auto it = last_reading.items.begin();
             for(; it != last_reading.items.end(); ++it)
@@ -454,16 +469,21 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
               it = --last_reading.items.end();
               it->st_dev = s.st_dev;
               it->millis = fields[9];
+              it->ios = ios;
+              it->ios_millis = ios_millis;
             }
             else
             {
               auto timediff = std::chrono::duration_cast<std::chrono::milliseconds>(now - it->last_updated);
               it->f_iosbusytime = std::min((float) ((double) (fields[9] - it->millis) / timediff.count()), 1.0f);
+              it->f_ioslatency = (ios > it->ios) ? (float) ((double) (ios_millis - it->ios_millis) / (1000.0 * (ios - it->ios))) : 0.0f;
               it->millis = fields[9];
+              it->ios = ios;
+              it->ios_millis = ios_millis;
             }
             it->f_iosinprogress = (uint32_t) fields[8];
             it->last_updated = now;
-            return {it->f_iosinprogress, it->f_iosbusytime};
+            return _ios_t{it->f_iosinprogress, it->f_iosbusytime, it->f_ioslatency};
           }
         }
         // It's totally possible that the dev_t reported by stat()
@@ -483,7 +503,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
     On Mac OS, getting the current i/o wait time appears to be privileged only?
     */
 #endif
-    return {-1, detail::constexpr_float_allbits_set_nan()};
+    return _ios_t{(uint32_t) -1, detail::constexpr_float_allbits_set_nan(), detail::constexpr_float_allbits_set_nan()};
   }
   catch(...)
   {
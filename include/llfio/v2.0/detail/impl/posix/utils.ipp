@@ -24,11 +24,17 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "../../../utils.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <mutex>  // for lock_guard
+#include <string>
+#include <thread>
 
 #include <sys/mman.h>
 
 #ifdef __linux__
+#include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>  // for preadv
 #endif
 #ifdef __APPLE__
@@ -208,6 +214,185 @@ namespace utils
     return false;
   }
 
+  namespace detail
+  {
+#ifdef __linux__
+    inline ssize_t read_small_file(char *buffer, size_t length, const char *path) noexcept
+    {
+      int h = ::open(path, O_RDONLY | O_CLOEXEC);
+      if(h == -1)
+      {
+        return -1;
+      }
+      auto bytes = ::read(h, buffer, length - 1);
+      ::close(h);
+      if(bytes < 0)
+      {
+        return -1;
+      }
+      buffer[bytes] = 0;
+      return bytes;
+    }
+    // Counts the CPUs in a list like "0-3,8-11"
+    inline unsigned count_cpulist(const char *p) noexcept
+    {
+      unsigned ret = 0;
+      while(*p >= '0' && *p <= '9')
+      {
+        char *e = nullptr;
+        unsigned long first = strtoul(p, &e, 10), last = first;
+        if(*e == '-')
+        {
+          last = strtoul(e + 1, &e, 10);
+        }
+        if(last >= first)
+        {
+          ret += (unsigned) (last - first + 1);
+        }
+        p = (*e == ',') ? e + 1 : e;
+      }
+      return ret;
+    }
+    // Returns the CPU budget imposed by the cgroup at `cgroupdir` and all its ancestors, or zero if unlimited
+    inline unsigned cgroup_cpu_limit(std::string cgroupdir, bool v2) noexcept
+    {
+      unsigned ret = 0;
+      char buffer[4096];
+      const size_t rootlen = v2 ? strlen("/sys/fs/cgroup") : cgroupdir.find('/', strlen("/sys/fs/cgroup/"));
+      if(rootlen == std::string::npos)
+      {
+        return 0;
+      }
+      for(bool leaf = true;; leaf = false)
+      {
+        unsigned limit = 0;
+        if(v2)
+        {
+          // "max 100000" or "<quota> <period>"
+          if(read_small_file(buffer, sizeof(buffer), (cgroupdir + "/cpu.max").c_str()) > 0 && buffer[0] != 'm')
+          {
+            char *e = nullptr;
+            const auto quota = strtoull(buffer, &e, 10), period = strtoull(e, nullptr, 10);
+            if(quota > 0 && period > 0)
+            {
+              limit = (unsigned) ((quota + period - 1) / period);
+            }
+          }
+          if(leaf && read_small_file(buffer, sizeof(buffer), (cgroupdir + "/cpuset.cpus.effective").c_str()) > 0)
+          {
+            const auto cpus = count_cpulist(buffer);
+            if(cpus > 0 && (limit == 0 || cpus < limit))
+            {
+              limit = cpus;
+            }
+          }
+        }
+        else
+        {
+          if(read_small_file(buffer, sizeof(buffer), (cgroupdir + "/cpu.cfs_quota_us").c_str()) > 0)
+          {
+            const auto quota = strtoll(buffer, nullptr, 10);
+            if(quota > 0 && read_small_file(buffer, sizeof(buffer), (cgroupdir + "/cpu.cfs_period_us").c_str()) > 0)
+            {
+              const auto period = strtoll(buffer, nullptr, 10);
+              if(period > 0)
+              {
+                limit = (unsigned) ((quota + period - 1) / period);
+              }
+            }
+          }
+        }
+        if(limit > 0 && (ret == 0 || limit < ret))
+        {
+          ret = limit;
+        }
+        if(cgroupdir.size() <= rootlen)
+        {
+          break;
+        }
+        cgroupdir.resize(cgroupdir.rfind('/'));
+      }
+      return ret;
+    }
+    inline unsigned calculate_effective_cpu_concurrency() noexcept
+    {
+      unsigned ret = std::thread::hardware_concurrency();
+      cpu_set_t affinity;
+      CPU_ZERO(&affinity);
+      if(-1 != ::sched_getaffinity(0, sizeof(affinity), &affinity))
+      {
+        const auto cpus = (unsigned) CPU_COUNT(&affinity);
+        if(cpus > 0 && (ret == 0 || cpus < ret))
+        {
+          ret = cpus;
+        }
+      }
+      try
+      {
+        char buffer[4096];
+        if(read_small_file(buffer, sizeof(buffer), "/proc/self/cgroup") > 0)
+        {
+          // Lines are "hierarchy-ID:controller-list:cgroup-path"
+          for(char *line = buffer; line != nullptr && *line != 0;)
+          {
+            char *eol = strchr(line, '\n');
+            if(eol != nullptr)
+            {
+              *eol = 0;
+            }
+            char *colon1 = strchr(line, ':'), *colon2 = (colon1 != nullptr) ? strchr(colon1 + 1, ':') : nullptr;
+            if(colon2 != nullptr)
+            {
+              const std::string controllers(colon1 + 1, colon2), cgroup(colon2 + 1);
+              unsigned limit = 0;
+              if(controllers.empty())
+              {
+                limit = cgroup_cpu_limit("/sys/fs/cgroup" + ((cgroup == "/") ? std::string() : cgroup), true);
+              }
+              else if(controllers == "cpu,cpuacct" || controllers == "cpuacct,cpu" || controllers == "cpu")
+              {
+                limit = cgroup_cpu_limit("/sys/fs/cgroup/" + controllers + ((cgroup == "/") ? std::string() : cgroup), false);
+              }
+              if(limit > 0 && (ret == 0 || limit < ret))
+              {
+                ret = limit;
+              }
+            }
+            line = (eol != nullptr) ? eol + 1 : nullptr;
+          }
+        }
+      }
+      catch(...)
+      {
+      }
+      return std::max(ret, 1U);
+    }
+#endif
+  }  // namespace detail
+
+  unsigned effective_cpu_concurrency() noexcept
+  {
+#ifdef __linux__
+    static std::atomic<unsigned> cached{0};
+    static std::atomic<std::chrono::steady_clock::rep> last_calculated{0};
+    const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto last = last_calculated.load(std::memory_order_relaxed);
+    auto ret = cached.load(std::memory_order_acquire);
+    if(ret == 0 || now - last >= std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)).count())
+    {
+      // Only one thread recalculates, the others use the previous value if there is one
+      if(last_calculated.compare_exchange_strong(last, now, std::memory_order_relaxed) || ret == 0)
+      {
+        ret = detail::calculate_effective_cpu_concurrency();
+        cached.store(ret, std::memory_order_release);
+      }
+    }
+    return ret;
+#else
+    return std::max(std::thread::hardware_concurrency(), 1U);
+#endif
+  }
+
   result<process_memory_usage> current_process_memory_usage() noexcept
   {
 #ifdef __linux__
@@ -0,0 +1,381 @@
+/* A persisted cache of storage profiles and the i/o parameters they recommend
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#include "../../storage_profile_cache.hpp"
+
+#include "../../path_discovery.hpp"
+#include "../../statfs.hpp"
+#include "../../utils.hpp"
+
+#include <map>
+#include <mutex>
+#include <sstream>
+
+LLFIO_V2_NAMESPACE_EXPORT_BEGIN
+
+namespace storage_profile
+{
+  static constexpr const char _profile_cache_leafname[] = "llfio_storage_profiles.yaml";
+
+  struct _profile_cache
+  {
+    std::mutex lock;
+    path_handle dir;  // if not valid, the storage backed temporary files directory is used
+    bool loaded{false};
+    struct device
+    {
+      std::string document;  // the YAML excluding the device and filesystem lines
+      recommended_io_parameters params;
+    };
+    std::map<std::string, device> devices;  // keyed by "<filesystem id or mount source> <filesystem>"
+    std::map<uint64_t, std::string> keys;   // device id to key, which is only stable within this process
+  };
+  inline _profile_cache &_profile_cache_store()
+  {
+    static _profile_cache v;
+    return v;
+  }
+
+  /* Flattens YAML in the layout written by storage_profile::write() into a map of colon
+  delimited item names to their values. This is not a YAML parser, it only understands
+  nesting by indentation, `name: value` and comments.
+  */
+  inline std::map<std::string, std::string> _parse_profile(const std::string &document)
+  {
+    std::map<std::string, std::string> ret;
+    std::vector<std::pair<size_t, std::string>> sections;
+    std::istringstream in(document);
+    std::string line;
+    while(std::getline(in, line))
+    {
+      while(!line.empty() && (line.back() == '\r' || line.back() == ' '))
+      {
+        line.pop_back();
+      }
+      const size_t indent = line.find_first_not_of(' ');
+      if(indent == std::string::npos || line[indent] == '#')
+      {
+        continue;
+      }
+      while(!sections.empty() && sections.back().first >= indent)
+      {
+        sections.pop_back();
+      }
+      std::string name;
+      for(auto &i : sections)
+      {
+        name.append(i.second);
+        name.push_back(':');
+      }
+      if(line.back() == ':')
+      {
+        sections.emplace_back(indent, line.substr(indent, line.size() - indent - 1));
+        continue;
+      }
+      const size_t colon = line.find(": ", indent);
+      if(colon != std::string::npos)
+      {
+        ret[name + line.substr(indent, colon - indent)] = line.substr(colon + 2);
+      }
+    }
+    return ret;
+  }
+
+  inline recommended_io_parameters _recommend(const std::map<std::string, std::string> &items)
+  {
+    static constexpr const char *block_sizes[] = {"4k", "16k", "64k", "256k", "1m", "4m"};
+    static constexpr size_t block_size_bytes[] = {4096, 16384, 65536, 262144, 1048576, 4194304};
+    auto find = [&items](const std::string &name) -> unsigned long long {
+      auto it = items.find(name);
+      return (it == items.end()) ? 0 : strtoull(it->second.c_str(), nullptr, 10);
+    };
+    struct knee
+    {
+      size_t io_size{0}, queue_depth{0};
+      unsigned long long peak{0};
+    };
+    // The smallest block size whose knee reaches within a tenth of the best block size's knee
+    auto best = [&find](const std::string &section) {
+      knee ret;
+      for(const char *mode : {"mixed", "read"})
+      {
+        unsigned long long knees[sizeof(block_sizes) / sizeof(block_sizes[0])];
+        for(size_t n = 0; n < sizeof(block_sizes) / sizeof(block_sizes[0]); n++)
+        {
+          knees[n] = find(section + "throughput:" + mode + ":" + block_sizes[n] + ":knee_bytes_per_sec");
+          ret.peak = std::max(ret.peak, knees[n]);
+        }
+        if(ret.peak == 0)
+        {
+          continue;
+        }
+        for(size_t n = 0; n < sizeof(block_sizes) / sizeof(block_sizes[0]); n++)
+        {
+          if(static_cast<double>(knees[n]) >= static_cast<double>(ret.peak) * 0.9)
+          {
+            ret.io_size = block_size_bytes[n];
+            ret.queue_depth = static_cast<size_t>(find(section + "throughput:" + mode + ":" + block_sizes[n] + ":knee_qd"));
+            break;
+          }
+        }
+        break;
+      }
+      return ret;
+    };
+    recommended_io_parameters ret;
+    ret.io_size = utils::file_buffer_default_size();
+    const knee cached = best("direct=0 sync=0:"), direct = best("direct=1 sync=0:");
+    ret.direct_io_wins = (cached.peak != 0 && direct.peak > cached.peak);
+    const std::string section(ret.direct_io_wins ? "direct=1 sync=0:" : "direct=0 sync=0:");
+    const knee &chosen = ret.direct_io_wins ? direct : cached;
+    if(chosen.io_size != 0)
+    {
+      ret.io_size = chosen.io_size;
+      ret.queue_depth = chosen.queue_depth;
+    }
+    ret.atomic_rewrite_quantum = static_cast<size_t>(find(section + "concurrency:atomic_rewrite_quantum"));
+    ret.unqueued_read_latency = find(section + "latency:read:qd1:50%");
+    ret.profiled = (chosen.io_size != 0 || ret.atomic_rewrite_quantum != 0 || ret.unqueued_read_latency != 0);
+    return ret;
+  }
+
+  inline const path_handle &_profile_cache_directory(_profile_cache &cache) noexcept
+  {
+    return cache.dir.is_valid() ? cache.dir : path_discovery::storage_backed_temporary_files_directory();
+  }
+
+  // Must be called with the cache lock held
+  inline result<void> _load_profile_cache(_profile_cache &cache) noexcept
+  {
+    try
+    {
+      cache.loaded = true;
+      const path_handle &dir = _profile_cache_directory(cache);
+      if(!dir.is_valid())
+      {
+        return success();
+      }
+      auto fh = file_handle::file(dir, _profile_cache_leafname, file_handle::mode::read);
+      if(!fh)
+      {
+        return success();  // nothing has been cached yet
+      }
+      OUTCOME_TRY(auto &&length, fh.value().maximum_extent());
+      std::string contents(static_cast<size_t>(length), 0);
+      OUTCOME_TRY(auto &&read, fh.value().read(0, {{reinterpret_cast<byte *>(&contents[0]), contents.size()}}));
+      contents.resize(read);
+      std::istringstream in(contents);
+      std::string line, document;
+      auto add = [&cache](std::string &document) {
+        const auto items = _parse_profile(document);
+        auto device = items.find("device"), filesystem = items.find("filesystem");
+        if(device != items.end() && filesystem != items.end())
+        {
+          auto &i = cache.devices[device->second + " " + filesystem->second];
+          i.params = _recommend(items);
+          // Strip the two key lines, they are regenerated when stored
+          i.document = document.substr(document.find('\n', document.find("filesystem:")) + 1);
+        }
+        document.clear();
+      };
+      while(std::getline(in, line))
+      {
+        if(line.compare(0, 3, "---") == 0)
+        {
+          add(document);
+          continue;
+        }
+        document.append(line);
+        document.push_back('\n');
+      }
+      add(document);
+      return success();
+    }
+    catch(...)
+    {
+      return error_from_exception();
+    }
+  }
+
+  /* Device ids change across reboots and hotplugging, so the persisted key is the filing
+  system id, which most filing systems derive from the volume's UUID or serial number.
+  Where there is none, the mount source is the next most stable thing. Must be called with
+  the cache lock held.
+  */
+  inline result<std::string> _profile_cache_key(_profile_cache &cache, const file_handle &h) noexcept
+  {
+    try
+    {
+      const auto devid = static_cast<uint64_t>(h.st_dev());
+      auto it = cache.keys.find(devid);
+      if(it == cache.keys.end())
+      {
+        statfs_t statfs;
+        OUTCOME_TRY(statfs.fill(h, statfs_t::want::fsid | statfs_t::want::fstypename));
+        std::string key;
+        if((statfs.f_fsid[0] == 0 && statfs.f_fsid[1] == 0) || (statfs.f_fsid[0] == static_cast<uint64_t>(-1) && statfs.f_fsid[1] == static_cast<uint64_t>(-1)))
+        {
+          OUTCOME_TRY(statfs.fill(h, statfs_t::want::mntfromname));
+          key = statfs.f_mntfromname;
+        }
+        else
+        {
+          char buffer[40];
+          snprintf(buffer, sizeof(buffer), "%016llx%016llx", static_cast<unsigned long long>(statfs.f_fsid[0]), static_cast<unsigned long long>(statfs.f_fsid[1]));
+          key = buffer;
+        }
+        it = cache.keys.emplace(devid, key + " " + statfs.f_fstypename).first;
+      }
+      return it->second;
+    }
+    catch(...)
+    {
+      return error_from_exception();
+    }
+  }
+
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<void> set_profile_cache_directory(const path_handle &dir) noexcept
+  {
+    LLFIO_LOG_FUNCTION_CALL(&dir);
+    auto &cache = _profile_cache_store();
+    path_handle newdir;
+    if(dir.is_valid())
+    {
+      OUTCOME_TRY(newdir, dir.clone());
+    }
+    std::lock_guard<std::mutex> g(cache.lock);
+    cache.dir = std::move(newdir);
+    cache.loaded = false;
+    cache.devices.clear();
+    return success();
+  }
+
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<recommended_io_parameters> recommended_parameters(const file_handle &h) noexcept
+  {
+    LLFIO_LOG_FUNCTION_CALL(&h);
+    auto &cache = _profile_cache_store();
+    std::lock_guard<std::mutex> g(cache.lock);
+    if(!cache.loaded)
+    {
+      (void) _load_profile_cache(cache);
+    }
+    OUTCOME_TRY(auto &&key, _profile_cache_key(cache, h));
+    auto it = cache.devices.find(key);
+    if(it == cache.devices.end())
+    {
+      recommended_io_parameters ret;
+      ret.io_size = utils::file_buffer_default_size();
+      return ret;
+    }
+    return it->second.params;
+  }
+
+  LLFIO_HEADERS_ONLY_FUNC_SPEC recommended_io_parameters recommended_parameters() noexcept
+  {
+    LLFIO_LOG_FUNCTION_CALL(0);
+    auto &cache = _profile_cache_store();
+    std::lock_guard<std::mutex> g(cache.lock);
+    if(!cache.loaded)
+    {
+      (void) _load_profile_cache(cache);
+    }
+    recommended_io_parameters ret;
+    ret.io_size = utils::file_buffer_default_size();
+    bool first = true;
+    for(auto &i : cache.devices)
+    {
+      const recommended_io_parameters &p = i.second.params;
+      if(!p.profiled)
+      {
+        continue;
+      }
+      if(first)
+      {
+        ret = p;
+        first = false;
+        continue;
+      }
+      ret.io_size = std::max(ret.io_size, p.io_size);
+      ret.queue_depth = std::max(ret.queue_depth, p.queue_depth);
+      ret.atomic_rewrite_quantum = std::max(ret.atomic_rewrite_quantum, p.atomic_rewrite_quantum);
+      ret.direct_io_wins = ret.direct_io_wins && p.direct_io_wins;
+      ret.unqueued_read_latency = std::max(ret.unqueued_read_latency, p.unqueued_read_latency);
+    }
+    return ret;
+  }
+
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<void> store_cached_profile(const file_handle &h, const std::string &yaml) noexcept
+  {
+    LLFIO_LOG_FUNCTION_CALL(&h);
+    try
+    {
+      auto &cache = _profile_cache_store();
+      std::lock_guard<std::mutex> g(cache.lock);
+      // Reload so updates by other processes since we last looked are not lost
+      cache.devices.clear();
+      OUTCOME_TRY(_load_profile_cache(cache));
+      OUTCOME_TRY(auto &&key, _profile_cache_key(cache, h));
+      const path_handle &dir = _profile_cache_directory(cache);
+      if(!dir.is_valid())
+      {
+        return errc::no_such_file_or_directory;
+      }
+      auto &device = cache.devices[key];
+      device.document = yaml;
+      if(!device.document.empty() && device.document.back() != '\n')
+      {
+        device.document.push_back('\n');
+      }
+      std::string contents;
+      for(auto &i : cache.devices)
+      {
+        const auto space = i.first.rfind(' ');  // mount sources may contain spaces, filing system names do not
+        contents.append("---\ndevice: ").append(i.first, 0, space).append("\nfilesystem: ").append(i.first, space + 1, std::string::npos).append("\n");
+        contents.append(i.second.document);
+        if(&i.second == &device)
+        {
+          // Recommend from what was written, so it matches what a reload would parse
+          i.second.params = _recommend(_parse_profile(contents.substr(contents.rfind("---\n") + 4)));
+        }
+      }
+      OUTCOME_TRY(auto &&fh, file_handle::uniquely_named_file(dir, file_handle::mode::write, file_handle::caching::all));
+      auto unfh = make_scope_exit([&fh]() noexcept {
+        if(fh.is_valid())
+        {
+          (void) fh.unlink();
+        }
+      });
+      OUTCOME_TRY(fh.write(0, {{reinterpret_cast<const byte *>(contents.data()), contents.size()}}));
+      OUTCOME_TRY(fh.relink(dir, _profile_cache_leafname));
+      OUTCOME_TRY(fh.close());
+      return success();
+    }
+    catch(...)
+    {
+      return error_from_exception();
+    }
+  }
+}  // namespace storage_profile
+
+LLFIO_V2_NAMESPACE_END
@@ -23,6 +23,7 @@ Distributed under the Boost Software License, Version 1.0.
 */
 
 #include "../../algorithm/traverse.hpp"
+#include "../../utils.hpp"
 
 #include <condition_variable>
 #include <iostream>
@@ -366,8 +367,8 @@ namespace algorithm
           // Fire up the threadpool
           if(0 == threads)
           {
-            // Filesystems are generally only concurrent to the real CPU count
-            threads = std::thread::hardware_concurrency() / 2;
+            // Filesystems are generally only concurrent to the real CPU count, which may be limited by cgroup quota
+            threads = utils::effective_cpu_concurrency() / 2;
             if(threads < 4)
             {
               threads = 4;
@@ -40,6 +40,7 @@ result<file_handle> file_handle::file(const path_handle &base, file_handle::path
   result<file_handle> ret(in_place_type<file_handle>, native_handle_type(), _caching, flags, nullptr);
   native_handle_type &nativeh = ret.value()._v;
   LLFIO_LOG_FUNCTION_CALL(&ret);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   nativeh.behaviour |= native_handle_type::disposition::file;
   DWORD fileshare = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
   OUTCOME_TRY(auto &&access, access_mask_from_handle_mode(nativeh, _mode, flags));
@@ -183,6 +184,7 @@ result<file_handle> file_handle::file(const path_handle &base, file_handle::path
   {
     FlushFileBuffers(nativeh.h);
   }
+  LLFIO_LOG_IO_TRACE(open, ret.value(), 0, 0);
   return ret;
 }
 
@@ -408,7 +410,7 @@ result<std::vector<file_handle::extent_pair>> file_handle::extents() const noexc
 }
 
 result<file_handle::extent_pair> file_handle::clone_extents_to(file_handle::extent_pair extent, io_handle &dest_, io_handle::extent_type destoffset, deadline d,
-                                                               bool force_copy_now, bool emulate_if_unsupported) noexcept
+                                                               bool force_copy_now, bool emulate_if_unsupported, size_t _blocksize) noexcept
 {
   try
   {
@@ -446,7 +448,7 @@ result<file_handle::extent_pair> file_handle::clone_extents_to(file_handle::exte
       extent.length = mycurrentlength - extent.offset;
     }
     LLFIO_DEADLINE_TO_SLEEP_INIT(d);
-    const size_type blocksize = utils::file_buffer_default_size();
+    const size_type blocksize = (_blocksize != 0) ? utils::round_up_to_page_size(static_cast<size_type>(_blocksize), utils::page_size()) : utils::file_buffer_default_size();
     byte *buffer = nullptr;
     auto unbufferh = make_scope_exit([&]() noexcept {
       if(buffer != nullptr)
@@ -878,7 +880,7 @@ result<file_handle::extent_type> file_handle::zero(file_handle::extent_pair exte
 
 /******************************************* statfs_t ************************************************/
 
-LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fill_ios(const handle & /*unused*/, const std::string &mntfromname) noexcept
+LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<statfs_t::_ios_t> statfs_t::_fill_ios(const handle & /*unused*/, const std::string &mntfromname) noexcept
 {
   try
   {
@@ -910,6 +912,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
       struct item
       {
         int64_t ReadTime{0}, WriteTime{0}, IdleTime{0};
+        DWORD ReadCount{0}, WriteCount{0};
       };
       std::mutex lock;
       std::vector<item> items;
@@ -917,6 +920,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
 
     uint32_t iosinprogress = 0;
     float iosbusytime = 0;
+    float ioslatency = 0;
     DWORD disk_extents = vde->NumberOfDiskExtents;
     for(DWORD disk_extent = 0; disk_extent < disk_extents; disk_extent++)
     {
@@ -964,14 +968,25 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> statfs_t::_fi
         uint64_t wd = (uint64_t) dp->WriteTime.QuadPart - (uint64_t) last_reading.items[DiskNumber].WriteTime;
         uint64_t id = (uint64_t) dp->IdleTime.QuadPart - (uint64_t) last_reading.items[DiskNumber].IdleTime;
         iosbusytime += 1 - (float) ((double) id / (rd + wd + id));
+        // ReadTime and WriteTime are the cumulative 100ns units spent completing each i/o. The counts
+        // are DWORDs which wrap, so each delta is taken modulo 2^32 before they are summed.
+        uint64_t ios = (uint64_t) (DWORD) (dp->ReadCount - last_reading.items[DiskNumber].ReadCount) +
+                       (uint64_t) (DWORD) (dp->WriteCount - last_reading.items[DiskNumber].WriteCount);
+        if(ios > 0)
+        {
+          ioslatency += (float) ((double) (rd + wd) / (10000000.0 * ios));
+        }
       }
       last_reading.items[DiskNumber].ReadTime = dp->ReadTime.QuadPart;
       last_reading.items[DiskNumber].WriteTime = dp->WriteTime.QuadPart;
       last_reading.items[DiskNumber].IdleTime = dp->IdleTime.QuadPart;
+      last_reading.items[DiskNumber].ReadCount = dp->ReadCount;
+      last_reading.items[DiskNumber].WriteCount = dp->WriteCount;
     }
     iosinprogress /= disk_extents;
     iosbusytime /= disk_extents;
-    return {iosinprogress, std::min(iosbusytime, 1.0f)};
+    ioslatency /= disk_extents;
+    return _ios_t{iosinprogress, std::min(iosbusytime, 1.0f), ioslatency};
   }
   catch(...)
   {
@@ -31,6 +31,8 @@ LLFIO_V2_NAMESPACE_BEGIN
 
 result<void> fs_handle::_fetch_inode() const noexcept
 {
+  // An implementation detail, not an operation of the program being traced
+  LLFIO_LOG_IO_TRACE_SUPPRESS();
   stat_t s;
   OUTCOME_TRYV(s.fill(_get_handle(), stat_t::want::dev | stat_t::want::ino));
   _devid = s.st_dev;
@@ -280,6 +282,7 @@ result<void> fs_handle::unlink(deadline d) noexcept
   windows_nt_kernel::init();
   using namespace windows_nt_kernel;
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   auto &h = _get_handle();
   HANDLE duph = INVALID_HANDLE_VALUE;
   // Get myself DELETE privs if possible
@@ -388,6 +391,7 @@ result<void> fs_handle::unlink(deadline d) noexcept
       }
     }
   }
+  LLFIO_LOG_IO_TRACE(unlink, h, 0, 0);
   return success();
 }
 
@@ -484,7 +488,8 @@ LLFIO_HEADERS_ONLY_FUNC_SPEC result<filesystem::path> to_win32_path(const fs_han
     }
   }
   OUTCOME_TRY(_h._fetch_inode());
-  // Ensure the mapped path exists and is the same file as our source
+  // Ensure the mapped path exists and is the same file as our source, without tracing the check
+  LLFIO_LOG_IO_TRACE_SUPPRESS();
   handle checkh(native_handle_type(native_handle_type::disposition::file | native_handle_type::disposition::_child_close_executed,
                                    CreateFileW(buffer.c_str(), SYNCHRONIZE | FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
                                                nullptr, OPEN_ALWAYS, FILE_FLAG_BACKUP_SEMANTICS, nullptr)));
@@ -76,6 +76,7 @@ result<handle::path_type> handle::current_path() const noexcept
 result<void> handle::close() noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(_v)
   {
 #ifndef NDEBUG
@@ -97,6 +98,7 @@ result<void> handle::close() noexcept
     {
       return win32_error();
     }
+    LLFIO_LOG_IO_TRACE(close, *this, 0, 0);
     _v = native_handle_type();
   }
   return success();
@@ -182,6 +182,7 @@ io_handle::io_result<io_handle::buffers_type> io_handle::_do_read(io_handle::io_
   windows_nt_kernel::init();
   using namespace windows_nt_kernel;
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   using EIOSB = windows_nt_kernel::IO_STATUS_BLOCK;
   std::array<EIOSB, 64> _ols{};
   if(reqs.buffers.size() > 64)
@@ -190,6 +191,10 @@ io_handle::io_result<io_handle::buffers_type> io_handle::_do_read(io_handle::io_
   }
   io_handle::io_result<io_handle::buffers_type> ret(reqs.buffers);
   do_read_write<true>(ret, NtReadFile, _v, nullptr, {_ols.data(), _ols.size()}, reqs, d);
+  if(ret)
+  {
+    LLFIO_LOG_IO_TRACE(read, *this, reqs.offset, detail::io_trace_bytes(ret.value()));
+  }
   return ret;
 }
 
@@ -198,6 +203,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_write(io_hand
   windows_nt_kernel::init();
   using namespace windows_nt_kernel;
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   using EIOSB = windows_nt_kernel::IO_STATUS_BLOCK;
   std::array<EIOSB, 64> _ols{};
   if(reqs.buffers.size() > 64)
@@ -206,6 +212,10 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_write(io_hand
   }
   io_handle::io_result<io_handle::const_buffers_type> ret(reqs.buffers);
   do_read_write<true>(ret, NtWriteFile, _v, nullptr, {_ols.data(), _ols.size()}, reqs, d);
+  if(ret)
+  {
+    LLFIO_LOG_IO_TRACE(write, *this, reqs.offset, detail::io_trace_bytes(ret.value()));
+  }
   return ret;
 }
 
@@ -214,6 +224,7 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
   windows_nt_kernel::init();
   using namespace windows_nt_kernel;
   LLFIO_LOG_FUNCTION_CALL(this);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   if(d && !_v.is_nonblocking())
   {
     return errc::not_supported;
@@ -263,6 +274,14 @@ io_handle::io_result<io_handle::const_buffers_type> io_handle::_do_barrier(io_ha
   {
     return ntkernel_error(ntstat);
   }
+  if(kind <= barrier_kind::wait_data_only)
+  {
+    LLFIO_LOG_IO_TRACE(barrier_data, *this, reqs.offset, detail::io_trace_bytes(reqs.buffers));
+  }
+  else
+  {
+    LLFIO_LOG_IO_TRACE(barrier_all, *this, reqs.offset, detail::io_trace_bytes(reqs.buffers));
+  }
   return {reqs.buffers};
 }
 
@@ -33,6 +33,7 @@ LLFIO_V2_NAMESPACE_BEGIN
 LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> stat_t::fill(const handle &h, stat_t::want wanted) noexcept
 {
   LLFIO_LOG_FUNCTION_CALL(&h);
+  LLFIO_LOG_IO_TRACE_BEGIN();
   windows_nt_kernel::init();
   using namespace windows_nt_kernel;
   alignas(8) wchar_t buffer[32769];
@@ -223,6 +224,7 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> stat_t::fill(const handle &h, sta
     st_reparse_point = static_cast<unsigned int>((fai.BasicInformation.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0u);
     ++ret;
   }
+  LLFIO_LOG_IO_TRACE(stat, h, 0, 0);
   return ret;
 }
 
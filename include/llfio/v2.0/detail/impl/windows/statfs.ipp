@@ -247,17 +247,22 @@ LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> statfs_t::fill(const handle &h, s
       break;
     }
   }
-  if(!!(wanted & want::iosinprogress) || !!(wanted & want::iosbusytime))
+  if(!!(wanted & want::iosinprogress) || !!(wanted & want::iosbusytime) || !!(wanted & want::ioslatency))
   {
     OUTCOME_TRY(auto &&ios, _fill_ios(h, f_mntfromname));
     if(!!(wanted & want::iosinprogress))
     {
-      f_iosinprogress = ios.first;
+      f_iosinprogress = ios.iosinprogress;
       ++ret;
     }
     if(!!(wanted & want::iosbusytime))
     {
-      f_iosbusytime = ios.second;
+      f_iosbusytime = ios.iosbusytime;
+      ++ret;
+    }
+    if(!!(wanted & want::ioslatency))
+    {
+      f_ioslatency = ios.ioslatency;
       ++ret;
     }
   }
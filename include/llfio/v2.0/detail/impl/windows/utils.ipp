@@ -26,6 +26,8 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "import.hpp"
 
+#include <thread>
+
 LLFIO_V2_NAMESPACE_BEGIN
 
 namespace utils
@@ -205,6 +207,25 @@ namespace utils
     return success();
   }
 
+  unsigned effective_cpu_concurrency() noexcept
+  {
+    unsigned ret = std::thread::hardware_concurrency();
+    DWORD_PTR processmask = 0, systemmask = 0;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &processmask, &systemmask) && processmask != 0)
+    {
+      unsigned cpus = 0;
+      for(; processmask != 0; processmask &= processmask - 1)
+      {
+        cpus++;
+      }
+      if(ret == 0 || cpus < ret)
+      {
+        ret = cpus;
+      }
+    }
+    return (ret == 0) ? 1 : ret;
+  }
+
   result<process_memory_usage> current_process_memory_usage() noexcept {
     // Amazingly Win32 doesn't expose private working set, so to avoid having
     // to iterate all the pages in the process and calculate, use a hidden
@@ -27,7 +27,12 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "deadline.h"
 
+#include "outcome/coroutine_support.hpp"
+
+#include <chrono>
 #include <memory>  // for unique_ptr and shared_ptr
+#include <string>
+#include <vector>
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -160,15 +165,62 @@ On Linux only, we have a custom userspace implementation with superior performan
 A similar strategy to Microsoft Windows' approach is used. We
 dynamically increase the number of kernel threads until none are sleeping
 awaiting i/o. If more kernel threads are running than three more than the number of
-CPUs in the system, the number of kernel threads is dynamically reduced.
+CPUs in the system, the number of kernel threads is dynamically reduced. The number
+of CPUs is that returned by `utils::effective_cpu_concurrency()`, so the affinity
+mask, and any cgroup CPU quota or cpuset, are respected as they change.
 Note that **all** the kernel threads for the current process are considered,
 not just the kernel threads created by this thread pool implementation.
 Therefore, if you have alternative thread pool implementations (e.g. OpenMP,
 `std::async`), those are also included in the dynamic adjustment.
 
+Scanning every thread in the process costs several syscalls per thread, and so is
+only done every 100-250 milliseconds. If the macro `LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT`
+is defined to 1, an alternative strategy is used instead: every five milliseconds,
+the on-CPU time of each of this pool's kernel threads which is executing a work
+item is sampled from its `schedstat`. A kernel thread which was on CPU for less
+than a tenth of the sample period is deemed blocked. If the kernel permits it, a
+PSI trigger on `/proc/pressure/cpu` is also installed, and whilst it reports that
+runnable tasks are stalling for CPU, no kernel threads above hardware concurrency
+are permitted. This strategy responds to blocking within milliseconds, but only
+the kernel threads of this pool are considered.
+
+Each kernel thread in the pool owns a work stealing deque per nesting level.
+Work items rescheduled by a kernel thread are pushed onto its own deque, and
+are popped most recently pushed first so caches stay hot. Work submitted from
+outside the pool goes into a shared FIFO injection queue per nesting level.
+A kernel thread without work of its own takes from the injection queue, and
+failing that steals the least recently pushed work from the deque of a randomly
+chosen other kernel thread. All of these sources are exhausted for a higher
+priority nesting level before any lower priority nesting level is examined.
+
+Work is ordered firstly by the priority class of its group, then by nesting level.
+Work items whose delay returned by `work_item::next()` has expired are executed
+ahead of all other work of the same priority class and nesting level, the one which
+has been due the longest first. Whilst the concurrency controller finds the CPUs
+saturated, no more than a quarter of them may execute `priority_class::background`
+work at a time.
+
+The CPUs of the system can be partitioned by NUMA node or by shared L3 cache
+using `partitioning(cpu_partitioning)`. Each partition, or CPU domain, gets
+its own injection queue per nesting level, and each kernel thread is pinned
+to the CPUs of a CPU domain. Work submitted from outside the pool goes into the
+injection queue of the CPU domain the submitting thread is running upon. A kernel
+thread looks for work within its own CPU domain before stealing from elsewhere.
+If a work item has a locality hint set for a NUMA node, when submitted or
+rescheduled it goes into the injection queue of a CPU domain on that NUMA node.
+
+A kernel thread which runs out of work first spins for up to `us_spin_for_more_work()`
+microseconds watching an eventcount which is incremented by every submission, and
+only then parks on its condition variable. Submitting work costs a single atomic
+increment if a kernel thread is spinning, as it will notice the new work by itself;
+otherwise exactly one parked kernel thread is woken, and it wakes another if it finds
+more work queued than it can take. No more than half the CPUs may spin at a time,
+and each kernel thread adapts its spin duration to how often spinning finds work.
+
 As this is wholly implemented by this library, dynamic memory allocation
-occurs in the initial `make_dynamic_thread_pool_group()` and per thread
-creation, but otherwise the implementation does not perform dynamic memory
+occurs in the initial `make_dynamic_thread_pool_group()`, per thread
+creation, and the first time a kernel thread queues work at a nesting level,
+but otherwise the implementation does not perform dynamic memory
 allocations.
 
 After multiple rewrites, eventually I got this custom userspace implementation
@@ -179,6 +231,24 @@ work items I benchmarked this custom userspace implementation as beating
 that Linux libdispatch appears to have a scale up bug when work items are
 small and few, it is often less than half the performance of LLFIO's custom
 implementation).
+
+### Introspection
+
+`statistics()` returns a snapshot of a group: how many work items it has which have not
+yet finished, how many times its work items have been executed, and how long its work
+items waited between becoming runnable and beginning execution. `pool_statistics()`
+returns a snapshot of the kernel threads of the pool, including how many were added and
+removed, and for each how long it has been busy, blocked within work and sleeping.
+Statistics are always collected, at the cost of reading the steady clock three times
+per work item executed. Per kernel thread statistics are only available on Linux
+with our custom userspace implementation.
+
+For finer detail, `trace_events(capacity)` enables recording of work item submission,
+execution and completion, and of kernel threads being added, removed, sleeping and
+waking, into a lock free ring buffer of the most recent `capacity` events. These can be
+retrieved with `traced_events()`, or as Chrome trace JSON with `traced_events_as_chrome_json()`
+which can be loaded into `chrome://tracing` or Perfetto. When tracing is disabled,
+which is the default, the cost is one atomic load per event which would be recorded.
 */
 class LLFIO_DECL dynamic_thread_pool_group
 {
@@ -197,9 +267,13 @@ public:
     std::atomic<intptr_t> _nextwork{-1};
     std::chrono::steady_clock::time_point _timepoint1;
     std::chrono::system_clock::time_point _timepoint2;
+    std::chrono::steady_clock::time_point _timepoint_runnable;  // when last made runnable, for statistics
     int _internalworkh_inuse{0};
+    int _locality_hint{-1};
 
   protected:
+    bool _release_when_done{false};  // invoke group_complete() as soon as next() returns -1, not when the group completes
+
     constexpr bool _has_timer_set_relative() const noexcept { return _timepoint1 != std::chrono::steady_clock::time_point(); }
     constexpr bool _has_timer_set_absolute() const noexcept { return _timepoint2 != std::chrono::system_clock::time_point(); }
     constexpr bool _has_timer_set() const noexcept { return _has_timer_set_relative() || _has_timer_set_absolute(); }
@@ -216,7 +290,10 @@ public:
         , _nextwork(o._nextwork.load(std::memory_order_relaxed))
         , _timepoint1(o._timepoint1)
         , _timepoint2(o._timepoint2)
+        , _timepoint_runnable(o._timepoint_runnable)
         , _internalworkh_inuse(o._internalworkh_inuse)
+        , _locality_hint(o._locality_hint)
+        , _release_when_done(o._release_when_done)
     {
       assert(o._parent.load(std::memory_order_relaxed) == nullptr);
       assert(o._internalworkh == nullptr);
@@ -255,6 +332,21 @@ public:
     //! Returns the parent work group between successful submission and just before `group_complete()`.
     dynamic_thread_pool_group *parent() const noexcept { return reinterpret_cast<dynamic_thread_pool_group *>(_parent.load(std::memory_order_relaxed)); }
 
+    //! Returns the NUMA node this work item would prefer to execute upon, or -1 if none.
+    int locality_hint() const noexcept { return _locality_hint; }
+    /*! \brief Sets the NUMA node this work item would prefer to execute upon, or -1 for none.
+
+    This only has an effect if the pool's CPUs have been partitioned using
+    `dynamic_thread_pool_group::partitioning(cpu_partitioning)`, and is only
+    consulted when the work item is next scheduled.
+    */
+    void set_locality_hint(int numa_node) noexcept { _locality_hint = numa_node; }
+    /*! \brief Sets the NUMA node this work item would prefer to execute upon
+    to the NUMA node upon which the memory at `addr` currently resides e.g.
+    the memory returned by a `map_handle` or a `mapped_file_handle`.
+    */
+    inline result<void> set_locality_hint(const void *addr) noexcept;
+
     /*! Invoked by the i/o thread pool to determine if this work item
     has more work to do.
 
@@ -319,24 +411,29 @@ public:
   \brief A work item which paces when it next executes according to i/o congestion.
 
   Currently there is only a working implementation of this for the Microsoft Windows
-  and Linux platforms, due to lack of working `statfs_t::f_iosinprogress` on other
+  and Linux platforms, due to lack of working `statfs_t::f_ioslatency` on other
   platforms. If retrieving that for a seekable handle does not work, the constructor
   throws an exception.
 
-  For seekable handles, currently `reads`, `writes` and `barriers` are ignored. We
-  simply retrieve, periodically, `statfs_t::f_iosinprogress` and `statfs_t::f_iosbusytime`
-  for the storage devices backing the seekable handle. If the recent averaged i/o wait time exceeds
-  `max_iosbusytime` and the i/o in progress > `max_iosinprogress`, `next()` will
-  start setting the default deadline passed to
-  `io_aware_next()`. Thereafter, every 1/10th of a second, if `statfs_t::f_iosinprogress`
-  is above `max_iosinprogress`, it will increase the deadline by 1/16th, whereas if it is
-  below `min_iosinprogress`, it will decrease the deadline by 1/16th. The default deadline
-  chosen is always the worst of all the
+  For seekable handles, currently `reads`, `writes` and `barriers` are ignored. Pacing
+  is done by a delay based congestion controller similar to TCP Vegas and BBR, with
+  one controller per storage device shared by all the work items using handles on
+  that device. Every 1/10th of a second, `statfs_t::f_ioslatency` is sampled, which
+  is the mean time taken by the block layer to complete each i/o to that device since
+  the previous sample. This is smoothed with a 7/8 moving average. The lowest sample
+  seen in the past ten seconds is the device's latency without any queuing; when it
+  expires, pacing is briefly doubled to drain the queue so that it can be remeasured.
+
+  The difference between the smoothed and minimum latencies is the time i/o spends
+  queued. If this exceeds `max_queuing_latency`, `next()` will start setting the
+  default deadline passed to `io_aware_next()` to 1ms, and thereafter increase it by
+  1/16th per sample (1/4 if queuing exceeds four times `max_queuing_latency`). If
+  queuing drops below `min_queuing_latency`, the deadline decreases by 1/16th per
+  sample until it is removed altogether. In between, the deadline is held steady.
+  If the device completes no i/o and has none in progress, pacing is removed
+  immediately. The default deadline chosen is always the worst of all the
   storage devices of all the handles. This will reduce concurrency within the kernel thread pool
-  in order to reduce congestion on the storage devices. If at any point `statfs_t::f_iosbusytime`
-  drops below `max_iosbusytime` as averaged across one second, and `statfs_t::f_iosinprogress` drops
-  below `min_iosinprogress`, the additional
-  throttling is completely removed. `io_aware_next()` can ignore the default deadline
+  in order to reduce congestion on the storage devices. `io_aware_next()` can ignore the default deadline
   passed into it, and can set any other deadline.
 
   For non-seekable handles, the handle must have an i/o multiplexer set upon it, and on
@@ -352,13 +449,20 @@ public:
   class LLFIO_DECL io_aware_work_item : public work_item
   {
   public:
-    //! Maximum i/o busyness above which throttling is to begin.
+    /*! Queuing latency below which pacing is reduced. The default of 500us suits SSDs, you want around 5ms for spinning rust or 50us for NV-RAM.
+    If any handle's device has a cached storage profile, the constructor replaces this with five times the slowest such device's
+    unqueued 4Kb read latency (see `storage_profile::recommended_parameters()`).
+    */
+    std::chrono::microseconds min_queuing_latency{500};
+    //! Queuing latency above which pacing is increased. The default of 2ms suits SSDs, you want around 20ms for spinning rust or 200us for NV-RAM. Profiled devices use four times `min_queuing_latency`.
+    std::chrono::microseconds max_queuing_latency{2000};
+    //! \deprecated Ignored since pacing became latency based, use `max_queuing_latency` instead.
     float max_iosbusytime{0.95f};
-    //! Minimum i/o in progress to target if `iosbusytime` exceeded. The default of 16 suits SSDs, you want around 4 for spinning rust or NV-RAM.
+    //! \deprecated Ignored since pacing became latency based, use `min_queuing_latency` instead.
     uint32_t min_iosinprogress{16};
-    //! Maximum i/o in progress to target if `iosbusytime` exceeded. The default of 32 suits SSDs, you want around 8 for spinning rust or NV-RAM.
+    //! \deprecated Ignored since pacing became latency based, use `max_queuing_latency` instead.
 #ifdef _WIN32
-    uint32_t max_iosinprogress{1};  // windows appears to do a lot of i/o coalescing
+    uint32_t max_iosinprogress{1};
 #else
     uint32_t max_iosinprogress{32};
 #endif
@@ -413,6 +517,134 @@ public:
     virtual intptr_t io_aware_next(deadline &d) noexcept = 0;
   };
 
+  /*! \class parallel_for_work_items
+  \brief A set of work items which together invoke a callable over every index in `[begin, end)`.
+
+  Submitting a work item per element of a fine grained data parallel loop is inefficient,
+  as each work item is separately scheduled and separately completed by the pool. This instead
+  creates one work item per CPU available to the process (as per `utils::effective_cpu_concurrency()`),
+  or as many as you specify, which all claim chunks of the range from a shared atomic cursor
+  whenever the pool asks them for more work. Each claim takes `1/(2 * concurrency)` of what remains
+  unclaimed, but no less than `min_chunk`, so early chunks are large and late chunks are small.
+  The range is thus split lazily across kernel threads according to how quickly each gets through
+  its chunks, and the pool schedules and completes work once per chunk rather than once per element.
+
+  `F` is invoked with `(size_t begin, size_t end)` for each chunk if it can be, otherwise with `(size_t i)`
+  for each element of each chunk from within a loop which the compiler can inline. `F` must not throw.
+  Instances can be neither copied nor moved, and must outlive the completion of the group they were
+  submitted to.
+  */
+  template <class F> class parallel_for_work_items
+  {
+    class _item final : public work_item
+    {
+      friend class parallel_for_work_items;
+      parallel_for_work_items *_parent{nullptr};
+      size_t _begin{0}, _end{0};
+
+      virtual intptr_t next(deadline & /*unused*/) noexcept override { return _parent->_claim(_begin, _end) ? 1 : -1; }
+      virtual result<void> operator()(intptr_t /*unused*/) noexcept override
+      {
+        _invoke(_parent->_f, _begin, _end, 0);
+        _parent->_completed.fetch_add(_end - _begin, std::memory_order_relaxed);
+        return success();
+      }
+
+    public:
+      _item() = default;
+    };
+
+    template <class G> static auto _invoke(G &f, size_t begin, size_t end, int /*unused*/) -> decltype(f(begin, end), void()) { f(begin, end); }
+    template <class G> static void _invoke(G &f, size_t begin, size_t end, ...)
+    {
+      for(; begin < end; ++begin)
+      {
+        f(begin);
+      }
+    }
+
+    bool _claim(size_t &begin, size_t &end) noexcept
+    {
+      size_t cur = _next.load(std::memory_order_relaxed);
+      for(;;)
+      {
+        if(cur >= _end)
+        {
+          return false;
+        }
+        const size_t remaining = _end - cur;
+        size_t n = remaining / (2 * _concurrency);
+        if(n < _min_chunk)
+        {
+          n = (_min_chunk < remaining) ? _min_chunk : remaining;
+        }
+        if(_next.compare_exchange_weak(cur, cur + n, std::memory_order_relaxed, std::memory_order_relaxed))
+        {
+          begin = cur;
+          end = cur + n;
+          return true;
+        }
+      }
+    }
+
+    std::atomic<size_t> _next, _completed{0};
+    const size_t _end, _min_chunk, _concurrency;
+    F _f;
+    std::unique_ptr<_item[]> _items;
+
+    static size_t _calculate_concurrency(size_t begin, size_t end, size_t min_chunk, size_t concurrency) noexcept
+    {
+      if(concurrency == 0)
+      {
+        concurrency = _default_parallel_for_concurrency();
+      }
+      const size_t chunks = (end > begin) ? ((end - begin + min_chunk - 1) / min_chunk) : 1;
+      return (chunks < concurrency) ? chunks : concurrency;
+    }
+
+  public:
+    /*! \brief Constructs work items which will invoke `f` over `[begin, end)`, claiming no fewer
+    than `min_chunk` elements at a time, using `concurrency` work items (zero means one per CPU
+    available to the process).
+    */
+    parallel_for_work_items(size_t begin, size_t end, F f, size_t min_chunk = 1, size_t concurrency = 0)
+        : _next(begin)
+        , _end(end)
+        , _min_chunk((min_chunk > 0) ? min_chunk : 1)
+        , _concurrency(_calculate_concurrency(begin, end, _min_chunk, concurrency))
+        , _f(std::move(f))
+        , _items(new _item[_concurrency])
+    {
+      for(size_t n = 0; n < _concurrency; n++)
+      {
+        _items[n]._parent = this;
+      }
+    }
+    parallel_for_work_items(const parallel_for_work_items &) = delete;
+    parallel_for_work_items(parallel_for_work_items &&) = delete;
+    parallel_for_work_items &operator=(const parallel_for_work_items &) = delete;
+    parallel_for_work_items &operator=(parallel_for_work_items &&) = delete;
+    ~parallel_for_work_items() = default;
+
+    //! The number of work items which will share the range.
+    size_t concurrency() const noexcept { return _concurrency; }
+    //! The number of elements whose invocation has completed so far, updated once per chunk.
+    size_t completed() const noexcept { return _completed.load(std::memory_order_relaxed); }
+    //! The callable invoked upon the range.
+    F &callable() noexcept { return _f; }
+
+    //! Threadsafe. Submits all the work items into `group`.
+    result<void> submit(dynamic_thread_pool_group *group) noexcept { return group->submit(span<_item>(_items.get(), _concurrency)); }
+  };
+  //! Returns a `parallel_for_work_items` which will invoke `f` over `[begin, end)`.
+  template <class F>
+  static std::unique_ptr<parallel_for_work_items<typename std::decay<F>::type>> make_parallel_for(size_t begin, size_t end, F &&f, size_t min_chunk = 1,
+                                                                                                 size_t concurrency = 0)
+  {
+    return std::unique_ptr<parallel_for_work_items<typename std::decay<F>::type>>(
+    new parallel_for_work_items<typename std::decay<F>::type>(begin, end, std::forward<F>(f), min_chunk, concurrency));
+  }
+
   virtual ~dynamic_thread_pool_group() {}
 
   /*! \brief A textual description of the underlying implementation of
@@ -487,6 +719,39 @@ public:
     return true;
   }
 
+  //! The priority class of a group, by which its work is ordered relative to the work of other groups.
+  enum class priority_class : uint8_t
+  {
+    background,       //!< Executes only after other work, and is throttled when the CPUs are saturated.
+    normal,           //!< The default.
+    latency_critical  //!< Executes before other work.
+  };
+  /*! \brief Threadsafe. Returns the priority class of this group. Groups created from within
+  a work item inherit the priority class of that work item's group, else they are `priority_class::normal`.
+  */
+  virtual priority_class priority() const noexcept = 0;
+  /*! \brief Threadsafe. Sets the priority class of this group. Work already queued is unaffected,
+  but all work subsequently scheduled uses the new priority class.
+
+  On Microsoft Windows this sets the callback priority within the Win32 thread pool, on
+  Grand Central Dispatch it selects the global queue priority.
+  */
+  virtual result<void> set_priority(priority_class v) noexcept = 0;
+
+  //! A snapshot of the statistics of a group.
+  struct group_statistics
+  {
+    priority_class priority{priority_class::normal};   //!< The priority class of the group.
+    size_t nesting_level{0};                           //!< The nesting level of the group.
+    size_t work_items_active{0};                       //!< Work items submitted which have not yet finished.
+    uint64_t work_items_executed{0};                   //!< Total executions of work items since the group was created.
+    std::chrono::nanoseconds total_wait_time{0};       //!< Total time work items spent runnable before execution.
+    std::chrono::nanoseconds max_wait_time{0};         //!< The longest time a work item spent runnable before execution.
+    std::chrono::nanoseconds total_execution_time{0};  //!< Total time spent executing work items.
+  };
+  //! Threadsafe. Returns a snapshot of the statistics of this group.
+  virtual group_statistics statistics() const noexcept = 0;
+
   //! Returns the work item nesting level which would be used if a new dynamic thread pool group were created within the current work item.
   static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC size_t current_nesting_level() noexcept;
   //! Returns the work item the calling thread is running within, if any.
@@ -505,7 +770,339 @@ public:
   on Windows, Grand Central Dispatch etc.
   */
   static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t ms_sleep_for_more_work(uint32_t v) noexcept;
+  /*! \brief Returns the maximum number of microseconds that a thread without work spins
+  waiting for more before parking on its condition variable.
+
+  Note that this will be zero on all but on Linux if using our local thread pool
+  implementation.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t us_spin_for_more_work() noexcept;
+  /*! \brief Sets the maximum number of microseconds that a thread without work spins
+  waiting for more before parking, returning the value actually set.
+
+  Each thread adapts its spin within this maximum, doubling it each time spinning
+  found work and halving it each time it did not. Zero disables spinning, which
+  minimises CPU consumption at the cost of wakeup latency. Values above one second
+  are clamped.
+
+  Note that this will have no effect (and thus return zero) on all but on Linux if
+  using our local thread pool implementation.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC uint32_t us_spin_for_more_work(uint32_t v) noexcept;
+
+  //! How the CPUs of the system are partitioned into domains within which work preferentially stays.
+  enum class cpu_partitioning
+  {
+    none,       //!< All CPUs are a single domain.
+    numa_node,  //!< One domain per NUMA node.
+    l3_cache    //!< One domain per set of CPUs sharing a L3 cache.
+  };
+  /*! \brief Returns how the CPUs of the system are currently partitioned.
+  Note that this will be `cpu_partitioning::none` on all but on Linux if using our
+  local thread pool implementation.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC cpu_partitioning partitioning() noexcept;
+  /*! \brief Sets how the CPUs of the system are partitioned, returning the value actually set.
+
+  The topology is read from `/sys/devices/system`, and is intersected with the CPU
+  affinity of the process. Kernel threads in the pool are pinned to the CPUs of their
+  domain the next time they look for work. If the topology cannot be determined, a
+  single domain of all CPUs results.
+
+  Note that this will have no effect (and thus return `cpu_partitioning::none`) on all
+  but on Linux if using our local thread pool implementation.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<cpu_partitioning> partitioning(cpu_partitioning v) noexcept;
+  /*! \brief Returns the NUMA node upon which the memory at `addr` currently resides.
+  Returns `errc::operation_not_supported` on platforms other than Linux.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<int> numa_node_of(const void *addr) noexcept;
+
+  //! A snapshot of the statistics of a kernel thread in the pool.
+  struct thread_statistics
+  {
+    uint32_t thread_id{0};                     //!< The kernel's id for the thread.
+    bool sleeping{false};                      //!< True if the thread is currently sleeping awaiting work.
+    std::chrono::nanoseconds busy_time{0};     //!< Time spent on CPU whilst awake.
+    std::chrono::nanoseconds blocked_time{0};  //!< Time spent off CPU whilst awake e.g. blocked on i/o within work items.
+    std::chrono::nanoseconds idle_time{0};     //!< Time spent sleeping awaiting work.
+  };
+  //! A snapshot of the statistics of the pool.
+  struct pool_statistics_t
+  {
+    size_t work_items_queued{0};  //!< Work items runnable but not yet executing, across all groups.
+    uint64_t threads_added{0};    //!< Kernel threads added to the pool since process start.
+    uint64_t threads_removed{0};  //!< Kernel threads removed from the pool since process start.
+    size_t cpu_domains{1};        //!< The number of CPU domains the CPUs are partitioned into, see `partitioning()`.
+    //! Totals for all kernel threads which have ever been in the pool.
+    std::chrono::nanoseconds busy_time{0}, blocked_time{0}, idle_time{0};
+    //! The kernel threads currently in the pool. Busy and blocked time are updated every 100 milliseconds.
+    std::vector<thread_statistics> threads;
+  };
+  /*! \brief Returns a snapshot of the statistics of the pool. Note that kernel thread statistics
+  are only available on Linux if using our local thread pool implementation.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<pool_statistics_t> pool_statistics() noexcept;
+
+  //! The kind of a traced event.
+  enum class trace_event_kind : uint8_t
+  {
+    work_item_submitted,  //!< A work item became runnable.
+    work_item_begin,      //!< A work item began executing.
+    work_item_end,        //!< A work item finished executing.
+    thread_added,         //!< A kernel thread was added to the pool.
+    thread_removed,       //!< A kernel thread was removed from the pool.
+    thread_sleep,         //!< A kernel thread went to sleep awaiting work.
+    thread_wake           //!< A kernel thread woke from sleep.
+  };
+  //! A traced event.
+  struct trace_event
+  {
+    std::chrono::steady_clock::time_point timestamp;               //!< When the event occurred.
+    trace_event_kind kind{trace_event_kind::work_item_submitted};  //!< What occurred.
+    uint32_t thread_id{0};                                         //!< The kernel's id for the thread upon which it occurred.
+    const dynamic_thread_pool_group *group{nullptr};               //!< The group concerned, if any.
+    const work_item *item{nullptr};                                //!< The work item concerned, if any.
+  };
+  /*! \brief Threadsafe. Enables recording of the most recent `capacity` events, rounded up
+  to a power of two, discarding any previously recorded. Zero disables tracing.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<void> trace_events(size_t capacity) noexcept;
+  //! Threadsafe. Returns the events currently recorded, oldest first.
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::vector<trace_event>> traced_events() noexcept;
+  /*! \brief Threadsafe. Returns the events currently recorded in the Chrome trace event JSON
+  format. Work item execution and kernel thread sleep become duration events, the others
+  instant events.
+  */
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::string> traced_events_as_chrome_json() noexcept;
+
+protected:
+  //! The number of work items `parallel_for_work_items` uses by default.
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC size_t _default_parallel_for_concurrency() noexcept;
+
+  //! Intrusively linked notification that a group has stopped, used by `when_all()`.
+  struct _stopped_waiter
+  {
+    _stopped_waiter *_next{nullptr};
+    //! Invoked without locks held, possibly from within `_notify_when_stopped()`.
+    virtual void _stopped(const result<void> &cause) noexcept = 0;
+
+  protected:
+    ~_stopped_waiter() = default;
+  };
+  //! Invokes `w` when this group next has no work remaining, immediately if it has none now.
+  virtual void _notify_when_stopped(_stopped_waiter *w) noexcept = 0;
+
+#if LLFIO_ENABLE_COROUTINES
+private:
+  // Resumes a coroutine from within a kernel thread of the pool
+  class _coroutine_work_item final : public work_item
+  {
+    dynamic_thread_pool_group *_group;
+    coroutine_handle<> _coro;
+    deadline _d;
+    result<void> *_result;
+    bool _scheduled{false};
+
+  public:
+    _coroutine_work_item(dynamic_thread_pool_group *group, coroutine_handle<> coro, deadline d, result<void> *res) noexcept
+        : _group(group)
+        , _coro(coro)
+        , _d(d)
+        , _result(res)
+    {
+      _release_when_done = true;
+    }
+    virtual intptr_t next(deadline &d) noexcept override
+    {
+      if(_scheduled)
+      {
+        return -1;
+      }
+      _scheduled = true;
+      if(_d)
+      {
+        d = _d;
+      }
+      return 1;
+    }
+    virtual result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      auto coro = _coro;
+      _coro = {};
+      coro.resume();
+      return success();
+    }
+    virtual void group_complete(const result<void> &cancelled) noexcept override
+    {
+      if(_coro)
+      {
+        // The group was stopped before the coroutine could be resumed, so resume it with the cause
+        *_result = cancelled ? result<void>(errc::operation_canceled) : cancelled;
+        _d = {};
+        _scheduled = false;
+        if(_group->submit(this))
+        {
+          return;
+        }
+        auto coro = _coro;
+        delete this;
+        coro.resume();
+        return;
+      }
+      delete this;
+    }
+  };
+
+public:
+  /*! \brief An awaitable returned by `schedule()` and `schedule_after()` which suspends
+  the awaiting coroutine, and resumes it from within a kernel thread of the pool.
+  */
+  class schedule_awaitable
+  {
+    friend class dynamic_thread_pool_group;
+    dynamic_thread_pool_group *_group;
+    deadline _d;
+    result<void> _result{success()};
+
+    schedule_awaitable(dynamic_thread_pool_group *group, deadline d) noexcept
+        : _group(group)
+        , _d(d)
+    {
+    }
+
+  public:
+    //! Always suspends
+    bool await_ready() noexcept { return false; }
+    //! Submits a work item into the group which will resume `coro`
+    bool await_suspend(coroutine_handle<> coro) noexcept
+    {
+      auto *wi = new(std::nothrow) _coroutine_work_item(_group, coro, _d, &_result);
+      if(wi == nullptr)
+      {
+        _result = errc::not_enough_memory;
+        return false;
+      }
+      auto r = _group->submit(wi);
+      if(!r)
+      {
+        delete wi;
+        _result = std::move(r);
+        return false;
+      }
+      return true;
+    }
+    //! Returns any failure to schedule, including the group being stopped before resumption.
+    result<void> await_resume() noexcept { return std::move(_result); }
+  };
+
+  /*! \brief Returns an awaitable which resumes the awaiting coroutine as work within this group,
+  and thus within the pool's dynamic concurrency.
+
+  Each suspension allocates a small work item which is released once it has resumed
+  the coroutine. If the group is stopped before the coroutine is resumed, it is resumed
+  with the cause of the stop.
+  */
+  schedule_awaitable schedule() noexcept { return schedule_awaitable(this, deadline()); }
+  /*! \brief Returns an awaitable which resumes the awaiting coroutine as work within this group
+  no sooner than deadline `d`. Relative deadlines use the steady clock, absolute deadlines
+  the system clock, exactly as if `work_item::next()` had returned `d`.
+  */
+  schedule_awaitable schedule_after(deadline d) noexcept { return schedule_awaitable(this, d); }
+
+  /*! \brief Awaits `a` e.g. the awaitable returned by `io_handle::co_read()`, then resumes the
+  awaiting coroutine as work within this group.
+
+  i/o completions are otherwise resumed within whatever thread pumps the i/o multiplexer.
+  If rescheduling onto the pool fails, the coroutine continues in the completing thread.
+  */
+  template <class Awaitable> eager<decltype(std::declval<Awaitable &>().await_resume())> resume_after(Awaitable a)
+  {
+    auto ret = co_await a;
+    (void) co_await schedule();
+    co_return std::move(ret);
+  }
+
+  /*! \brief An awaitable returned by `when_all()` which suspends the awaiting coroutine until
+  all of the groups have stopped.
+  */
+  class when_all_awaitable
+  {
+    friend class dynamic_thread_pool_group;
+    struct _waiter final : _stopped_waiter
+    {
+      when_all_awaitable *parent{nullptr};
+      virtual void _stopped(const result<void> &cause) noexcept override { parent->_one_stopped(cause); }
+    };
+    std::vector<dynamic_thread_pool_group *> _groups;
+    std::vector<_waiter> _waiters;
+    std::atomic<size_t> _remaining{0};
+    std::atomic<bool> _failed{false};
+    result<void> _result{success()};
+    coroutine_handle<> _coro;
+
+    explicit when_all_awaitable(span<dynamic_thread_pool_group *> groups)
+        : _groups(groups.begin(), groups.end())
+        , _waiters(groups.size())
+    {
+    }
+
+    void _one_stopped(const result<void> &cause) noexcept
+    {
+      if(!cause && !_failed.exchange(true, std::memory_order_relaxed))
+      {
+        _result = cause;
+      }
+      if(1 == _remaining.fetch_sub(1, std::memory_order_acq_rel))
+      {
+        _coro.resume();
+      }
+    }
+
+  public:
+    //! True if all the groups have already stopped
+    bool await_ready() noexcept
+    {
+      for(auto *group : _groups)
+      {
+        if(!group->stopped())
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+    //! Registers for notification of each group stopping
+    bool await_suspend(coroutine_handle<> coro) noexcept
+    {
+      _coro = coro;
+      _remaining.store(_groups.size() + 1, std::memory_order_relaxed);
+      for(size_t n = 0; n < _groups.size(); n++)
+      {
+        _waiters[n].parent = this;
+        _groups[n]->_notify_when_stopped(&_waiters[n]);
+      }
+      // If every group has already stopped, don't suspend
+      return 1 != _remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    //! Returns the first abnormal completion cause of any of the groups, if any.
+    result<void> await_resume() noexcept { return std::move(_result); }
+  };
+
+  /*! \brief Returns an awaitable which resumes the awaiting coroutine once all of `groups`
+  have no work remaining, returning the first abnormal completion cause of any of them.
+  The coroutine is resumed from within the kernel thread which completed the last group.
+  */
+  static when_all_awaitable when_all(span<dynamic_thread_pool_group *> groups) { return when_all_awaitable(groups); }
+#endif
 };
+
+inline result<void> dynamic_thread_pool_group::work_item::set_locality_hint(const void *addr) noexcept
+{
+  OUTCOME_TRY(auto &&node, dynamic_thread_pool_group::numa_node_of(addr));
+  _locality_hint = node;
+  return success();
+}
 //! A unique ptr to a work group within the global dynamic thread pool.
 using dynamic_thread_pool_group_ptr = std::unique_ptr<dynamic_thread_pool_group>;
 
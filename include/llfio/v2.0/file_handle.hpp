@@ -328,8 +328,8 @@ public:
   This implementation first enumerates the valid extents for the region requested, and
   only clones extents which are reported as valid. It
   then iterates the platform specific syscall to cause the extents to be cloned in
-  `utils::page_allocator<T>` sized chunks (i.e. the next large page greater or equal
-  to 1Mb). Generally speaking, if the dedicated syscalls fail, the implementation falls
+  `blocksize` chunks, which if zero are `utils::page_allocator<T>` sized (i.e. the next
+  large page greater or equal to 1Mb). Generally speaking, if the dedicated syscalls fail, the implementation falls
   back to a user space emulation, unless `emulate_if_unsupported` is false.
 
   If the region being cloned does not exist in the source file, the region is truncated
@@ -340,7 +340,7 @@ public:
   code.
 
   \note The current implementation does not permit overlapping clones within the same
-  inode to differ by less than `utils::page_allocator<T>` sized chunks. It will fail
+  inode to differ by less than one chunk. It will fail
   with an error code comparing equal to `errc::invalid_parameter`.
 
   If you really want the copy to happen now, and not later via copy-on-write, set
@@ -352,7 +352,7 @@ public:
   LLFIO_MAKE_FREE_FUNCTION
   LLFIO_HEADERS_ONLY_VIRTUAL_SPEC
   result<extent_pair> clone_extents_to(extent_pair extent, io_handle &dest, io_handle::extent_type destoffset, deadline d = {}, bool force_copy_now = false,
-                                       bool emulate_if_unsupported = true) noexcept;
+                                       bool emulate_if_unsupported = true, size_t blocksize = 0) noexcept;
   //! \overload
   LLFIO_MAKE_FREE_FUNCTION
   result<extent_pair> clone_extents_to(io_handle &dest, deadline d = {}, bool force_copy_now = false, bool emulate_if_unsupported = true) noexcept
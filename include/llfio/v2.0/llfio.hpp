@@ -70,6 +70,7 @@ import LLFIO_MODULE_NAME;
 #include "file_handle.hpp"
 #include "process_handle.hpp"
 #include "statfs.hpp"
+#include "storage_profile_cache.hpp"
 #ifdef LLFIO_INCLUDE_STORAGE_PROFILE
 #include "storage_profile.hpp"
 #endif
@@ -346,6 +346,155 @@ LLFIO_V2_NAMESPACE_END
 #define LLFIO_LOG_ALL(inst, message)
 #endif
 
+#if LLFIO_LOGGING_LEVEL
+#include <atomic>
+#include <chrono>
+
+LLFIO_V2_NAMESPACE_BEGIN
+
+//! The kinds of operation reported to an `io_trace_hook`
+enum class io_trace_op : unsigned char
+{
+  open,          //!< A file was opened or created
+  read,          //!< `bytes` were read from `offset`
+  write,         //!< `bytes` were written at `offset`
+  barrier_data,  //!< `bytes` from `offset` were flushed without their metadata, all of them if `bytes` is zero
+  barrier_all,   //!< `bytes` from `offset` were flushed with their metadata, all of them if `bytes` is zero
+  stat,          //!< The metadata of the inode was read
+  unlink,        //!< The inode was unlinked
+  close          //!< The handle was closed, its native handle remains readable during the call
+};
+
+/*! \brief A callback receiving every successful operation traced by LLFIO, immediately after
+it completes and on the thread which performed it.
+
+`duration` is the time the operation took. Failed operations are not reported, nor are
+those LLFIO performs internally, such as the stat fetching the inode of a handle before it
+is unlinked. Any LLFIO i/o the hook itself performs is not reported either.
+*/
+using io_trace_hook = void (*)(void *context, io_trace_op op, const handle &h, unsigned long long offset, unsigned long long bytes,
+                               std::chrono::nanoseconds duration);
+
+namespace detail
+{
+  // A seqlock, so a hook is never called with the context of another
+  struct io_trace_hook_state
+  {
+    std::atomic<unsigned> seq{0};  // odd whilst the hook and context are being changed
+    std::atomic<io_trace_hook> hook{nullptr};
+    std::atomic<void *> context{nullptr};
+  };
+  inline LLFIO_DECL io_trace_hook_state &io_trace_hooks() noexcept
+  {
+    static io_trace_hook_state v;
+    return v;
+  }
+  // Nonzero whilst operations on this thread are performed internally by LLFIO, or by a hook
+  inline unsigned &io_trace_suppressed() noexcept
+  {
+    static thread_local unsigned v;
+    return v;
+  }
+  class io_trace_suppressor
+  {
+  public:
+    io_trace_suppressor() noexcept { ++io_trace_suppressed(); }
+    io_trace_suppressor(const io_trace_suppressor &) = delete;
+    io_trace_suppressor(io_trace_suppressor &&) = delete;
+    io_trace_suppressor &operator=(const io_trace_suppressor &) = delete;
+    io_trace_suppressor &operator=(io_trace_suppressor &&) = delete;
+    ~io_trace_suppressor() { --io_trace_suppressed(); }
+  };
+  // Only reads the clock if a hook is installed, so otherwise the cost is one atomic load
+  class io_trace_timer
+  {
+    io_trace_hook _hook{nullptr};
+    void *_context{nullptr};
+    std::chrono::steady_clock::time_point _begin;
+
+  public:
+    io_trace_timer() noexcept
+    {
+      auto &hooks = io_trace_hooks();
+      if(hooks.hook.load(std::memory_order_relaxed) == nullptr || io_trace_suppressed() != 0)
+      {
+        return;
+      }
+      for(;;)
+      {
+        const unsigned seq = hooks.seq.load(std::memory_order_acquire);
+        if((seq & 1U) == 0)
+        {
+          _hook = hooks.hook.load(std::memory_order_relaxed);
+          _context = hooks.context.load(std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if(hooks.seq.load(std::memory_order_relaxed) == seq)
+          {
+            break;
+          }
+        }
+      }
+      if(_hook != nullptr)
+      {
+        _begin = std::chrono::steady_clock::now();
+      }
+    }
+    void operator()(io_trace_op op, const handle &h, unsigned long long offset, unsigned long long bytes) const noexcept
+    {
+      if(_hook != nullptr)
+      {
+        const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _begin);
+        io_trace_suppressor suppress;
+        _hook(_context, op, h, offset, bytes, duration);
+      }
+    }
+  };
+  template <class BuffersType> inline unsigned long long io_trace_bytes(const BuffersType &buffers) noexcept
+  {
+    unsigned long long ret = 0;
+    for(const auto &b : buffers)
+    {
+      ret += b.size();
+    }
+    return ret;
+  }
+}  // namespace detail
+
+/*! \brief Installs a hook receiving every successful open, read, write, barrier, stat, unlink
+and close performed by LLFIO's blocking i/o, replacing any previous hook. A null `hook`
+removes it.
+
+This is intended for recording i/o traces of a process for later replay. Whilst no hook
+is installed the cost to each operation is a single atomic load. Operations already
+in progress on other threads when the hook is changed may be reported to the old hook,
+but always with the old context. Tracing is compiled out if `LLFIO_LOGGING_LEVEL` is zero.
+*/
+inline void set_io_trace_hook(io_trace_hook hook, void *context = nullptr) noexcept
+{
+  auto &hooks = detail::io_trace_hooks();
+  // Make the sequence odd, which also excludes concurrent callers
+  unsigned seq = hooks.seq.load(std::memory_order_relaxed);
+  do
+  {
+    seq &= ~1U;
+  } while(!hooks.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed));
+  std::atomic_thread_fence(std::memory_order_release);
+  hooks.hook.store(hook, std::memory_order_relaxed);
+  hooks.context.store(context, std::memory_order_relaxed);
+  hooks.seq.store(seq + 2, std::memory_order_release);
+}
+
+LLFIO_V2_NAMESPACE_END
+
+#define LLFIO_LOG_IO_TRACE_BEGIN() ::LLFIO_V2_NAMESPACE::detail::io_trace_timer llfio_io_trace_timer_
+#define LLFIO_LOG_IO_TRACE(op, h, offset, bytes) llfio_io_trace_timer_(::LLFIO_V2_NAMESPACE::io_trace_op::op, (h), (offset), (bytes))
+#define LLFIO_LOG_IO_TRACE_SUPPRESS() ::LLFIO_V2_NAMESPACE::detail::io_trace_suppressor llfio_io_trace_suppressor_
+#else
+#define LLFIO_LOG_IO_TRACE_BEGIN()
+#define LLFIO_LOG_IO_TRACE(op, h, offset, bytes)
+#define LLFIO_LOG_IO_TRACE_SUPPRESS()
+#endif
+
 
 #if !LLFIO_EXPERIMENTAL_STATUS_CODE
 #ifndef LLFIO_DISABLE_PATHS_IN_FAILURE_INFO
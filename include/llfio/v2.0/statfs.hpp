@@ -63,7 +63,7 @@ filing system for your handle reports a `dev_t` from `fstat()` which does not
 match anything in the system's disk hardware i/o stats. As this can be completely
 benign (e.g. your handle is a socket), this is treated as a soft failure.
 
-Note for `f_iosinprogress` and `f_iosbusytime` that support is not implemented yet
+Note for `f_iosinprogress`, `f_iosbusytime` and `f_ioslatency` that support is not implemented yet
 outside Microsoft Windows and Linux. Note also that for Linux, filing systems
 spanning multiple hardware devices have undefined outcomes, whereas on Windows
 you are given the average of the values for all underlying hardware devices.
@@ -104,6 +104,7 @@ struct LLFIO_DECL statfs_t
 
   uint32_t f_iosinprogress{_allbits1_32}; /*!< i/o's currently in progress (i.e. queue depth)  (Windows, Linux) */
   float f_iosbusytime{_allbits1_float};   /*!< percentage of time spent doing i/o (1.0 = 100%) (Windows, Linux) */
+  float f_ioslatency{_allbits1_float};    /*!< mean seconds to complete each i/o since the last reading, zero if none completed (Windows, Linux) */
 
   //! Used to indicate what metadata should be filled in
   QUICKCPPLIB_BITFIELD_BEGIN(want){flags = 1 << 0,
@@ -122,6 +123,7 @@ struct LLFIO_DECL statfs_t
                                    mntonname = 1 << 13,
                                    iosinprogress = 1 << 14,
                                    iosbusytime = 1 << 15,
+                                   ioslatency = 1 << 16,
                                    all = static_cast<unsigned>(-1)} QUICKCPPLIB_BITFIELD_END(want)
   //! Constructs a default initialised instance (all bits set)
   statfs_t()
@@ -143,8 +145,14 @@ struct LLFIO_DECL statfs_t
   LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<size_t> fill(const handle &h, want wanted = want::all) noexcept;
 
 private:
+  struct _ios_t
+  {
+    uint32_t iosinprogress;
+    float iosbusytime;
+    float ioslatency;
+  };
   // Implemented in file_handle.ipp on Windows, otherwise in statfs.ipp
-  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<std::pair<uint32_t, float>> _fill_ios(const handle &h, const std::string &mntfromname) noexcept;
+  static LLFIO_HEADERS_ONLY_MEMFUNC_SPEC result<_ios_t> _fill_ios(const handle &h, const std::string &mntfromname) noexcept;
 };
 
 LLFIO_V2_NAMESPACE_END
@@ -26,6 +26,7 @@ Distributed under the Boost Software License, Version 1.0.
 #define LLFIO_STORAGE_PROFILE_H
 
 #include "io_handle.hpp"
+#include "storage_profile_cache.hpp"
 
 #if LLFIO_EXPERIMENTAL_STATUS_CODE
 #include "outcome/experimental/status_outcome.hpp"
@@ -221,8 +222,18 @@ namespace storage_profile
     LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> write_qd1(storage_profile &sp, file_handle &srch) noexcept;
     LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> read_qd16(storage_profile &sp, file_handle &srch) noexcept;
     LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> write_qd16(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> read_qd32(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> write_qd32(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> read_qd128(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> write_qd128(storage_profile &sp, file_handle &srch) noexcept;
     LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> readwrite_qd4(storage_profile &sp, file_handle &srch) noexcept;
   }
+  namespace throughput
+  {
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> read_sweep(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> write_sweep(storage_profile &sp, file_handle &srch) noexcept;
+    LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> mixed_sweep(storage_profile &sp, file_handle &srch) noexcept;
+  }
   namespace response_time
   {
     LLFIO_HEADERS_ONLY_FUNC_SPEC outcome<void> traversal_warm_racefree_0b(storage_profile &sp, file_handle &srch) noexcept;
@@ -347,6 +358,25 @@ namespace storage_profile
     item<unsigned long long> read_qd16_95 = {"latency:read:qd16:95%", latency::read_qd16, "The nanoseconds to read 4Kb at a queue depth of 16 (95% of the time)"};
     item<unsigned long long> read_qd16_99 = {"latency:read:qd16:99%", latency::read_qd16, "The nanoseconds to read 4Kb at a queue depth of 16 (99% of the time)"};
     item<unsigned long long> read_qd16_99999 = {"latency:read:qd16:99.999%", latency::read_qd16, "The nanoseconds to read 4Kb at a queue depth of 16 (99.999% of the time)"};
+    item<unsigned long long> read_qd16_iops = {"latency:read:qd16:iops", latency::read_qd16, "The 4Kb reads per second completed at a queue depth of 16"};
+
+    item<unsigned long long> read_qd32_min = {"latency:read:qd32:min", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (min)"};
+    item<unsigned long long> read_qd32_mean = {"latency:read:qd32:mean", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (arithmetic mean)"};
+    item<unsigned long long> read_qd32_max = {"latency:read:qd32:max", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (max)"};
+    item<unsigned long long> read_qd32_50 = {"latency:read:qd32:50%", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (50% of the time)"};
+    item<unsigned long long> read_qd32_95 = {"latency:read:qd32:95%", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (95% of the time)"};
+    item<unsigned long long> read_qd32_99 = {"latency:read:qd32:99%", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (99% of the time)"};
+    item<unsigned long long> read_qd32_99999 = {"latency:read:qd32:99.999%", latency::read_qd32, "The nanoseconds to read 4Kb at a queue depth of 32 (99.999% of the time)"};
+    item<unsigned long long> read_qd32_iops = {"latency:read:qd32:iops", latency::read_qd32, "The 4Kb reads per second completed at a queue depth of 32"};
+
+    item<unsigned long long> read_qd128_min = {"latency:read:qd128:min", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (min)"};
+    item<unsigned long long> read_qd128_mean = {"latency:read:qd128:mean", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (arithmetic mean)"};
+    item<unsigned long long> read_qd128_max = {"latency:read:qd128:max", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (max)"};
+    item<unsigned long long> read_qd128_50 = {"latency:read:qd128:50%", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (50% of the time)"};
+    item<unsigned long long> read_qd128_95 = {"latency:read:qd128:95%", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (95% of the time)"};
+    item<unsigned long long> read_qd128_99 = {"latency:read:qd128:99%", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (99% of the time)"};
+    item<unsigned long long> read_qd128_99999 = {"latency:read:qd128:99.999%", latency::read_qd128, "The nanoseconds to read 4Kb at a queue depth of 128 (99.999% of the time)"};
+    item<unsigned long long> read_qd128_iops = {"latency:read:qd128:iops", latency::read_qd128, "The 4Kb reads per second completed at a queue depth of 128"};
 
     item<unsigned> write_nothing = {"latency:write:nothing", latency::write_nothing, "The nanoseconds to write zero bytes"};
 
@@ -365,6 +395,25 @@ namespace storage_profile
     item<unsigned long long> write_qd16_95 = {"latency:write:qd16:95%", latency::write_qd16, "The nanoseconds to write 4Kb at a queue depth of 16 (95% of the time)"};
     item<unsigned long long> write_qd16_99 = {"latency:write:qd16:99%", latency::write_qd16, "The nanoseconds to write 4Kb at a queue depth of 16 (99% of the time)"};
     item<unsigned long long> write_qd16_99999 = {"latency:write:qd16:99.999%", latency::write_qd16, "The nanoseconds to write 4Kb at a queue depth of 16 (99.999% of the time)"};
+    item<unsigned long long> write_qd16_iops = {"latency:write:qd16:iops", latency::write_qd16, "The 4Kb writes per second completed at a queue depth of 16"};
+
+    item<unsigned long long> write_qd32_min = {"latency:write:qd32:min", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (min)"};
+    item<unsigned long long> write_qd32_mean = {"latency:write:qd32:mean", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (arithmetic mean)"};
+    item<unsigned long long> write_qd32_max = {"latency:write:qd32:max", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (max)"};
+    item<unsigned long long> write_qd32_50 = {"latency:write:qd32:50%", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (50% of the time)"};
+    item<unsigned long long> write_qd32_95 = {"latency:write:qd32:95%", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (95% of the time)"};
+    item<unsigned long long> write_qd32_99 = {"latency:write:qd32:99%", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (99% of the time)"};
+    item<unsigned long long> write_qd32_99999 = {"latency:write:qd32:99.999%", latency::write_qd32, "The nanoseconds to write 4Kb at a queue depth of 32 (99.999% of the time)"};
+    item<unsigned long long> write_qd32_iops = {"latency:write:qd32:iops", latency::write_qd32, "The 4Kb writes per second completed at a queue depth of 32"};
+
+    item<unsigned long long> write_qd128_min = {"latency:write:qd128:min", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (min)"};
+    item<unsigned long long> write_qd128_mean = {"latency:write:qd128:mean", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (arithmetic mean)"};
+    item<unsigned long long> write_qd128_max = {"latency:write:qd128:max", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (max)"};
+    item<unsigned long long> write_qd128_50 = {"latency:write:qd128:50%", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (50% of the time)"};
+    item<unsigned long long> write_qd128_95 = {"latency:write:qd128:95%", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (95% of the time)"};
+    item<unsigned long long> write_qd128_99 = {"latency:write:qd128:99%", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (99% of the time)"};
+    item<unsigned long long> write_qd128_99999 = {"latency:write:qd128:99.999%", latency::write_qd128, "The nanoseconds to write 4Kb at a queue depth of 128 (99.999% of the time)"};
+    item<unsigned long long> write_qd128_iops = {"latency:write:qd128:iops", latency::write_qd128, "The 4Kb writes per second completed at a queue depth of 128"};
 
     item<unsigned long long> readwrite_qd4_min = {"latency:readwrite:qd4:min", latency::readwrite_qd4, "The nanoseconds to 75% read 25% write 4Kb at a total queue depth of 4 (min)"};
     item<unsigned long long> readwrite_qd4_mean = {"latency:readwrite:qd4:mean", latency::readwrite_qd4, "The nanoseconds to 75% read 25% write 4Kb at a total queue depth of 4 (arithmetic mean)"};
@@ -374,6 +423,48 @@ namespace storage_profile
     item<unsigned long long> readwrite_qd4_99 = {"latency:readwrite:qd4:99%", latency::readwrite_qd4, "The nanoseconds to 75% read 25% write 4Kb at a total queue depth of 4 (99% of the time)"};
     item<unsigned long long> readwrite_qd4_99999 = {"latency:readwrite:qd4:99.999%", latency::readwrite_qd4, "The nanoseconds to 75% read 25% write 4Kb at a total queue depth of 4 (99.999% of the time)"};
 
+    item<std::string> read_sweep = {"throughput:read:sweep", throughput::read_sweep, "{block size: {queue depth: [bytes per second, 50% nanoseconds, 99% nanoseconds]}} for random reads"};
+    item<unsigned> read_4k_knee_qd = {"throughput:read:4k:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Kb reads"};
+    item<unsigned long long> read_4k_knee_bytes_per_sec = {"throughput:read:4k:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 4Kb reads at the knee queue depth"};
+    item<unsigned> read_16k_knee_qd = {"throughput:read:16k:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 16Kb reads"};
+    item<unsigned long long> read_16k_knee_bytes_per_sec = {"throughput:read:16k:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 16Kb reads at the knee queue depth"};
+    item<unsigned> read_64k_knee_qd = {"throughput:read:64k:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 64Kb reads"};
+    item<unsigned long long> read_64k_knee_bytes_per_sec = {"throughput:read:64k:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 64Kb reads at the knee queue depth"};
+    item<unsigned> read_256k_knee_qd = {"throughput:read:256k:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 256Kb reads"};
+    item<unsigned long long> read_256k_knee_bytes_per_sec = {"throughput:read:256k:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 256Kb reads at the knee queue depth"};
+    item<unsigned> read_1m_knee_qd = {"throughput:read:1m:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 1Mb reads"};
+    item<unsigned long long> read_1m_knee_bytes_per_sec = {"throughput:read:1m:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 1Mb reads at the knee queue depth"};
+    item<unsigned> read_4m_knee_qd = {"throughput:read:4m:knee_qd", throughput::read_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Mb reads"};
+    item<unsigned long long> read_4m_knee_bytes_per_sec = {"throughput:read:4m:knee_bytes_per_sec", throughput::read_sweep, "The bytes per second of random 4Mb reads at the knee queue depth"};
+
+    item<std::string> write_sweep = {"throughput:write:sweep", throughput::write_sweep, "{block size: {queue depth: [bytes per second, 50% nanoseconds, 99% nanoseconds]}} for random writes"};
+    item<unsigned> write_4k_knee_qd = {"throughput:write:4k:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Kb writes"};
+    item<unsigned long long> write_4k_knee_bytes_per_sec = {"throughput:write:4k:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 4Kb writes at the knee queue depth"};
+    item<unsigned> write_16k_knee_qd = {"throughput:write:16k:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 16Kb writes"};
+    item<unsigned long long> write_16k_knee_bytes_per_sec = {"throughput:write:16k:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 16Kb writes at the knee queue depth"};
+    item<unsigned> write_64k_knee_qd = {"throughput:write:64k:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 64Kb writes"};
+    item<unsigned long long> write_64k_knee_bytes_per_sec = {"throughput:write:64k:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 64Kb writes at the knee queue depth"};
+    item<unsigned> write_256k_knee_qd = {"throughput:write:256k:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 256Kb writes"};
+    item<unsigned long long> write_256k_knee_bytes_per_sec = {"throughput:write:256k:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 256Kb writes at the knee queue depth"};
+    item<unsigned> write_1m_knee_qd = {"throughput:write:1m:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 1Mb writes"};
+    item<unsigned long long> write_1m_knee_bytes_per_sec = {"throughput:write:1m:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 1Mb writes at the knee queue depth"};
+    item<unsigned> write_4m_knee_qd = {"throughput:write:4m:knee_qd", throughput::write_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Mb writes"};
+    item<unsigned long long> write_4m_knee_bytes_per_sec = {"throughput:write:4m:knee_bytes_per_sec", throughput::write_sweep, "The bytes per second of random 4Mb writes at the knee queue depth"};
+
+    item<std::string> mixed_sweep = {"throughput:mixed:sweep", throughput::mixed_sweep, "{block size: {queue depth: [bytes per second, 50% nanoseconds, 99% nanoseconds]}} for random 75% read 25% write i/o"};
+    item<unsigned> mixed_4k_knee_qd = {"throughput:mixed:4k:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Kb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_4k_knee_bytes_per_sec = {"throughput:mixed:4k:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 4Kb 75% read 25% write i/o at the knee queue depth"};
+    item<unsigned> mixed_16k_knee_qd = {"throughput:mixed:16k:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 16Kb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_16k_knee_bytes_per_sec = {"throughput:mixed:16k:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 16Kb 75% read 25% write i/o at the knee queue depth"};
+    item<unsigned> mixed_64k_knee_qd = {"throughput:mixed:64k:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 64Kb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_64k_knee_bytes_per_sec = {"throughput:mixed:64k:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 64Kb 75% read 25% write i/o at the knee queue depth"};
+    item<unsigned> mixed_256k_knee_qd = {"throughput:mixed:256k:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 256Kb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_256k_knee_bytes_per_sec = {"throughput:mixed:256k:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 256Kb 75% read 25% write i/o at the knee queue depth"};
+    item<unsigned> mixed_1m_knee_qd = {"throughput:mixed:1m:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 1Mb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_1m_knee_bytes_per_sec = {"throughput:mixed:1m:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 1Mb 75% read 25% write i/o at the knee queue depth"};
+    item<unsigned> mixed_4m_knee_qd = {"throughput:mixed:4m:knee_qd", throughput::mixed_sweep, "The queue depth past which doubling it gains less than 10% more throughput for random 4Mb 75% read 25% write i/o"};
+    item<unsigned long long> mixed_4m_knee_bytes_per_sec = {"throughput:mixed:4m:knee_bytes_per_sec", throughput::mixed_sweep, "The bytes per second of random 4Mb 75% read 25% write i/o at the knee queue depth"};
+
     item<unsigned long long> create_file_warm_racefree_0b = {"response_time:race_free:warm_cache:create_file:0b", response_time::traversal_warm_racefree_0b, "The average nanoseconds to create a 0 byte file (warm cache, race free)"};
     item<unsigned long long> enumerate_file_warm_racefree_0b = {"response_time:race_free:warm_cache:enumerate_file:0b", response_time::traversal_warm_racefree_0b, "The average nanoseconds to enumerate a 0 byte file (warm cache, race free)"};
     item<unsigned long long> open_file_read_warm_racefree_0b = {"response_time:race_free:warm_cache:open_file_read:0b", response_time::traversal_warm_racefree_0b, "The average nanoseconds to open a 0 byte file for reading (warm cache, race free)"};
@@ -398,6 +489,12 @@ namespace storage_profile
     item<unsigned> delete_1M_files = {"response_time:delete_1M_files_single_dir", response_time::traversal_warm_nonracefree_1M, "The milliseconds to delete 1M files in a single directory"};
     */
   };
+
+  /*! \brief Replaces the cached profile of the storage device and filing system on which `h`
+  resides with `by_caching`, indexed as `fs-probe` permutes caching strategies (bit 0 set is
+  direct i/o, bit 1 set is synchronous i/o).
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<void> store_cached_profile(const file_handle &h, span<const storage_profile> by_caching) noexcept;
 }  // namespace storage_profile
 
 LLFIO_V2_NAMESPACE_END
@@ -0,0 +1,110 @@
+/* A persisted cache of storage profiles and the i/o parameters they recommend
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#ifndef LLFIO_STORAGE_PROFILE_CACHE_H
+#define LLFIO_STORAGE_PROFILE_CACHE_H
+
+#include "file_handle.hpp"
+
+//! \file storage_profile_cache.hpp Provides a persisted cache of storage profiles
+
+LLFIO_V2_NAMESPACE_EXPORT_BEGIN
+
+namespace storage_profile
+{
+  /*! \brief The i/o parameters recommended for a storage device and filing system.
+
+  If there is no cached profile for the device, `profiled` is false and every member
+  is a conservative default which matches what LLFIO did before profiles were consulted.
+  */
+  struct recommended_io_parameters
+  {
+    //! True if these parameters were derived from a cached profile.
+    bool profiled{false};
+    //! The smallest i/o size reaching within a tenth of peak throughput.
+    size_t io_size{0};
+    //! The queue depth beyond which doubling it gains little throughput at `io_size`, zero if unknown.
+    size_t queue_depth{0};
+    //! The i/o modify quantum guaranteed to be atomically visible to readers, zero if unknown.
+    size_t atomic_rewrite_quantum{0};
+    //! True if uncached i/o (`caching::only_metadata`) was measured as faster than cached i/o.
+    bool direct_io_wins{false};
+    //! The median nanoseconds to read 4Kb at a queue depth of one, zero if unknown.
+    unsigned long long unqueued_read_latency{0};
+  };
+
+  /*! \brief Sets the directory in which the profile cache is kept.
+
+  The default is `path_discovery::storage_backed_temporary_files_directory()`, which an
+  invalid `dir` restores. Profiles already loaded into memory are discarded.
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<void> set_profile_cache_directory(const path_handle &dir) noexcept;
+
+  /*! \brief Returns the i/o parameters recommended for the storage device and filing
+  system on which `h` resides.
+
+  The cache is a single YAML file named `llfio_storage_profiles.yaml` holding one
+  document per device, keyed by the filing system id (`statfs_t::f_fsid`), or the mount
+  source (`statfs_t::f_mntfromname`) where there is none, and the filing system name
+  (`statfs_t::f_fstypename`). Unlike device ids, these survive reboots and the device
+  being plugged in elsewhere. Each document has the layout written by `fs-probe`, with a
+  section of results per caching strategy. The file is read once per process, and the
+  key is looked up once per device per process, so after the first call this is a map
+  lookup under a mutex.
+
+  The recommendations are derived from the `throughput:mixed` sweep if present, else the
+  `throughput:read` sweep. If the device sustained more throughput with `direct=1 sync=0`
+  than with `direct=0 sync=0`, direct i/o wins and the remaining parameters come from the
+  direct results.
+
+  \mallocs The first call per process reads the whole cache file into memory.
+  \errors Any error from `statfs_t::fill()`. A missing or unreadable cache is not an
+  error, the defaults are returned instead.
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<recommended_io_parameters> recommended_parameters(const file_handle &h) noexcept;
+
+  /*! \brief Returns the largest of each i/o parameter recommended for any device in the
+  profile cache, for sizing resources which are shared between devices.
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC recommended_io_parameters recommended_parameters() noexcept;
+
+  /*! \brief Replaces the cached profile of the storage device and filing system on which `h`
+  resides with `yaml`, which ought to have the layout written by `fs-probe`.
+
+  The cache file is rewritten to a temporary file which is then atomically renamed over
+  the original, so concurrent readers never see a partial cache. Concurrent writers from
+  different processes may lose one another's updates.
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC result<void> store_cached_profile(const file_handle &h, const std::string &yaml) noexcept;
+}  // namespace storage_profile
+
+LLFIO_V2_NAMESPACE_END
+
+#if LLFIO_HEADERS_ONLY == 1 && !defined(DOXYGEN_SHOULD_SKIP_THIS)
+#define LLFIO_INCLUDED_BY_HEADER 1
+#include "detail/impl/storage_profile_cache.ipp"
+#undef LLFIO_INCLUDED_BY_HEADER
+#endif
+
+#endif
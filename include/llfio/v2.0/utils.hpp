@@ -194,6 +194,19 @@ namespace utils
   LLFIO_HEADERS_ONLY_FUNC_SPEC bool running_under_wsl() noexcept;
 #endif
 
+  /*! \brief Returns the number of CPUs the calling process can actually make use of.
+
+  This is the lesser of `std::thread::hardware_concurrency()` and the count of CPUs
+  in the process' affinity mask. On Linux, if the process is within a cgroup which
+  restricts CPU, it is also no more than the cgroup's `cpuset.cpus.effective`, and
+  the cgroup's `cpu.max` quota divided by its period rounded up (or the cgroup v1
+  `cpu.cfs_quota_us` equivalent), for the cgroup and all its ancestors.
+
+  As these can change at any time, the value is recalculated if more than one
+  second has passed since the last calculation. Never returns less than one.
+  */
+  LLFIO_HEADERS_ONLY_FUNC_SPEC unsigned effective_cpu_concurrency() noexcept;
+
   /*! \brief Memory usage statistics for a process.
    */
   struct process_memory_usage
@@ -0,0 +1,581 @@
+/* Shared timing, histogram and JSON reporting for the benchmark programs
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#ifndef BENCHMARK_HARNESS_HPP
+#define BENCHMARK_HARNESS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace benchmark_harness
+{
+  //! Returns the CPU's tick counter, or the steady clock in nanoseconds on CPUs without one.
+  inline uint64_t ticksclock()
+  {
+#ifdef _MSC_VER
+#if defined(_M_X64) || defined(_M_IX86)
+    unsigned x;
+    return (uint64_t) __rdtscp(&x);
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned lo, hi, aux;
+    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+    return (uint64_t) lo | ((uint64_t) hi << 32);
+#elif defined(__aarch64__)
+    uint64_t count;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(count));
+    return count;
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  //! How `ticksclock()` relates to wall time, measured once per process.
+  struct clock_calibration
+  {
+    //! Picoseconds per tick.
+    double ps_per_tick{0};
+    //! Ticks taken by a back to back pair of `ticksclock()` calls, which is subtracted from every sample.
+    uint64_t overhead_ticks{0};
+  };
+
+  /*! \brief Returns the calibration of `ticksclock()`, busy waiting a quarter of a second
+  against the steady clock the first time it is called.
+  */
+  inline const clock_calibration &calibration()
+  {
+    static const clock_calibration ret = [] {
+      clock_calibration c;
+      const auto begin = std::chrono::steady_clock::now();
+      auto end = begin;
+      const uint64_t _begin = ticksclock();
+      do
+      {
+        end = std::chrono::steady_clock::now();
+      } while(end - begin < std::chrono::milliseconds(250));
+      const uint64_t _end = ticksclock();
+      c.ps_per_tick = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() * 1000.0 / (double) (_end - _begin);
+      // Take the least of many, as any one pair may be interrupted
+      c.overhead_ticks = (uint64_t) -1;
+      for(size_t n = 0; n < 1000; n++)
+      {
+        volatile uint64_t a = ticksclock();
+        volatile uint64_t b = ticksclock();
+        c.overhead_ticks = std::min(c.overhead_ticks, (uint64_t) (b - a));
+      }
+      return c;
+    }();
+    return ret;
+  }
+
+  //! Converts an interval measured by `ticksclock()` into picoseconds, less the cost of reading the clock.
+  inline uint64_t ticks_to_ps(uint64_t ticks)
+  {
+    const auto &c = calibration();
+    return (ticks > c.overhead_ticks) ? (uint64_t) ((double) (ticks - c.overhead_ticks) * c.ps_per_tick) : 0;
+  }
+
+  //! Returns nanoseconds since an arbitrary epoch, as measured by `ticksclock()`.
+  inline uint64_t nanoclock()
+  {
+    const auto &c = calibration();
+    return (uint64_t) ((double) ticksclock() * c.ps_per_tick / 1000.0);
+  }
+
+  /*! \brief A log-linear histogram of picosecond durations.
+
+  Values below 32 are counted exactly, above that each power of two is divided into 32
+  buckets, so any percentile is accurate to within about 3%. The exact minimum, maximum
+  and mean are kept alongside. Unlike sorting every sample, memory use is fixed no matter
+  how long a benchmark runs.
+  */
+  class histogram
+  {
+    static constexpr unsigned _sub_bucket_bits = 5;
+    static constexpr uint64_t _sub_buckets = 1ULL << _sub_bucket_bits;
+
+    std::vector<uint64_t> _counts;
+    uint64_t _count{0}, _min{(uint64_t) -1}, _max{0};
+    double _sum{0};
+
+    static size_t _index(uint64_t v) noexcept
+    {
+      if(v < _sub_buckets)
+      {
+        return (size_t) v;
+      }
+      unsigned msb = 0;
+      for(uint64_t x = v; x > 1; x >>= 1)
+      {
+        msb++;
+      }
+      const unsigned shift = msb - _sub_bucket_bits;
+      return (size_t) (shift + 1) * _sub_buckets + (size_t) ((v >> shift) & (_sub_buckets - 1));
+    }
+    static double _midpoint(size_t idx) noexcept
+    {
+      if(idx < _sub_buckets)
+      {
+        return (double) idx;
+      }
+      const size_t shift = idx / _sub_buckets - 1;
+      const double low = (double) ((_sub_buckets + idx % _sub_buckets) << shift);
+      return low + (double) (1ULL << shift) / 2.0;
+    }
+
+  public:
+    histogram()
+        : _counts((64 - _sub_bucket_bits + 1) * _sub_buckets)
+    {
+    }
+
+    //! Records a duration in picoseconds
+    void record(uint64_t ps) noexcept
+    {
+      _counts[_index(ps)]++;
+      _count++;
+      _sum += (double) ps;
+      _min = std::min(_min, ps);
+      _max = std::max(_max, ps);
+    }
+    //! Adds all the records of another histogram to this one
+    void merge(const histogram &o) noexcept
+    {
+      for(size_t n = 0; n < _counts.size(); n++)
+      {
+        _counts[n] += o._counts[n];
+      }
+      _count += o._count;
+      _sum += o._sum;
+      _min = std::min(_min, o._min);
+      _max = std::max(_max, o._max);
+    }
+    //! The number of records
+    uint64_t count() const noexcept { return _count; }
+    //! The least record in nanoseconds
+    double min() const noexcept { return (_count == 0) ? 0 : (double) _min / 1000.0; }
+    //! The greatest record in nanoseconds
+    double max() const noexcept { return (double) _max / 1000.0; }
+    //! The mean record in nanoseconds
+    double mean() const noexcept { return (_count == 0) ? 0 : _sum / (double) _count / 1000.0; }
+    //! The record at fraction `p` of the way through the sorted records, in nanoseconds
+    double percentile(double p) const noexcept
+    {
+      if(_count == 0)
+      {
+        return 0;
+      }
+      const auto target = (uint64_t) std::ceil(p * (double) _count);
+      uint64_t seen = 0;
+      for(size_t n = 0; n < _counts.size(); n++)
+      {
+        seen += _counts[n];
+        if(seen >= target && _counts[n] > 0)
+        {
+          return std::min(std::max(_midpoint(n), (double) _min), (double) _max) / 1000.0;
+        }
+      }
+      return max();
+    }
+  };
+
+  //! The summary of one benchmark. All times are nanoseconds per operation.
+  struct result
+  {
+    std::string name;
+    uint64_t iterations{0};
+    //! Bytes transferred per operation, zero if not applicable
+    uint64_t bytes{0};
+    double min{0}, mean{0}, p50{0}, p90{0}, p99{0}, p999{0}, max{0};
+
+    result() = default;
+    result(std::string _name, const histogram &h, uint64_t _iterations, uint64_t _bytes = 0)
+        : name(std::move(_name))
+        , iterations(_iterations)
+        , bytes(_bytes)
+        , min(h.min())
+        , mean(h.mean())
+        , p50(h.percentile(0.5))
+        , p90(h.percentile(0.9))
+        , p99(h.percentile(0.99))
+        , p999(h.percentile(0.999))
+        , max(h.max())
+    {
+    }
+  };
+
+  /*! \brief Repeatedly calls `f` for `duration`, returning the distribution of the time taken
+  per call.
+
+  Operations much quicker than the clock would be swamped by reading it, so a warm up
+  first finds how many calls take at least a microsecond, and each sample then times that
+  many calls back to back and records their average. Slow operations are thus timed
+  individually, whereas for quick ones the tail percentiles are smoothed.
+  */
+  template <class F> inline result run(std::string name, std::chrono::nanoseconds duration, uint64_t bytes, F &&f)
+  {
+    const auto &c = calibration();
+    uint64_t batch = 1;
+    for(;;)
+    {
+      const auto begin = ticksclock();
+      for(uint64_t n = 0; n < batch; n++)
+      {
+        f();
+      }
+      const auto end = ticksclock();
+      if(ticks_to_ps(end - begin) >= 1000000 || batch >= (1U << 20))
+      {
+        break;
+      }
+      batch *= 2;
+    }
+    histogram h;
+    uint64_t iterations = 0;
+    const auto until = ticksclock() + (uint64_t) ((double) duration.count() * 1000.0 / c.ps_per_tick);
+    uint64_t end;
+    do
+    {
+      const auto begin = ticksclock();
+      for(uint64_t n = 0; n < batch; n++)
+      {
+        f();
+      }
+      end = ticksclock();
+      h.record(ticks_to_ps(end - begin) / batch);
+      iterations += batch;
+    } while(end < until);
+    return result(std::move(name), h, iterations, bytes);
+  }
+
+  //! Writes results as JSON, one benchmark per line.
+  inline void write_json(std::ostream &s, const char *program, const std::vector<result> &results)
+  {
+    const auto escape = [](const std::string &v) {
+      std::string ret;
+      for(char c : v)
+      {
+        if(c == '"' || c == '\\')
+        {
+          ret.push_back('\\');
+        }
+        ret.push_back(c);
+      }
+      return ret;
+    };
+    char date[64] = "";
+    const time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    const auto flags = s.flags();
+    const auto precision = s.precision();
+    s << "{\n  \"context\": {\"program\": \"" << escape(program) << "\", \"date\": \"" << date << "\"},\n  \"benchmarks\": [";
+    s << std::setprecision(1) << std::fixed;
+    for(size_t n = 0; n < results.size(); n++)
+    {
+      const auto &r = results[n];
+      s << (n > 0 ? "," : "") << "\n    {\"name\": \"" << escape(r.name) << "\", \"iterations\": " << r.iterations << ", \"bytes\": " << r.bytes
+        << ", \"min_ns\": " << r.min << ", \"mean_ns\": " << r.mean << ", \"p50_ns\": " << r.p50 << ", \"p90_ns\": " << r.p90 << ", \"p99_ns\": " << r.p99
+        << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.max << "}";
+    }
+    s << "\n  ]\n}\n";
+    s.flags(flags);
+    s.precision(precision);
+  }
+
+  namespace detail
+  {
+    // Just enough of a JSON parser to read back what write_json() writes, in whatever formatting
+    struct json_value
+    {
+      enum class kind
+      {
+        null,
+        boolean,
+        number,
+        string,
+        array,
+        object
+      } type{kind::null};
+      double number{0};
+      std::string string;
+      std::vector<json_value> array;
+      std::vector<std::string> keys;
+      std::vector<json_value> values;
+
+      const json_value *find(const char *key) const
+      {
+        for(size_t n = 0; n < keys.size(); n++)
+        {
+          if(keys[n] == key)
+          {
+            return &values[n];
+          }
+        }
+        return nullptr;
+      }
+    };
+    class json_parser
+    {
+      const char *_p, *_end;
+
+      [[noreturn]] void _fail(const char *what) const { throw std::runtime_error(std::string("Malformed JSON: ") + what); }
+      void _skip()
+      {
+        while(_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n'))
+        {
+          ++_p;
+        }
+      }
+      void _expect(char c)
+      {
+        _skip();
+        if(_p >= _end || *_p != c)
+        {
+          _fail("unexpected character");
+        }
+        ++_p;
+      }
+      std::string _string()
+      {
+        _expect('"');
+        std::string ret;
+        while(_p < _end && *_p != '"')
+        {
+          if(*_p == '\\' && _p + 1 < _end)
+          {
+            ++_p;
+          }
+          ret.push_back(*_p++);
+        }
+        _expect('"');
+        return ret;
+      }
+
+    public:
+      json_parser(const char *begin, const char *end)
+          : _p(begin)
+          , _end(end)
+      {
+      }
+      json_value value()
+      {
+        json_value ret;
+        _skip();
+        if(_p >= _end)
+        {
+          _fail("unexpected end");
+        }
+        if(*_p == '{')
+        {
+          ret.type = json_value::kind::object;
+          ++_p;
+          _skip();
+          if(_p < _end && *_p == '}')
+          {
+            ++_p;
+            return ret;
+          }
+          do
+          {
+            ret.keys.push_back(_string());
+            _expect(':');
+            ret.values.push_back(value());
+            _skip();
+          } while(_p < _end && *_p == ',' && ++_p);
+          _expect('}');
+        }
+        else if(*_p == '[')
+        {
+          ret.type = json_value::kind::array;
+          ++_p;
+          _skip();
+          if(_p < _end && *_p == ']')
+          {
+            ++_p;
+            return ret;
+          }
+          do
+          {
+            ret.array.push_back(value());
+            _skip();
+          } while(_p < _end && *_p == ',' && ++_p);
+          _expect(']');
+        }
+        else if(*_p == '"')
+        {
+          ret.type = json_value::kind::string;
+          ret.string = _string();
+        }
+        else if(_end - _p >= 4 && (0 == memcmp(_p, "true", 4) || 0 == memcmp(_p, "null", 4)))
+        {
+          ret.type = (*_p == 't') ? json_value::kind::boolean : json_value::kind::null;
+          ret.number = (*_p == 't') ? 1 : 0;
+          _p += 4;
+        }
+        else if(_end - _p >= 5 && 0 == memcmp(_p, "false", 5))
+        {
+          ret.type = json_value::kind::boolean;
+          _p += 5;
+        }
+        else
+        {
+          ret.type = json_value::kind::number;
+          std::string digits;
+          while(_p < _end && strchr("+-.0123456789eE", *_p) != nullptr)
+          {
+            digits.push_back(*_p++);
+          }
+          if(digits.empty())
+          {
+            _fail("unexpected character");
+          }
+          ret.number = std::stod(digits);
+        }
+        return ret;
+      }
+    };
+  }  // namespace detail
+
+  //! Reads results previously written by `write_json()`, throwing if the file cannot be parsed.
+  inline std::vector<result> read_json(const std::string &path)
+  {
+    std::ifstream s(path, std::ios::binary);
+    if(!s)
+    {
+      throw std::runtime_error("Could not open " + path);
+    }
+    std::stringstream buffer;
+    buffer << s.rdbuf();
+    const std::string contents = buffer.str();
+    const auto root = detail::json_parser(contents.data(), contents.data() + contents.size()).value();
+    const auto *benchmarks = root.find("benchmarks");
+    if(benchmarks == nullptr || benchmarks->type != detail::json_value::kind::array)
+    {
+      throw std::runtime_error(path + " has no benchmarks array");
+    }
+    std::vector<result> ret;
+    for(const auto &i : benchmarks->array)
+    {
+      const auto number = [&](const char *key) {
+        const auto *v = i.find(key);
+        return (v != nullptr) ? v->number : 0.0;
+      };
+      const auto *name = i.find("name");
+      if(name == nullptr)
+      {
+        continue;
+      }
+      result r;
+      r.name = name->string;
+      r.iterations = (uint64_t) number("iterations");
+      r.bytes = (uint64_t) number("bytes");
+      r.min = number("min_ns");
+      r.mean = number("mean_ns");
+      r.p50 = number("p50_ns");
+      r.p90 = number("p90_ns");
+      r.p99 = number("p99_ns");
+      r.p999 = number("p999_ns");
+      r.max = number("max_ns");
+      ret.push_back(std::move(r));
+    }
+    return ret;
+  }
+
+  /*! \brief Prints how each of `current` differs from the identically named benchmark in
+  `baseline`, returning how many are slower by more than `threshold` (e.g. 0.1 for 10%) plus
+  how many in `baseline` are missing from `current`.
+
+  The median is compared as it is much less disturbed by the odd preemption than the mean. A
+  benchmark which failed or was dropped counts as a regression, as it can no longer be tracked.
+  */
+  inline size_t compare(std::ostream &s, const std::vector<result> &baseline, const std::vector<result> &current, double threshold)
+  {
+    const auto flags = s.flags();
+    const auto precision = s.precision();
+    size_t regressions = 0;
+    size_t namewidth = 4;
+    for(const auto &r : current)
+    {
+      namewidth = std::max(namewidth, r.name.size());
+    }
+    for(const auto &b : baseline)
+    {
+      namewidth = std::max(namewidth, b.name.size());
+    }
+    s << std::left << std::setw((int) namewidth) << "name"
+      << "  " << std::right << std::setw(14) << "baseline p50" << std::setw(14) << "current p50" << std::setw(10) << "change" << std::endl;
+    s << std::setprecision(1) << std::fixed;
+    for(const auto &r : current)
+    {
+      auto it = std::find_if(baseline.begin(), baseline.end(), [&](const result &b) { return b.name == r.name; });
+      s << std::left << std::setw((int) namewidth) << r.name << "  " << std::right;
+      if(it == baseline.end() || it->p50 <= 0)
+      {
+        s << std::setw(14) << "-" << std::setw(14) << r.p50 << std::setw(10) << "new" << std::endl;
+        continue;
+      }
+      const double change = (r.p50 - it->p50) / it->p50;
+      s << std::setw(14) << it->p50 << std::setw(14) << r.p50 << std::setw(9) << std::showpos << change * 100.0 << std::noshowpos << "%";
+      if(change > threshold)
+      {
+        s << "  REGRESSED";
+        regressions++;
+      }
+      s << std::endl;
+    }
+    for(const auto &b : baseline)
+    {
+      if(current.end() != std::find_if(current.begin(), current.end(), [&](const result &r) { return r.name == b.name; }))
+      {
+        continue;
+      }
+      s << std::left << std::setw((int) namewidth) << b.name << "  " << std::right << std::setw(14) << b.p50 << std::setw(14) << "-" << std::setw(10) << "missing"
+        << "  MISSING" << std::endl;
+      regressions++;
+    }
+    s.flags(flags);
+    s.precision(precision);
+    return regressions;
+  }
+}  // namespace benchmark_harness
+
+#endif
@@ -0,0 +1,374 @@
+/* Microbenchmarks of the core handle hot paths, with regression tracking
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+/* Usage: benchmark-harness [--filter <regex>] [--duration <ms>] [--output <results.json>]
+                            [--compare <baseline.json>] [--threshold <percent>]
+
+Each benchmark runs for --duration milliseconds (default 1000), and results are
+written as JSON to --output (default stdout). With --compare, each median is compared
+to the baseline's and the exit code is 1 if any is more than --threshold percent
+(default 10) slower, or if any benchmark in the baseline which --filter selects did not
+produce a result. A typical use is to save a baseline before upgrading:
+
+  benchmark-harness --output baseline.json
+  ... upgrade ...
+  benchmark-harness --output current.json --compare baseline.json
+*/
+
+#define LLFIO_ENABLE_TEST_IO_MULTIPLEXERS 1
+
+#include "../../include/llfio/llfio.hpp"
+
+#include "include/benchmark_harness.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <vector>
+
+namespace llfio = LLFIO_V2_NAMESPACE;
+using benchmark_harness::result;
+
+static constexpr size_t testfile_size = 16 * 1024 * 1024;
+static constexpr size_t directory_entries = 256;
+
+struct benchmark_context
+{
+  llfio::directory_handle workdir;
+  llfio::file_handle testfile;
+  llfio::directory_handle testdir;
+  std::chrono::milliseconds duration{1000};
+};
+
+struct benchmark
+{
+  const char *name;
+  std::function<std::vector<result>(benchmark_context &ctx, const std::string &name)> run;
+};
+
+static std::vector<result> file_handle_io(benchmark_context &ctx, const std::string &name, bool write)
+{
+  std::vector<result> ret;
+  std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> buffer(1024 * 1024);
+  memset(buffer.data(), 0x78, buffer.size());
+  for(size_t bytes : {(size_t) 1, (size_t) 4096, (size_t) 65536, (size_t) 1048576})
+  {
+    llfio::file_handle::extent_type offset = 0;
+    ret.push_back(benchmark_harness::run(name + ":" + std::to_string(bytes), ctx.duration, bytes, [&] {
+      if(write)
+      {
+        ctx.testfile.write(offset, {{buffer.data(), bytes}}).value();
+      }
+      else
+      {
+        ctx.testfile.read(offset, {{buffer.data(), bytes}}).value();
+      }
+      offset = (offset + bytes) % (testfile_size - bytes + 1);
+    }));
+  }
+  return ret;
+}
+
+static std::vector<result> map_handle_map_close(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<result> ret;
+  for(size_t bytes : {(size_t) 4096, (size_t) 65536, (size_t) 1048576})
+  {
+    ret.push_back(benchmark_harness::run(name + ":" + std::to_string(bytes), ctx.duration, bytes, [&] {
+      auto mh = llfio::map_handle::map(bytes).value();
+      mh.close().value();
+    }));
+  }
+  return ret;
+}
+
+static std::vector<result> directory_handle_read(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<llfio::directory_entry> storage(directory_entries * 2);
+  llfio::directory_handle::buffers_type entries({storage.data(), storage.size()});
+  return {benchmark_harness::run(name + ":" + std::to_string(directory_entries), ctx.duration, 0, [&] {
+    // Reuse the kernel buffer from the previous enumeration, as the documentation recommends
+    entries = ctx.testdir.read({llfio::directory_handle::buffers_type({storage.data(), storage.size()}, std::move(entries))}).value();
+    if(entries.size() != directory_entries)
+    {
+      abort();
+    }
+  })};
+}
+
+static std::vector<result> path_view_c_str(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<result> ret;
+  static const llfio::filesystem::path native("some/fairly/typical/relative/path/to/a/file.txt");
+  static const char16_t foreign[] = u"some/fairly/typical/relative/path/to/a/file.txt";
+  // The path is already in the native encoding and zero terminated, so no copy is needed
+  ret.push_back(benchmark_harness::run(name + ":passthrough", ctx.duration, 0, [&] {
+    llfio::path_view v(native);
+    llfio::path_view::c_str<> z(v, llfio::path_view::zero_terminated);
+    if(z.buffer == nullptr)
+    {
+      abort();
+    }
+  }));
+  // Every platform's native encoding differs from UTF-16 in either width or type, so this always converts
+  ret.push_back(benchmark_harness::run(name + ":convert", ctx.duration, 0, [&] {
+    llfio::path_view v(foreign, sizeof(foreign) / sizeof(foreign[0]) - 1, llfio::path_view::zero_terminated);
+    llfio::path_view::c_str<> z(v, llfio::path_view::zero_terminated);
+    if(z.buffer == nullptr)
+    {
+      abort();
+    }
+  }));
+  return ret;
+}
+
+static std::vector<result> stat_t_fill(benchmark_context &ctx, const std::string &name)
+{
+  llfio::stat_t s(nullptr);
+  return {benchmark_harness::run(name, ctx.duration, 0, [&] { s.fill(ctx.testfile).value(); })};
+}
+
+static std::vector<result> statfs_t_fill(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<result> ret;
+  llfio::statfs_t s;
+  ret.push_back(benchmark_harness::run(name + ":all", ctx.duration, 0, [&] { s.fill(ctx.testfile).value(); }));
+  // The free space query is the one most often made in a loop, and avoids enumerating mounts
+  ret.push_back(benchmark_harness::run(name + ":bavail", ctx.duration, 0, [&] { s.fill(ctx.testfile, llfio::statfs_t::want::bavail).value(); }));
+  return ret;
+}
+
+static std::vector<result> lock_acquire_release(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<result> ret;
+  ret.push_back(benchmark_harness::run(name + ":lock_file", ctx.duration, 0, [&] {
+    ctx.testfile.lock_file().value();
+    ctx.testfile.unlock_file();
+  }));
+  ret.push_back(benchmark_harness::run(name + ":lock_file_range:exclusive", ctx.duration, 0, [&] {
+    auto g = ctx.testfile.lock_file_range(0, 4096, llfio::lock_kind::exclusive).value();
+  }));
+  ret.push_back(benchmark_harness::run(name + ":lock_file_range:shared", ctx.duration, 0, [&] {
+    auto g = ctx.testfile.lock_file_range(0, 4096, llfio::lock_kind::shared).value();
+  }));
+  return ret;
+}
+
+/* Initiates a 4Kb read through the multiplexer and polls it to completion, then disposes
+of its state. With the null multiplexer this is the overhead of the multiplexer machinery
+alone, as the read completes immediately.
+*/
+static result multiplexer_round_trip(benchmark_context &ctx, const std::string &name, llfio::io_multiplexer *multiplexer)
+{
+  struct receiver final : llfio::io_multiplexer::io_operation_state_visitor
+  {
+    bool failed{false};
+
+    virtual bool read_completed(llfio::io_multiplexer::io_operation_state::lock_guard & /*unused*/, llfio::io_operation_state_type /*unused*/,
+                                llfio::io_multiplexer::io_result<llfio::io_multiplexer::buffers_type> &&res) override
+    {
+      failed = !res;
+      return false;
+    }
+  } visitor;
+  auto h = llfio::file_handle::file(ctx.workdir, "testfile", llfio::file_handle::mode::read, llfio::file_handle::creation::open_existing,
+                                    llfio::file_handle::caching::all, llfio::file_handle::flag::multiplexable)
+           .value();
+  h.set_multiplexer(multiplexer).value();
+  std::vector<llfio::byte> storage(multiplexer->io_state_requirements().first);
+  llfio::byte buffer[4096];
+  llfio::io_multiplexer::buffer_type b;
+  auto ret = benchmark_harness::run(name, ctx.duration, sizeof(buffer), [&] {
+    b = {buffer, sizeof(buffer)};
+    auto *state = multiplexer->construct_and_init_io_operation({storage.data(), storage.size()}, &h, &visitor, {}, {}, llfio::io_multiplexer::io_request<llfio::io_multiplexer::buffers_type>({&b, 1}, 0));
+    multiplexer->flush_inited_io_operations().value();
+    while(!is_finished(state->current_state()))
+    {
+      multiplexer->check_for_any_completed_io().value();
+    }
+    state->~io_operation_state();
+    if(visitor.failed)
+    {
+      abort();
+    }
+  });
+  h.set_multiplexer(nullptr).value();
+  return ret;
+}
+
+static std::vector<result> io_multiplexer_round_trip(benchmark_context &ctx, const std::string &name)
+{
+  std::vector<result> ret;
+  auto null_multiplexer = llfio::test::multiplexer_null(1, false).value();
+  ret.push_back(multiplexer_round_trip(ctx, name + ":null", null_multiplexer.get()));
+  if(auto *multiplexer = llfio::this_thread::multiplexer())
+  {
+    ret.push_back(multiplexer_round_trip(ctx, name + ":this_thread", multiplexer));
+  }
+  return ret;
+}
+
+static const benchmark benchmarks[] = {
+{"file_handle:read", [](benchmark_context &ctx, const std::string &name) { return file_handle_io(ctx, name, false); }},
+{"file_handle:write", [](benchmark_context &ctx, const std::string &name) { return file_handle_io(ctx, name, true); }},
+{"map_handle:map_close", map_handle_map_close},
+{"directory_handle:read", directory_handle_read},
+{"path_view:c_str", path_view_c_str},
+{"stat_t:fill", stat_t_fill},
+{"statfs_t:fill", statfs_t_fill},
+{"lockable_io_handle:lock_unlock", lock_acquire_release},
+{"io_multiplexer:round_trip", io_multiplexer_round_trip},
+};
+
+int main(int argc, char *argv[])
+{
+  std::regex filter(".*");
+  std::string output, baseline;
+  double threshold = 0.1;
+  benchmark_context ctx;
+  for(int n = 1; n < argc; n++)
+  {
+    auto arg = [&] {
+      if(n + 1 >= argc)
+      {
+        std::cerr << "Option " << argv[n] << " needs a value" << std::endl;
+        exit(2);
+      }
+      return argv[++n];
+    };
+    if(0 == strcmp(argv[n], "--filter"))
+    {
+      try
+      {
+        filter.assign(arg());
+      }
+      catch(...)
+      {
+        std::cerr << "Regex '" << argv[n] << "' is not valid" << std::endl;
+        return 2;
+      }
+    }
+    else if(0 == strcmp(argv[n], "--duration"))
+    {
+      ctx.duration = std::chrono::milliseconds(atoi(arg()));
+    }
+    else if(0 == strcmp(argv[n], "--output"))
+    {
+      output = arg();
+    }
+    else if(0 == strcmp(argv[n], "--compare"))
+    {
+      baseline = arg();
+    }
+    else if(0 == strcmp(argv[n], "--threshold"))
+    {
+      threshold = atof(arg()) / 100.0;
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--filter <regex>] [--duration <ms>] [--output <results.json>] [--compare <baseline.json>] [--threshold <percent>]"
+                << std::endl;
+      return 2;
+    }
+  }
+  std::vector<result> baseline_results;
+  if(!baseline.empty())
+  {
+    try
+    {
+      baseline_results = benchmark_harness::read_json(baseline);
+      // Benchmarks deselected by --filter are not missing
+      baseline_results.erase(std::remove_if(baseline_results.begin(), baseline_results.end(), [&](const result &r) { return !std::regex_search(r.name, filter); }),
+                             baseline_results.end());
+    }
+    catch(const std::exception &e)
+    {
+      std::cerr << e.what() << std::endl;
+      return 2;
+    }
+  }
+
+  ctx.workdir = llfio::directory({}, "llfio_benchmark_harness", llfio::directory_handle::mode::write, llfio::directory_handle::creation::if_needed).value();
+  ctx.testfile = llfio::file_handle::file(ctx.workdir, "testfile", llfio::file_handle::mode::write, llfio::file_handle::creation::if_needed).value();
+  {
+    std::vector<llfio::byte> buffer(testfile_size);
+    memset(buffer.data(), 0x78, buffer.size());
+    ctx.testfile.truncate(testfile_size).value();
+    ctx.testfile.write(0, {{buffer.data(), buffer.size()}}).value();
+  }
+  ctx.testdir = llfio::directory(ctx.workdir, "testdir", llfio::directory_handle::mode::write, llfio::directory_handle::creation::if_needed).value();
+  for(size_t n = 0; n < directory_entries; n++)
+  {
+    llfio::file_handle::file(ctx.testdir, std::to_string(n), llfio::file_handle::mode::write, llfio::file_handle::creation::if_needed).value();
+  }
+
+  std::vector<result> results;
+  for(const auto &b : benchmarks)
+  {
+    if(!std::regex_search(b.name, filter))
+    {
+      continue;
+    }
+    std::cerr << "Running " << b.name << " ..." << std::endl;
+    try
+    {
+      for(auto &r : b.run(ctx, b.name))
+      {
+        std::cerr << "   " << r.name << ": " << r.p50 << " ns/op (50%), " << r.p99 << " ns/op (99%)" << std::endl;
+        results.push_back(std::move(r));
+      }
+    }
+    catch(const std::exception &e)
+    {
+      std::cerr << "   failed with " << e.what() << std::endl;
+    }
+  }
+
+  ctx.testdir.close().value();
+  ctx.testfile.close().value();
+  llfio::algorithm::reduce(std::move(ctx.workdir)).value();
+
+  if(output.empty())
+  {
+    benchmark_harness::write_json(std::cout, "benchmark-harness", results);
+  }
+  else
+  {
+    std::ofstream out(output);
+    benchmark_harness::write_json(out, "benchmark-harness", results);
+  }
+  if(!baseline.empty())
+  {
+    const auto regressions = benchmark_harness::compare(std::cerr, baseline_results, results, threshold);
+    if(regressions > 0)
+    {
+      std::cerr << "\n" << regressions << " benchmarks regressed by more than " << threshold * 100.0 << "% or are missing" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
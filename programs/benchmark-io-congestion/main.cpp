@@ -40,6 +40,7 @@ static constexpr unsigned long long TEST_FILE_SIZE = 4ULL * 1024 * 1024 * 1024;
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include <tuple>
 #include <vector>
@@ -62,8 +63,29 @@ struct benchmark_results
 {
   std::chrono::microseconds duration;
   llfio::utils::process_memory_usage memory_usage;
+  float io_latency;  // mean block layer i/o completion latency in seconds during the run
 };
 
+// Sleeps for the benchmark duration, sampling the mean i/o completion latency of the device backing h
+inline float sample_io_latency(llfio::io_handle *h, unsigned seconds)
+{
+  llfio::statfs_t statfs;
+  double total = 0;
+  unsigned samples = 0;
+  (void) statfs.fill(*h, llfio::statfs_t::want::ioslatency);
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  while(std::chrono::steady_clock::now() < end)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    if(statfs.fill(*h, llfio::statfs_t::want::ioslatency) && statfs.f_ioslatency > 0)
+    {
+      total += statfs.f_ioslatency;
+      samples++;
+    }
+  }
+  return (samples > 0) ? (float) (total / samples) : 0.0f;
+}
+
 inline QUICKCPPLIB_NOINLINE void memcpy_s(llfio::byte *dest, const llfio::byte *s, size_t len)
 {
 #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
@@ -131,7 +153,12 @@ struct llfio_runner_unpaced
   llfio::dynamic_thread_pool_group_ptr group = llfio::make_dynamic_thread_pool_group().value();
   std::vector<llfio::dynamic_thread_pool_group::work_item *> workitems;
 
-  llfio_runner_unpaced(llfio::io_handle * /*unused*/) {}
+  llfio::io_handle *h;
+
+  llfio_runner_unpaced(llfio::io_handle *_h)
+      : h(_h)
+  {
+  }
   ~llfio_runner_unpaced()
   {
     for(auto *p : workitems)
@@ -163,12 +190,12 @@ struct llfio_runner_unpaced
   {
     group->submit(workitems).value();
     auto begin = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    auto latency = sample_io_latency(h, seconds);
     auto memusage = llfio::utils::current_process_memory_usage().value();
     cancel.store(true, std::memory_order_release);
     group->wait().value();
     auto end = std::chrono::steady_clock::now();
-    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage};
+    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage, latency};
   }
 };
 
@@ -180,8 +207,11 @@ struct llfio_runner_paced
   std::vector<llfio::dynamic_thread_pool_group::work_item *> workitems;
   std::atomic<int64_t> last_pace{0};
 
-  llfio_runner_paced(llfio::io_handle *h)
-      : awareness{h, 1.0f /* 100% reads */}
+  llfio::io_handle *h;
+
+  llfio_runner_paced(llfio::io_handle *_h)
+      : awareness{_h, 1.0f /* 100% reads */}
+      , h(_h)
   {
   }
   ~llfio_runner_paced()
@@ -227,12 +257,119 @@ struct llfio_runner_paced
   {
     group->submit(workitems).value();
     auto begin = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    auto latency = sample_io_latency(h, seconds);
+    auto memusage = llfio::utils::current_process_memory_usage().value();
+    cancel.store(true, std::memory_order_release);
+    group->wait().value();
+    auto end = std::chrono::steady_clock::now();
+    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage, latency};
+  }
+};
+
+// The pacing algorithm io_aware_work_item used before it became latency based, kept for comparison
+struct llfio_runner_statfs_paced
+{
+  std::atomic<bool> cancel{false};
+  llfio::dynamic_thread_pool_group_ptr group = llfio::make_dynamic_thread_pool_group().value();
+  std::vector<llfio::dynamic_thread_pool_group::work_item *> workitems;
+  llfio::io_handle *h;
+  struct pacer_t
+  {
+    std::mutex lock;
+    llfio::deadline default_deadline;
+    float average_busy{0}, average_queuedepth{0};
+    std::chrono::steady_clock::time_point last_updated;
+    llfio::statfs_t statfs;
+  } pacer;
+
+  llfio_runner_statfs_paced(llfio::io_handle *_h)
+      : h(_h)
+  {
+  }
+  ~llfio_runner_statfs_paced()
+  {
+    for(auto *p : workitems)
+    {
+      delete p;
+    }
+  }
+  void pace(llfio::deadline &d)
+  {
+    static constexpr float max_iosbusytime = 0.95f;
+    static constexpr uint32_t min_iosinprogress = 16, max_iosinprogress = 32;
+    std::lock_guard<std::mutex> g(pacer.lock);
+    auto now = std::chrono::steady_clock::now();
+    if(now - pacer.last_updated >= std::chrono::milliseconds(100))
+    {
+      auto elapsed = now - pacer.last_updated;
+      (void) pacer.statfs.fill(*h, llfio::statfs_t::want::iosinprogress | llfio::statfs_t::want::iosbusytime);
+      pacer.last_updated = now;
+      if(elapsed > std::chrono::seconds(5))
+      {
+        pacer.average_busy = pacer.statfs.f_iosbusytime;
+        pacer.average_queuedepth = (float) pacer.statfs.f_iosinprogress;
+      }
+      else
+      {
+        pacer.average_busy = (pacer.average_busy * 0.9f) + (pacer.statfs.f_iosbusytime * 0.1f);
+        pacer.average_queuedepth = (pacer.average_queuedepth * 0.9f) + (pacer.statfs.f_iosinprogress * 0.1f);
+      }
+      if(pacer.average_busy < max_iosbusytime && pacer.average_queuedepth < min_iosinprogress)
+      {
+        pacer.default_deadline = std::chrono::seconds(0);
+      }
+      else if(pacer.average_queuedepth > max_iosinprogress)
+      {
+        if(0 == pacer.default_deadline.nsecs)
+        {
+          pacer.default_deadline = std::chrono::milliseconds(1);
+        }
+        else
+        {
+          pacer.default_deadline.nsecs += std::max(pacer.default_deadline.nsecs >> 4, 1ULL);
+        }
+      }
+      else if(pacer.average_queuedepth < min_iosinprogress && pacer.default_deadline.nsecs > 1)
+      {
+        pacer.default_deadline.nsecs -= std::max(pacer.default_deadline.nsecs >> 4, 1ULL);
+      }
+    }
+    d = pacer.default_deadline;
+  }
+  template <class F> void add_workitem(F &&f)
+  {
+    struct workitem final : public llfio::dynamic_thread_pool_group::work_item
+    {
+      llfio_runner_statfs_paced *parent;
+      F f;
+      workitem(llfio_runner_statfs_paced *_parent, F &&_f)
+          : parent(_parent)
+          , f(std::move(_f))
+      {
+      }
+      virtual intptr_t next(llfio::deadline &d) noexcept override
+      {
+        parent->pace(d);
+        return parent->cancel.load(std::memory_order_relaxed) ? -1 : 1;
+      }
+      virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+      {
+        f();
+        return llfio::success();
+      }
+    };
+    workitems.push_back(new workitem(this, std::move(f)));
+  }
+  benchmark_results run(unsigned seconds)
+  {
+    group->submit(workitems).value();
+    auto begin = std::chrono::steady_clock::now();
+    auto latency = sample_io_latency(h, seconds);
     auto memusage = llfio::utils::current_process_memory_usage().value();
     cancel.store(true, std::memory_order_release);
     group->wait().value();
     auto end = std::chrono::steady_clock::now();
-    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage};
+    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage, latency};
   }
 };
 
@@ -242,8 +379,12 @@ struct asio_runner
 {
   std::atomic<bool> cancel{false};
   asio::io_context ctx;
+  llfio::io_handle *h;
 
-  asio_runner(llfio::io_handle * /*unused*/) {}
+  asio_runner(llfio::io_handle *_h)
+      : h(_h)
+  {
+  }
   template <class F> struct C
   {
     asio_runner *parent;
@@ -287,12 +428,12 @@ struct asio_runner
       }
     }
     auto begin = std::chrono::steady_clock::now();
-    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    auto latency = sample_io_latency(h, seconds);
     auto memusage = llfio::utils::current_process_memory_usage().value();
     cleanup.release();
     do_cleanup();
     auto end = std::chrono::steady_clock::now();
-    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage};
+    return {std::chrono::duration_cast<std::chrono::microseconds>(end - begin), memusage, latency};
   }
 };
 #endif
@@ -350,6 +491,7 @@ template <class Runner> void benchmark(llfio::mapped_file_handle &maph, const ch
     double throughput;
     size_t paged_in;
     unsigned max_concurrency;
+    float io_latency;
   };
   std::vector<result_t> results;
   for(size_t items = 1; items <= MAX_WORK_ITEMS; items <<= 1)
@@ -375,10 +517,11 @@ template <class Runner> void benchmark(llfio::mapped_file_handle &maph, const ch
     {
       total += i.count;
     }
-    results.push_back({items, 1000000.0 * total / out.duration.count(), out.memory_usage.total_address_space_paged_in, shared.max_concurrency});
+    results.push_back({items, 1000000.0 * total / out.duration.count(), out.memory_usage.total_address_space_paged_in, shared.max_concurrency, out.io_latency});
     std::cout << "   For " << results.back().items << " work items got " << results.back().throughput << " SHA256 hashes/sec with "
               << (results.back().items * SHA256_BUFFER_SIZE / 1024.0 / 1024.0) << " Mb working set, " << results.back().max_concurrency
-              << " maximum concurrency, and " << (results.back().paged_in / 1024.0 / 1024.0) << " Mb paged in." << std::endl;
+              << " maximum concurrency, " << (results.back().paged_in / 1024.0 / 1024.0) << " Mb paged in, and "
+              << (results.back().io_latency * 1000.0) << " ms mean i/o latency." << std::endl;
     // std::cout << "      " << (out.memory_usage.total_address_space_in_use / 1024.0 / 1024.0) << ","
     //          << (out.memory_usage.total_address_space_paged_in / 1024.0 / 1024.0) << "," << (out.memory_usage.private_committed / 1024.0 / 1024.0) << ","
     //          << (out.memory_usage.private_paged_in / 1024.0 / 1024.0) << std::endl;
@@ -386,12 +529,12 @@ template <class Runner> void benchmark(llfio::mapped_file_handle &maph, const ch
   if(name != nullptr)
   {
     std::ofstream out(std::string(name) + "_results.csv");
-    out << R"("Work items","SHA256 hashes/sec","Working set","Max concurrency","Paged in")";
+    out << R"("Work items","SHA256 hashes/sec","Working set","Max concurrency","Paged in","Mean i/o latency ms")";
     for(auto &i : results)
     {
       out << "\n"
           << i.items << "," << i.throughput << "," << (i.items * SHA256_BUFFER_SIZE / 1024.0 / 1024.0) << "," << i.max_concurrency << ","
-          << (i.paged_in / 1024.0 / 1024.0);
+          << (i.paged_in / 1024.0 / 1024.0) << "," << (i.io_latency * 1000.0);
     }
     out << std::endl;
   }
@@ -442,18 +585,23 @@ int main(int argc, char *argv[])
 
     benchmark<llfio_runner_unpaced>(fileh, nullptr);
 
-#if 0
     {
       std::string llfio_name("llfio unpaced (");
       llfio_name.append(llfio::dynamic_thread_pool_group::implementation_description());
       llfio_name.push_back(')');
       benchmark<llfio_runner_unpaced>(fileh, llfio_name.c_str());
     }
-#endif
+
+    {
+      std::string llfio_name("llfio statfs paced (");
+      llfio_name.append(llfio::dynamic_thread_pool_group::implementation_description());
+      llfio_name.push_back(')');
+      benchmark<llfio_runner_statfs_paced>(fileh, llfio_name.c_str());
+    }
 
 #if 1
     {
-      std::string llfio_name("llfio paced (");
+      std::string llfio_name("llfio latency paced (");
       llfio_name.append(llfio::dynamic_thread_pool_group::implementation_description());
       llfio_name.push_back(')');
       benchmark<llfio_runner_paced>(fileh, llfio_name.c_str());
@@ -29,6 +29,8 @@ Distributed under the Boost Software License, Version 1.0.
 #include "../../include/llfio/llfio.hpp"
 #include "quickcpplib/algorithm/small_prng.hpp"
 
+#include "../benchmark-harness/include/benchmark_harness.hpp"
+
 #include <chrono>
 #include <fstream>
 #include <iostream>
@@ -37,62 +39,7 @@ Distributed under the Boost Software License, Version 1.0.
 namespace llfio = LLFIO_V2_NAMESPACE;
 using QUICKCPPLIB_NAMESPACE::algorithm::small_prng::small_prng;
 
-inline uint64_t ticksclock()
-{
-#ifdef _MSC_VER
-  auto rdtscp = [] {
-    unsigned x;
-    return (uint64_t) __rdtscp(&x);
-  };
-#else
-#if defined(__x86_64__)
-  auto rdtscp = [] {
-    unsigned lo, hi, aux;
-    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
-    return (uint64_t) lo | ((uint64_t) hi << 32);
-  };
-#elif defined(__i386__)
-  auto rdtscp = [] {
-    unsigned lo, hi, aux;
-    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
-    return (uint64_t) lo | ((uint64_t) hi << 32);
-  };
-#endif
-#if __ARM_ARCH >= 6
-  auto rdtscp = [] {
-    unsigned count;
-    asm volatile("MRC p15, 0, %0, c9, c13, 0" : "=r"(count));
-    return (uint64_t) count * 64;
-  };
-#endif
-#endif
-  return rdtscp();
-}
-
-inline uint64_t nanoclock()
-{
-  static double ticks_per_sec;
-  static uint64_t offset;
-  if(ticks_per_sec == 0)
-  {
-    auto end = std::chrono::high_resolution_clock::now(), begin = std::chrono::high_resolution_clock::now();
-    uint64_t _begin = ticksclock(), _end;
-    do
-    {
-      end = std::chrono::high_resolution_clock::now();
-    } while(std::chrono::duration_cast<std::chrono::seconds>(end - begin).count() < 1);
-    _end = ticksclock();
-    double x = (double) (_end - _begin);
-    ticks_per_sec = x / 1000000000.0;
-    volatile uint64_t a = ticksclock();
-    volatile uint64_t b = ticksclock();
-    offset = b - a;
-#if 1
-    std::cout << "There are " << ticks_per_sec << " TSCs in 1 nanosecond and it takes " << offset << " ticks per nanoclock()." << std::endl;
-#endif
-  }
-  return (uint64_t)((ticksclock() - offset) / ticks_per_sec);
-}
+using benchmark_harness::nanoclock;
 
 template <class F> inline void run_test(const char *csv, off_t max_extent, F &&f)
 {
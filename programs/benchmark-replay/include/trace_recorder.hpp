@@ -0,0 +1,158 @@
+/* Records the i/o an LLFIO-using process performs, for replay by benchmark-replay
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include "../../../include/llfio/llfio.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/* A trace is a text file with one operation per line, in the order the operations
+completed:
+
+  <thread> <start ns> <duration ns> open <handle> <file> <r|w> <caching> <path>
+  <thread> <start ns> <duration ns> read|write|barrier_data|barrier_all <handle> <offset> <bytes>
+  <thread> <start ns> <duration ns> stat|unlink|close <handle>
+
+Threads, handles and files are numbered from zero in order of first appearance. Each
+open of a file gets a new handle number, and every open of the same path the same file
+number. Start times are since the recording began. Lines beginning with # are comments.
+*/
+namespace trace_recorder
+{
+  namespace llfio = LLFIO_V2_NAMESPACE;
+
+  //! The name of each `llfio::io_trace_op` in a trace
+  static constexpr const char *op_names[] = {"open", "read", "write", "barrier_data", "barrier_all", "stat", "unlink", "close"};
+
+  /*! \brief Writes a trace of every open, read, write, barrier, stat, unlink and close of
+  a regular file which LLFIO performs in this process during the recorder's lifetime.
+
+  Only one recorder can be active at a time. Handles opened before recording began are
+  given an open at their first use, and LLFIO must not have been built with
+  `LLFIO_LOGGING_LEVEL` zero.
+  */
+  class recorder
+  {
+    using clock = std::chrono::steady_clock;
+
+    std::mutex _lock;
+    std::ofstream _out;
+    clock::time_point _epoch{clock::now()};
+    std::unordered_map<intptr_t, unsigned long long> _handles;
+    std::unordered_map<std::string, unsigned long long> _files;
+    std::unordered_map<std::thread::id, unsigned> _threads;
+    unsigned long long _next_handle{0};
+
+    // Fetching the path of a newly seen handle is not itself traced, as it is done within the hook
+    static void _hook(void *context, llfio::io_trace_op op, const llfio::handle &h, unsigned long long offset, unsigned long long bytes,
+                      std::chrono::nanoseconds duration)
+    {
+      if(!h.is_regular())
+      {
+        return;
+      }
+      static_cast<recorder *>(context)->_record(op, h, offset, bytes, duration);
+    }
+    void _record(llfio::io_trace_op op, const llfio::handle &h, unsigned long long offset, unsigned long long bytes, std::chrono::nanoseconds duration)
+    {
+      const auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - duration - _epoch).count();
+      std::lock_guard<std::mutex> g(_lock);
+      const unsigned thread = _threads.emplace(std::this_thread::get_id(), (unsigned) _threads.size()).first->second;
+      const intptr_t native = h.native_handle()._init;
+      auto it = _handles.find(native);
+      if(it == _handles.end() || op == llfio::io_trace_op::open)
+      {
+        if(op == llfio::io_trace_op::close)
+        {
+          return;
+        }
+        std::string path = "<unknown>";
+        auto r = h.current_path();
+        if(r && !r.value().empty())
+        {
+          path = r.value().generic_string();
+        }
+        const unsigned long long file = _files.emplace(path, (unsigned long long) _files.size()).first->second;
+        it = _handles.insert_or_assign(native, _next_handle++).first;
+        // A handle used before recording began is opened immediately before its first use
+        _out << thread << " " << start << " " << ((op == llfio::io_trace_op::open) ? duration.count() : 0) << " open " << it->second << " " << file << " "
+             << (h.is_writable() ? "w" : "r") << " " << (unsigned) h.kernel_caching() << " " << path << "\n";
+        if(op == llfio::io_trace_op::open)
+        {
+          return;
+        }
+      }
+      _out << thread << " " << start << " " << duration.count() << " " << op_names[(unsigned) op] << " " << it->second;
+      switch(op)
+      {
+      case llfio::io_trace_op::read:
+      case llfio::io_trace_op::write:
+      case llfio::io_trace_op::barrier_data:
+      case llfio::io_trace_op::barrier_all:
+        _out << " " << offset << " " << bytes;
+        break;
+      default:
+        break;
+      }
+      _out << "\n";
+      if(op == llfio::io_trace_op::close)
+      {
+        _handles.erase(it);
+      }
+    }
+
+  public:
+    //! Begins recording to a trace file at `path`, throwing if it cannot be created.
+    explicit recorder(const std::string &path)
+        : _out(path)
+    {
+      if(!_out)
+      {
+        throw std::runtime_error("Could not create " + path);
+      }
+      _out << "# thread start_ns duration_ns op handle args\n";
+      llfio::set_io_trace_hook(_hook, this);
+    }
+    recorder(const recorder &) = delete;
+    recorder(recorder &&) = delete;
+    recorder &operator=(const recorder &) = delete;
+    recorder &operator=(recorder &&) = delete;
+    //! Stops recording. Operations still in progress on other threads must have completed.
+    ~recorder()
+    {
+      llfio::set_io_trace_hook(nullptr);
+      std::lock_guard<std::mutex> g(_lock);
+      _out.flush();
+    }
+  };
+}  // namespace trace_recorder
+
+#endif
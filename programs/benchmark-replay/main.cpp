@@ -0,0 +1,822 @@
+/* Replays recorded i/o traces through LLFIO, to benchmark realistic mixed workloads
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+/* Usage: benchmark-replay <trace> [--engine <engine>] [--think-scale <factor>] [--drop-caches]
+                           [--output <results.json>] [--compare <baseline.json>] [--threshold <percent>]
+
+To record a trace, construct a `trace_recorder::recorder` from include/trace_recorder.hpp
+in the process of interest for the duration to be captured:
+
+  trace_recorder::recorder rec("myapp.trace");
+
+Each recorded thread becomes a stream of operations which are replayed in order, waiting
+between each for the think time the recorded thread spent outside LLFIO multiplied by
+--think-scale (default 1, zero replays as fast as possible). Files are replayed within
+a scratch directory under their file number, never at their recorded paths, and are
+created beforehand large enough for every read in the trace to find data.
+
+The engines are:
+
+  blocking                    A kernel thread per stream performing blocking i/o (the default).
+  multiplexer_null            All streams on one thread, reads, writes and barriers via the null
+                              i/o multiplexer.
+  io_uring                    As multiplexer_null, but via io_uring.
+  iocp                        As multiplexer_null, but via IOCP (Windows only).
+  dynamic_thread_pool_group   A work item per stream, think times as work item delays.
+
+The latency distribution of each kind of operation is written as JSON to --output
+(default stdout), which with --compare is checked against a baseline as benchmark-harness
+does. A kind of operation in the baseline which this replay did not perform also fails.
+*/
+
+#define LLFIO_ENABLE_TEST_IO_MULTIPLEXERS 1
+
+#include "../../include/llfio/llfio.hpp"
+
+#include "../benchmark-harness/include/benchmark_harness.hpp"
+#include "include/trace_recorder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace llfio = LLFIO_V2_NAMESPACE;
+using clock_type = std::chrono::steady_clock;
+using trace_recorder::op_names;
+static constexpr size_t op_kinds = sizeof(op_names) / sizeof(op_names[0]);
+
+struct trace_op
+{
+  llfio::io_trace_op op{llfio::io_trace_op::open};
+  unsigned long long handle{0}, offset{0}, bytes{0};
+  //! How long to wait after the previous operation in the stream completes before beginning this one
+  std::chrono::nanoseconds think{0};
+  // Opens only
+  unsigned long long file{0};
+  bool writable{false};
+  llfio::file_handle::caching caching{llfio::file_handle::caching::all};
+};
+
+struct trace
+{
+  //! The operations of each recorded thread
+  std::vector<std::vector<trace_op>> streams;
+  unsigned long long handles{0};
+  //! The size each file must have before replay begins
+  std::vector<unsigned long long> file_extents;
+};
+
+static trace load_trace(const std::string &path, double think_scale)
+{
+  std::ifstream in(path);
+  if(!in)
+  {
+    throw std::runtime_error("Could not open " + path);
+  }
+  trace ret;
+  std::vector<unsigned long long> handle_files;
+  std::vector<long long> stream_ends;
+  std::string line;
+  for(size_t lineno = 1; std::getline(in, line); lineno++)
+  {
+    if(line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+    const auto malformed = [&] { return std::runtime_error(path + ":" + std::to_string(lineno) + " is malformed"); };
+    std::istringstream s(line);
+    unsigned thread;
+    long long start, duration;
+    std::string opname;
+    trace_op o;
+    if(!(s >> thread >> start >> duration >> opname >> o.handle))
+    {
+      throw malformed();
+    }
+    const auto *it = std::find_if(std::begin(op_names), std::end(op_names), [&](const char *name) { return opname == name; });
+    if(it == std::end(op_names))
+    {
+      throw malformed();
+    }
+    o.op = static_cast<llfio::io_trace_op>(it - std::begin(op_names));
+    if(o.op == llfio::io_trace_op::open)
+    {
+      std::string mode;
+      unsigned caching;
+      if(!(s >> o.file >> mode >> caching))
+      {
+        throw malformed();
+      }
+      o.writable = (mode == "w");
+      o.caching = static_cast<llfio::file_handle::caching>(caching);
+      if(handle_files.size() <= o.handle)
+      {
+        handle_files.resize(o.handle + 1, (unsigned long long) -1);
+      }
+      handle_files[o.handle] = o.file;
+      if(ret.file_extents.size() <= o.file)
+      {
+        ret.file_extents.resize(o.file + 1);
+      }
+    }
+    else if(o.handle >= handle_files.size() || handle_files[o.handle] == (unsigned long long) -1)
+    {
+      throw std::runtime_error(path + ":" + std::to_string(lineno) + " uses a handle before opening it");
+    }
+    if(o.op == llfio::io_trace_op::read || o.op == llfio::io_trace_op::write || o.op == llfio::io_trace_op::barrier_data || o.op == llfio::io_trace_op::barrier_all)
+    {
+      if(!(s >> o.offset >> o.bytes))
+      {
+        throw malformed();
+      }
+      if(o.op == llfio::io_trace_op::read)
+      {
+        auto &extent = ret.file_extents[handle_files[o.handle]];
+        extent = std::max(extent, o.offset + o.bytes);
+      }
+    }
+    if(ret.streams.size() <= thread)
+    {
+      ret.streams.resize(thread + 1);
+      stream_ends.resize(thread + 1);
+    }
+    o.think = std::chrono::nanoseconds((long long) ((double) std::max(0LL, start - stream_ends[thread]) * think_scale));
+    stream_ends[thread] = start + duration;
+    ret.handles = std::max(ret.handles, o.handle + 1);
+    ret.streams[thread].push_back(o);
+  }
+  return ret;
+}
+
+static void wait_until(clock_type::time_point when)
+{
+  auto now = clock_type::now();
+  if(when - now > std::chrono::microseconds(200))
+  {
+    std::this_thread::sleep_for(when - now - std::chrono::microseconds(100));
+  }
+  while(clock_type::now() < when)
+  {
+    std::this_thread::yield();
+  }
+}
+
+/* Holds the handles, which any stream may use, and performs operations upon them. A
+handle used by a stream before the stream which opens it has done so makes the first
+stream wait. An operation upon a handle another stream has closed is skipped, which can
+happen if replay reorders the streams relative to one another. A close is deferred until
+operations already upon the handle complete.
+*/
+class replayer
+{
+  struct handle_slot
+  {
+    llfio::file_handle h;
+    std::atomic<int> state{0};  // 0 = not yet opened, 1 = open, 2 = closing, 3 = closed
+    std::atomic<unsigned> users{0};
+    std::atomic<size_t> closer{(size_t) -1};  // the stream closing the handle
+  };
+  struct stream_stats
+  {
+    benchmark_harness::histogram latency[op_kinds];
+    unsigned long long bytes[op_kinds]{}, skipped{0}, failed{0};
+  };
+
+  const llfio::directory_handle &_dir;
+  std::unique_ptr<handle_slot[]> _handles;
+  std::vector<stream_stats> _stats;
+  llfio::io_multiplexer *_multiplexer{nullptr};
+
+public:
+  const trace &t;
+
+  replayer(const trace &_t, const llfio::directory_handle &dir, llfio::io_multiplexer *multiplexer)
+      : _dir(dir)
+      , _handles(std::make_unique<handle_slot[]>(_t.handles))
+      , _stats(_t.streams.size())
+      , _multiplexer(multiplexer)
+      , t(_t)
+  {
+  }
+  replayer(const replayer &) = delete;
+  replayer(replayer &&) = delete;
+  replayer &operator=(const replayer &) = delete;
+  replayer &operator=(replayer &&) = delete;
+  ~replayer()
+  {
+    // Handles the trace never closed must leave the multiplexer before it is destroyed
+    for(unsigned long long n = 0; n < t.handles; n++)
+    {
+      if(_multiplexer != nullptr && _handles[n].state.load() == 1)
+      {
+        (void) _handles[n].h.set_multiplexer(nullptr);
+      }
+    }
+  }
+
+  //! A page aligned buffer large enough for every read and write in `stream`
+  std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> make_buffer(size_t stream) const
+  {
+    size_t bytes = 1;
+    for(const auto &o : t.streams[stream])
+    {
+      if(o.op == llfio::io_trace_op::read || o.op == llfio::io_trace_op::write)
+      {
+        bytes = std::max(bytes, (size_t) o.bytes);
+      }
+    }
+    std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> ret(bytes);
+    memset(ret.data(), 0x78, ret.size());
+    return ret;
+  }
+  //! True if `o` need not wait for another stream to open its handle
+  bool ready(const trace_op &o) const noexcept { return o.op == llfio::io_trace_op::open || _handles[o.handle].state.load(std::memory_order_acquire) != 0; }
+  //! Pins the handle of `o` open, returning null if it has been closed
+  llfio::file_handle *acquire(size_t stream, const trace_op &o) noexcept
+  {
+    auto &slot = _handles[o.handle];
+    slot.users.fetch_add(1);
+    if(slot.state.load() != 1)
+    {
+      slot.users.fetch_sub(1);
+      _stats[stream].skipped++;
+      return nullptr;
+    }
+    return &slot.h;
+  }
+  void release(const trace_op &o) noexcept { _handles[o.handle].users.fetch_sub(1); }
+  //! Records the outcome of `o`, which took `ticks` of `benchmark_harness::ticksclock()`
+  void record(size_t stream, const trace_op &o, bool ok, uint64_t ticks) noexcept
+  {
+    auto &stats = _stats[stream];
+    if(!ok)
+    {
+      stats.failed++;
+      return;
+    }
+    stats.latency[(unsigned) o.op].record(benchmark_harness::ticks_to_ps(ticks));
+    if(o.op == llfio::io_trace_op::read || o.op == llfio::io_trace_op::write)
+    {
+      stats.bytes[(unsigned) o.op] += o.bytes;
+    }
+  }
+
+  /*! Performs `o` with blocking i/o, using `buffer` for any data. Returns false if `o` is a
+  close which must be retried once operations upon its handle complete, which under the
+  multiplexer engines happens on the calling thread.
+  */
+  bool execute(size_t stream, const trace_op &o, llfio::byte *buffer)
+  {
+    auto &slot = _handles[o.handle];
+    if(o.op == llfio::io_trace_op::open)
+    {
+      const auto begin = benchmark_harness::ticksclock();
+      auto r = llfio::file_handle::file(_dir, std::to_string(o.file), o.writable ? llfio::file_handle::mode::write : llfio::file_handle::mode::read,
+                                        o.writable ? llfio::file_handle::creation::if_needed : llfio::file_handle::creation::open_existing, o.caching,
+                                        (_multiplexer != nullptr) ? llfio::file_handle::flag::multiplexable : llfio::file_handle::flag::none);
+      const auto end = benchmark_harness::ticksclock();
+      if(r)
+      {
+        slot.h = std::move(r).value();
+        if(_multiplexer != nullptr)
+        {
+          slot.h.set_multiplexer(_multiplexer).value();
+        }
+        slot.state.store(1, std::memory_order_release);
+      }
+      record(stream, o, !!r, end - begin);
+      return true;
+    }
+    if(o.op == llfio::io_trace_op::close)
+    {
+      int expected = 1;
+      if(slot.state.compare_exchange_strong(expected, 2))
+      {
+        slot.closer.store(stream);
+      }
+      else if(expected != 2 || slot.closer.load() != stream)
+      {
+        _stats[stream].skipped++;
+        return true;
+      }
+      if(slot.users.load() != 0)
+      {
+        return false;
+      }
+      if(_multiplexer != nullptr)
+      {
+        (void) slot.h.set_multiplexer(nullptr);
+      }
+      const auto begin = benchmark_harness::ticksclock();
+      const bool ok = !!slot.h.close();
+      record(stream, o, ok, benchmark_harness::ticksclock() - begin);
+      slot.state.store(3);
+      return true;
+    }
+    auto *h = acquire(stream, o);
+    if(h == nullptr)
+    {
+      return true;
+    }
+    llfio::file_handle::const_buffer_type range(nullptr, (size_t) o.bytes);
+    bool ok = false;
+    const auto begin = benchmark_harness::ticksclock();
+    switch(o.op)
+    {
+    case llfio::io_trace_op::read:
+      ok = !!h->read(o.offset, {{buffer, (size_t) o.bytes}});
+      break;
+    case llfio::io_trace_op::write:
+      ok = !!h->write(o.offset, {{buffer, (size_t) o.bytes}});
+      break;
+    case llfio::io_trace_op::barrier_data:
+      ok = !!h->barrier({{&range, 1}, o.offset}, llfio::file_handle::barrier_kind::wait_data_only);
+      break;
+    case llfio::io_trace_op::barrier_all:
+      ok = !!h->barrier({{&range, 1}, o.offset}, llfio::file_handle::barrier_kind::wait_all);
+      break;
+    case llfio::io_trace_op::stat:
+    {
+      llfio::stat_t s(nullptr);
+      ok = !!s.fill(*h);
+      break;
+    }
+    case llfio::io_trace_op::unlink:
+      ok = !!h->unlink();
+      break;
+    default:
+      break;
+    }
+    const auto end = benchmark_harness::ticksclock();
+    release(o);
+    record(stream, o, ok, end - begin);
+    return true;
+  }
+
+  //! Summarises the replay, which took `elapsed`
+  std::vector<benchmark_harness::result> results(const std::string &engine, std::chrono::nanoseconds elapsed) const
+  {
+    std::vector<benchmark_harness::result> ret;
+    benchmark_harness::histogram latency[op_kinds];
+    unsigned long long bytes[op_kinds]{}, totalbytes = 0, skipped = 0, failed = 0, ops = 0;
+    for(const auto &s : _stats)
+    {
+      for(size_t n = 0; n < op_kinds; n++)
+      {
+        latency[n].merge(s.latency[n]);
+        bytes[n] += s.bytes[n];
+        totalbytes += s.bytes[n];
+      }
+      skipped += s.skipped;
+      failed += s.failed;
+    }
+    for(size_t n = 0; n < op_kinds; n++)
+    {
+      if(latency[n].count() == 0)
+      {
+        continue;
+      }
+      ops += latency[n].count();
+      ret.emplace_back("replay:" + engine + ":" + op_names[n], latency[n], latency[n].count(), bytes[n] / latency[n].count());
+    }
+    const double secs = (double) elapsed.count() / 1000000000.0;
+    std::cerr << "Replayed " << ops << " operations in " << secs << " seconds, " << (double) ops / secs << " ops/sec, " << (double) totalbytes / secs / 1048576.0
+              << " Mb/sec. " << skipped << " were skipped and " << failed << " failed." << std::endl;
+    return ret;
+  }
+};
+
+static void run_blocking(replayer &r)
+{
+  std::vector<std::thread> threads;
+  for(size_t stream = 0; stream < r.t.streams.size(); stream++)
+  {
+    threads.emplace_back([&r, stream] {
+      auto buffer = r.make_buffer(stream);
+      auto last = clock_type::now();
+      for(const auto &o : r.t.streams[stream])
+      {
+        wait_until(last + o.think);
+        while(!r.ready(o))
+        {
+          std::this_thread::yield();
+        }
+        while(!r.execute(stream, o, buffer.data()))
+        {
+          std::this_thread::yield();
+        }
+        last = clock_type::now();
+      }
+    });
+  }
+  for(auto &i : threads)
+  {
+    i.join();
+  }
+}
+
+/* Runs every stream from this thread, with at most one operation per stream in flight.
+Reads, writes and barriers go through the multiplexer, everything else is performed
+immediately as the multiplexer has no equivalent.
+*/
+static void run_multiplexer(replayer &r, llfio::io_multiplexer *multiplexer)
+{
+  struct stream_state final : llfio::io_multiplexer::io_operation_state_visitor
+  {
+    size_t idx{0};
+    clock_type::time_point due;
+    std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> buffer;
+    std::unique_ptr<llfio::byte[]> storage;
+    llfio::io_multiplexer::io_operation_state *state{nullptr};
+    llfio::io_multiplexer::buffer_type b;
+    llfio::io_multiplexer::const_buffer_type cb;
+    uint64_t begin{0}, end{0};
+    bool ok{false};
+
+    virtual bool read_completed(lock_guard & /*unused*/, llfio::io_operation_state_type /*unused*/,
+                                llfio::io_multiplexer::io_result<llfio::io_multiplexer::buffers_type> &&res) override
+    {
+      end = benchmark_harness::ticksclock();
+      ok = !!res;
+      return false;
+    }
+    virtual bool write_completed(lock_guard & /*unused*/, llfio::io_operation_state_type /*unused*/,
+                                 llfio::io_multiplexer::io_result<llfio::io_multiplexer::const_buffers_type> &&res) override
+    {
+      end = benchmark_harness::ticksclock();
+      ok = !!res;
+      return false;
+    }
+    virtual bool barrier_completed(lock_guard & /*unused*/, llfio::io_operation_state_type /*unused*/,
+                                   llfio::io_multiplexer::io_result<llfio::io_multiplexer::const_buffers_type> &&res) override
+    {
+      end = benchmark_harness::ticksclock();
+      ok = !!res;
+      return false;
+    }
+  };
+  const auto start = clock_type::now();
+  std::vector<stream_state> streams(r.t.streams.size());
+  for(size_t n = 0; n < streams.size(); n++)
+  {
+    streams[n].buffer = r.make_buffer(n);
+    streams[n].storage = std::make_unique<llfio::byte[]>(multiplexer->io_state_requirements().first);
+    if(!r.t.streams[n].empty())
+    {
+      streams[n].due = start + r.t.streams[n].front().think;
+    }
+  }
+  for(;;)
+  {
+    bool remaining = false, in_flight = false, initiated = false;
+    auto soonest = clock_type::time_point::max();
+    for(size_t n = 0; n < streams.size(); n++)
+    {
+      auto &s = streams[n];
+      const auto &ops = r.t.streams[n];
+      auto advance = [&] {
+        if(++s.idx < ops.size())
+        {
+          s.due = clock_type::now() + ops[s.idx].think;
+        }
+      };
+      if(s.state != nullptr)
+      {
+        if(!is_finished(s.state->current_state()))
+        {
+          remaining = in_flight = true;
+          continue;
+        }
+        s.state->~io_operation_state();
+        s.state = nullptr;
+        r.release(ops[s.idx]);
+        r.record(n, ops[s.idx], s.ok, s.end - s.begin);
+        advance();
+      }
+      if(s.idx == ops.size())
+      {
+        continue;
+      }
+      remaining = true;
+      const auto &o = ops[s.idx];
+      if(clock_type::now() < s.due || !r.ready(o))
+      {
+        soonest = std::min(soonest, s.due);
+        continue;
+      }
+      if(o.op != llfio::io_trace_op::read && o.op != llfio::io_trace_op::write && o.op != llfio::io_trace_op::barrier_data && o.op != llfio::io_trace_op::barrier_all)
+      {
+        if(!r.execute(n, o, s.buffer.data()))
+        {
+          // A close waits for operations upon its handle, which complete below
+          soonest = std::min(soonest, clock_type::now());
+          continue;
+        }
+        advance();
+        continue;
+      }
+      auto *h = r.acquire(n, o);
+      if(h == nullptr)
+      {
+        advance();
+        continue;
+      }
+      const llfio::span<llfio::byte> storage(s.storage.get(), multiplexer->io_state_requirements().first);
+      s.begin = benchmark_harness::ticksclock();
+      if(o.op == llfio::io_trace_op::read)
+      {
+        s.b = {s.buffer.data(), (size_t) o.bytes};
+        s.state = multiplexer->construct_and_init_io_operation(storage, h, &s, {}, {}, llfio::io_multiplexer::io_request<llfio::io_multiplexer::buffers_type>({&s.b, 1}, o.offset));
+      }
+      else if(o.op == llfio::io_trace_op::write)
+      {
+        s.cb = {s.buffer.data(), (size_t) o.bytes};
+        s.state = multiplexer->construct_and_init_io_operation(storage, h, &s, {}, {}, llfio::io_multiplexer::io_request<llfio::io_multiplexer::const_buffers_type>({&s.cb, 1}, o.offset));
+      }
+      else
+      {
+        s.cb = {nullptr, (size_t) o.bytes};
+        s.state = multiplexer->construct_and_init_io_operation(
+        storage, h, &s, {}, {}, llfio::io_multiplexer::io_request<llfio::io_multiplexer::const_buffers_type>({&s.cb, 1}, o.offset),
+        (o.op == llfio::io_trace_op::barrier_data) ? llfio::io_multiplexer::barrier_kind::wait_data_only : llfio::io_multiplexer::barrier_kind::wait_all);
+      }
+      initiated = in_flight = true;
+    }
+    if(!remaining)
+    {
+      break;
+    }
+    if(initiated)
+    {
+      multiplexer->flush_inited_io_operations().value();
+    }
+    if(in_flight)
+    {
+      multiplexer->check_for_any_completed_io().value();
+    }
+    else if(soonest != clock_type::time_point::max())
+    {
+      wait_until(std::min(soonest, clock_type::now() + std::chrono::milliseconds(1)));
+    }
+    else
+    {
+      // Every remaining stream awaits a handle another has yet to open
+      std::this_thread::yield();
+    }
+  }
+}
+
+/* Each stream is a work item performing one operation per invocation, with the think
+time before the next as the work item's delay.
+*/
+static void run_dynamic_thread_pool_group(replayer &r)
+{
+  struct stream_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    replayer *parent{nullptr};
+    size_t stream{0}, idx{0};
+    clock_type::time_point due;
+    std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> buffer;
+
+    virtual intptr_t next(llfio::deadline &d) noexcept override
+    {
+      const auto &ops = parent->t.streams[stream];
+      if(idx == ops.size())
+      {
+        return -1;
+      }
+      if(!parent->ready(ops[idx]))
+      {
+        d = std::chrono::microseconds(50);
+        return 0;
+      }
+      const auto now = clock_type::now();
+      if(due > now)
+      {
+        d = std::chrono::duration_cast<std::chrono::nanoseconds>(due - now);
+      }
+      return 1;
+    }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      const auto &ops = parent->t.streams[stream];
+      if(!parent->execute(stream, ops[idx], buffer.data()))
+      {
+        // Retry the close once operations upon its handle complete
+        due = clock_type::now() + std::chrono::microseconds(50);
+        return llfio::success();
+      }
+      if(++idx < ops.size())
+      {
+        due = clock_type::now() + ops[idx].think;
+      }
+      return llfio::success();
+    }
+  };
+  const auto start = clock_type::now();
+  std::vector<stream_item> items(r.t.streams.size());
+  std::vector<llfio::dynamic_thread_pool_group::work_item *> workitems;
+  for(size_t n = 0; n < items.size(); n++)
+  {
+    items[n].parent = &r;
+    items[n].stream = n;
+    items[n].buffer = r.make_buffer(n);
+    if(!r.t.streams[n].empty())
+    {
+      items[n].due = start + r.t.streams[n].front().think;
+    }
+    workitems.push_back(&items[n]);
+  }
+  auto group = llfio::make_dynamic_thread_pool_group().value();
+  group->submit(workitems).value();
+  group->wait().value();
+}
+
+int main(int argc, char *argv[])
+{
+  std::string tracepath, engine = "blocking", output, baseline;
+  double think_scale = 1.0, threshold = 0.1;
+  bool drop_caches = false;
+  for(int n = 1; n < argc; n++)
+  {
+    auto arg = [&] {
+      if(n + 1 >= argc)
+      {
+        std::cerr << "Option " << argv[n] << " needs a value" << std::endl;
+        exit(2);
+      }
+      return argv[++n];
+    };
+    if(0 == strcmp(argv[n], "--engine"))
+    {
+      engine = arg();
+    }
+    else if(0 == strcmp(argv[n], "--think-scale"))
+    {
+      think_scale = atof(arg());
+    }
+    else if(0 == strcmp(argv[n], "--drop-caches"))
+    {
+      drop_caches = true;
+    }
+    else if(0 == strcmp(argv[n], "--output"))
+    {
+      output = arg();
+    }
+    else if(0 == strcmp(argv[n], "--compare"))
+    {
+      baseline = arg();
+    }
+    else if(0 == strcmp(argv[n], "--threshold"))
+    {
+      threshold = atof(arg()) / 100.0;
+    }
+    else if(argv[n][0] != '-' && tracepath.empty())
+    {
+      tracepath = argv[n];
+    }
+    else
+    {
+      tracepath.clear();
+      break;
+    }
+  }
+  if(tracepath.empty())
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " <trace> [--engine blocking|multiplexer_null|io_uring|iocp|dynamic_thread_pool_group] [--think-scale <factor>] [--drop-caches] [--output "
+                 "<results.json>] [--compare <baseline.json>] [--threshold <percent>]"
+              << std::endl;
+    return 2;
+  }
+  trace t;
+  std::vector<benchmark_harness::result> baseline_results;
+  try
+  {
+    t = load_trace(tracepath, think_scale);
+    if(!baseline.empty())
+    {
+      baseline_results = benchmark_harness::read_json(baseline);
+    }
+  }
+  catch(const std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+
+  llfio::io_multiplexer_ptr multiplexer;
+  if(engine == "multiplexer_null")
+  {
+    multiplexer = llfio::test::multiplexer_null(1, false).value();
+  }
+  else if(engine == "io_uring")
+  {
+#if 0  // The io_uring multiplexer is not yet compiled into LLFIO, see io_handle.hpp
+    multiplexer = llfio::test::multiplexer_linux_io_uring(1, false).value();
+#else
+    std::cerr << "The io_uring multiplexer is not yet compiled into LLFIO." << std::endl;
+    return 2;
+#endif
+  }
+#ifdef _WIN32
+  else if(engine == "iocp")
+  {
+    multiplexer = llfio::test::multiplexer_win_iocp(1, false).value();
+  }
+#endif
+  else if(engine != "blocking" && engine != "dynamic_thread_pool_group")
+  {
+    std::cerr << "Unknown engine " << engine << std::endl;
+    return 2;
+  }
+
+  auto dir = llfio::directory({}, "llfio_benchmark_replay", llfio::directory_handle::mode::write, llfio::directory_handle::creation::if_needed).value();
+  {
+    std::cerr << "Creating " << t.file_extents.size() << " files ..." << std::endl;
+    std::vector<llfio::byte, llfio::utils::page_allocator<llfio::byte>> buffer(1024 * 1024);
+    memset(buffer.data(), 0x78, buffer.size());
+    for(size_t n = 0; n < t.file_extents.size(); n++)
+    {
+      // A file the traced program unlinked may have been unlinked by a previous replay too
+      auto fh = llfio::file_handle::file(dir, std::to_string(n), llfio::file_handle::mode::write, llfio::file_handle::creation::if_needed).value();
+      fh.truncate(t.file_extents[n]).value();
+      for(unsigned long long offset = 0; offset < t.file_extents[n]; offset += buffer.size())
+      {
+        const auto bytes = (size_t) std::min((unsigned long long) buffer.size(), t.file_extents[n] - offset);
+        fh.write(offset, {{buffer.data(), bytes}}).value();
+      }
+    }
+    if(drop_caches)
+    {
+      (void) llfio::utils::drop_filesystem_cache();
+    }
+  }
+
+  std::cerr << "Replaying " << t.streams.size() << " streams with the " << engine << " engine ..." << std::endl;
+  std::vector<benchmark_harness::result> results;
+  {
+    replayer r(t, dir, multiplexer.get());
+    const auto begin = clock_type::now();
+    if(multiplexer)
+    {
+      run_multiplexer(r, multiplexer.get());
+    }
+    else if(engine == "dynamic_thread_pool_group")
+    {
+      run_dynamic_thread_pool_group(r);
+    }
+    else
+    {
+      run_blocking(r);
+    }
+    results = r.results(engine, clock_type::now() - begin);
+  }
+  llfio::algorithm::reduce(std::move(dir)).value();
+
+  if(output.empty())
+  {
+    benchmark_harness::write_json(std::cout, "benchmark-replay", results);
+  }
+  else
+  {
+    std::ofstream out(output);
+    benchmark_harness::write_json(out, "benchmark-replay", results);
+  }
+  if(!baseline.empty())
+  {
+    const auto regressions = benchmark_harness::compare(std::cerr, baseline_results, results, threshold);
+    if(regressions > 0)
+    {
+      std::cerr << "\n" << regressions << " operations regressed by more than " << threshold * 100.0 << "% or are missing" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -51,6 +51,13 @@ static LLFIO_V2_NAMESPACE::storage_profile::storage_profile profile[permute_flag
     }                                                                                                                                                                                                                                                                                                                          \
   }
 
+/* Runs every storage profile test matching the regex for each caching strategy selected by
+the flags bitfield, appending the results to fs_probe_results.yaml. A complete run takes a
+long while: besides writing up to 17Gb of test files, most latency tests run for ten seconds
+each, and the three throughput sweeps run for up to 13.5 seconds each, so allow at least
+several minutes per caching strategy. Pass the regex "(?!throughput:).*" to skip the
+sweeps, though only a complete run is cached for recommended_parameters().
+*/
 int main(int argc, char *argv[])
 {
   using namespace LLFIO_V2_NAMESPACE;
@@ -72,7 +79,8 @@ int main(int argc, char *argv[])
       torunflags = atoi(argv[2]);
     if(!regexvalid)
     {
-      std::cerr << "Usage: " << argv[0] << " <regex for tests to run> [<flags>]" << std::endl;
+      std::cerr << "Usage: " << argv[0] << " <regex for tests to run> [<flags>]\n\nA complete run takes several minutes per caching strategy, of which\n"
+                << "the throughput sweeps take up to forty seconds. Exclude them with the regex\n\"(?!throughput:).*\"." << std::endl;
       return 1;
     }
   }
@@ -185,6 +193,23 @@ int main(int argc, char *argv[])
       results.flush();
     }
   }
+  // A complete run is cached for the library to derive recommended i/o parameters from
+  if(argc < 2)
+  {
+    auto _testfile(file_handle::file({}, "test", handle::mode::read));
+    if(_testfile)
+    {
+      auto stored = storage_profile::store_cached_profile(_testfile.value(), span<const storage_profile::storage_profile>(profile, permute_flags_max));
+      if(stored)
+      {
+        std::cout << "\nCached results for this device and filing system" << std::endl;
+      }
+      else
+      {
+        std::cerr << "WARNING: Failed to cache results due to '" << stored.error().message() << "'" << std::endl;
+      }
+    }
+  }
   // Delete the test file
   auto delete_testfile = [](std::string name) {
     auto _testfile(file_handle::file({}, name, handle::mode::write));
@@ -28,6 +28,11 @@ Distributed under the Boost Software License, Version 1.0.
 #include "../../../include/llfio/llfio.hpp"
 #include "quickcpplib/algorithm/open_hash_index.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <queue>
+#include <set>
 #include <vector>
 
 namespace key_value_store
@@ -55,6 +60,14 @@ namespace key_value_store
     {
     }
   };
+  class old_store : std::runtime_error
+  {
+  public:
+    old_store()
+        : std::runtime_error("The store was written by an older version of this library whose format is no longer supported, please export and reimport its contents")
+    {
+    }
+  };
   class maximum_writers_reached : std::runtime_error
   {
   public:
@@ -100,19 +113,29 @@ namespace key_value_store
     //! The key which caused the transaction to abort
     key_type key() const { return _key; }
   };
+  class snapshot_too_old : std::runtime_error
+  {
+  public:
+    snapshot_too_old()
+        : std::runtime_error("The version of a key visible to the snapshot is no longer kept, hold the snapshot to retain it")
+    {
+    }
+  };
 
   namespace index
   {
     using namespace QUICKCPPLIB_NAMESPACE::algorithm::open_hash_index;
     struct value_history
     {
-      // Most recent six versions of this value
+      // Most recent four versions of this value. A deletion has a zero transaction_counter, with
+      // the bottom 48 bits of the transaction counter of the deletion in value_offset
       struct item
       {
         uint64_t transaction_counter;   // transaction counter when this was updated
         uint64_t value_offset : 58;     // Shifted left 6 as tail of blob record (value_tail) will always be on 64 byte boundary
         uint64_t value_identifier : 6;  // 0-47 is smallfile identifier, 48-63 is reserved for future usage
-        uint64_t length;                // Length in bytes
+        uint32_t length;                // Length in bytes as stored
+        uint32_t raw_length;            // Length in bytes before compression, zero if stored uncompressed
       } history[4];
     };
     static_assert(sizeof(value_history) == 96, "value_history is wrong size");
@@ -128,56 +151,2237 @@ namespace key_value_store
 
     struct index
     {
-      uint64_t magic;                              // versionmagic, currently "AFIOKV01" for valid, "DEADKV01" for requires repair
+      uint64_t magic;                              // versionmagic, currently "AFIOKV06" for valid, "DEADKV01" for requires repair
       std::atomic<uint64_t> transaction_counter;   // top 16 bits are number of keys changed this transaction, bottom 48 bits are monotonic counter
       uint128 hash;                                // Optional hash of index file written on last close to guard against systems which don't write mmaps properly
       std::atomic<unsigned> writes_occurring[48];  // Incremented just before an update, decremented after, per writer
       std::atomic<bool> all_writes_synced;         // Set if all writers since the first which has opened this store did so with `O_SYNC` on (i.e. safe during fsck to check small file tails only)
+      uint64_t applied_extent[48];                 // Per writer, the smallfile length before which every record is either reflected in the index or was never committed
+      std::atomic<uint32_t> table_generation;      // The newest hash table is in this file if zero, else in file "index<table_generation>"
+      std::atomic<uint32_t> migrating;             // Set whilst items are moved from the previous hash table into the newest
+      std::atomic<uint64_t> migration_cursor;      // Items of the previous hash table below this have been claimed for migration
+      std::atomic<uint64_t> items;                 // Number of keys in the hash index
+      std::atomic<bool> values_compressed;         // If every writer compresses values with the dictionary in file `dictionary`. Not a bitfield, as any writer may set it at any time.
+      std::atomic<uint64_t> applying_from[48];     // Per writer, no later than the oldest transaction counter it has taken but not finished applying, zero if none
+      std::atomic<uint64_t> oldest_held[48];       // Per writer, one plus the transaction counter of its oldest held snapshot, zero if none
 
       uint64_t contents_hashed : 1;       // If records written are hashed and checked on fetch
       uint64_t key_is_hash_of_value : 1;  // On read, check hash of value equals key
+      uint64_t has_ordered_index : 1;     // If every writer must maintain the ordered index
+    };
+
+    /* The hash index grows online. The table following the header in the `index` file is
+    generation zero. Whenever the newest table becomes three quarters full, a table of twice the
+    size is created in file `index<generation>`, and the items in the previous table are moved
+    into the newest a batch at a time by each writer after it commits. Whilst migration
+    is in progress lookups probe the previous table before the newest, and an item is inserted
+    into the newest table before being erased from the previous, so a lookup never misses an
+    item being moved. Only one user may grow the index at a time, which is enforced across
+    processes by locking a byte of the `index` file.
+    */
+    class resizable_open_hash_index
+    {
+      static constexpr llfio::file_handle::extent_type _resizelockoffset = INT64_MAX - 1;
+      static constexpr size_t _keyoffset = 16;  // offset of the key within each item
+
+      struct _table
+      {
+        uint32_t generation{0};
+        size_t entries{0};
+        optional<open_hash_index> idx;
+      };
+      llfio::path_handle _dir;
+      llfio::file_handle *_indexfile{nullptr};
+      const bool _writable;
+      const llfio::section_handle::flag _mapflags;
+      index *_header{nullptr};
+      std::mutex _lock;                             // serialises mapping new tables, and growing
+      std::vector<std::unique_ptr<_table>> _tables;  // every table ever mapped, so iterators into retired tables remain valid
+      std::atomic<_table *> _newest{nullptr}, _previous{nullptr};
+
+      static std::string _name(uint32_t generation) { return "index" + std::to_string(generation); }
+      // Must be called with _lock held
+      _table *_map(uint32_t generation)
+      {
+        for(auto &t : _tables)
+        {
+          if(t->generation == generation)
+          {
+            return t.get();
+          }
+        }
+        auto t = std::make_unique<_table>();
+        t->generation = generation;
+        auto fh = llfio::file_handle::file(_dir, _name(generation), _writable ? llfio::file_handle::mode::write : llfio::file_handle::mode::read, llfio::file_handle::creation::open_existing,
+                                           llfio::file_handle::caching::all, llfio::file_handle::flag::disable_prefetching);
+        if(!fh)
+        {
+          return nullptr;
+        }
+        llfio::section_handle sh = llfio::section_handle::section(fh.value(), 0, _mapflags).value();
+        t->entries = (size_t)(sh.length().value() / sizeof(open_hash_index::value_type));
+        t->idx.emplace(sh, t->entries, 0, _mapflags);
+        _tables.push_back(std::move(t));
+        return _tables.back().get();
+      }
+      // Maps any tables created by other users since last called
+      void _refresh()
+      {
+        auto *newest = _newest.load(std::memory_order_acquire);
+        const uint32_t generation = _header->table_generation.load(std::memory_order_acquire);
+        const bool migrating = _header->migrating.load(std::memory_order_acquire) != 0;
+        if(newest != nullptr && newest->generation == generation && migrating == (_previous.load(std::memory_order_acquire) != nullptr))
+        {
+          return;
+        }
+        std::lock_guard<std::mutex> g(_lock);
+        for(;;)
+        {
+          const uint32_t generation_ = _header->table_generation.load(std::memory_order_acquire);
+          const bool migrating_ = _header->migrating.load(std::memory_order_acquire) != 0;
+          auto *newest_ = _map(generation_);
+          auto *previous_ = migrating_ ? _map(generation_ - 1) : nullptr;
+          if(newest_ == nullptr || (migrating_ && previous_ == nullptr))
+          {
+            // The table was retired between reading the header and opening it
+            if(_header->table_generation.load(std::memory_order_acquire) == generation_ && (_header->migrating.load(std::memory_order_acquire) != 0) == migrating_)
+            {
+              throw std::runtime_error("key-value store index table is missing");
+            }
+            continue;
+          }
+          _previous.store(previous_, std::memory_order_release);
+          _newest.store(newest_, std::memory_order_release);
+          return;
+        }
+      }
+      // Moves an item from the previous table into the newest, if it is still in the previous table
+      static void _migrate_item(_table *previous, _table *newest, const key_type &key)
+      {
+        auto it = previous->idx->find_exclusive(key);
+        if(it == previous->idx->end())
+        {
+          return;
+        }
+        {
+          auto ret = newest->idx->insert({it->first, it->second});
+          if(ret.first == newest->idx->end())
+          {
+            throw index_full();  // cannot happen, as the newest table is twice the size of the previous
+          }
+        }
+        previous->idx->erase(std::move(it));
+      }
+      // Moves the next batch of items in the previous table into the newest
+      void _migrate_some(_table *previous, _table *newest, uint64_t batch)
+      {
+        const uint64_t begin = _header->migration_cursor.fetch_add(batch, std::memory_order_relaxed);
+        if(begin >= previous->entries)
+        {
+          return;
+        }
+        const uint64_t end = std::min(begin + batch, (uint64_t) previous->entries);
+        for(uint64_t n = begin; n < end; n++)
+        {
+          // This racy read of the key is only a hint, the final sweep moves anything missed
+          key_type key;
+          memcpy(&key, (const char *) (previous->idx->container().data() + n) + _keyoffset, sizeof(key));
+          _migrate_item(previous, newest, key);
+        }
+        if(end == previous->entries)
+        {
+          _finish_migration(previous, newest);
+        }
+      }
+      void _finish_migration(_table *previous, _table *newest)
+      {
+        // Sweep up anything moved within the previous table by erasure since its slot was
+        // migrated, or inserted by a writer yet to notice the growth
+        std::vector<key_type> keys;
+        do
+        {
+          keys.clear();
+          for(auto it = previous->idx->begin(); it != previous->idx->end(); ++it)
+          {
+            keys.push_back(it->first);
+          }
+          for(const auto &key : keys)
+          {
+            _migrate_item(previous, newest, key);
+          }
+        } while(!keys.empty());
+        _header->migrating.store(0, std::memory_order_seq_cst);
+        if(previous->generation > 0)
+        {
+          // Other users may still have the table mapped, which keeps its storage alive
+          auto fh = llfio::file_handle::file(_dir, _name(previous->generation), llfio::file_handle::mode::write, llfio::file_handle::creation::open_existing);
+          if(fh)
+          {
+            (void) fh.value().unlink();
+          }
+        }
+        _refresh();
+      }
+      // Returns false if the index could not be grown as a migration is still in progress
+      bool _grow(_table *full)
+      {
+        std::lock_guard<std::mutex> g(_lock);
+        auto guard = _indexfile->lock_file_range(_resizelockoffset, 1, llfio::lock_kind::exclusive).value();
+        if(_header->table_generation.load(std::memory_order_acquire) != full->generation)
+        {
+          return true;  // someone else grew it
+        }
+        if(_header->migrating.load(std::memory_order_acquire) != 0)
+        {
+          /* Only two tables may be in use at a time. The caller may hold locks on items, so
+          cannot complete the migration. As migration claims far more items per commit than
+          the commit inserts, this can only happen if the newest table fills early due to
+          clustering.
+          */
+          return false;
+        }
+        const uint32_t generation = full->generation + 1;
+        llfio::file_handle::extent_type size = full->entries * 2 * sizeof(open_hash_index::value_type);
+        size = llfio::utils::round_up_to_page_size(size, llfio::utils::page_size());
+        {
+          auto fh = llfio::file_handle::file(_dir, _name(generation), llfio::file_handle::mode::write, llfio::file_handle::creation::always_new, llfio::file_handle::caching::all,
+                                             llfio::file_handle::flag::disable_prefetching)
+                    .value();
+          fh.truncate(size).value();
+        }
+        _header->migration_cursor.store(0, std::memory_order_relaxed);
+        _header->migrating.store(1, std::memory_order_seq_cst);
+        _header->table_generation.store(generation, std::memory_order_seq_cst);
+        auto *newest = _map(generation);
+        if(newest == nullptr)
+        {
+          throw std::runtime_error("key-value store index table is missing");
+        }
+        _previous.store(_map(full->generation), std::memory_order_release);
+        _newest.store(newest, std::memory_order_release);
+        return true;
+      }
+
+    public:
+      using value_type = open_hash_index::value_type;
+      using iterator = open_hash_index::iterator;
+      using const_iterator = open_hash_index::const_iterator;
+
+      resizable_open_hash_index(llfio::file_handle &indexfile, const llfio::path_handle &dir, bool writable)
+          : _dir(dir.clone_to_path_handle().value())
+          , _indexfile(&indexfile)
+          , _writable(writable)
+          , _mapflags(writable ? llfio::section_handle::flag::readwrite : (llfio::section_handle::flag::read | llfio::section_handle::flag::cow))
+      {
+        llfio::section_handle sh = llfio::section_handle::section(indexfile, 0, _mapflags).value();
+        auto t = std::make_unique<_table>();
+        t->entries = (size_t)((sh.length().value() - sizeof(index)) / sizeof(value_type));
+        t->idx.emplace(sh, t->entries, sizeof(index), _mapflags);
+        _header = reinterpret_cast<index *>((char *) t->idx->container().data() - sizeof(index));
+        _tables.push_back(std::move(t));
+        _refresh();
+      }
+      //! The header of the index
+      index *header() const noexcept { return _header; }
+      //! The number of entries in the newest table
+      size_t capacity() const noexcept { return _newest.load(std::memory_order_acquire)->entries; }
+
+      auto end() noexcept { return _newest.load(std::memory_order_acquire)->idx->end(); }
+      const_iterator find_shared(const key_type &key)
+      {
+        _refresh();
+        for(;;)
+        {
+          auto *previous = _previous.load(std::memory_order_acquire);
+          auto *newest = _newest.load(std::memory_order_acquire);
+          if(previous != nullptr)
+          {
+            auto it = previous->idx->find_shared(key);
+            if(it != previous->idx->end())
+            {
+              return it;
+            }
+          }
+          auto it = newest->idx->find_shared(key);
+          // If the index grew since, the item may have been moved into a table not yet mapped
+          if(it != newest->idx->end() || _header->table_generation.load(std::memory_order_seq_cst) == newest->generation)
+          {
+            return it;
+          }
+          _refresh();
+        }
+      }
+      iterator find_exclusive(const key_type &key)
+      {
+        _refresh();
+        for(;;)
+        {
+          auto *previous = _previous.load(std::memory_order_acquire);
+          auto *newest = _newest.load(std::memory_order_acquire);
+          if(previous != nullptr)
+          {
+            _migrate_item(previous, newest, key);
+          }
+          auto it = newest->idx->find_exclusive(key);
+          if(it != newest->idx->end() || _header->table_generation.load(std::memory_order_seq_cst) == newest->generation)
+          {
+            return it;
+          }
+          _refresh();
+        }
+      }
+      auto insert(const std::pair<key_type, value_history> &v)
+      {
+        for(;;)
+        {
+          _refresh();
+          auto *previous = _previous.load(std::memory_order_acquire);
+          auto *newest = _newest.load(std::memory_order_acquire);
+          if(previous == nullptr && _writable && (_header->items.load(std::memory_order_relaxed) + 1) * 4 > newest->entries * 3)
+          {
+            _grow(newest);
+            continue;
+          }
+          auto ret = newest->idx->insert({v.first, v.second});
+          if(ret.first == newest->idx->end())
+          {
+            if(!_writable || !_grow(newest))
+            {
+              return ret;
+            }
+            continue;
+          }
+          if(ret.second)
+          {
+            _header->items.fetch_add(1, std::memory_order_relaxed);
+          }
+          if(_header->table_generation.load(std::memory_order_seq_cst) != newest->generation)
+          {
+            // The index grew whilst I was inserting, so move what I inserted myself
+            const bool inserted = ret.second;
+            ret.first = {};
+            _refresh();
+            _migrate_item(newest, _newest.load(std::memory_order_acquire), v.first);
+            newest = _newest.load(std::memory_order_acquire);
+            ret = newest->idx->insert({v.first, v.second});
+            ret.second = inserted;
+          }
+          return ret;
+        }
+      }
+      void erase(iterator &&it)
+      {
+        const char *p = (const char *) &it->first;
+        for(auto &t : _tables)
+        {
+          const char *begin = (const char *) t->idx->container().data();
+          if(p >= begin && p < begin + t->entries * sizeof(value_type))
+          {
+            t->idx->erase(std::move(it));
+            _header->items.fetch_sub(1, std::memory_order_relaxed);
+            return;
+          }
+        }
+      }
+      //! Calls `f` with every item in every table in use. Items being migrated may be seen twice.
+      template <class F> void for_each(F &&f)
+      {
+        _refresh();
+        for(auto *t : {_previous.load(std::memory_order_acquire), _newest.load(std::memory_order_acquire)})
+        {
+          if(t != nullptr)
+          {
+            for(auto it = t->idx->begin(); it != t->idx->end(); ++it)
+            {
+              f(*it);
+            }
+          }
+        }
+      }
+      /*! Moves at least `batch` items of the previous table into the newest, if migrating. The
+      caller must hold no locks on items.
+      */
+      void migrate_some(uint64_t batch)
+      {
+        _refresh();
+        auto *previous = _previous.load(std::memory_order_acquire);
+        if(previous != nullptr)
+        {
+          _migrate_some(previous, _newest.load(std::memory_order_acquire), batch);
+        }
+      }
+      //! Completes any migration in progress, e.g. one abandoned by a user which exited suddenly. The caller must hold no locks on items.
+      void finish_migration()
+      {
+        _refresh();
+        auto *previous = _previous.load(std::memory_order_acquire);
+        if(previous != nullptr)
+        {
+          _header->migration_cursor.store(UINT64_MAX / 2, std::memory_order_relaxed);
+          _finish_migration(previous, _newest.load(std::memory_order_acquire));
+        }
+      }
+      //! Unlocks every item, which is only safe if no other user has the index open
+      void clear_locks() noexcept
+      {
+        for(auto *t : {_previous.load(std::memory_order_acquire), _newest.load(std::memory_order_acquire)})
+        {
+          if(t != nullptr)
+          {
+            for(size_t n = 0; n < t->entries; n++)
+            {
+              reinterpret_cast<std::atomic<uint32_t> *>(t->idx->container().data() + n)->store(0, std::memory_order_relaxed);
+            }
+          }
+        }
+      }
+    };
+
+    /* The optional ordered index is a file of keys in order: a sorted delta run of up to
+    `ordered_index_delta_capacity` keys, into which each commit merges the keys it inserts, and
+    a sorted base run, into which the delta is merged whenever it would overflow. Keys removed
+    from the hash index are dropped lazily when the delta is merged into the base. Readers are
+    lock free, retrying if `generation` changed or was odd during their read.
+    */
+    struct ordered_index
+    {
+      uint64_t magic;                       // "AFIOOI01" for valid, anything else means rebuild
+      std::atomic<uint64_t> generation;     // odd whilst being modified
+      uint64_t base_count, delta_count;     // keys in each run
     };
+    static constexpr size_t ordered_index_delta_capacity = 65536;
+    static constexpr size_t ordered_index_delta_offset = 4096;
+    static constexpr size_t ordered_index_base_offset = ordered_index_delta_offset + ordered_index_delta_capacity * sizeof(key_type);
+
+    // The ordered index orders keys by their most significant bits first
+    inline bool key_less(const key_type &a, const key_type &b) noexcept
+    {
+      return (a.as_longlongs[1] != b.as_longlongs[1]) ? (a.as_longlongs[1] < b.as_longlongs[1]) : (a.as_longlongs[0] < b.as_longlongs[0]);
+    }
 
     struct value_tail
     {
       uint128 hash;  // 128 bit hash of contents
       key_type key;
       uint64_t transaction_counter;  // transaction counter when this was updated
-      uint64_t length;               // (uint64_t)-1 means key was deleted
+      uint32_t length;               // Length in bytes as stored, (uint32_t)-1 means key was deleted
+      uint32_t raw_length;           // Length in bytes before compression, zero if stored uncompressed
     };
     static_assert(sizeof(value_tail) == 48, "value_tail is wrong size");
   }
 
-  class transaction;
-
-  /*! A transactional key-value store.
+  /* Values are compressed using LZ77 with a dictionary trained from sample values preceding
+  every value, so even small values can refer to content common to all values. The format
+  is that of an LZ4 block: each sequence is a token whose top nibble is the count of literals
+  and bottom nibble the match length less four, either extended by following bytes if fifteen,
+  then the literals, then a two byte little endian offset back into the dictionary and value
+  decompressed so far. The last sequence has literals only.
   */
-  class basic_key_value_store
+  namespace compression
   {
-    friend class transaction;
-    llfio::file_handle _indexfile;
-    llfio::file_handle _mysmallfile;  // append only
-    llfio::file_handle::extent_guard _indexfileguard, _smallfileguard;
-    size_t _mysmallfileidx{(size_t) -1};
-    struct
+    static constexpr size_t min_match = 4;
+    static constexpr size_t max_offset = 65535;
+    //! Values shorter than this are never compressed
+    static constexpr size_t min_value_size = 32;
+    //! The largest dictionary, all of which can be referred to from the start of a value
+    static constexpr size_t max_dictionary_size = max_offset - min_match;
+
+    inline uint32_t hash4(const char *p) noexcept
     {
-      std::vector<llfio::file_handle> blocking;
-      std::vector<llfio::mapped_file_handle> mapped;
-    } _smallfiles;
-    optional<index::open_hash_index> _index;
-    index::index *_indexheader{nullptr};
-    std::mutex _commitlock;
-    size_t _mmap_over_extension{0};
+      uint32_t v;
+      memcpy(&v, p, 4);
+      return v * 2654435761U;
+    }
 
-    static constexpr llfio::file_handle::extent_type _indexinuseoffset = INT64_MAX;
-    static constexpr uint64_t _goodmagic = 0x3130564b4f494641;  // "AFIOKV01"
-    static constexpr uint64_t _badmagic = 0x3130564b44414544;   // "DEADKV01"
+    //! A trained dictionary, and a hash table of where sequences occur within it
+    class dictionary
+    {
+      static constexpr unsigned _table_bits = 14;
+      std::vector<char> _bytes;
+      std::vector<uint32_t> _table;  // one plus offset into the dictionary, zero if none
+
+    public:
+      explicit dictionary(std::vector<char> bytes)
+          : _bytes(std::move(bytes))
+          , _table(1U << _table_bits)
+      {
+        // Later positions overwrite earlier, preferring the nearest and so shortest offsets
+        for(size_t n = 0; n + min_match <= _bytes.size(); n++)
+        {
+          _table[hash4(_bytes.data() + n) >> (32 - _table_bits)] = (uint32_t)(n + 1);
+        }
+      }
+      span<const char> bytes() const noexcept { return {_bytes.data(), _bytes.size()}; }
+      //! Returns one plus the offset of a candidate match for the sequence with hash `h`, or zero
+      uint32_t lookup(uint32_t h) const noexcept { return _table[h >> (32 - _table_bits)]; }
+    };
+
+    /*! \brief Trains a dictionary of up to `dictionary_size` bytes from sample values.
+
+    Each sample is cut into 64 byte segments, and each segment is scored by how often the
+    eight byte sequences it contains occur across all the samples. The best scoring segments
+    are chosen greedily, with the sequences of each chosen segment no longer counting towards
+    the score of any other, so the dictionary holds as much distinct common content as possible.
+    */
+    inline std::vector<char> train(span<const span<const char>> samples, size_t dictionary_size)
+    {
+      static constexpr size_t k = 8, segment_size = 64;
+      static constexpr unsigned table_bits = 18;
+      dictionary_size = std::min(dictionary_size, max_dictionary_size);
+      auto kmer = [](const char *p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return (size_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - table_bits));
+      };
+      std::vector<uint32_t> frequency(1U << table_bits);
+      for(const auto &sample : samples)
+      {
+        for(size_t n = 0; n + k <= sample.size(); n++)
+        {
+          frequency[kmer(sample.data() + n)]++;
+        }
+      }
+      struct segment
+      {
+        const char *data;
+        size_t length;
+        uint64_t score;
+        bool operator<(const segment &o) const noexcept { return score < o.score; }
+      };
+      auto score = [&](const char *data, size_t length) {
+        uint64_t ret = 0;
+        for(size_t n = 0; n + k <= length; n++)
+        {
+          ret += frequency[kmer(data + n)];
+        }
+        return ret;
+      };
+      std::priority_queue<segment> segments;
+      for(const auto &sample : samples)
+      {
+        for(size_t offset = 0; offset + k <= sample.size(); offset += segment_size)
+        {
+          const size_t length = std::min(segment_size, sample.size() - offset);
+          segments.push({sample.data() + offset, length, score(sample.data() + offset, length)});
+        }
+      }
+      std::vector<char> ret;
+      ret.reserve(dictionary_size);
+      while(!segments.empty() && ret.size() < dictionary_size)
+      {
+        // Scores only ever fall, so a segment whose rescore still beats the next best is the best
+        segment best = segments.top();
+        segments.pop();
+        best.score = score(best.data, best.length);
+        if(best.score == 0)
+        {
+          continue;
+        }
+        if(!segments.empty() && best.score < segments.top().score)
+        {
+          segments.push(best);
+          continue;
+        }
+        const size_t length = std::min(best.length, dictionary_size - ret.size());
+        ret.insert(ret.end(), best.data, best.data + length);
+        for(size_t n = 0; n + k <= best.length; n++)
+        {
+          frequency[kmer(best.data + n)] = 0;
+        }
+      }
+      return ret;
+    }
+
+    //! Compresses `in` into `out`, returning the length compressed, or zero if it would not be shorter than `in`
+    inline size_t compress(span<char> out, span<const char> in, const dictionary &dict) noexcept
+    {
+      if(in.size() < min_value_size)
+      {
+        return 0;
+      }
+      const auto dictbytes = dict.bytes();
+      // A table of where sequences occur within the value, sized to the value
+      unsigned table_bits = 8;
+      while(table_bits < 12 && ((size_t) 1 << table_bits) < in.size())
+      {
+        table_bits++;
+      }
+      uint32_t table[1U << 12];
+      memset(table, 0, sizeof(uint32_t) << table_bits);
+      size_t op = 0, anchor = 0, i = 0;
+      const size_t limit = in.size() - 5;  // the last five bytes are always literals
+      const size_t outlimit = std::min(out.size(), in.size() - 1);
+      auto put_length = [&](size_t length) {
+        for(; length >= 255; length -= 255)
+        {
+          if(op == outlimit)
+          {
+            return false;
+          }
+          out[op++] = (char) 255;
+        }
+        if(op == outlimit)
+        {
+          return false;
+        }
+        out[op++] = (char) length;
+        return true;
+      };
+      auto put_sequence = [&](size_t literals, size_t offset, size_t matchlength) {
+        if(op + 1 + literals + 2 > outlimit)
+        {
+          return false;
+        }
+        const size_t ml = (matchlength != 0) ? matchlength - min_match : 0;
+        out[op++] = (char) (((literals < 15 ? literals : 15) << 4) | (ml < 15 ? ml : 15));
+        if(literals >= 15 && !put_length(literals - 15))
+        {
+          return false;
+        }
+        if(op + literals > outlimit)
+        {
+          return false;
+        }
+        memcpy(out.data() + op, in.data() + anchor, literals);
+        op += literals;
+        if(matchlength == 0)
+        {
+          return true;
+        }
+        if(op + 2 > outlimit)
+        {
+          return false;
+        }
+        out[op++] = (char) (offset & 0xff);
+        out[op++] = (char) (offset >> 8);
+        return ml < 15 || put_length(ml - 15);
+      };
+      while(i + min_match <= limit)
+      {
+        const uint32_t h = hash4(in.data() + i);
+        size_t bestlength = 0, bestoffset = 0;
+        uint32_t &slot = table[h >> (32 - table_bits)];
+        if(slot != 0 && i - (slot - 1) <= max_offset)
+        {
+          const size_t j = slot - 1;
+          size_t length = 0;
+          while(i + length < limit && in[j + length] == in[i + length])
+          {
+            length++;
+          }
+          bestlength = length;
+          bestoffset = i - j;
+        }
+        slot = (uint32_t)(i + 1);
+        if(const uint32_t d = dict.lookup(h))
+        {
+          const size_t j = d - 1, offset = i + dictbytes.size() - j;
+          if(offset <= max_offset)
+          {
+            size_t length = 0;
+            while(j + length < dictbytes.size() && i + length < limit && dictbytes[j + length] == in[i + length])
+            {
+              length++;
+            }
+            if(length > bestlength)
+            {
+              bestlength = length;
+              bestoffset = offset;
+            }
+          }
+        }
+        if(bestlength < min_match)
+        {
+          i++;
+          continue;
+        }
+        if(!put_sequence(i - anchor, bestoffset, bestlength))
+        {
+          return 0;
+        }
+        i += bestlength;
+        anchor = i;
+      }
+      if(!put_sequence(in.size() - anchor, 0, 0))
+      {
+        return 0;
+      }
+      return op;
+    }
+
+    //! Decompresses `in` into `out`, returning false if `in` is not exactly `out.size()` bytes when decompressed
+    inline bool decompress(span<char> out, span<const char> in, span<const char> dict) noexcept
+    {
+      size_t ip = 0, op = 0;
+      auto get_length = [&](size_t &length) {
+        unsigned char c;
+        do
+        {
+          if(ip == in.size())
+          {
+            return false;
+          }
+          c = (unsigned char) in[ip++];
+          length += c;
+        } while(c == 255);
+        return true;
+      };
+      while(ip < in.size())
+      {
+        const auto token = (unsigned char) in[ip++];
+        size_t literals = token >> 4;
+        if(literals == 15 && !get_length(literals))
+        {
+          return false;
+        }
+        if(literals > in.size() - ip || literals > out.size() - op)
+        {
+          return false;
+        }
+        memcpy(out.data() + op, in.data() + ip, literals);
+        ip += literals;
+        op += literals;
+        if(ip == in.size())
+        {
+          break;  // the last sequence has no match
+        }
+        if(in.size() - ip < 2)
+        {
+          return false;
+        }
+        const size_t offset = (unsigned char) in[ip] | ((size_t)(unsigned char) in[ip + 1] << 8);
+        ip += 2;
+        size_t matchlength = (token & 15) + min_match;
+        if((token & 15) == 15 && !get_length(matchlength))
+        {
+          return false;
+        }
+        if(offset == 0 || offset > op + dict.size() || matchlength > out.size() - op)
+        {
+          return false;
+        }
+        // Matches may overlap their own output, and may begin within the dictionary
+        for(size_t n = 0; n < matchlength; n++, op++)
+        {
+          out[op] = (op >= offset) ? out[op - offset] : dict[dict.size() - (offset - op)];
+        }
+      }
+      return op == out.size();
+    }
+  }  // namespace compression
+
+  class transaction;
+
+  /*! A transactional key-value store.
+  */
+  class basic_key_value_store
+  {
+    friend class transaction;
+    llfio::file_handle _indexfile;
+    llfio::file_handle _mysmallfile;  // append only
+    llfio::file_handle::extent_guard _indexfileguard, _smallfileguard;
+    size_t _mysmallfileidx{(size_t) -1};
+    struct
+    {
+      std::vector<llfio::file_handle> blocking;
+      std::vector<llfio::mapped_file_handle> mapped;
+    } _smallfiles;                             // capacity for all 48 is reserved, so they never relocate
+    std::atomic<size_t> _smallfiles_opened{0};  // how many of _smallfiles may be used without taking _smallfileslock
+    std::mutex _smallfileslock;                // serialises opening smallfiles created since the store was opened
+    optional<index::resizable_open_hash_index> _index;
+    index::index *_indexheader{nullptr};
+    std::mutex _commitlock;  // held by the group commit leader, and by compaction whilst it appends
+
+    /* Group commit: committing transactions push a request onto a lock free stack. Whichever
+    committer becomes leader takes the whole stack, lays out every request's records after
+    my smallfile's end, writes them all with as few gather writes as `max_buffers()` permits
+    and a single barrier, then updates the index for each and wakes their committers.
+    */
+    struct _toupdate_type
+    {
+      const key_type key;
+      const uint64_t old_transaction_counter;
+      const bool insertion, update, removal;
+      index::value_history::item history_item{};
+      index::open_hash_index::iterator it{};
+      _toupdate_type(key_type _key, uint64_t _old_transaction_counter, bool _insertion, bool _update, bool _removal)
+          : key(_key)
+          , old_transaction_counter(_old_transaction_counter)
+          , insertion(_insertion)
+          , update(_update)
+          , removal(_removal)
+      {
+      }
+    };
+    struct _commit_request
+    {
+      transaction *tr{nullptr};
+      std::vector<_toupdate_type> toupdate;
+      std::vector<llfio::byte> tailbuffers;                    // 128 bytes per item
+      std::vector<llfio::file_handle::const_buffer_type> reqs;  // gather buffers of this request's records
+      std::vector<char> compressed;                             // compressed values, if the store compresses
+      std::vector<std::pair<size_t, size_t>> compressed_items;  // offset, length into compressed, zero length if stored raw
+      std::exception_ptr error;
+      std::atomic<bool> done{false};
+      _commit_request *next{nullptr};
+    };
+    std::atomic<_commit_request *> _commit_queue{nullptr};
+    llfio::path_handle _dir;
+    llfio::mapped_file_handle _orderedindexfile;
+    index::ordered_index *_orderedindexheader{nullptr};
+    std::mutex _orderedindexlock;       // serialises updating the map of the ordered index
+    std::mutex _orderedindexwritelock;  // serialises this process' writers of the ordered index, as byte range locks do not
+    std::atomic<bool> _commit_leader{false};
+    std::mutex _commit_waitlock;
+    std::condition_variable _commit_waitcond;
+    size_t _mmap_over_extension{0};
+    size_t _zero_copy_threshold{65536};
+
+    /* Values at least `_zero_copy_threshold` long are returned by find() as views into read only
+    maps of the smallfiles. Each view pins the reader epoch current when it was taken. A map which
+    must be relocated to grow it is retired rather than closed, and is only closed once the epoch
+    has advanced twice, which cannot happen whilst any reader which could have seen it remains.
+    */
+    struct _smallfile_view
+    {
+      std::atomic<llfio::byte *> address{nullptr};
+      std::atomic<llfio::file_handle::extent_type> length{0};
+    } _smallfile_views[48];
+    std::vector<llfio::mapped_file_handle> _smallfile_readmaps;  // protected by _remaplock
+    std::mutex _remaplock;
+    std::atomic<uint64_t> _reader_epoch{2};
+    std::atomic<size_t> _reader_epoch_pins[2] = {};
+    std::vector<std::pair<uint64_t, llfio::mapped_file_handle>> _retired_readmaps;  // protected by _remaplock
+    std::atomic<size_t> _retired_readmaps_count{0};
+
+    // Values shorter than `_zero_copy_threshold` are read into registered buffers recycled
+    // through a pool, one free list per power of two multiple of the page size
+    static constexpr size_t _buffer_pool_classes = 8, _buffer_pool_max_free = 64;
+    struct _buffer_pool
+    {
+      std::mutex lock;
+      std::vector<llfio::io_handle::registered_buffer_type> free;
+    } _buffer_pools[_buffer_pool_classes];
+
+    // The compression dictionary is loaded when first needed, and never changes thereafter
+    std::unique_ptr<compression::dictionary> _dictionary;
+    std::atomic<const compression::dictionary *> _dictionary_ptr{nullptr};
+    std::mutex _dictionarylock;
+
+    /* Held snapshots retain the versions of keys they can see. As a version falls off the end of
+    the history of its key, it is kept here if any held snapshot can see it, and compaction treats
+    versions kept here as live.
+    */
+    struct _retained_version
+    {
+      index::value_history::item item;
+      uint64_t superseded_at;  // when the next newer version was written
+    };
+    std::mutex _snapshotlock;
+    std::multiset<uint64_t> _held_snapshots;                               // protected by _snapshotlock
+    std::atomic<size_t> _held_snapshots_count{0};                          // avoids taking _snapshotlock when none are held
+    std::map<key_type, std::vector<_retained_version>> _retained_versions;  // protected by _snapshotlock
+
+    static constexpr llfio::file_handle::extent_type _indexinuseoffset = INT64_MAX;
+    static constexpr uint64_t _goodmagic = 0x3630564b4f494641;  // "AFIOKV06"
+    static constexpr uint64_t _badmagic = 0x3130564b44414544;   // "DEADKV01"
+    // True if `magic` is that of an earlier version of the format, "AFIOKV01" to "AFIOKV05"
+    static bool _is_old_magic(uint64_t magic) noexcept
+    {
+      const auto version = (char) (magic >> 56);
+      return (magic & 0x00ffffffffffffffULL) == (_goodmagic & 0x00ffffffffffffffULL) && version >= '1' && version < (char) (_goodmagic >> 56);
+    }
+
+    static size_t _pad_length(size_t length)
+    {
+      // We append a value_tail record and round up to 64 byte multiple
+      return (length + sizeof(index::value_tail) + 63) & ~63;
+    }
+    llfio::file_handle &_smallfile(size_t idx) { return _smallfiles.mapped.empty() ? _smallfiles.blocking[idx] : static_cast<llfio::file_handle &>(_smallfiles.mapped[idx]); }
+    // Opens the smallfiles up to and including `idx` which other writers created after this store was opened
+    void _open_newer_smallfiles(size_t idx)
+    {
+      if(idx < _smallfiles_opened.load(std::memory_order_acquire))
+      {
+        return;
+      }
+      std::lock_guard<std::mutex> g(_smallfileslock);
+      for(size_t n = _smallfiles_opened.load(std::memory_order_relaxed); n <= idx; n++)
+      {
+        auto fh = llfio::file_handle::file(_dir, std::to_string(n), llfio::file_handle::mode::read, llfio::file_handle::creation::open_existing,
+                                           llfio::file_handle::caching::all, llfio::file_handle::flag::disable_prefetching);
+        if(n >= 48 || !fh)
+        {
+          // The index refers to a smallfile which does not exist
+          _indexheader->magic = _badmagic;
+          throw corrupted_store();
+        }
+        if(_smallfiles.mapped.empty())
+        {
+          _smallfiles.blocking.push_back(std::move(fh).value());
+        }
+        else
+        {
+          const auto currentlength = fh.value().maximum_extent().value();
+          _smallfiles.mapped.push_back(
+          llfio::mapped_file_handle(std::move(fh).value(), (size_t)(currentlength + _mmap_over_extension), llfio::section_handle::flag::read));
+        }
+        _smallfiles_opened.store(n + 1, std::memory_order_release);
+      }
+    }
+    // The bottom 48 bits of the transaction counter when a version was written, zero if there is no version
+    static uint64_t _written_at(const index::value_history::item &h) noexcept { return (h.transaction_counter != 0) ? (h.transaction_counter & ((1ULL << 48) - 1)) : h.value_offset; }
+
+    // Called with `key` exclusively locked just before `dropped` falls off the end of its history
+    void _retain_version(const key_type &key, const index::value_history::item &dropped, uint64_t superseded_at)
+    {
+      const uint64_t written_at = _written_at(dropped);
+      if(written_at == 0 || _held_snapshots_count.load(std::memory_order_acquire) == 0)
+      {
+        return;
+      }
+      std::lock_guard<std::mutex> g(_snapshotlock);
+      auto it = _held_snapshots.lower_bound(written_at);
+      if(it != _held_snapshots.end() && *it < superseded_at)
+      {
+        _retained_versions[key].push_back({dropped, superseded_at});
+      }
+    }
+    /* Waits until the writers in other processes have applied every transaction numbered no later
+    than `transaction_counter`. Writers of this store instance are excluded by `_commitlock`.
+    */
+    void _wait_for_other_writers(uint64_t transaction_counter)
+    {
+      // Pairs with the fence between a writer setting applying_from and numbering its transactions
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for(size_t n = 0; n < 48; n++)
+      {
+        if(_mysmallfile.is_valid() && n == _mysmallfileidx)
+        {
+          continue;
+        }
+        for(size_t spins = 1;; spins++)
+        {
+          const uint64_t from = _indexheader->applying_from[n].load(std::memory_order_acquire);
+          if(from == 0 || from > transaction_counter)
+          {
+            break;
+          }
+          if((spins % 1024) == 0)
+          {
+            // A writer which died leaves applying_from set. If it can be locked, its smallfile is unclaimed.
+            _open_newer_smallfiles(n);
+            auto claimed = _smallfile(n).lock_file_range(_indexinuseoffset, 1, llfio::lock_kind::shared, std::chrono::seconds(0));
+            if(claimed)
+            {
+              // Transactions it never began applying were never committed, but one partially applied needs recovery
+              if(_indexheader->writes_occurring[n] != 0)
+              {
+                throw corrupted_store();
+              }
+              break;
+            }
+          }
+          std::this_thread::yield();
+        }
+      }
+    }
+    /* Publishes the oldest snapshot this store instance holds, so compaction by other processes,
+    which cannot see the versions it retains, leaves their regions alone. Must be called with
+    _snapshotlock held. Stores opened read only have no slot to publish in.
+    */
+    void _publish_oldest_held() noexcept
+    {
+      if(_mysmallfile.is_valid())
+      {
+        _indexheader->oldest_held[_mysmallfileidx].store(_held_snapshots.empty() ? 0 : (*_held_snapshots.begin() + 1), std::memory_order_seq_cst);
+      }
+    }
+    // True if a writer in another process publishes a held snapshot
+    bool _snapshots_held_elsewhere()
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for(size_t n = 0; n < 48; n++)
+      {
+        if(n == _mysmallfileidx || _indexheader->oldest_held[n].load(std::memory_order_acquire) == 0)
+        {
+          continue;
+        }
+        // A writer which died leaves its snapshot published. If it can be locked, its smallfile is unclaimed.
+        _open_newer_smallfiles(n);
+        auto claimed = _smallfile(n).lock_file_range(_indexinuseoffset, 1, llfio::lock_kind::shared, std::chrono::seconds(0));
+        if(!claimed)
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    void _release_snapshot(uint64_t transaction_counter) noexcept
+    {
+      std::lock_guard<std::mutex> g(_snapshotlock);
+      _held_snapshots.erase(_held_snapshots.find(transaction_counter));
+      _held_snapshots_count.fetch_sub(1, std::memory_order_release);
+      _publish_oldest_held();
+      // Forget the versions no remaining held snapshot can see
+      for(auto it = _retained_versions.begin(); it != _retained_versions.end();)
+      {
+        auto &versions = it->second;
+        versions.erase(std::remove_if(versions.begin(), versions.end(),
+                                      [this](const _retained_version &v) {
+                                        auto sit = _held_snapshots.lower_bound(_written_at(v.item));
+                                        return sit == _held_snapshots.end() || *sit >= v.superseded_at;
+                                      }),
+                       versions.end());
+        if(versions.empty())
+        {
+          it = _retained_versions.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    uint64_t _pin_reader_epoch() noexcept
+    {
+      for(;;)
+      {
+        const auto epoch = _reader_epoch.load(std::memory_order_seq_cst);
+        _reader_epoch_pins[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+        // If the epoch advanced meanwhile, our pin may have been missed
+        if(_reader_epoch.load(std::memory_order_seq_cst) == epoch)
+        {
+          return epoch;
+        }
+        _reader_epoch_pins[epoch & 1].fetch_sub(1, std::memory_order_release);
+      }
+    }
+    void _unpin_reader_epoch(uint64_t epoch) noexcept
+    {
+      _reader_epoch_pins[epoch & 1].fetch_sub(1, std::memory_order_seq_cst);
+      if(_retired_readmaps_count.load(std::memory_order_relaxed) > 0)
+      {
+        std::unique_lock<std::mutex> g(_remaplock, std::try_to_lock);
+        if(g.owns_lock())
+        {
+          _reclaim_retired_readmaps();
+        }
+      }
+    }
+    // Must be called with _remaplock held
+    void _reclaim_retired_readmaps() noexcept
+    {
+      // Advance the epoch for as long as no reader remains pinned in the previous one
+      for(int n = 0; n < 2; n++)
+      {
+        const auto epoch = _reader_epoch.load(std::memory_order_seq_cst);
+        if(_reader_epoch_pins[(epoch - 1) & 1].load(std::memory_order_seq_cst) != 0)
+        {
+          break;
+        }
+        _reader_epoch.store(epoch + 1, std::memory_order_seq_cst);
+      }
+      const auto epoch = _reader_epoch.load(std::memory_order_seq_cst);
+      _retired_readmaps.erase(std::remove_if(_retired_readmaps.begin(), _retired_readmaps.end(), [epoch](const auto &i) { return i.first + 2 <= epoch; }),
+                              _retired_readmaps.end());
+      _retired_readmaps_count.store(_retired_readmaps.size(), std::memory_order_relaxed);
+    }
+    // Returns the address of a read only map of the smallfile covering at least `extent` bytes. The caller must have pinned the reader epoch.
+    const llfio::byte *_map_smallfile(size_t idx, llfio::file_handle::extent_type extent)
+    {
+      auto &view = _smallfile_views[idx];
+      // length is stored after address, so if the length suffices so does the address
+      if(view.length.load(std::memory_order_acquire) >= extent)
+      {
+        return view.address.load(std::memory_order_acquire);
+      }
+      std::lock_guard<std::mutex> g(_remaplock);
+      const size_t overextension = std::max(_mmap_over_extension, (size_t) 64 * 1024 * 1024);
+      if(_smallfile_readmaps.size() <= idx)
+      {
+        _smallfile_readmaps.resize(48);
+      }
+      auto &rm = _smallfile_readmaps[idx];
+      if(!rm.is_valid())
+      {
+        rm = llfio::mapped_file_handle(_smallfile(idx).reopen(llfio::file_handle::mode::read).value(), extent + overextension, llfio::section_handle::flag::read);
+      }
+      auto length = rm.update_map().value();
+      if(length < extent)
+      {
+        const auto filelength = rm.underlying_file_maximum_extent().value();
+        if(filelength < extent)
+        {
+          // The index refers to a record which the smallfile does not contain
+          _indexheader->magic = _badmagic;
+          throw corrupted_store();
+        }
+        // Relocate into a bigger reservation, retiring the old map until no reader can still be using it
+        llfio::mapped_file_handle old(std::move(rm));
+        rm = old.reopen(filelength + overextension).value();
+        length = rm.update_map().value();
+        view.address.store(rm.address(), std::memory_order_release);
+        view.length.store(length, std::memory_order_release);
+        _retired_readmaps.emplace_back(_reader_epoch.load(std::memory_order_seq_cst), std::move(old));
+        _reclaim_retired_readmaps();
+        return rm.address();
+      }
+      view.address.store(rm.address(), std::memory_order_release);
+      view.length.store(length, std::memory_order_release);
+      return rm.address();
+    }
+
+    llfio::io_handle::registered_buffer_type _acquire_buffer(size_t bytes)
+    {
+      const size_t pagesize = llfio::utils::page_size();
+      size_t cls = 0;
+      while(cls < _buffer_pool_classes && (pagesize << cls) < bytes)
+      {
+        cls++;
+      }
+      if(cls < _buffer_pool_classes)
+      {
+        auto &pool = _buffer_pools[cls];
+        std::lock_guard<std::mutex> g(pool.lock);
+        if(!pool.free.empty())
+        {
+          auto ret = std::move(pool.free.back());
+          pool.free.pop_back();
+          return ret;
+        }
+        bytes = pagesize << cls;
+      }
+      return _smallfile(_mysmallfileidx != (size_t) -1 ? _mysmallfileidx : 0).allocate_registered_buffer(bytes).value();
+    }
+    void _release_buffer(llfio::io_handle::registered_buffer_type &&buffer) noexcept
+    {
+      const size_t pagesize = llfio::utils::page_size();
+      for(size_t cls = 0; cls < _buffer_pool_classes; cls++)
+      {
+        if((pagesize << cls) == buffer->size())
+        {
+          auto &pool = _buffer_pools[cls];
+          std::lock_guard<std::mutex> g(pool.lock);
+          if(pool.free.size() < _buffer_pool_max_free)
+          {
+            pool.free.push_back(std::move(buffer));
+          }
+          return;
+        }
+      }
+    }
+
+    // Opens, and if necessary creates or rebuilds, the ordered index
+    void _open_ordered_index()
+    {
+      const bool writable = _mysmallfile.is_valid();
+      auto fh = llfio::file_handle::file(_dir, "orderedindex", writable ? llfio::file_handle::mode::write : llfio::file_handle::mode::read,
+                                         writable ? llfio::file_handle::creation::if_needed : llfio::file_handle::creation::open_existing, llfio::file_handle::caching::all,
+                                         llfio::file_handle::flag::disable_prefetching)
+                .value();
+      // Reserve enough address space to never need to relocate the map
+      _orderedindexfile = llfio::mapped_file_handle(std::move(fh), (size_t) 1 << 36, writable ? llfio::section_handle::flag::readwrite : llfio::section_handle::flag::read);
+      if(writable)
+      {
+        auto guard = _orderedindexfile.lock_file_range(_indexinuseoffset, 1, llfio::lock_kind::exclusive).value();
+        if(_orderedindexfile.maximum_extent().value() < index::ordered_index_base_offset)
+        {
+          _orderedindexfile.truncate(index::ordered_index_base_offset).value();
+        }
+        _orderedindexheader = reinterpret_cast<index::ordered_index *>(_orderedindexfile.address());
+        // An odd generation with nobody else holding the lock means a writer died mid-update
+        if(_orderedindexheader->magic != _goodorderedmagic || (_orderedindexheader->generation.load(std::memory_order_acquire) & 1) != 0)
+        {
+          _ordered_index_rebuild();
+        }
+        _indexheader->has_ordered_index = true;
+      }
+      else
+      {
+        _orderedindexheader = reinterpret_cast<index::ordered_index *>(_orderedindexfile.address());
+        if(_orderedindexheader->magic != _goodorderedmagic)
+        {
+          _orderedindexheader = nullptr;
+          _orderedindexfile.close().value();
+          throw corrupted_store();
+        }
+      }
+    }
+    // Rebuilds the ordered index from the hash index. Must be called with the exclusive lock held.
+    void _ordered_index_rebuild()
+    {
+      auto &h = *_orderedindexheader;
+      std::vector<key_type> keys;
+      _index->for_each([&](const index::resizable_open_hash_index::value_type &v) { keys.push_back(v.first); });
+      std::sort(keys.begin(), keys.end(), index::key_less);
+      keys.erase(std::unique(keys.begin(), keys.end(), [](const key_type &a, const key_type &b) { return a == b; }), keys.end());
+      // Leave an odd generation from a dead writer odd, so readers never see an even one mid-rebuild
+      if((h.generation.load(std::memory_order_acquire) & 1) == 0)
+      {
+        h.generation.fetch_add(1, std::memory_order_acq_rel);
+      }
+      h.base_count = 0;
+      h.delta_count = 0;
+      _ordered_index_merge_into_base(keys);
+      h.magic = _goodorderedmagic;
+      h.generation.fetch_add(1, std::memory_order_release);
+    }
+    // True if the key is in the hash index and not deleted
+    bool _key_is_live(const key_type &k)
+    {
+      auto it = _index->find_shared(k);
+      return it != _index->end() && it->second.history[0].transaction_counter != 0;
+    }
+    const key_type *_ordered_index_run(size_t offset) const noexcept { return reinterpret_cast<const key_type *>(_orderedindexfile.address() + offset); }
+    key_type *_ordered_index_run(size_t offset) noexcept { return reinterpret_cast<key_type *>(_orderedindexfile.address() + offset); }
+    // Ensures the map of the ordered index covers `extent` bytes
+    void _ordered_index_ensure_mapped(llfio::file_handle::extent_type extent)
+    {
+      if(_orderedindexfile.map().length() < extent)
+      {
+        std::lock_guard<std::mutex> g(_orderedindexlock);
+        if(_orderedindexfile.map().length() < extent && _orderedindexfile.update_map().value() < extent)
+        {
+          throw corrupted_store();
+        }
+      }
+    }
+    // Merges the delta run and `keys` into the base run. Must be called with the generation odd.
+    void _ordered_index_merge_into_base(const std::vector<key_type> &keys)
+    {
+      auto &h = *_orderedindexheader;
+      const key_type *base = _ordered_index_run(index::ordered_index_base_offset), *delta = _ordered_index_run(index::ordered_index_delta_offset);
+      std::vector<key_type> merged, merged2;
+      merged.reserve(h.base_count + h.delta_count + keys.size());
+      std::merge(base, base + h.base_count, delta, delta + h.delta_count, std::back_inserter(merged), index::key_less);
+      merged2.reserve(merged.size() + keys.size());
+      std::merge(merged.begin(), merged.end(), keys.begin(), keys.end(), std::back_inserter(merged2), index::key_less);
+      // Drop duplicates, and keys since removed or deleted from the hash index
+      merged2.erase(std::unique(merged2.begin(), merged2.end(), [](const key_type &a, const key_type &b) { return a == b; }), merged2.end());
+      merged2.erase(std::remove_if(merged2.begin(), merged2.end(), [this](const key_type &k) { return !_key_is_live(k); }), merged2.end());
+      const llfio::file_handle::extent_type needed = index::ordered_index_base_offset + merged2.size() * sizeof(key_type);
+      if(_orderedindexfile.maximum_extent().value() < needed)
+      {
+        // Grow in 1Mb chunks
+        _orderedindexfile.truncate((needed + 1024 * 1024 - 1) & ~(llfio::file_handle::extent_type)(1024 * 1024 - 1)).value();
+      }
+      if(!merged2.empty())
+      {
+        memcpy(_ordered_index_run(index::ordered_index_base_offset), merged2.data(), merged2.size() * sizeof(key_type));
+      }
+      h.base_count = merged2.size();
+      h.delta_count = 0;
+    }
+    // Adds keys newly inserted into the hash index, which must be sorted, to the ordered index
+    void _ordered_index_insert(const std::vector<key_type> &keys)
+    {
+      std::lock_guard<std::mutex> g(_orderedindexwritelock);
+      auto guard = _orderedindexfile.lock_file_range(_indexinuseoffset, 1, llfio::lock_kind::exclusive).value();
+      auto &h = *_orderedindexheader;
+      _ordered_index_ensure_mapped(index::ordered_index_base_offset + h.base_count * sizeof(key_type));
+      h.generation.fetch_add(1, std::memory_order_acq_rel);
+      auto unodd = make_scope_exit([&h]() noexcept { h.generation.fetch_add(1, std::memory_order_release); });
+      if(h.delta_count + keys.size() > index::ordered_index_delta_capacity)
+      {
+        _ordered_index_merge_into_base(keys);
+        return;
+      }
+      // Merge into the delta from the back, so no temporary is needed
+      key_type *delta = _ordered_index_run(index::ordered_index_delta_offset);
+      size_t d = h.delta_count, k = keys.size(), out = d + k;
+      while(k > 0)
+      {
+        if(d > 0 && index::key_less(keys[k - 1], delta[d - 1]))
+        {
+          delta[--out] = delta[--d];
+        }
+        else
+        {
+          delta[--out] = keys[--k];
+        }
+      }
+      h.delta_count += keys.size();
+    }
+    /* Copies up to `max` keys no less than `first` and no greater than `last` in order into `out`,
+    returning how many. Duplicates between the runs are returned once. Lock free.
+    */
+    size_t _ordered_index_read(key_type *out, size_t max, const key_type &first, const key_type &last)
+    {
+      auto &h = *_orderedindexheader;
+      for(size_t spins = 0;; spins++)
+      {
+        const auto generation = h.generation.load(std::memory_order_acquire);
+        if(generation & 1)
+        {
+          if(spins < 1024)
+          {
+            std::this_thread::yield();
+            continue;
+          }
+          // Wait for any live writer to finish. If the generation is still odd, the writer died.
+          const bool writable = _mysmallfile.is_valid();
+          std::lock_guard<std::mutex> g(_orderedindexwritelock);
+          auto guard = _orderedindexfile.lock_file_range(_indexinuseoffset, 1, writable ? llfio::lock_kind::exclusive : llfio::lock_kind::shared).value();
+          if(h.generation.load(std::memory_order_acquire) & 1)
+          {
+            if(!writable)
+            {
+              throw corrupted_store();
+            }
+            _ordered_index_rebuild();
+          }
+          spins = 0;
+          continue;
+        }
+        const size_t base_count = h.base_count, delta_count = h.delta_count;
+        _ordered_index_ensure_mapped(index::ordered_index_base_offset + base_count * sizeof(key_type));
+        const key_type *base = _ordered_index_run(index::ordered_index_base_offset), *delta = _ordered_index_run(index::ordered_index_delta_offset);
+        const key_type *b = std::lower_bound(base, base + base_count, first, index::key_less), *d = std::lower_bound(delta, delta + delta_count, first, index::key_less);
+        size_t n = 0;
+        while(n < max)
+        {
+          const key_type *next;
+          if(b != base + base_count && (d == delta + delta_count || !index::key_less(*d, *b)))
+          {
+            next = b++;
+          }
+          else if(d != delta + delta_count)
+          {
+            next = d++;
+          }
+          else
+          {
+            break;
+          }
+          if(index::key_less(last, *next))
+          {
+            break;
+          }
+          if(n == 0 || !(out[n - 1] == *next))
+          {
+            out[n++] = *next;
+          }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(h.generation.load(std::memory_order_relaxed) == generation)
+        {
+          return n;
+        }
+      }
+    }
+    static key_type _zero_key() noexcept
+    {
+      key_type ret;
+      ret.as_longlongs[0] = ret.as_longlongs[1] = 0;
+      return ret;
+    }
+    static constexpr uint64_t _goodorderedmagic = 0x31304f494f494641;  // "AFIOOI01"
+
+  public:
+    //! Statistics about online compaction of the smallfiles
+    struct compaction_statistics
+    {
+      //! The number of 1Mb smallfile regions reclaimed
+      uint64_t regions_reclaimed{0};
+      //! The number of still live value records moved out of reclaimed regions
+      uint64_t records_moved{0};
+      //! The number of bytes of still live value records moved
+      uint64_t bytes_moved{0};
+      //! The number of bytes of smallfile deallocated by hole punching
+      uint64_t bytes_punched{0};
+    };
+
+  private:
+    // Smallfiles are compacted in aligned regions of this size
+    static constexpr llfio::file_handle::extent_type _compaction_region_size = 1024 * 1024;
+    struct _compaction_record
+    {
+      key_type key;
+      uint64_t transaction_counter;
+      llfio::file_handle::extent_type begin, end;
+    };
+    struct _compaction_region
+    {
+      size_t smallfile;
+      llfio::file_handle::extent_type offset;
+      std::vector<_compaction_record> records;  // live records overlapping this region when scanned
+    };
+    std::mutex _compactlock;                                                         // one compaction step at a time
+    std::vector<bool> _punched_regions[48];                                          // protected by _compactlock
+    std::vector<std::pair<uint64_t, std::pair<size_t, llfio::file_handle::extent_type>>> _pending_punches;  // protected by _remaplock
+
+    /* Scans the index for the live bytes in every complete region of every smallfile below
+    its writer's applied extent, returning those regions with no more than `max_live_fraction`
+    live along with their live records. Records after the applied extent may belong to a
+    commit still being written by another process, so they are never considered.
+    Must be called with _compactlock held.
+    */
+    std::vector<_compaction_region> _find_compaction_candidates(float max_live_fraction)
+    {
+      // Versions retained by held snapshots in other processes are known only to them
+      if(_snapshots_held_elsewhere())
+      {
+        return {};
+      }
+      // Writers which opened the store after this instance may have created more smallfiles
+      for(size_t n = 48; n > 0; n--)
+      {
+        if(_indexheader->applied_extent[n - 1] != 0)
+        {
+          _open_newer_smallfiles(n - 1);
+          break;
+        }
+      }
+      const size_t smallfiles = std::max(_smallfiles.blocking.size(), _smallfiles.mapped.size());
+      std::vector<std::vector<uint64_t>> live(smallfiles);
+      for(size_t n = 0; n < smallfiles; n++)
+      {
+        const llfio::file_handle::extent_type applied = std::min(_smallfile(n).maximum_extent().value(), _indexheader->applied_extent[n]);
+        live[n].resize((size_t)(applied / _compaction_region_size));
+      }
+      auto for_each_live_record = [&](auto &&f) {
+        auto visit = [&](const key_type &key, const index::value_history::item &h) {
+          if(h.transaction_counter == 0 || h.value_identifier >= smallfiles)
+          {
+            return;
+          }
+          const llfio::file_handle::extent_type end = h.value_offset * 64, begin = end - _pad_length(h.length);
+          auto &regions = live[h.value_identifier];
+          for(auto r = begin / _compaction_region_size; r < regions.size() && r * _compaction_region_size < end; r++)
+          {
+            f(key, h, begin, end, (size_t) r);
+          }
+        };
+        _index->for_each([&](const index::resizable_open_hash_index::value_type &v) {
+          for(const auto &h : v.second.history)
+          {
+            visit(v.first, h);
+          }
+        });
+        // Versions retained for held snapshots are also live
+        std::lock_guard<std::mutex> g(_snapshotlock);
+        for(const auto &r : _retained_versions)
+        {
+          for(const auto &v : r.second)
+          {
+            visit(r.first, v.item);
+          }
+        }
+      };
+      // First pass counts the live bytes in each region
+      for_each_live_record([&](const key_type & /*unused*/, const index::value_history::item &h, llfio::file_handle::extent_type begin, llfio::file_handle::extent_type end, size_t r) {
+        const auto rbegin = r * _compaction_region_size, rend = rbegin + _compaction_region_size;
+        live[h.value_identifier][r] += std::min(end, rend) - std::max(begin, rbegin);
+      });
+      // Regions already reclaimed but still awaiting their hole punch are not candidates
+      {
+        std::lock_guard<std::mutex> g(_remaplock);
+        for(const auto &i : _pending_punches)
+        {
+          const auto r = (size_t)(i.second.second / _compaction_region_size);
+          if(r < live[i.second.first].size())
+          {
+            live[i.second.first][r] = (uint64_t) -1;
+          }
+        }
+      }
+      std::vector<_compaction_region> ret;
+      std::vector<std::vector<size_t>> candidate(smallfiles);
+      for(size_t n = 0; n < smallfiles; n++)
+      {
+        candidate[n].assign(live[n].size(), (size_t) -1);
+        for(size_t r = 0; r < live[n].size(); r++)
+        {
+          const bool punched = r < _punched_regions[n].size() && _punched_regions[n][r];
+          if(!punched && live[n][r] <= (uint64_t)(max_live_fraction * _compaction_region_size))
+          {
+            candidate[n][r] = ret.size();
+            ret.push_back({n, r * _compaction_region_size, {}});
+          }
+        }
+      }
+      // Second pass gathers the live records of the candidate regions
+      for_each_live_record([&](const key_type &key, const index::value_history::item &h, llfio::file_handle::extent_type begin, llfio::file_handle::extent_type end, size_t r) {
+        const auto idx = candidate[h.value_identifier][r];
+        if(idx != (size_t) -1)
+        {
+          ret[idx].records.push_back({key, h.transaction_counter, begin, end});
+        }
+      });
+      return ret;
+    }
+
+    /* Appends the still live records of a region to my smallfile, repoints the index at the
+    copies, and queues the region to be hole punched once no reader can still be viewing it.
+    Must be called with _compactlock held.
+    */
+    void _compact_region(_compaction_region &region, compaction_statistics &stats)
+    {
+      const size_t smallfile = region.smallfile;
+      auto &records = region.records;
+      std::sort(records.begin(), records.end(), [](const _compaction_record &a, const _compaction_record &b) { return a.begin < b.begin; });
+      records.erase(std::unique(records.begin(), records.end(), [](const _compaction_record &a, const _compaction_record &b) { return a.begin == b.begin; }), records.end());
+      auto is_referenced = [smallfile](const index::value_history &vh, const _compaction_record &rec) -> const index::value_history::item * {
+        for(const auto &h : vh.history)
+        {
+          if(h.transaction_counter == rec.transaction_counter && h.value_identifier == smallfile && h.value_offset * 64 == rec.end)
+          {
+            return &h;
+          }
+        }
+        return nullptr;
+      };
+      // Must be called with _snapshotlock held
+      auto is_retained = [this, smallfile](const _compaction_record &rec) -> index::value_history::item * {
+        auto it = _retained_versions.find(rec.key);
+        if(it != _retained_versions.end())
+        {
+          for(auto &v : it->second)
+          {
+            if(v.item.transaction_counter == rec.transaction_counter && v.item.value_identifier == smallfile && v.item.value_offset * 64 == rec.end)
+            {
+              return &v.item;
+            }
+          }
+        }
+        return nullptr;
+      };
+      // Drop records superseded, or already moved by a neighbouring region, since the scan
+      records.erase(std::remove_if(records.begin(), records.end(),
+                                   [&](const _compaction_record &rec) {
+                                     auto it = _index->find_shared(rec.key);
+                                     if(it != _index->end() && is_referenced(it->second, rec) != nullptr)
+                                     {
+                                       return false;
+                                     }
+                                     std::lock_guard<std::mutex> g(_snapshotlock);
+                                     return is_retained(rec) == nullptr;
+                                   }),
+                    records.end());
+      // Read the live records back to back
+      std::vector<llfio::byte> buffer;
+      {
+        size_t total = 0;
+        for(const auto &rec : records)
+        {
+          total += (size_t)(rec.end - rec.begin);
+        }
+        buffer.resize(total);
+        llfio::byte *p = buffer.data();
+        for(const auto &rec : records)
+        {
+          const size_t len = (size_t)(rec.end - rec.begin);
+          auto read = _smallfile(smallfile).read(rec.begin, {{p, len}}).value();
+          if(read.size() != 1 || read[0].size() != len)
+          {
+            _indexheader->magic = _badmagic;
+            throw corrupted_store();
+          }
+          if(read[0].data() != p)
+          {
+            memcpy(p, read[0].data(), len);
+          }
+          p += len;
+        }
+      }
+      if(!records.empty())
+      {
+        // Serialise with commits, which also append to my smallfile
+        std::lock_guard<decltype(_commitlock)> commitlockguard(_commitlock);
+        const llfio::file_handle::extent_type value_offset = _mysmallfile.maximum_extent().value();
+        assert((value_offset % 64) == 0);
+        // The index is correct whether it refers to the originals or the copies, so crash recovery
+        // need never examine the copies
+        _indexheader->applied_extent[_mysmallfileidx] = value_offset + buffer.size();
+        // POSIX guarantees that at least 16 gather buffers can be written in a single shot
+        std::vector<llfio::file_handle::const_buffer_type> reqs;
+        reqs.reserve(16);
+        const llfio::byte *p = buffer.data();
+        for(const auto &rec : records)
+        {
+          reqs.push_back({p, (size_t)(rec.end - rec.begin)});
+          p += rec.end - rec.begin;
+          if(reqs.size() == 16)
+          {
+            _mysmallfile.write({reqs, 0}).value();
+            reqs.clear();
+          }
+        }
+        if(!reqs.empty())
+        {
+          _mysmallfile.write({reqs, 0}).value();
+        }
+        // Repoint the index at the copies, any history item updated concurrently is left alone
+        _indexheader->writes_occurring[_mysmallfileidx].fetch_add(1);
+        llfio::file_handle::extent_type newend = value_offset;
+        for(const auto &rec : records)
+        {
+          newend += rec.end - rec.begin;
+          auto it = _index->find_exclusive(rec.key);
+          index::value_history::item *h = nullptr;
+          if(it != _index->end())
+          {
+            h = const_cast<index::value_history::item *>(is_referenced(it->second, rec));
+          }
+          std::lock_guard<std::mutex> g(_snapshotlock);
+          if(h == nullptr)
+          {
+            h = is_retained(rec);
+          }
+          if(h != nullptr)
+          {
+            h->value_identifier = _mysmallfileidx;
+            h->value_offset = newend / 64;
+            stats.records_moved++;
+            stats.bytes_moved += rec.end - rec.begin;
+          }
+        }
+        _indexheader->writes_occurring[_mysmallfileidx].fetch_sub(1);
+      }
+      std::lock_guard<std::mutex> g(_remaplock);
+      _pending_punches.push_back({_reader_epoch.load(std::memory_order_seq_cst), {smallfile, region.offset}});
+      stats.regions_reclaimed++;
+    }
+
+    // Hole punches those reclaimed regions which no reader can still be viewing. Must be called with _compactlock held.
+    void _punch_reclaimed_regions(compaction_statistics &stats)
+    {
+      std::vector<std::pair<size_t, llfio::file_handle::extent_type>> topunch;
+      // A snapshot held by another process since the regions were compacted may retain versions in them
+      if(_snapshots_held_elsewhere())
+      {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> g(_remaplock);
+        _reclaim_retired_readmaps();
+        const auto epoch = _reader_epoch.load(std::memory_order_seq_cst);
+        for(auto it = _pending_punches.begin(); it != _pending_punches.end();)
+        {
+          if(it->first + 2 <= epoch)
+          {
+            topunch.push_back(it->second);
+            it = _pending_punches.erase(it);
+          }
+          else
+          {
+            ++it;
+          }
+        }
+      }
+      for(const auto &i : topunch)
+      {
+        // Crash recovery by another process may since have cut the smallfile back, in which case
+        // the region may now hold records being written by its new owner
+        if(i.second + _compaction_region_size > _indexheader->applied_extent[i.first])
+        {
+          continue;
+        }
+        if(i.first == _mysmallfileidx)
+        {
+          _mysmallfile.zero(i.second, _compaction_region_size).value();
+        }
+        else
+        {
+          // Other smallfiles are opened read only
+          auto fh = _smallfile(i.first).reopen(llfio::file_handle::mode::write).value();
+          fh.zero(i.second, _compaction_region_size).value();
+        }
+        auto &punched = _punched_regions[i.first];
+        const auto r = (size_t)(i.second / _compaction_region_size);
+        if(punched.size() <= r)
+        {
+          punched.resize(r + 1);
+        }
+        punched[r] = true;
+        stats.bytes_punched += _compaction_region_size;
+      }
+    }
+
+    // Scans and compacts the smallfiles one step per invocation
+    class _compaction_pass
+    {
+      friend class basic_key_value_store;
+      basic_key_value_store *_parent;
+      const float _max_live_fraction;
+      const std::chrono::milliseconds _rescan_interval;  // zero means a single pass
+      std::vector<_compaction_region> _candidates;
+      size_t _next_candidate{0};
+      bool _scanned{false};
+      compaction_statistics _stats;
+
+    public:
+      _compaction_pass(basic_key_value_store *parent, float max_live_fraction, std::chrono::milliseconds rescan_interval)
+          : _parent(parent)
+          , _max_live_fraction(max_live_fraction)
+          , _rescan_interval(rescan_interval)
+      {
+      }
+      intptr_t next(llfio::deadline &d) noexcept
+      {
+        if(_next_candidate < _candidates.size())
+        {
+          return 2;  // compact the next candidate
+        }
+        if(!_scanned)
+        {
+          return 1;  // scan for candidates
+        }
+        if(_rescan_interval.count() == 0)
+        {
+          return -1;
+        }
+        _scanned = false;
+        d = llfio::deadline(_rescan_interval);
+        return 1;
+      }
+      llfio::result<void> step(intptr_t work) noexcept
+      {
+        try
+        {
+          std::lock_guard<std::mutex> g(_parent->_compactlock);
+          if(work == 1)
+          {
+            _candidates = _parent->_find_compaction_candidates(_max_live_fraction);
+            _next_candidate = 0;
+            _scanned = true;
+          }
+          else
+          {
+            _parent->_compact_region(_candidates[_next_candidate++], _stats);
+          }
+          _parent->_punch_reclaimed_regions(_stats);
+          return llfio::success();
+        }
+        catch(...)
+        {
+          return llfio::error_from_exception();
+        }
+      }
+    };
+    // Paces a compaction pass according to the congestion of my smallfile's storage
+    struct _compactor_awareness
+    {
+      llfio::dynamic_thread_pool_group::io_aware_work_item::io_handle_awareness awareness[1];
+    };
+    class _paced_compactor final : _compactor_awareness, public llfio::dynamic_thread_pool_group::io_aware_work_item
+    {
+      _compaction_pass &_pass;
+
+      virtual intptr_t io_aware_next(llfio::deadline &d) noexcept override { return _pass.next(d); }
+      virtual llfio::result<void> operator()(intptr_t work) noexcept override { return _pass.step(work); }
+
+    public:
+      _paced_compactor(basic_key_value_store *parent, _compaction_pass &pass)
+          : _compactor_awareness{{{&parent->_mysmallfile, 1.0f, 1.0f, 0.0f}}}
+          , io_aware_work_item(awareness)
+          , _pass(pass)
+      {
+      }
+    };
+    // Used where the storage cannot be paced, for example tmpfs has no i/o latency statistics
+    class _unpaced_compactor final : public llfio::dynamic_thread_pool_group::work_item
+    {
+      _compaction_pass &_pass;
+
+      virtual intptr_t next(llfio::deadline &d) noexcept override { return _pass.next(d); }
+      virtual llfio::result<void> operator()(intptr_t work) noexcept override { return _pass.step(work); }
+
+    public:
+      explicit _unpaced_compactor(_compaction_pass &pass)
+          : _pass(pass)
+      {
+      }
+    };
+    class _compactor
+    {
+      friend class basic_key_value_store;
+      _compaction_pass _pass;
+      std::unique_ptr<_paced_compactor> _paced;
+      std::unique_ptr<_unpaced_compactor> _unpaced;
+
+    public:
+      _compactor(basic_key_value_store *parent, float max_live_fraction, std::chrono::milliseconds rescan_interval)
+          : _pass(parent, max_live_fraction, rescan_interval)
+      {
+        try
+        {
+          _paced = std::make_unique<_paced_compactor>(parent, _pass);
+        }
+        catch(...)
+        {
+          _unpaced = std::make_unique<_unpaced_compactor>(_pass);
+        }
+      }
+      llfio::dynamic_thread_pool_group::work_item *item() noexcept
+      {
+        if(_paced)
+        {
+          return _paced.get();
+        }
+        return _unpaced.get();
+      }
+      const compaction_statistics &stats() const noexcept { return _pass._stats; }
+    };
+    llfio::dynamic_thread_pool_group_ptr _compactor_group;
+    std::unique_ptr<_compactor> _background_compactor;
+  public:
+    //! Statistics about the crash recovery performed when the store was last opened by its first user
+    struct recovery_statistics
+    {
+      //! True if the store had not been closed cleanly, so recovery was performed
+      bool performed{false};
+      //! True if every record referred to by the index was checked, not just the smallfile tails
+      bool full{false};
+      //! The number of history items dropped as they referred to missing or invalid records
+      uint64_t items_dropped{0};
+      //! The number of partially applied transactions whose remaining keys were applied
+      uint64_t transactions_completed{0};
+      //! The number of partially applied transactions with missing records whose applied keys were reverted
+      uint64_t transactions_reverted{0};
+      //! The number of bytes of incomplete records removed from the ends of smallfiles
+      uint64_t bytes_truncated{0};
+    };
+
+  private:
+    recovery_statistics _last_recovery;
+
+    // Returns the tail of the record ending at `end` if it is plausible, and its contents match its hash if hashed
+    static const index::value_tail *_recoverable_record(const llfio::byte *data, llfio::file_handle::extent_type end, bool contents_hashed, uint64_t head, llfio::file_handle::extent_type &begin) noexcept
+    {
+      static constexpr uint64_t counter_mask = (1ULL << 48) - 1;
+      if(end < 64 || (end % 64) != 0)
+      {
+        return nullptr;
+      }
+      const auto *vt = reinterpret_cast<const index::value_tail *>(data + end - sizeof(index::value_tail));
+      const uint64_t counter = vt->transaction_counter & counter_mask;
+      // The counter must be no later than head's, and within 2^47 of it
+      if(counter == 0 || (vt->transaction_counter >> 48) == 0 || ((head - counter) & counter_mask) >= (1ULL << 47))
+      {
+        return nullptr;
+      }
+      const llfio::file_handle::extent_type recordlength = (vt->length == (uint32_t) -1) ? 64 : ((vt->length > end) ? end + 64 : _pad_length((size_t) vt->length));
+      if(recordlength + 64 > end)
+      {
+        return nullptr;  // the first 64 bytes of a smallfile are never a record
+      }
+      begin = end - recordlength;
+      if(contents_hashed)
+      {
+        QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
+        index::value_tail tail;
+        memcpy(&tail, vt, sizeof(tail));
+        memset(&tail.hash, 0, sizeof(tail.hash));
+        if(vt->length == (uint32_t) -1)
+        {
+          // Deletion records were hashed in one piece
+          llfio::byte record[64];
+          memcpy(record, data + begin, 64 - sizeof(tail));
+          memcpy(record + 64 - sizeof(tail), &tail, sizeof(tail));
+          hasher.add((const char *) record, 64);
+        }
+        else
+        {
+          hasher.add((const char *) data + begin, (size_t)(recordlength - sizeof(tail)));
+          hasher.add((const char *) &tail, sizeof(tail));
+        }
+        if(hasher.finalise() != vt->hash)
+        {
+          return nullptr;
+        }
+      }
+      return vt;
+    }
+
+    // A record found by recovery after those known to be reflected in the index
+    struct _recovered_record
+    {
+      key_type key;
+      uint64_t transaction_counter;
+      uint64_t length;  // (uint64_t)-1 means key was deleted
+      uint32_t raw_length;
+      llfio::file_handle::extent_type end;
+    };
+    // A history item which recovery must check refers to a valid record
+    struct _recovery_check
+    {
+      key_type key;
+      index::value_history::item item;
+      bool valid;
+    };
+    // Checks the records referred to in, and scans the tail of, one smallfile
+    class _recoverer final : public llfio::dynamic_thread_pool_group::work_item
+    {
+      friend class basic_key_value_store;
+      const llfio::byte *_data{nullptr};
+      llfio::file_handle::extent_type _length{0}, _scanfrom{64}, _validend{64};
+      bool _full{false}, _contents_hashed{false}, _done{false};
+      uint64_t _head{0};
+      std::vector<_recovery_check> _checks;
+      std::vector<_recovered_record> _records;
+
+      virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+      {
+        if(_done)
+        {
+          return -1;
+        }
+        _done = true;
+        return 1;
+      }
+      virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+      {
+        try
+        {
+          // Walk forwards from the last point known to be reflected in the index, stopping at the
+          // first incomplete record. Records may begin with zeros, so allow for zeros before the
+          // beginning of each record but no other bytes.
+          llfio::file_handle::extent_type begin = _scanfrom, recordbegin = 0;
+          _validend = _scanfrom;
+          while(begin < _length)
+          {
+            llfio::file_handle::extent_type nonzero = begin;
+            while(nonzero < _length && _data[nonzero] == llfio::byte(0))
+            {
+              nonzero++;
+            }
+            const index::value_tail *found = nullptr;
+            llfio::file_handle::extent_type end = begin + 64;
+            for(; end <= _length; end += 64)
+            {
+              found = _recoverable_record(_data, end, _contents_hashed, _head, recordbegin);
+              if(found != nullptr && recordbegin >= begin && recordbegin <= nonzero)
+              {
+                break;
+              }
+              found = nullptr;
+            }
+            if(found == nullptr)
+            {
+              break;
+            }
+            _records.push_back({found->key, found->transaction_counter, (found->length == (uint32_t) -1) ? (uint64_t) -1 : found->length, found->raw_length, end});
+            begin = _validend = end;
+          }
+          for(auto &check : _checks)
+          {
+            const llfio::file_handle::extent_type end = check.item.value_offset * 64;
+            check.valid = (end <= _scanfrom || end <= _validend);
+            if(check.valid && _full)
+            {
+              const auto *vt = _recoverable_record(_data, end, _contents_hashed, _head, recordbegin);
+              check.valid = (vt != nullptr && vt->key == check.key && vt->transaction_counter == check.item.transaction_counter && vt->length == check.item.length &&
+                             vt->raw_length == check.item.raw_length);
+            }
+          }
+          return llfio::success();
+        }
+        catch(...)
+        {
+          return llfio::error_from_exception();
+        }
+      }
+    };
+    // Removes the history item of key matching `item`, removing the key if no history remains
+    static bool _recovery_drop(index::resizable_open_hash_index &idx, const key_type &key, const index::value_history::item &item)
+    {
+      auto it = idx.find_exclusive(key);
+      if(it == idx.end())
+      {
+        return false;
+      }
+      index::value_history &value = it->second;
+      for(size_t n = 0; n < 4; n++)
+      {
+        auto &h = value.history[n];
+        if(h.transaction_counter == item.transaction_counter && h.value_identifier == item.value_identifier && h.value_offset == item.value_offset)
+        {
+          memmove(value.history + n, value.history + n + 1, sizeof(value.history[0]) * (3 - n));
+          memset(value.history + 3, 0, sizeof(value.history[0]));
+          if(value.history[0].transaction_counter == 0 && value.history[1].transaction_counter == 0 && value.history[2].transaction_counter == 0 && value.history[3].transaction_counter == 0)
+          {
+            idx.erase(std::move(it));
+          }
+          return true;
+        }
+      }
+      return false;
+    }
+    /* Called by the first user to open the store for writing. If the store was not closed
+    cleanly, checks the index against the smallfiles. If every writer wrote with `O_SYNC`,
+    only the records after each writer's `applied_extent` need examining, otherwise every
+    record the index refers to is checked too.
+
+    A commit writes its records, then applies them to the index, so a writer which exited
+    suddenly may have left at most one transaction partially applied. If all of its records
+    were written, the remainder is applied, else what was applied is reverted. Records never
+    applied at all were never reported committed, and are left as dead space.
+    */
+    void _recover(const llfio::path_handle &dir)
+    {
+      static constexpr uint64_t counter_mask = (1ULL << 48) - 1;
+      _last_recovery = {};
+      {
+        uint64_t magic = 0;
+        _indexfile.read(0, {{(llfio::byte *) &magic, sizeof(magic)}}).value();
+        if(magic != _goodmagic && magic != _badmagic)
+        {
+          return;  // not a store we understand
+        }
+      }
+      const llfio::file_handle::extent_type indexlength = _indexfile.maximum_extent().value();
+      index::resizable_open_hash_index idx(_indexfile, dir, true);
+      auto *header = idx.header();
+      std::vector<llfio::mapped_file_handle> smallfiles;
+      std::vector<llfio::file_handle::extent_type> lengths;
+      for(size_t n = 0; n < 48; n++)
+      {
+        auto fh = llfio::mapped_file_handle::mapped_file(dir, std::to_string(n), llfio::file_handle::mode::read, llfio::file_handle::creation::open_existing, llfio::file_handle::caching::all, llfio::file_handle::flag::disable_prefetching);
+        if(!fh)
+        {
+          break;
+        }
+        smallfiles.push_back(std::move(fh).value());
+        lengths.push_back(smallfiles.back().maximum_extent().value());
+      }
+
+      // Was the store closed cleanly?
+      bool needed = (header->magic == _badmagic), full = !header->all_writes_synced;
+      for(size_t n = 0; n < 48; n++)
+      {
+        if(header->writes_occurring[n] != 0)
+        {
+          needed = true;
+        }
+      }
+      for(size_t n = 0; n < smallfiles.size(); n++)
+      {
+        if(lengths[n] != std::max(header->applied_extent[n], (uint64_t) 64))
+        {
+          needed = true;
+        }
+      }
+      if(header->contents_hashed)
+      {
+        // The last user to close the store hashes the index
+        if(header->hash.as_longlongs[0] == 0 && header->hash.as_longlongs[1] == 0)
+        {
+          needed = true;
+        }
+        else
+        {
+          const uint128 stored = header->hash;
+          memset(&header->hash, 0, sizeof(header->hash));
+          if(stored != QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash::hash((const char *) header, (size_t) indexlength))
+          {
+            needed = full = true;
+          }
+        }
+      }
+      if(!needed)
+      {
+        return;
+      }
+      _last_recovery.performed = true;
+      _last_recovery.full = full;
+
+      // Users which exited suddenly may have left items locked, or the index part way through growing
+      idx.clear_locks();
+      idx.finish_migration();
+
+      std::vector<_recoverer> recoverers(smallfiles.size());
+      for(size_t n = 0; n < smallfiles.size(); n++)
+      {
+        auto &r = recoverers[n];
+        r._data = smallfiles[n].address();
+        r._length = lengths[n] & ~(llfio::file_handle::extent_type) 63;
+        r._scanfrom = std::min(std::max(header->applied_extent[n], (uint64_t) 64), r._length);
+        r._full = full;
+        r._contents_hashed = header->contents_hashed;
+        r._head = header->transaction_counter.load(std::memory_order_relaxed) & counter_mask;
+      }
+      // Every history item must be no later than head, within 2^47 of head, and refer to an existing smallfile
+      const uint64_t head = header->transaction_counter.load(std::memory_order_relaxed) & counter_mask;
+      std::vector<std::pair<key_type, index::value_history::item>> todrop;
+      idx.for_each([&](const index::resizable_open_hash_index::value_type &v) {
+        for(const auto &h : v.second.history)
+        {
+          if(h.transaction_counter == 0)
+          {
+            continue;
+          }
+          const uint64_t counter = h.transaction_counter & counter_mask;
+          if(((head - counter) & counter_mask) >= (1ULL << 47) || h.value_identifier >= smallfiles.size() || h.value_offset * 64 > recoverers[h.value_identifier]._length)
+          {
+            todrop.emplace_back(v.first, h);
+          }
+          else
+          {
+            recoverers[h.value_identifier]._checks.push_back({v.first, h, true});
+          }
+        }
+      });
+      {
+        auto group = llfio::make_dynamic_thread_pool_group().value();
+        group->submit(llfio::span<_recoverer>(recoverers)).value();
+        group->wait().value();
+      }
+      for(auto &r : recoverers)
+      {
+        for(const auto &check : r._checks)
+        {
+          if(!check.valid)
+          {
+            todrop.emplace_back(check.key, check.item);
+          }
+        }
+      }
+      for(const auto &i : todrop)
+      {
+        if(_recovery_drop(idx, i.first, i.second))
+        {
+          _last_recovery.items_dropped++;
+        }
+      }
+
+      // Finish or revert any partially applied transactions found in the tails
+      bool inserted = false;
+      for(size_t n = 0; n < recoverers.size(); n++)
+      {
+        const auto &records = recoverers[n]._records;
+        for(size_t i = 0; i < records.size();)
+        {
+          size_t j = i + 1;
+          while(j < records.size() && records[j].transaction_counter == records[i].transaction_counter)
+          {
+            j++;
+          }
+          const uint64_t transaction_counter = records[i].transaction_counter;
+          const bool complete = (j - i) == (transaction_counter >> 48);
+          auto as_item = [&](const _recovered_record &rec) {
+            index::value_history::item h;
+            memset(&h, 0, sizeof(h));
+            if(rec.length != (uint64_t) -1)
+            {
+              h.transaction_counter = transaction_counter;
+              h.value_offset = rec.end / 64;
+              h.value_identifier = n;
+              h.length = (uint32_t) rec.length;
+              h.raw_length = rec.raw_length;
+            }
+            else
+            {
+              h.value_offset = transaction_counter & ((1ULL << 48) - 1);
+            }
+            return h;
+          };
+          // A deletion is deemed applied if the key is gone or its latest revision is a deletion
+          auto is_applied = [&](const _recovered_record &rec) {
+            auto it = idx.find_shared(rec.key);
+            if(rec.length == (uint64_t) -1)
+            {
+              return it == idx.end() || it->second.history[0].transaction_counter == 0;
+            }
+            if(it == idx.end())
+            {
+              return false;
+            }
+            const auto h = as_item(rec);
+            for(const auto &item : it->second.history)
+            {
+              if(item.transaction_counter == h.transaction_counter && item.value_identifier == h.value_identifier && item.value_offset == h.value_offset)
+              {
+                return true;
+              }
+            }
+            return false;
+          };
+          size_t applied = 0;
+          for(size_t k = i; k < j; k++)
+          {
+            applied += is_applied(records[k]);
+          }
+          if(applied > 0 && applied < j - i)
+          {
+            for(size_t k = i; k < j; k++)
+            {
+              const auto &rec = records[k];
+              const bool thisapplied = is_applied(rec);
+              if(complete && !thisapplied)
+              {
+                auto it = idx.find_exclusive(rec.key);
+                if(it == idx.end())
+                {
+                  if(rec.length == (uint64_t) -1)
+                  {
+                    continue;
+                  }
+                  index::value_history vh;
+                  memset(&vh, 0, sizeof(vh));
+                  it = idx.insert({rec.key, std::move(vh)}).first;
+                  if(it == idx.end())
+                  {
+                    throw index_full();
+                  }
+                  inserted = true;
+                }
+                index::value_history &value = it->second;
+                memmove(value.history + 1, value.history, sizeof(value.history) - sizeof(value.history[0]));
+                value.history[0] = as_item(rec);
+                if(value.history[0].transaction_counter == 0 && value.history[1].transaction_counter == 0 && value.history[2].transaction_counter == 0 && value.history[3].transaction_counter == 0)
+                {
+                  idx.erase(std::move(it));
+                }
+              }
+              else if(!complete && thisapplied && rec.length != (uint64_t) -1)
+              {
+                _recovery_drop(idx, rec.key, as_item(rec));
+              }
+            }
+            if(complete)
+            {
+              _last_recovery.transactions_completed++;
+            }
+            else
+            {
+              _last_recovery.transactions_reverted++;
+            }
+          }
+          i = j;
+        }
+      }
+      if(inserted || _last_recovery.items_dropped > 0 || _last_recovery.transactions_reverted > 0)
+      {
+        if(header->has_ordered_index)
+        {
+          // Have the ordered index rebuilt when next used
+          auto fh = llfio::file_handle::file(dir, "orderedindex", llfio::file_handle::mode::write, llfio::file_handle::creation::open_existing);
+          if(fh)
+          {
+            const uint64_t badorderedmagic = 0;
+            fh.value().write(0, {{(const llfio::byte *) &badorderedmagic, sizeof(badorderedmagic)}}).value();
+          }
+        }
+      }
 
-    static size_t _pad_length(size_t length)
-    {
-      // We append a value_tail record and round up to 64 byte multiple
-      return (length + sizeof(index::value_tail) + 63) & ~63;
+      // Remove incomplete records from the ends of the smallfiles
+      smallfiles.clear();
+      for(size_t n = 0; n < recoverers.size(); n++)
+      {
+        const auto validend = recoverers[n]._validend;
+        if(lengths[n] > validend)
+        {
+          llfio::file_handle::file(dir, std::to_string(n), llfio::file_handle::mode::write, llfio::file_handle::creation::open_existing).value().truncate(validend).value();
+          _last_recovery.bytes_truncated += lengths[n] - validend;
+        }
+        header->applied_extent[n] = validend;
+      }
+      header->magic = _goodmagic;
     }
+
     void _openfiles(const llfio::path_handle &dir, llfio::file_handle::mode mode, llfio::file_handle::caching caching)
     {
       const llfio::file_handle::mode smallfilemode =
@@ -239,24 +2443,33 @@ namespace key_value_store
           }
           break;
         }
+        _smallfiles_opened.store(_smallfiles.blocking.size(), std::memory_order_release);
         if(mode == llfio::file_handle::mode::write && !_mysmallfile.is_valid())
         {
           throw maximum_writers_reached();
         }
         // Set up the index, either r/w or read only with copy on write
-        llfio::section_handle::flag mapflags = (mode == llfio::file_handle::mode::write) ? llfio::section_handle::flag::readwrite : (llfio::section_handle::flag::read | llfio::section_handle::flag::cow);
-        llfio::section_handle sh = llfio::section_handle::section(_indexfile, 0, mapflags).value();
-        llfio::file_handle::extent_type len = sh.length().value();
-        len -= sizeof(index::index);
-        len /= sizeof(index::open_hash_index::value_type);
-        size_t offset = sizeof(index::index);
-        _index.emplace(sh, len, offset, mapflags);
-        _indexheader = reinterpret_cast<index::index *>((char *) _index->container().data() - offset);
+        _index.emplace(_indexfile, dir, mode == llfio::file_handle::mode::write);
+        _indexheader = _index->header();
         if(_indexheader->writes_occurring[_mysmallfileidx] != 0)
         {
           _indexheader->magic = _badmagic;
           throw corrupted_store();
         }
+        if(_mysmallfile.is_valid())
+        {
+          // Any records after those reflected in the index were never reported as committed, so
+          // disown them, restoring the 64 byte alignment of records if an append was torn
+          auto length = _mysmallfile.maximum_extent().value();
+          if((length % 64) != 0)
+          {
+            length = (length + 63) & ~(llfio::file_handle::extent_type) 63;
+            _mysmallfile.truncate(length).value();
+          }
+          _indexheader->applied_extent[_mysmallfileidx] = length;
+          _indexheader->applying_from[_mysmallfileidx].store(0, std::memory_order_release);
+          _indexheader->oldest_held[_mysmallfileidx].store(0, std::memory_order_release);
+        }
       }
     }
 
@@ -290,23 +2503,21 @@ namespace key_value_store
           }
           else
           {
-            /* TODO: Check consistency of index by checking that every item's transaction counter is within 2^47 of head's
-            and that no item has a transaction counter later than head's.
-
-            Check that every smallfile's tail points to a complete set of value records which matches the one in the history in the index
-            or that that key's latest value exists and is valid.
-            */
-            //_openfiles(dir, writable);
-            if(_indexheader->contents_hashed)
-            {
-            }
-            // Now we've finished the checks, reset writes_occurring and all_writes_synced
+            // Check the index against the smallfiles if the store was not closed cleanly
+            _recover(dir);
+            // Now we've finished the checks, reset writes_occurring and all_writes_synced, unless
+            // the header is of some other format, which is refused below without modifying it
             index::index i;
             _indexfile.read(0, {{(llfio::byte *) &i, sizeof(i)}}).value();
-            memset(i.writes_occurring, 0, sizeof(i.writes_occurring));
-            i.all_writes_synced = _indexfile.are_writes_durable();
-            memset(&i.hash, 0, sizeof(i.hash));
-            _indexfile.write(0, {{(llfio::byte *) &i, sizeof(i)}}).value();
+            if(i.magic == _goodmagic || i.magic == _badmagic)
+            {
+              memset(i.writes_occurring, 0, sizeof(i.writes_occurring));
+              memset(i.applying_from, 0, sizeof(i.applying_from));
+              memset(i.oldest_held, 0, sizeof(i.oldest_held));
+              i.all_writes_synced = _indexfile.are_writes_durable();
+              memset(&i.hash, 0, sizeof(i.hash));
+              _indexfile.write(0, {{(llfio::byte *) &i, sizeof(i)}}).value();
+            }
           }
         }
       }
@@ -320,7 +2531,14 @@ namespace key_value_store
         if(!memcmp(buffer, &badmagic, 8))
           throw corrupted_store();
         if(memcmp(buffer, &goodmagic, 8))
+        {
+          // Values were stored in a different layout, and their compression format changed, with no migration
+          uint64_t magic;
+          memcpy(&magic, buffer, 8);
+          if(_is_old_magic(magic))
+            throw old_store();
           throw unknown_store();
+        }
       }
       // Open our smallfiles and map our index for shared usage
       _openfiles(dir, mode, caching);
@@ -328,6 +2546,11 @@ namespace key_value_store
       {
         _indexheader->all_writes_synced = false;
       }
+      _dir = dir.clone_to_path_handle().value();
+      if(_indexheader->has_ordered_index)
+      {
+        _open_ordered_index();
+      }
     }
     //! \overload
     basic_key_value_store(const llfio::path_view &dir, size_t hashtableentries, bool enable_integrity = false, llfio::file_handle::mode mode = llfio::file_handle::mode::write, llfio::file_handle::caching caching = llfio::file_handle::caching::all)
@@ -341,6 +2564,7 @@ namespace key_value_store
     }
     ~basic_key_value_store()
     {
+      (void) stop_compacting();
       // Release my smallfile
       _smallfileguard.unlock();
       _mysmallfile.close().value();
@@ -362,23 +2586,39 @@ namespace key_value_store
     Requires lots of virtual address space as the entire
     of all the small files is mapped into memory with additional `overextension`. Also requires a kernel
     page cache implementation which correctly updates appends to the smallfile into the mapped view
-    without `msync(MS_INVALIDATE)`.
+    without `msync(MS_INVALIDATE)`. Sets `zero_copy_threshold()` to zero, so every fetch returns
+    a view into mapped memory.
     */
     void use_mmaps(size_t overextension = 1024ULL * 1024 * 1024)
     {
       if(_mmap_over_extension != 0)
         return;
-      _smallfiles.mapped.reserve(_smallfiles.blocking.size());
+      _smallfiles.mapped.reserve(48);
       for(size_t n = 0; n < _smallfiles.blocking.size(); n++)
       {
         auto currentlength = _smallfiles.blocking[n].maximum_extent().value();
-        _smallfiles.mapped.push_back(llfio::mapped_file_handle(std::move(_smallfiles.blocking[n]), (unsigned)(currentlength + overextension)));
+        const auto sflags = (n == _mysmallfileidx) ? llfio::section_handle::flag::readwrite : llfio::section_handle::flag::read;
+        _smallfiles.mapped.push_back(llfio::mapped_file_handle(std::move(_smallfiles.blocking[n]), (size_t)(currentlength + overextension), sflags));
+      }
+      if(_mysmallfileidx != (size_t) -1)
+      {
+        _smallfileguard.set_handle(&_smallfiles.mapped[_mysmallfileidx]);
       }
-      _smallfileguard.set_handle(&_smallfiles.mapped[_mysmallfileidx]);
       _smallfiles.blocking.clear();
       _mmap_over_extension = overextension;
+      _zero_copy_threshold = 0;
     }
 
+    //! The value length at and above which `find()` returns a view into mapped memory instead of a copy. Defaults to 64Kb.
+    size_t zero_copy_threshold() const noexcept { return _zero_copy_threshold; }
+    /*! \brief Sets the value length at and above which `find()` returns a view into mapped memory.
+
+    Views avoid any memory allocation and copying, but each new extent of a smallfile
+    costs a page fault on first access. Values below the threshold are read into registered
+    buffers which are recycled through a pool.
+    */
+    void zero_copy_threshold(size_t v) noexcept { _zero_copy_threshold = v; }
+
     //! Retrieve when keys were last updated by setting the second to the latest transaction counter.
     //! Note that counter will be `(uint64_t)-1` for any unknown keys. Never throws exceptions.
     void last_updated(span<std::pair<key_type, uint64_t>> keys) noexcept
@@ -396,7 +2636,11 @@ namespace key_value_store
         }
       }
     }
-    //! Information about a key value
+    /*! \brief Information about a key value.
+
+    The value is either a view into mapped memory or a buffer borrowed from the store, so
+    it remains valid only until this is destroyed, and the store must outlive this.
+    */
     struct keyvalue_info
     {
       friend class basic_key_value_store;
@@ -408,7 +2652,16 @@ namespace key_value_store
       //! When this value was last modified
       uint64_t transaction_counter;
 
-      keyvalue_info(keyvalue_info &&o) noexcept : key(std::move(o.key)), value(std::move(o.value)), transaction_counter(std::move(o.transaction_counter)), _value_buffer(std::move(o._value_buffer)) { o._value_buffer = nullptr; }
+      keyvalue_info(keyvalue_info &&o) noexcept
+          : key(std::move(o.key))
+          , value(std::move(o.value))
+          , transaction_counter(std::move(o.transaction_counter))
+          , _parent(o._parent)
+          , _pinned_epoch(o._pinned_epoch)
+          , _buffer(std::move(o._buffer))
+      {
+        o._pinned_epoch = 0;
+      }
       keyvalue_info &operator=(keyvalue_info &&o) noexcept
       {
         if(this == &o)
@@ -421,9 +2674,13 @@ namespace key_value_store
       }
       ~keyvalue_info()
       {
-        if(_value_buffer != nullptr)
+        if(_buffer)
+        {
+          _parent->_release_buffer(std::move(_buffer));
+        }
+        if(_pinned_epoch != 0)
         {
-          free(_value_buffer);
+          _parent->_unpin_reader_epoch(_pinned_epoch);
         }
       }
 
@@ -441,15 +2698,232 @@ namespace key_value_store
           , transaction_counter((uint64_t) -1)
       {
       }
-      keyvalue_info(key_type _key, span<char> buffer, bool free_on_destruct, uint64_t tc)
-          : key(_key)
-          , value(buffer)
-          , transaction_counter(tc)
-          , _value_buffer(free_on_destruct ? buffer.data() : nullptr)
+      basic_key_value_store *_parent{nullptr};
+      uint64_t _pinned_epoch{0};                         // reader epoch pinned by a view, zero if none
+      llfio::io_handle::registered_buffer_type _buffer;  // buffer borrowed from the pool, if any
+    };
+
+  private:
+    static constexpr uint64_t _gooddictionarymagic = 0x3130444b4f494641;  // "AFIOKD01"
+
+    // Returns the store's compression dictionary, loading it from file `dictionary` if necessary
+    const compression::dictionary &_compression_dictionary()
+    {
+      if(const auto *d = _dictionary_ptr.load(std::memory_order_acquire))
+      {
+        return *d;
+      }
+      std::lock_guard<std::mutex> g(_dictionarylock);
+      if(!_dictionary)
+      {
+        auto fh = llfio::file_handle::file(_dir, "dictionary");
+        if(!fh)
+        {
+          throw corrupted_store();
+        }
+        uint64_t header[2] = {0, 0};  // magic, length
+        if(fh.value().read(0, {{(llfio::byte *) header, sizeof(header)}}).value() != sizeof(header) || header[0] != _gooddictionarymagic ||
+           header[1] > compression::max_dictionary_size)
+        {
+          throw corrupted_store();
+        }
+        std::vector<char> bytes((size_t) header[1]);
+        if(!bytes.empty() && fh.value().read(sizeof(header), {{(llfio::byte *) bytes.data(), bytes.size()}}).value() != bytes.size())
+        {
+          throw corrupted_store();
+        }
+        _dictionary = std::make_unique<compression::dictionary>(std::move(bytes));
+        _dictionary_ptr.store(_dictionary.get(), std::memory_order_release);
+      }
+      return *_dictionary;
+    }
+    // Replaces the compressed value of `ret` with its decompressed value
+    void _decompress_value(keyvalue_info &ret, const index::value_history::item &item)
+    {
+      const auto &dict = _compression_dictionary();
+      auto buffer = _acquire_buffer(item.raw_length);
+      if(!compression::decompress({(char *) buffer->data(), item.raw_length}, ret.value, dict.bytes()))
+      {
+        _release_buffer(std::move(buffer));
+        _indexheader->magic = _badmagic;
+        throw corrupted_store();
+      }
+      // The compressed value is no longer needed
+      if(ret._buffer)
+      {
+        _release_buffer(std::move(ret._buffer));
+      }
+      if(ret._pinned_epoch != 0)
+      {
+        _unpin_reader_epoch(ret._pinned_epoch);
+        ret._pinned_epoch = 0;
+      }
+      ret._buffer = std::move(buffer);
+      ret.value = span<const char>((const char *) ret._buffer->data(), item.raw_length);
+    }
+    // Checks the record of a value against its index entry, setting the value of `ret` to it if it is good
+    void _validate_value(keyvalue_info &ret, const llfio::byte *buffer, const index::value_history::item &item)
+    {
+      const size_t length = item.length, smallfilelength = _pad_length(length);
+      // The value may be in read only memory, so work on a copy of the tail
+      index::value_tail vt;
+      memcpy(&vt, buffer + smallfilelength - sizeof(index::value_tail), sizeof(vt));
+      if(_indexheader->contents_hashed || _indexheader->key_is_hash_of_value)
+      {
+        uint128 tocheck = vt.hash, thishash;
+        if(_indexheader->contents_hashed)
+        {
+          // The record was hashed with its tail's hash zeroed
+          QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
+          memset(&vt.hash, 0, sizeof(vt.hash));
+          hasher.add((const char *) buffer, smallfilelength - sizeof(index::value_tail));
+          hasher.add((const char *) &vt, sizeof(vt));
+          thishash = hasher.finalise();
+        }
+        else
+        {
+          thishash = QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash::hash((const char *) buffer, length);
+        }
+        if(tocheck != thishash)
+        {
+          _indexheader->magic = _badmagic;
+          throw corrupted_store();
+        }
+      }
+      if(vt.key != ret.key)
+      {
+        _indexheader->magic = _badmagic;
+        throw corrupted_store();
+      }
+      if(vt.length != length || vt.raw_length != item.raw_length)
+      {
+        _indexheader->magic = _badmagic;
+        throw corrupted_store();
+      }
+      if(vt.transaction_counter != item.transaction_counter)
+      {
+        _indexheader->magic = _badmagic;
+        throw corrupted_store();
+      }
+      ret.value = span<const char>((const char *) buffer, length);
+      ret.transaction_counter = item.transaction_counter;
+      if(item.raw_length != 0)
+      {
+        _decompress_value(ret, item);
+      }
+    }
+    // Records which find_many() will read are coalesced when no more than this far apart
+    static constexpr size_t _coalesce_gap = 16384;
+
+    // Reads the value of a version of a key, which must be kept from being compacted away until this returns
+    keyvalue_info _read_value(key_type key, const index::value_history::item &item)
+    {
+      size_t length = item.length, smallfilelength = _pad_length(length);
+      _open_newer_smallfiles(item.value_identifier);
+      keyvalue_info ret(key);
+      ret._parent = this;
+      const llfio::file_handle::extent_type extent = item.value_offset * 64;
+      const llfio::byte *buffer;
+      if(length >= _zero_copy_threshold)
+      {
+        // Return a view into the map, pinning the reader epoch so the map cannot be closed beneath it
+        ret._pinned_epoch = _pin_reader_epoch();
+        buffer = _map_smallfile(item.value_identifier, extent) + extent - smallfilelength;
+      }
+      else
+      {
+        ret._buffer = _acquire_buffer(smallfilelength);
+        llfio::file_handle::buffer_type reqs[] = {{ret._buffer->data(), smallfilelength}};
+        buffer = _smallfile(item.value_identifier).read(ret._buffer, {reqs, extent - smallfilelength}).value()[0].data();
+      }
+      _validate_value(ret, buffer, item);
+      return ret;
+    }
+
+  public:
+    /*! \brief A point in the history of the store at which `find()` reads the values of keys.
+
+    A snapshot sees every transaction committed before it was taken, and none committed after,
+    so reads through it are repeatable however many writers run concurrently. A held snapshot
+    retains every version it can see, even once a key has been updated more than three times
+    since, and keeps compaction from reclaiming them. A snapshot not held costs nothing, but
+    `find()` throws `snapshot_too_old` if the version it needs has fallen out of the history of
+    its key.
+
+    Taking a snapshot waits for writers in other processes to finish applying the transactions
+    numbered before it. Versions are retained only against writers using this store instance, so
+    even a held snapshot may throw `snapshot_too_old` once writers elsewhere supersede a version.
+    The oldest snapshot held by a writer is published in the index, and compaction by other
+    processes reclaims nothing whilst one is, as it cannot see the versions retained.
+    */
+    class snapshot
+    {
+      friend class basic_key_value_store;
+      basic_key_value_store *_parent{nullptr};
+      uint64_t _transaction_counter{0};  // bottom 48 bits of the transaction counter when taken
+      bool _held{false};
+
+      snapshot(basic_key_value_store *parent, uint64_t transaction_counter, bool held)
+          : _parent(parent)
+          , _transaction_counter(transaction_counter)
+          , _held(held)
+      {
+      }
+
+    public:
+      snapshot() = default;
+      snapshot(const snapshot &) = delete;
+      snapshot(snapshot &&o) noexcept
+          : _parent(o._parent)
+          , _transaction_counter(o._transaction_counter)
+          , _held(o._held)
+      {
+        o._held = false;
+      }
+      snapshot &operator=(const snapshot &) = delete;
+      snapshot &operator=(snapshot &&o) noexcept
+      {
+        if(this == &o)
+        {
+          return *this;
+        }
+        this->~snapshot();
+        new(this) snapshot(std::move(o));
+        return *this;
+      }
+      ~snapshot()
       {
+        if(_held)
+        {
+          _parent->_release_snapshot(_transaction_counter);
+        }
       }
-      char *_value_buffer{nullptr};
+
+      //! The counter of the newest transaction this snapshot can see
+      uint64_t transaction_counter() const noexcept { return _transaction_counter; }
+      //! True if this snapshot retains the versions it can see
+      bool is_held() const noexcept { return _held; }
     };
+
+    //! Takes a snapshot of the store, which if `hold` is true retains the versions it can see until destroyed
+    snapshot take_snapshot(bool hold = false)
+    {
+      if(_indexheader->magic != _goodmagic)
+        throw corrupted_store();
+      // Transactions are numbered before they are applied, so wait out any being applied
+      std::lock_guard<decltype(_commitlock)> commitlockguard(_commitlock);
+      const uint64_t transaction_counter = _indexheader->transaction_counter.load(std::memory_order_acquire) & ((1ULL << 48) - 1);
+      _wait_for_other_writers(transaction_counter);
+      if(hold)
+      {
+        std::lock_guard<std::mutex> g(_snapshotlock);
+        _held_snapshots.insert(transaction_counter);
+        _held_snapshots_count.fetch_add(1, std::memory_order_release);
+        _publish_oldest_held();
+      }
+      return snapshot(this, transaction_counter, hold);
+    }
+
     //! Retrieve the latest value for a key. May throw `corrupted_store`
     keyvalue_info find(key_type key, size_t revision = 0)
     {
@@ -460,80 +2934,504 @@ namespace key_value_store
       auto it = _index->find_shared(key);
       if(it == _index->end())
       {
-        // No value as no key
-        return keyvalue_info(key);
+        // No value as no key
+        return keyvalue_info(key);
+      }
+      else
+      {
+        const auto &item = it->second.history[revision];
+        if(item.transaction_counter == 0)
+        {
+          // No value on the key at this revision
+          return keyvalue_info(key);
+        }
+        return _read_value(key, item);
+      }
+    }
+    /*! \brief Retrieve the newest value for a key written no later than the snapshot was taken.
+    May throw `corrupted_store`, or `snapshot_too_old` if the version needed is retained by neither
+    the history of the key nor a held snapshot, as when a writer in another process superseded it.
+    */
+    keyvalue_info find(key_type key, const snapshot &s)
+    {
+      if(_indexheader->magic != _goodmagic)
+        throw corrupted_store();
+      if(s._parent != this)
+        throw std::invalid_argument("the snapshot is not of this store");
+      bool fallen_out = false;  // true if the version needed has fallen out of the history of the key
+      {
+        auto it = _index->find_shared(key);
+        if(it != _index->end())
+        {
+          fallen_out = true;
+          for(const auto &item : it->second.history)
+          {
+            const uint64_t written_at = _written_at(item);
+            if(written_at == 0)
+            {
+              // No older version, unless the key was removed and then inserted again
+              fallen_out = false;
+              break;
+            }
+            if(written_at <= s._transaction_counter)
+            {
+              return (item.transaction_counter == 0) ? keyvalue_info(key) : _read_value(key, item);
+            }
+          }
+        }
+      }
+      if(_held_snapshots_count.load(std::memory_order_acquire) == 0)
+      {
+        if(fallen_out)
+        {
+          throw snapshot_too_old();
+        }
+        return keyvalue_info(key);
+      }
+      // Look for the newest version retained for held snapshots, pinning the reader epoch so any
+      // compaction of it is not hole punched before it is read
+      const uint64_t epoch = _pin_reader_epoch();
+      auto unpin = make_scope_exit([&]() noexcept { _unpin_reader_epoch(epoch); });
+      index::value_history::item item;
+      memset(&item, 0, sizeof(item));
+      {
+        std::lock_guard<std::mutex> g(_snapshotlock);
+        auto it = _retained_versions.find(key);
+        if(it != _retained_versions.end())
+        {
+          for(const auto &v : it->second)
+          {
+            const uint64_t written_at = _written_at(v.item);
+            if(written_at <= s._transaction_counter && written_at > _written_at(item))
+            {
+              item = v.item;
+            }
+          }
+        }
+      }
+      if(fallen_out && _written_at(item) == 0)
+      {
+        throw snapshot_too_old();
+      }
+      if(item.transaction_counter == 0)
+      {
+        // No version, or a deletion
+        return keyvalue_info(key);
+      }
+      return _read_value(key, item);
+    }
+
+    /*! \brief Retrieve the values for many keys at once. May throw `corrupted_store`.
+
+    Equivalent to calling `find()` for each key in turn, returning the infos in the same order
+    as `keys`, but the index is looked up for every key first, and the records to be read are
+    then sorted by smallfile and offset. Records of neighbouring values no more than 16Kb apart
+    are read by a single scatter read, so a bulk lookup costs a few sequential reads per smallfile
+    rather than one random read per key.
+    */
+    std::vector<keyvalue_info> find_many(span<const key_type> keys, size_t revision = 0)
+    {
+      if(_indexheader->magic != _goodmagic)
+        throw corrupted_store();
+      if(revision >= 4)
+        throw std::invalid_argument("valid revision is 0-3");
+      std::vector<keyvalue_info> ret;
+      ret.reserve(keys.size());
+      struct located
+      {
+        size_t idx;
+        index::value_history::item item;
+        llfio::file_handle::extent_type begin() const noexcept { return item.value_offset * 64 - _pad_length(item.length); }
+      };
+      std::vector<located> found;
+      found.reserve(keys.size());
+      for(size_t n = 0; n < keys.size(); n++)
+      {
+        ret.push_back(keyvalue_info(keys[n]));
+        ret.back()._parent = this;
+      }
+      /* Hold the shared locks on the keys until their values are read, as find() does. They
+      are taken in key order, and each key only once, as commit() takes its exclusive locks
+      in key order, so a batch cannot deadlock against a committer.
+      */
+      std::vector<size_t> order(keys.size());
+      for(size_t n = 0; n < keys.size(); n++)
+      {
+        order[n] = n;
+      }
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+      std::vector<index::open_hash_index::const_iterator> locks;
+      locks.reserve(keys.size());
+      for(size_t o = 0; o < order.size(); o++)
+      {
+        const size_t n = order[o];
+        if(o > 0 && keys[order[o - 1]] == keys[n])
+        {
+          // A repeated key reads the same version again without relocking
+          if(!found.empty() && found.back().idx == order[o - 1])
+          {
+            found.push_back({n, found.back().item});
+          }
+          continue;
+        }
+        auto it = _index->find_shared(keys[n]);
+        if(it == _index->end())
+        {
+          continue;
+        }
+        const auto &item = it->second.history[revision];
+        if(item.transaction_counter == 0)
+        {
+          continue;
+        }
+        _open_newer_smallfiles(item.value_identifier);
+        found.push_back({n, item});
+        locks.push_back(std::move(it));
+      }
+      std::sort(found.begin(), found.end(), [](const located &a, const located &b) {
+        return (a.item.value_identifier != b.item.value_identifier) ? (a.item.value_identifier < b.item.value_identifier) : (a.item.value_offset < b.item.value_offset);
+      });
+      size_t maxbuffers = _smallfile(found.empty() ? 0 : found.front().item.value_identifier).max_buffers();
+      if(maxbuffers == 0)
+      {
+        maxbuffers = 16;  // POSIX guarantees that at least 16 scatter buffers can be read in a single shot
+      }
+      std::vector<llfio::byte> gap(_coalesce_gap);
+      std::vector<llfio::file_handle::buffer_type> reqs;
+      std::vector<size_t> members;
+      reqs.reserve(maxbuffers);
+      members.reserve(maxbuffers);
+      for(size_t i = 0; i < found.size();)
+      {
+        const auto &first = found[i];
+        if(first.item.length >= _zero_copy_threshold)
+        {
+          // A view into the map, as per find()
+          auto &kvi = ret[first.idx];
+          const llfio::file_handle::extent_type extent = first.item.value_offset * 64;
+          kvi._pinned_epoch = _pin_reader_epoch();
+          _validate_value(kvi, _map_smallfile(first.item.value_identifier, extent) + first.begin(), first.item);
+          i++;
+          continue;
+        }
+        // Coalesce the following records of the same smallfile into one scatter read, skipping small gaps
+        const size_t smallfile = first.item.value_identifier;
+        const llfio::file_handle::extent_type begin = first.begin();
+        llfio::file_handle::extent_type pos = begin;
+        reqs.clear();
+        members.clear();
+        size_t j = i;
+        for(; j < found.size() && reqs.size() + 2 <= maxbuffers; j++)
+        {
+          const auto &rec = found[j];
+          if(rec.item.value_identifier != smallfile || rec.item.length >= _zero_copy_threshold || rec.begin() < pos || rec.begin() - pos > _coalesce_gap)
+          {
+            break;
+          }
+          if(rec.begin() > pos)
+          {
+            reqs.push_back({gap.data(), (size_t)(rec.begin() - pos)});
+          }
+          const size_t smallfilelength = _pad_length(rec.item.length);
+          auto &kvi = ret[rec.idx];
+          kvi._buffer = _acquire_buffer(smallfilelength);
+          reqs.push_back({kvi._buffer->data(), smallfilelength});
+          members.push_back(j);
+          pos = rec.begin() + smallfilelength;
+        }
+        auto read = _smallfile(smallfile).read({reqs, begin}).value();
+        size_t bytesread = 0;
+        for(size_t n = 0; n < read.size(); n++)
+        {
+          bytesread += read[n].size();
+          // Some handles, e.g. mapped ones, return their own buffers
+          if(n < reqs.size() && read[n].data() != reqs[n].data())
+          {
+            memcpy(reqs[n].data(), read[n].data(), std::min(read[n].size(), reqs[n].size()));
+          }
+        }
+        if(bytesread != pos - begin)
+        {
+          _indexheader->magic = _badmagic;
+          throw corrupted_store();
+        }
+        for(auto m : members)
+        {
+          auto &kvi = ret[found[m].idx];
+          _validate_value(kvi, kvi._buffer->data(), found[m].item);
+        }
+        i = j;
+      }
+      return ret;
+    }
+
+    /*! \brief Enables the ordered index of keys, building it from the hash index if it does not exist.
+
+    Once any writer enables the ordered index, every writer maintains it during commit. It
+    permits `lower_bound()`, `for_each_in_range()` and `match()` with most significant bit
+    masks to execute in `O(log n + k)` instead of scanning the whole hash index.
+    */
+    void use_ordered_index()
+    {
+      if(_orderedindexheader == nullptr)
+      {
+        _open_ordered_index();
+      }
+    }
+    //! True if the ordered index is in use.
+    bool has_ordered_index() const noexcept { return _orderedindexheader != nullptr; }
+
+    /*! \brief Enables compression of values, training a dictionary from `samples` if the store does not have one.
+
+    The dictionary is trained once per store from samples of typical values, and is then
+    shared by every writer and reader of the store. Once any writer enables compression,
+    every writer compresses values during commit, storing the compressed form only if it
+    is smaller. Values are decompressed by `find()` and `find_many()`, so values returned
+    by them are never views of the smallfiles if they were stored compressed.
+    */
+    void use_compression(span<const span<const char>> samples, size_t dictionary_size = 16384)
+    {
+      auto existing = llfio::file_handle::file(_dir, "dictionary");
+      if(!existing)
+      {
+        const auto bytes = compression::train(samples, dictionary_size);
+        auto fh = llfio::file_handle::uniquely_named_file(_dir).value();
+        const uint64_t header[2] = {_gooddictionarymagic, bytes.size()};  // magic, length
+        fh.write(0, {{(const llfio::byte *) header, sizeof(header)}, {(const llfio::byte *) bytes.data(), bytes.size()}}).value();
+        fh.barrier().value();
+        // If another writer created the dictionary first, use theirs
+        if(!fh.relink(_dir, "dictionary", false))
+        {
+          fh.unlink().value();
+        }
+      }
+      _compression_dictionary();
+      _indexheader->values_compressed.store(true, std::memory_order_release);
+    }
+    //! True if values are being compressed.
+    bool uses_compression() const noexcept { return _indexheader->values_compressed.load(std::memory_order_acquire); }
+
+    /*! \brief Calls `f(key)` for every key no less than `first` and no greater than `last` in
+    order of most significant bits first, stopping early if `f` returns false. Requires the ordered index.
+
+    This is racy: keys inserted or removed during the iteration may or may not be seen.
+    */
+    template <class F> void for_each_in_range(key_type first, const key_type &last, F &&f)
+    {
+      if(_orderedindexheader == nullptr)
+      {
+        throw std::logic_error("the ordered index is not in use");
       }
-      else
+      key_type batch[256];
+      for(;;)
       {
-        // TODO Depending on length, make a mapped_span instead
-        const auto &item = it->second.history[revision];
-        if(item.transaction_counter == 0)
+        const size_t n = _ordered_index_read(batch, 256, first, last);
+        for(size_t i = 0; i < n; i++)
         {
-          // No value on the key at this revision
-          return keyvalue_info(key);
+          // Removed and deleted keys are only dropped from the ordered index lazily
+          if(!_key_is_live(batch[i]))
+          {
+            continue;
+          }
+          if(!f(batch[i]))
+          {
+            return;
+          }
         }
-        size_t length = item.length, smallfilelength = _pad_length(length);
-        if(item.value_identifier >= _smallfiles.blocking.size() && item.value_identifier >= _smallfiles.mapped.size())
+        if(n < 256)
         {
-          // TODO: Open newly created smallfiles
-          abort();
+          return;
         }
-        llfio::byte *buffer;
-        bool free_on_destruct = _smallfiles.mapped.empty();
-        if(!free_on_destruct)
+        // Resume after the last key returned
+        first = batch[255];
+        if(++first.as_longlongs[0] == 0 && ++first.as_longlongs[1] == 0)
         {
-          auto mappedlength = _smallfiles.mapped[item.value_identifier].maximum_extent().value();
-          if(item.value_offset * 64 > mappedlength)
-          {
-            // Update mapping to match the underlying file
-            mappedlength = _smallfiles.mapped[item.value_identifier].update_map().value();
-            if(mappedlength > _smallfiles.mapped[item.value_identifier].capacity())
-            {
-              // Need to remap into a new space
-              mappedlength = _smallfiles.mapped[item.value_identifier].reserve(mappedlength + _mmap_over_extension).value();
-            }
-          }
-          buffer = _smallfiles.mapped[item.value_identifier].address() + item.value_offset * 64 - smallfilelength;
+          return;
         }
-        else
+      }
+    }
+    //! Returns the first key no less than `key`, if any. Requires the ordered index.
+    optional<key_type> lower_bound(const key_type &key)
+    {
+      optional<key_type> ret;
+      key_type last;
+      last.as_longlongs[0] = last.as_longlongs[1] = (uint64_t) -1;
+      for_each_in_range(key, last, [&](const key_type &k) {
+        ret = k;
+        return false;
+      });
+      return ret;
+    }
+
+    //! The state of a `match()` in progress. Default construct to begin a match.
+    struct match_state
+    {
+      key_type next{_zero_key()};
+      bool done{false};
+    };
+    /*! \brief Returns the next key in the store for which `(key & mask) == (bits & mask)`, or
+    nothing once there are no more.
+
+    If the ordered index is in use, the leading most significant one bits of `mask` bound the
+    range of keys examined, so a mask of only most significant bits executes in `O(log n + k)`
+    for `k` keys matched. Otherwise, each call scans the whole hash index. Keys are returned in
+    order of most significant bits first. This is racy in the same way as `for_each_in_range()`.
+    */
+    optional<key_type> match(match_state &state, const key_type &mask = _zero_key(), const key_type &bits = _zero_key())
+    {
+      if(state.done)
+      {
+        return {};
+      }
+      auto matches = [&](const key_type &k) { return (k.as_longlongs[0] & mask.as_longlongs[0]) == (bits.as_longlongs[0] & mask.as_longlongs[0]) && (k.as_longlongs[1] & mask.as_longlongs[1]) == (bits.as_longlongs[1] & mask.as_longlongs[1]); };
+      optional<key_type> ret;
+      if(_orderedindexheader != nullptr)
+      {
+        // Find the run of most significant one bits in the mask, which bound the range of possible matches
+        key_type prefix = _zero_key();
+        for(int word = 1; word >= 0; word--)
         {
-          buffer = (llfio::byte *) malloc(smallfilelength);
-          if(!buffer)
+          const uint64_t m = mask.as_longlongs[word];
+          const uint64_t inv = ~m;
+          // Leading ones of m are those above the highest set bit of ~m
+          uint64_t lead = 0;
+          if(inv == 0)
           {
-            throw std::bad_alloc();
+            lead = (uint64_t) -1;
           }
-          _smallfiles.blocking[item.value_identifier].read(item.value_offset * 64 - smallfilelength, {{buffer, smallfilelength}}).value();
-        }
-        index::value_tail *vt = reinterpret_cast<index::value_tail *>(buffer + smallfilelength - sizeof(index::value_tail));
-        if(_indexheader->contents_hashed || _indexheader->key_is_hash_of_value)
-        {
-          QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
-          uint128 tocheck = vt->hash;
-          memset(&vt->hash, 0, sizeof(vt->hash));
-          uint128 thishash = QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash::hash((char *) buffer, _indexheader->contents_hashed ? smallfilelength : length);
-          if(tocheck != thishash)
+          else
           {
-            _indexheader->magic = _badmagic;
-            throw corrupted_store();
+            uint64_t highest = inv;
+            highest |= highest >> 1;
+            highest |= highest >> 2;
+            highest |= highest >> 4;
+            highest |= highest >> 8;
+            highest |= highest >> 16;
+            highest |= highest >> 32;
+            lead = ~highest;
+          }
+          prefix.as_longlongs[word] = lead;
+          if(lead != (uint64_t) -1)
+          {
+            break;
           }
         }
-        if(vt->key != key)
-        {
-          _indexheader->magic = _badmagic;
-          throw corrupted_store();
-        }
-        if(vt->length != length)
+        key_type first, last;
+        for(int word = 0; word < 2; word++)
         {
-          _indexheader->magic = _badmagic;
-          throw corrupted_store();
+          first.as_longlongs[word] = bits.as_longlongs[word] & prefix.as_longlongs[word];
+          last.as_longlongs[word] = first.as_longlongs[word] | ~prefix.as_longlongs[word];
         }
-        if(vt->transaction_counter != item.transaction_counter)
+        if(index::key_less(first, state.next))
         {
-          _indexheader->magic = _badmagic;
-          throw corrupted_store();
+          first = state.next;
         }
-        return keyvalue_info(key, span<char>((char *) buffer, length), free_on_destruct, item.transaction_counter);
+        for_each_in_range(first, last, [&](const key_type &k) {
+          if(matches(k))
+          {
+            ret = k;
+            return false;
+          }
+          return true;
+        });
+      }
+      else
+      {
+        _index->for_each([&](const index::resizable_open_hash_index::value_type &v) {
+          const key_type &k = v.first;
+          if(v.second.history[0].transaction_counter != 0 && !index::key_less(k, state.next) && matches(k) && (!ret || index::key_less(k, *ret)))
+          {
+            ret = k;
+          }
+        });
+      }
+      if(!ret)
+      {
+        state.done = true;
+        return {};
+      }
+      state.next = *ret;
+      if(++state.next.as_longlongs[0] == 0 && ++state.next.as_longlongs[1] == 0)
+      {
+        state.done = true;
+      }
+      return ret;
+    }
+
+    /*! \brief Performs a single pass of online free space consolidation, blocking until it completes.
+
+    Every aligned 1Mb region of every smallfile which is no more than `max_live_fraction`
+    referenced by the history of some key in the index has its still live value records
+    appended to my smallfile, and the index repointed at the copies under the exclusive lock
+    of each key. Once no reader can still be viewing the region, it is deallocated by punching
+    a hole in the smallfile. Only regions before each writer's applied extent are considered,
+    so records of commits still being written by other processes are never moved. The work is
+    executed by a `dynamic_thread_pool_group`, paced by an `io_aware_work_item` according to the
+    congestion of the storage, or unpaced if the storage cannot be paced (e.g. tmpfs).
+
+    Only one process should compact a store at a time, and views returned by `find()` in other
+    processes are not protected from the hole punching. Whilst a writer in another process holds
+    a snapshot, no region is compacted or punched. Does nothing if the store was opened read only.
+    */
+    compaction_statistics compact(float max_live_fraction = 0.5f)
+    {
+      if(!_mysmallfile.is_valid())
+      {
+        return {};
+      }
+      auto group = llfio::make_dynamic_thread_pool_group().value();
+      _compactor c(this, max_live_fraction, {});
+      group->submit(c.item()).value();
+      group->wait().value();
+      return c.stats();
+    }
+    /*! \brief Starts performing online free space consolidation in the background, rescanning
+    every `rescan_interval` after a pass completes. See `compact()`.
+    */
+    void start_compacting(float max_live_fraction = 0.5f, std::chrono::milliseconds rescan_interval = std::chrono::seconds(10))
+    {
+      if(!_mysmallfile.is_valid() || _background_compactor)
+      {
+        return;
+      }
+      _compactor_group = llfio::make_dynamic_thread_pool_group().value();
+      _background_compactor = std::make_unique<_compactor>(this, max_live_fraction, rescan_interval);
+      _compactor_group->submit(_background_compactor->item()).value();
+    }
+    /*! \brief Returns what crash recovery did when this store was opened, if this was the first
+    user to open the store since it was last closed, and it had not been closed cleanly.
+
+    If the store was last used by writers which all opened their smallfiles with `O_SYNC` on,
+    only the records at the ends of the smallfiles written after those last reflected in the
+    index are examined, so recovery takes time proportional to the work in flight, not the size
+    of the store. Otherwise every record the index refers to is checked as well.
+    */
+    const recovery_statistics &last_recovery() const noexcept { return _last_recovery; }
+    //! Stops background free space consolidation, returning what it achieved.
+    compaction_statistics stop_compacting() noexcept
+    {
+      if(!_background_compactor)
+      {
+        return {};
       }
+      (void) _compactor_group->stop();
+      (void) _compactor_group->wait();
+      auto ret = _background_compactor->stats();
+      _background_compactor.reset();
+      _compactor_group.reset();
+      return ret;
+    }
+    /*! \brief Returns how many retired smallfile maps and compacted regions are waiting for
+    every view which `find()` may have returned into them to be released.
+
+    Each is freed, or hole punched, at the next compaction step or map relocation once no
+    view pins the reader epoch in which it was retired.
+    */
+    size_t pending_reclamations()
+    {
+      std::lock_guard<std::mutex> g(_remaplock);
+      _reclaim_retired_readmaps();
+      return _retired_readmaps.size() + _pending_punches.size();
     }
   };
 
@@ -652,43 +3550,22 @@ namespace key_value_store
       _items.push_back(std::move(kvi));
       _items.back().remove = true;
     }
-    //! Commit the transaction, throwing `transaction_aborted` if a key's value was updated since it was fetched for this transaction.
-    void commit()
+
+  private:
+    using _commit_request = basic_key_value_store::_commit_request;
+    using _toupdate_type = basic_key_value_store::_toupdate_type;
+
+    /* Called by the leader. Early checks for abort, allocates this transaction's counter, and lays out its records at value_offset.
+    The shared lock on each key is held only whilst it is checked, as holding them for every request
+    in the group at once would lock keys out of order. _apply_commit() checks again under exclusive lock.
+    */
+    void _prepare_commit(_commit_request &req, llfio::file_handle::extent_type &value_offset)
     {
       if(_parent->_indexheader->magic != _parent->_goodmagic)
         throw corrupted_store();
-
-      // Firstly remove any items fetched but not used as a base for an update, and sort the remaining
-      // list of keys we are to update into order. This ensures that all writers always lock the keys
-      // in the same order, thus preventing deadlock.
-      _items.erase(std::remove_if(_items.begin(), _items.end(), [](const auto &item) { return !item.towrite.has_value() && !item.remove; }), _items.end());
-      std::sort(_items.begin(), _items.end(), [](const _item &a, const _item &b) { return a.kvi.key < b.kvi.key; });
-
-      // The update list, filled in as we progress
-      struct toupdate_type
-      {
-        const key_type key;
-        const uint64_t old_transaction_counter;
-        const bool insertion, update, removal;
-        index::value_history::item history_item{};
-        index::open_hash_index::iterator it{};
-        toupdate_type(key_type _key, uint64_t _old_transaction_counter, bool _insertion, bool _update, bool _removal)
-            : key(_key)
-            , old_transaction_counter(_old_transaction_counter)
-            , insertion(_insertion)
-            , update(_update)
-            , removal(_removal)
-        {
-        }
-      };
-      std::vector<toupdate_type> toupdate;
+      auto &toupdate = req.toupdate;
       toupdate.reserve(_items.size());
-      // Serialise multiple threads issuing commit using the same store
-      std::lock_guard<decltype(_parent->_commitlock)> commitlockguard(_parent->_commitlock);
-
-      // Take out shared locks on all the items in my commit with existing values, early checking if we will abort
-      std::vector<index::open_hash_index::const_iterator> shared_locks;
-      shared_locks.reserve(_items.size());
+      // Early check if we will abort
       for(const auto &item : _items)
       {
         bool insertion = false, update = false, removal = false;
@@ -702,7 +3579,6 @@ namespace key_value_store
             {
               throw transaction_aborted(item.kvi.key);
             }
-            shared_locks.push_back(std::move(it));
             removal = item.remove;
             update = !item.remove;
           }
@@ -731,155 +3607,87 @@ namespace key_value_store
           _.this_transaction_counter = old_transaction_counter = _parent->_indexheader->transaction_counter.load(std::memory_order_acquire);
           // Increment bottom 48 bits, letting it wrap if necessary
           _.counter++;
-          _.values_updated = _items.size();
+          _.values_updated = (uint16_t) _items.size();  // commit() refuses more than 65535 items
         } while(!_parent->_indexheader->transaction_counter.compare_exchange_weak(old_transaction_counter, _.this_transaction_counter, std::memory_order_release, std::memory_order_relaxed));
         this_transaction_counter = _.this_transaction_counter;
       }
 
-      bool items_written = false;
-      if(!_parent->_smallfiles.mapped.empty())
+      // Lay out the value and tail of each item as gather buffers
+      assert((value_offset % 64) == 0);
+      req.tailbuffers.assign(_items.size() * 128, llfio::byte(0));
+      req.reqs.reserve(_items.size() * 2);
+      for(size_t n = 0; n < _items.size(); n++)
       {
-        llfio::file_handle::extent_type original_length = _parent->_mysmallfile.maximum_extent().value();
-        // How big does this map need to be?
-        size_t totalcommitsize = 0;
-        for(size_t n = 0; n < _items.size(); n++)
-        {
-          toupdate_type &thisupdate = toupdate[n];
-          const transaction::_item &item = _items[n];
-          totalcommitsize += thisupdate.removal ? 64 : _parent->_pad_length(item.towrite->size());
-        }
-        if(totalcommitsize >= 4096)
+        llfio::byte *tailbuffer = req.tailbuffers.data() + n * 128;
+        index::value_tail *vt = reinterpret_cast<index::value_tail *>(tailbuffer + 128 - sizeof(index::value_tail));
+        _toupdate_type &thisupdate = toupdate[n];
+        const transaction::_item &item = _items[n];
+        vt->key = thisupdate.key;
+        vt->transaction_counter = this_transaction_counter;
+        size_t totalwrite = 0;
+        if(thisupdate.removal)
         {
-          auto &mfh = _parent->_smallfiles.mapped[_parent->_mysmallfileidx];
-          llfio::file_handle::extent_type new_length = original_length + totalcommitsize;
-          if(new_length > mfh.capacity())
+          vt->length = (uint32_t) -1;  // this key is being deleted
+          totalwrite = 64;
+          req.reqs.push_back({tailbuffer + 64, 64});
+          if(_parent->_indexheader->contents_hashed)
           {
-            mfh.reserve(new_length + _parent->_mmap_over_extension).value();
-          }
-          mfh.truncate(new_length).value();
-          llfio::byte *value = mfh.address() + original_length;
-          llfio::file_handle::extent_type value_offset = original_length;
-          for(size_t n = 0; n < _items.size(); n++)
-          {
-            toupdate_type &thisupdate = toupdate[n];
-            const transaction::_item &item = _items[n];
-            size_t totalwrite = 0;
-            if(thisupdate.removal)
-            {
-              totalwrite = 64;
-            }
-            else
-            {
-              memcpy(value, item.towrite->data(), item.towrite->size());
-              totalwrite = _parent->_pad_length(item.towrite->size());
-            }
-            index::value_tail *vt = reinterpret_cast<index::value_tail *>(value + totalwrite - sizeof(index::value_tail));
-            vt->key = thisupdate.key;
-            vt->transaction_counter = this_transaction_counter;
-            if(thisupdate.removal)
-            {
-              vt->length = (uint64_t) -1;  // this key is being deleted
-              memset(&thisupdate.history_item, 0, sizeof(thisupdate.history_item));
-            }
-            else
-            {
-              vt->length = item.towrite->size();
-              index::value_history::item &history_item = thisupdate.history_item;
-              history_item.transaction_counter = this_transaction_counter;
-              history_item.value_offset = (value_offset + totalwrite) / 64;
-              history_item.value_identifier = _parent->_mysmallfileidx;
-              history_item.length = vt->length;
-            }
-            if(_parent->_indexheader->contents_hashed)
-            {
-              vt->hash = QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash::hash((char *) value, totalwrite);
-            }
-            value += totalwrite;
-            value_offset += totalwrite;
+            QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
+            memset(&vt->hash, 0, sizeof(vt->hash));
+            hasher.add((const char *) req.reqs.back().data(), req.reqs.back().size());
+            vt->hash = hasher.finalise();
           }
-          items_written = true;
+          memset(&thisupdate.history_item, 0, sizeof(thisupdate.history_item));
+          thisupdate.history_item.value_offset = this_transaction_counter & ((1ULL << 48) - 1);
         }
-      }
-      if(!items_written)
-      {
-        // Gather append write all my items to my smallfile
-        llfio::file_handle::extent_type value_offset = _parent->_mysmallfile.maximum_extent().value();
-        assert((value_offset % 64) == 0);
-        // POSIX guarantees that at least 16 gather buffers can be written in a single shot
-        std::vector<llfio::file_handle::const_buffer_type> reqs;
-        reqs.reserve(16);
-        // With tails, that's eight items per syscall
-        llfio::byte tailbuffers[8][128];
-        memset(tailbuffers, 0, sizeof(tailbuffers));
-        for(size_t n = 0; n < _items.size(); n++)
+        else
         {
-          llfio::byte *tailbuffer = tailbuffers[n % 8];
-          index::value_tail *vt = reinterpret_cast<index::value_tail *>(tailbuffer + 128 - sizeof(index::value_tail));
-          toupdate_type &thisupdate = toupdate[n];
-          const transaction::_item &item = _items[n];
-          vt->key = thisupdate.key;
-          vt->transaction_counter = this_transaction_counter;
-          size_t totalwrite = 0;
-          if(thisupdate.removal)
+          // Store the compressed value instead if compression made it smaller
+          span<const char> stored = *item.towrite;
+          vt->raw_length = 0;
+          if(!req.compressed_items.empty() && req.compressed_items[n].second != 0)
           {
-            vt->length = (uint64_t) -1;  // this key is being deleted
-            totalwrite = 64;
-            reqs.push_back({tailbuffer + 64, 64});
-            if(_parent->_indexheader->contents_hashed)
-            {
-              QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
-              memset(&vt->hash, 0, sizeof(vt->hash));
-              hasher.add((const char *) reqs.back().data(), reqs.back().size());
-              vt->hash = hasher.finalise();
-            }
-            memset(&thisupdate.history_item, 0, sizeof(thisupdate.history_item));
+            stored = {req.compressed.data() + req.compressed_items[n].first, req.compressed_items[n].second};
+            vt->raw_length = (uint32_t) item.towrite->size();
           }
-          else
+          vt->length = (uint32_t) stored.size();
+          totalwrite = _parent->_pad_length(stored.size());
+          size_t tailbytes = totalwrite - stored.size();
+          assert(tailbytes < 128);
+          req.reqs.push_back({(const llfio::byte *) stored.data(), stored.size()});
+          req.reqs.push_back({tailbuffer + 128 - tailbytes, tailbytes});
+          if(_parent->_indexheader->contents_hashed)
           {
-            vt->length = item.towrite->size();
-            totalwrite = _parent->_pad_length(item.towrite->size());
-            size_t tailbytes = totalwrite - item.towrite->size();
-            assert(tailbytes < 128);
-            reqs.push_back({(llfio::byte *) item.towrite->data(), item.towrite->size()});
-            reqs.push_back({tailbuffer + 128 - tailbytes, tailbytes});
-            if(_parent->_indexheader->contents_hashed)
-            {
-              QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
-              memset(&vt->hash, 0, sizeof(vt->hash));
-              auto rit = reqs.end();
-              rit -= 2;
-              hasher.add((char *) rit->data(), rit->size());
-              ++rit;
-              hasher.add((char *) rit->data(), rit->size());
-              vt->hash = hasher.finalise();
-            }
-            index::value_history::item &history_item = thisupdate.history_item;
-            history_item.transaction_counter = this_transaction_counter;
-            history_item.value_offset = (value_offset + totalwrite) / 64;
-            history_item.value_identifier = _parent->_mysmallfileidx;
-            history_item.length = vt->length;
-          }
-          value_offset += totalwrite;
-          if((n % 8) == 7)
-          {
-            _parent->_mysmallfile.write({reqs, 0}).value();
-            reqs.clear();
+            QUICKCPPLIB_NAMESPACE::algorithm::hash::fast_hash hasher;
+            memset(&vt->hash, 0, sizeof(vt->hash));
+            auto rit = req.reqs.end();
+            rit -= 2;
+            hasher.add((const char *) rit->data(), rit->size());
+            ++rit;
+            hasher.add((const char *) rit->data(), rit->size());
+            vt->hash = hasher.finalise();
           }
+          index::value_history::item &history_item = thisupdate.history_item;
+          history_item.transaction_counter = this_transaction_counter;
+          history_item.value_offset = (value_offset + totalwrite) / 64;
+          history_item.value_identifier = _parent->_mysmallfileidx;
+          history_item.length = vt->length;
+          history_item.raw_length = vt->raw_length;
         }
-        if(!reqs.empty())
-        {
-          _parent->_mysmallfile.write({reqs, 0}).value();
-        }
+        value_offset += totalwrite;
       }
+    }
 
-      // Release all the shared locks on the existing items we are about to update
-      shared_locks.clear();
+    // Called by the leader after the records of a request have been written. Updates the index.
+    void _apply_commit(_commit_request &req, std::vector<key_type> &inserted)
+    {
+      auto &toupdate = req.toupdate;
       // Bail out if store has become corrupted
       if(_parent->_indexheader->magic != _parent->_goodmagic)
         throw corrupted_store();
       // Remove any newly inserted keys if we abort
       auto removeinserted = make_scope_exit([this, &toupdate]() noexcept {
-        for(auto updit = toupdate.rend(); updit != toupdate.rbegin(); ++updit)
+        for(auto updit = toupdate.rbegin(); updit != toupdate.rend(); ++updit)
         {
           if(updit->insertion && updit->it != _parent->_index->end())
           {
@@ -888,12 +3696,12 @@ namespace key_value_store
         }
       });
       // Take exclusive locks on all items in this transaction, inserting new keys if necessary
-      for(toupdate_type &item : toupdate)
+      for(_toupdate_type &item : toupdate)
       {
         auto it = _parent->_index->find_exclusive(item.key);
         if(it != _parent->_index->end())
         {
-          if(item.insertion || (item.update && it->second.history[0].transaction_counter != item.old_transaction_counter))
+          if(item.insertion || (item.old_transaction_counter != (uint64_t) -1 && it->second.history[0].transaction_counter != item.old_transaction_counter))
           {
             // Item has changed since transaction begun
             throw transaction_aborted(item.key);
@@ -930,6 +3738,7 @@ namespace key_value_store
       {
         // Update existing value's latest revision
         index::value_history &value = item.it->second;
+        _parent->_retain_version(item.key, value.history[3], _parent->_written_at(value.history[2]));
         memmove(value.history + 1, value.history, sizeof(value.history) - sizeof(value.history[0]));
         value.history[0] = item.history_item;
         if(item.removal)
@@ -945,11 +3754,302 @@ namespace key_value_store
           }
           if(alldeleted)
           {
+            // Held snapshots may see the deletions, so retain them along with the key
+            for(size_t n = 0; n < 4; n++)
+            {
+              _parent->_retain_version(item.key, value.history[n], (n == 0) ? (uint64_t) -1 : _parent->_written_at(value.history[n - 1]));
+            }
             _parent->_index->erase(std::move(item.it));
           }
         }
       }
       _parent->_indexheader->writes_occurring[_parent->_mysmallfileidx].fetch_sub(1);
+      for(auto &item : toupdate)
+      {
+        if(item.insertion)
+        {
+          inserted.push_back(item.key);
+        }
+      }
+      // Release the exclusive locks
+      toupdate.clear();
+    }
+
+    // Commits every queued request as a group until the queue is empty
+    static void _lead_group_commit(basic_key_value_store *parent) noexcept
+    {
+      for(;;)
+      {
+        _commit_request *batch = parent->_commit_queue.exchange(nullptr, std::memory_order_acq_rel);
+        if(batch == nullptr)
+        {
+          return;
+        }
+        // The queue is a stack, so reverse it to commit in order of arrival
+        std::vector<_commit_request *> requests;
+        for(; batch != nullptr; batch = batch->next)
+        {
+          requests.push_back(batch);
+        }
+        std::reverse(requests.begin(), requests.end());
+        {
+          // Serialise with compaction, which also appends to my smallfile
+          std::lock_guard<decltype(parent->_commitlock)> commitlockguard(parent->_commitlock);
+          // Snapshots taken by other processes wait for the transactions numbered before them to be applied
+          auto &applying_from = parent->_indexheader->applying_from[parent->_mysmallfileidx];
+          applying_from.store((parent->_indexheader->transaction_counter.load(std::memory_order_relaxed) & ((1ULL << 48) - 1)) + 1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          auto unapplying = make_scope_exit([&applying_from]() noexcept { applying_from.store(0, std::memory_order_release); });
+          std::vector<_commit_request *> written;
+          written.reserve(requests.size());
+          llfio::file_handle::extent_type original_length = (llfio::file_handle::extent_type) -1;
+          bool records_written = false;
+          try
+          {
+            original_length = parent->_mysmallfile.maximum_extent().value();
+            llfio::file_handle::extent_type value_offset = original_length;
+            for(auto *req : requests)
+            {
+              const auto value_offset_before = value_offset;
+              try
+              {
+                req->tr->_prepare_commit(*req, value_offset);
+                written.push_back(req);
+              }
+              catch(...)
+              {
+                req->error = std::current_exception();
+                value_offset = value_offset_before;
+              }
+            }
+            const size_t totalcommitsize = (size_t)(value_offset - original_length);
+            if(totalcommitsize > 0)
+            {
+              if(!parent->_smallfiles.mapped.empty() && totalcommitsize >= 4096)
+              {
+                // Extend the map and copy the records straight in
+                auto &mfh = parent->_smallfiles.mapped[parent->_mysmallfileidx];
+                if(value_offset > mfh.capacity())
+                {
+                  mfh.reserve(value_offset + parent->_mmap_over_extension).value();
+                }
+                mfh.truncate(value_offset).value();
+                llfio::byte *p = mfh.address() + original_length;
+                for(auto *req : written)
+                {
+                  for(const auto &b : req->reqs)
+                  {
+                    memcpy(p, b.data(), b.size());
+                    p += b.size();
+                  }
+                }
+              }
+              else
+              {
+                // Gather append write all the records, as many as the kernel permits per syscall
+                size_t maxbuffers = parent->_mysmallfile.max_buffers();
+                if(maxbuffers == 0)
+                {
+                  maxbuffers = 16;  // POSIX guarantees that at least 16 gather buffers can be written in a single shot
+                }
+                std::vector<llfio::file_handle::const_buffer_type> reqs;
+                reqs.reserve(maxbuffers);
+                for(auto *req : written)
+                {
+                  for(const auto &b : req->reqs)
+                  {
+                    reqs.push_back(b);
+                    if(reqs.size() == maxbuffers)
+                    {
+                      parent->_mysmallfile.write({reqs, 0}).value();
+                      reqs.clear();
+                    }
+                  }
+                }
+                if(!reqs.empty())
+                {
+                  parent->_mysmallfile.write({reqs, 0}).value();
+                }
+              }
+              // One barrier for the whole group
+              if(parent->_mysmallfile.are_safety_barriers_issued())
+              {
+                parent->_mysmallfile.barrier(llfio::file_handle::barrier_kind::wait_data_only).value();
+              }
+            }
+            records_written = true;
+            std::vector<key_type> inserted;
+            for(auto *req : written)
+            {
+              try
+              {
+                req->tr->_apply_commit(*req, inserted);
+              }
+              catch(...)
+              {
+                // Release any exclusive locks taken before aborting, as later requests may update the same keys
+                req->toupdate.clear();
+                req->error = std::current_exception();
+              }
+            }
+            parent->_indexheader->applied_extent[parent->_mysmallfileidx] = value_offset;
+            // No locks on items are now held, so move some of the hash index into its newest
+            // table if it is growing, at a rate which always completes before it next needs to grow
+            {
+              uint64_t updated = 0;
+              for(auto *req : written)
+              {
+                updated += req->tr->_items.size();
+              }
+              try
+              {
+                parent->_index->migrate_some(std::max(updated * 4, (uint64_t) 64));
+              }
+              catch(...)
+              {
+                // Anything skipped is swept up when the migration completes
+              }
+            }
+            if(parent->_orderedindexheader != nullptr && !inserted.empty())
+            {
+              try
+              {
+                std::sort(inserted.begin(), inserted.end(), index::key_less);
+                parent->_ordered_index_insert(inserted);
+              }
+              catch(...)
+              {
+                // The commits succeeded, so instead have the ordered index rebuilt when next opened
+                parent->_orderedindexheader->magic = 0;
+                parent->_orderedindexheader = nullptr;
+              }
+            }
+          }
+          catch(...)
+          {
+            // The records failed to be written, so fail every request not yet failed
+            for(auto *req : requests)
+            {
+              if(!req->error)
+              {
+                req->error = std::current_exception();
+              }
+            }
+            // None of the transactions were applied, so cut off any of their records which were written,
+            // else crash recovery would find them after the applied extent and treat them as torn. Their
+            // transaction counters are left unused.
+            if(!records_written && original_length != (llfio::file_handle::extent_type) -1)
+            {
+              // If even this fails, recovery reverts the transactions as it would after a crash
+              if(parent->_smallfiles.mapped.empty())
+              {
+                (void) parent->_mysmallfile.truncate(original_length);
+              }
+              else
+              {
+                (void) parent->_smallfiles.mapped[parent->_mysmallfileidx].truncate(original_length);
+              }
+            }
+          }
+        }
+        {
+          std::lock_guard<std::mutex> g(parent->_commit_waitlock);
+          for(auto *req : requests)
+          {
+            req->done.store(true, std::memory_order_release);
+          }
+        }
+        parent->_commit_waitcond.notify_all();
+      }
+    }
+
+  public:
+    /*! \brief Commit the transaction, throwing `transaction_aborted` if a key's value was updated since it was fetched for this transaction.
+
+    Concurrent commits to the same store are grouped: one committer becomes leader and
+    writes the records of every commit queued at that time together, with a single
+    barrier if the smallfile was opened with `caching::safety_barriers`, so throughput
+    scales with the number of committers rather than with the rate of barriers.
+    */
+    void commit()
+    {
+      if(_parent->_indexheader->magic != _parent->_goodmagic)
+        throw corrupted_store();
+
+      // Firstly remove any items fetched but not used as a base for an update, and sort the remaining
+      // list of keys we are to update into order. This ensures that all writers always lock the keys
+      // in the same order, thus preventing deadlock.
+      _items.erase(std::remove_if(_items.begin(), _items.end(), [](const auto &item) { return !item.towrite.has_value() && !item.remove; }), _items.end());
+      std::sort(_items.begin(), _items.end(), [](const _item &a, const _item &b) { return a.kvi.key < b.kvi.key; });
+      // Recovery knows a transaction is complete when it finds as many records as the top 16 bits
+      // of their transaction counter say were updated, so more could not be recovered
+      if(_items.size() > 65535)
+      {
+        throw transaction_limit_reached();
+      }
+      for(const auto &item : _items)
+      {
+        if(item.towrite.has_value() && item.towrite->size() >= (uint32_t) -1)
+        {
+          throw std::invalid_argument("values must be less than 4Gb long");
+        }
+      }
+
+      _commit_request req;
+      req.tr = this;
+      // Compress the values now, so the work is spread over the committers rather than done by the leader
+      if(_parent->_indexheader->values_compressed.load(std::memory_order_acquire))
+      {
+        const auto &dict = _parent->_compression_dictionary();
+        size_t total = 0;
+        for(const auto &item : _items)
+        {
+          if(item.towrite.has_value())
+          {
+            total += item.towrite->size();
+          }
+        }
+        req.compressed.resize(total);
+        req.compressed_items.assign(_items.size(), {0, 0});
+        size_t offset = 0;
+        for(size_t n = 0; n < _items.size(); n++)
+        {
+          if(_items[n].towrite.has_value())
+          {
+            const size_t length = compression::compress({req.compressed.data() + offset, _items[n].towrite->size()}, *_items[n].towrite, dict);
+            req.compressed_items[n] = {offset, length};
+            offset += length;
+          }
+        }
+      }
+
+      // Queue myself for the group commit
+      req.next = _parent->_commit_queue.load(std::memory_order_relaxed);
+      while(!_parent->_commit_queue.compare_exchange_weak(req.next, &req, std::memory_order_release, std::memory_order_relaxed))
+      {
+      }
+      while(!req.done.load(std::memory_order_acquire))
+      {
+        // If there is no leader, become it
+        if(!_parent->_commit_leader.exchange(true, std::memory_order_acquire))
+        {
+          _lead_group_commit(_parent);
+          _parent->_commit_leader.store(false, std::memory_order_release);
+          // A request queued as the leader finished may need a new leader
+          {
+            std::lock_guard<std::mutex> g(_parent->_commit_waitlock);
+          }
+          _parent->_commit_waitcond.notify_all();
+          continue;
+        }
+        std::unique_lock<std::mutex> g(_parent->_commit_waitlock);
+        _parent->_commit_waitcond.wait_for(g, std::chrono::milliseconds(1),
+                                           [&] { return req.done.load(std::memory_order_acquire) || !_parent->_commit_leader.load(std::memory_order_acquire); });
+      }
+      if(req.error)
+      {
+        std::rethrow_exception(req.error);
+      }
     }
   };
 }
@@ -24,7 +24,18 @@ Distributed under the Boost Software License, Version 1.0.
 
 #include "include/key_value_store.hpp"
 
+#include "../../include/kvstore/kvstore.hpp"
+
+#include <atomic>
 #include <iostream>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 namespace stackoverflow
 {
@@ -89,10 +100,8 @@ namespace stackoverflow
   }
 }  // namespace stackoverflow
 
-void benchmark(key_value_store::basic_key_value_store &store, const char *desc)
+const std::vector<std::pair<uint64_t, std::string>> &benchmark_values()
 {
-  std::cout << "\n" << desc << ":" << std::endl;
-  // Write 1M values and see how long it takes
   static std::vector<std::pair<uint64_t, std::string>> values;
   if(values.empty())
   {
@@ -103,6 +112,14 @@ void benchmark(key_value_store::basic_key_value_store &store, const char *desc)
       values.push_back({100 + n, randomvalue});
     }
   }
+  return values;
+}
+
+void benchmark(key_value_store::basic_key_value_store &store, const char *desc)
+{
+  std::cout << "\n" << desc << ":" << std::endl;
+  // Write 1M values and see how long it takes
+  auto &values = benchmark_values();
   std::cout << "  Inserting 1M key-value pairs ..." << std::endl;
   {
     auto begin = std::chrono::high_resolution_clock::now();
@@ -141,6 +158,551 @@ void benchmark(key_value_store::basic_key_value_store &store, const char *desc)
     auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
     std::cout << "  Fetched at " << (1000000000ULL / diff) << " items per sec" << std::endl;
   }
+  std::cout << "  Retrieving 1M key-value pairs in batches of 1024 ..." << std::endl;
+  {
+    std::vector<key_value_store::key_type> keys;
+    keys.reserve(1024);
+    auto begin = std::chrono::high_resolution_clock::now();
+    for(size_t n = 0; n < values.size(); n += 1024)
+    {
+      keys.clear();
+      for(size_t m = n; m < n + 1024 && m < values.size(); m++)
+      {
+        keys.push_back(values[m].first);
+      }
+      for(auto &kvi : store.find_many(keys))
+      {
+        if(!kvi)
+          abort();
+      }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+    std::cout << "  Fetched at " << (1000000000ULL / diff) << " items per sec" << std::endl;
+  }
+}
+
+// The same workload as benchmark(), but through the standard kvstore interface
+void benchmark(KVSTORE_V1_NAMESPACE::basic_key_value_store &store, const char *desc)
+{
+  using store_type = KVSTORE_V1_NAMESPACE::basic_key_value_store;
+  using LLFIO_V2_NAMESPACE::byte;
+  std::cout << "\n" << desc << ":" << std::endl;
+  auto &values = benchmark_values();
+  auto key = [](const uint64_t &k) { return store_type::key_type(reinterpret_cast<const byte *>(&k), sizeof(k)); };
+  store.max_size(values.size()).value();
+  std::cout << "  Inserting 1M key-value pairs ..." << std::endl;
+  {
+    auto begin = std::chrono::high_resolution_clock::now();
+    for(size_t n = 0; n < values.size(); n += 1024)
+    {
+      auto tr = store.begin_transaction().value();
+      for(size_t m = 0; m < 1024; m++)
+      {
+        if(n + m >= values.size())
+          break;
+        auto &i = values[n + m];
+        store_type::const_buffer_type b{reinterpret_cast<const byte *>(i.second.data()), i.second.size()};
+        tr->write(key(i.first), {{&b, 1}, 0}).value();
+      }
+      tr->commit().value();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+    std::cout << "  Inserted at " << (1000000000ULL / diff) << " items per sec" << std::endl;
+  }
+  std::cout << "  Retrieving 1M key-value pairs ..." << std::endl;
+  {
+    auto begin = std::chrono::high_resolution_clock::now();
+    for(auto &i : values)
+    {
+      // Reads return buffers pointing into the store's map, so nothing is copied
+      store_type::buffer_type b{nullptr, (size_t) -1};
+      auto r = store.read({{&b, 1}, 0}, key(i.first));
+      if(!r || r.value()[0].size() != i.second.size())
+        abort();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+    std::cout << "  Fetched at " << (1000000000ULL / diff) << " items per sec" << std::endl;
+  }
+}
+
+#ifndef _WIN32
+// Abandons, then kills, writers mid-commit in child processes, and checks what survives reopening the store
+void crash_recovery()
+{
+  std::cout << "\nCrash recovery:" << std::endl;
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("recoverystore", ec);
+  }
+  {
+    // Create the store with integrity checking, so the index is hashed on clean close
+    key_value_store::basic_key_value_store store("recoverystore", 10, true);
+  }
+  // A writer which exits without closing the store. Everything it committed must survive.
+  pid_t child = fork();
+  if(child == 0)
+  {
+    key_value_store::basic_key_value_store store("recoverystore", 0);
+    key_value_store::transaction tr(store);
+    for(uint64_t n = 1; n <= 10; n++)
+    {
+      tr.update_unsafe(n, "committed");
+    }
+    tr.commit();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  {
+    key_value_store::basic_key_value_store store("recoverystore", 0);
+    if(!store.last_recovery().performed)
+    {
+      std::cerr << "FAILURE: Recovery was not performed after a writer exited without closing the store!" << std::endl;
+    }
+    for(uint64_t n = 1; n <= 10; n++)
+    {
+      auto kvi = store.find(n);
+      if(!kvi || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != "committed")
+      {
+        std::cerr << "FAILURE: Committed key " << n << " did not survive its writer exiting!" << std::endl;
+      }
+    }
+  }
+  // A writer killed at some random point whilst committing transactions of eight keys in a loop.
+  // Each transaction must survive entirely or not at all, and all but possibly the last must survive.
+  static constexpr uint64_t keys_per_transaction = 8, first_key = 100000;
+  int started[2];
+  if(-1 == pipe(started))
+  {
+    abort();
+  }
+  child = fork();
+  if(child == 0)
+  {
+    close(started[0]);
+    key_value_store::basic_key_value_store store("recoverystore", 0);
+    for(uint64_t t = 0;; t++)
+    {
+      key_value_store::transaction tr(store);
+      const std::string value = std::to_string(t);
+      for(uint64_t n = 0; n < keys_per_transaction; n++)
+      {
+        tr.update_unsafe(first_key + t * keys_per_transaction + n, value);
+      }
+      tr.commit();
+      if(t == 0)
+      {
+        char c = 0;
+        (void) write(started[1], &c, 1);
+      }
+    }
+  }
+  close(started[1]);
+  {
+    char c;
+    (void) read(started[0], &c, 1);
+    close(started[0]);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  kill(child, SIGKILL);
+  waitpid(child, &status, 0);
+  {
+    key_value_store::basic_key_value_store store("recoverystore", 0);
+    const auto &stats = store.last_recovery();
+    std::cout << "  Recovery performed = " << stats.performed << " full = " << stats.full << " items dropped = " << stats.items_dropped
+              << " transactions completed = " << stats.transactions_completed << " transactions reverted = " << stats.transactions_reverted
+              << " bytes truncated = " << stats.bytes_truncated << std::endl;
+    if(!stats.performed)
+    {
+      std::cerr << "FAILURE: Recovery was not performed after a writer was killed!" << std::endl;
+    }
+    uint64_t survived = 0;
+    for(uint64_t t = 0;; t++)
+    {
+      const std::string value = std::to_string(t);
+      uint64_t found = 0;
+      for(uint64_t n = 0; n < keys_per_transaction; n++)
+      {
+        auto kvi = store.find(first_key + t * keys_per_transaction + n);
+        if(kvi)
+        {
+          if(LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != value)
+          {
+            std::cerr << "FAILURE: Key " << (first_key + t * keys_per_transaction + n) << " has a value from the wrong transaction!" << std::endl;
+          }
+          found++;
+        }
+      }
+      if(found == 0)
+      {
+        break;
+      }
+      if(found != keys_per_transaction)
+      {
+        std::cerr << "FAILURE: Only " << found << " of the keys of transaction " << t << " survived!" << std::endl;
+      }
+      survived++;
+    }
+    if(survived == 0)
+    {
+      std::cerr << "FAILURE: The first transaction, reported committed, did not survive!" << std::endl;
+    }
+    // Nothing after the first missing transaction may have survived
+    for(uint64_t n = 0; n < keys_per_transaction * 4; n++)
+    {
+      if(store.find(first_key + (survived + 1) * keys_per_transaction + n))
+      {
+        std::cerr << "FAILURE: A transaction after one which did not survive did!" << std::endl;
+        break;
+      }
+    }
+    std::cout << "  " << survived << " transactions survived the writer being killed" << std::endl;
+  }
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("recoverystore", ec);
+  }
+}
+#endif
+
+// Round trips values through the compression codec, including ones it cannot compress, and checks corrupted input is refused without overrunning
+void compression_round_trips()
+{
+  namespace compression = key_value_store::compression;
+  using LLFIO_V2_NAMESPACE::span;
+  std::cout << "\nCompression round trips:" << std::endl;
+  std::mt19937 rand(78);
+  auto random_bytes = [&](size_t length) {
+    std::string ret(length, 0);
+    for(auto &c : ret)
+    {
+      c = (char) rand();
+    }
+    return ret;
+  };
+  std::vector<std::string> samples;
+  for(size_t n = 0; n < 32; n++)
+  {
+    samples.push_back("{\"id\": " + std::to_string(n) + ", \"name\": \"customer" + std::to_string(n * 7) + "\", \"status\": \"active\"}");
+  }
+  std::vector<span<const char>> samplespans(samples.begin(), samples.end());
+  const compression::dictionary empty({}), trained(compression::train(samplespans, 4096));
+  size_t failures = 0;
+  // Compresses `value`, checking it decompresses back exactly, returning the compressed form which is empty if incompressible
+  auto round_trip = [&](const std::string &value, const compression::dictionary &dict) {
+    std::string compressed(value.size(), 0);
+    compressed.resize(compression::compress({&compressed[0], compressed.size()}, value, dict));
+    if(compressed.empty())
+    {
+      return compressed;
+    }
+    // Guard bytes after the output catch the decoder writing past its end
+    std::string out(value.size() + 64, '!');
+    if(compressed.size() >= value.size() || !compression::decompress({&out[0], value.size()}, compressed, dict.bytes()) || out.compare(0, value.size(), value) != 0 ||
+       out.compare(value.size(), 64, std::string(64, '!')) != 0)
+    {
+      std::cerr << "FAILURE: A value of " << value.size() << " bytes did not round trip through compression!" << std::endl;
+      failures++;
+    }
+    return compressed;
+  };
+  // Incompressible values, and values too short to compress, are stored raw
+  for(size_t length : {0, 1, 31, 32, 100, 65536})
+  {
+    if(!round_trip(random_bytes(length), empty).empty())
+    {
+      std::cerr << "FAILURE: A random value of " << length << " bytes was compressed!" << std::endl;
+      failures++;
+    }
+  }
+  // Runs of one byte, of literal and match lengths either side of where their encodings extend by a byte.
+  // A run of n bytes is encoded as a literal, a match of n - 6 bytes, then the five final literals.
+  for(size_t literals : {0, 1, 14, 15, 16, 269, 270, 271, 524, 525})
+  {
+    for(size_t run : {6 + 18, 6 + 19, 6 + 20, 6 + 269, 6 + 270, 6 + 271, 6 + 524, 6 + 525, 65535, 65536, 65537, 200000})
+    {
+      const auto value = random_bytes(literals) + std::string(run, 'x');
+      if(round_trip(value, empty).empty() && value.size() >= compression::min_value_size)
+      {
+        std::cerr << "FAILURE: A run of " << run << " bytes after " << literals << " literals was not compressed!" << std::endl;
+        failures++;
+      }
+    }
+  }
+  // Repeats at the furthest offsets a match can refer to, and matches into the dictionary
+  for(size_t distance : {65534, 65535, 65536})
+  {
+    const auto block = random_bytes(64);
+    round_trip(block + random_bytes(distance - 64) + block + random_bytes(16), empty);
+  }
+  for(const auto &sample : samples)
+  {
+    round_trip(sample, trained);
+  }
+  // Truncated or corrupted input must be refused, or decode to exactly the right length, without ever overrunning
+  const auto value = samples[5] + random_bytes(40) + std::string(300, 'y') + samples[6];
+  const auto compressed = round_trip(value, trained);
+  std::string out(value.size() + 64, '!');
+  auto decodes = [&](const std::string &in, size_t length) {
+    out.assign(value.size() + 64, '!');
+    const bool ret = compression::decompress({&out[0], length}, in, trained.bytes());
+    if(out.compare(length, out.size() - length, std::string(out.size() - length, '!')) != 0)
+    {
+      std::cerr << "FAILURE: Decompressing corrupted input overran its output!" << std::endl;
+      failures++;
+    }
+    return ret;
+  };
+  for(size_t length = 0; length < compressed.size(); length++)
+  {
+    if(decodes(compressed.substr(0, length), value.size()))
+    {
+      std::cerr << "FAILURE: Compressed input truncated to " << length << " bytes was accepted!" << std::endl;
+      failures++;
+    }
+  }
+  if(decodes(compressed, value.size() - 1) || decodes(compressed, value.size() + 1))
+  {
+    std::cerr << "FAILURE: Compressed input was accepted as decompressing to the wrong length!" << std::endl;
+    failures++;
+  }
+  for(size_t n = 0; n < 10000; n++)
+  {
+    auto corrupted = compressed;
+    corrupted[rand() % corrupted.size()] = (char) rand();
+    corrupted[rand() % corrupted.size()] = (char) rand();
+    (void) decodes(corrupted, value.size());
+  }
+  if(failures == 0)
+  {
+    std::cout << "  All compression round trips succeeded" << std::endl;
+  }
+}
+
+// Stores written by earlier versions of the format are refused, and left untouched
+void old_stores_refused()
+{
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  std::cout << "\nOld stores:" << std::endl;
+  {
+    std::error_code ec;
+    llfio::filesystem::remove_all("oldstore", ec);
+  }
+  {
+    auto dir = llfio::directory_handle::directory({}, "oldstore", llfio::directory_handle::mode::write, llfio::directory_handle::creation::if_needed).value();
+    auto fh = llfio::file_handle::file(dir, "index", llfio::file_handle::mode::write, llfio::file_handle::creation::if_needed).value();
+    char header[4096] = "AFIOKV04";
+    fh.write(0, {{(const llfio::byte *) header, sizeof(header)}}).value();
+  }
+  try
+  {
+    key_value_store::basic_key_value_store store("oldstore", 0);
+    std::cerr << "FAILURE: A store of an earlier format was opened!" << std::endl;
+  }
+  catch(const key_value_store::old_store &)
+  {
+    std::cout << "  A store of an earlier format was refused" << std::endl;
+  }
+  {
+    auto fh = llfio::file_handle::file({}, "oldstore/index").value();
+    char magic[8];
+    fh.read(0, {{(llfio::byte *) magic, sizeof(magic)}}).value();
+    if(memcmp(magic, "AFIOKV04", 8) != 0)
+    {
+      std::cerr << "FAILURE: Opening a store of an earlier format modified it!" << std::endl;
+    }
+  }
+  {
+    std::error_code ec;
+    llfio::filesystem::remove_all("oldstore", ec);
+  }
+}
+
+// Holds a view of a value whilst it is superseded and its region compacted, then checks the region is reclaimed once the view is released
+void views_outlive_compaction()
+{
+  std::cout << "\nViews outliving compaction:" << std::endl;
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("viewstore", ec);
+  }
+  {
+    // Values this long are returned by find() as views into a map of the smallfile
+    static constexpr uint64_t keys = 32;
+    auto value_of = [](uint64_t round) { return std::string(65536, (char) ('a' + round)); };
+    key_value_store::basic_key_value_store store("viewstore", 1000);
+    auto update_all = [&](uint64_t round) {
+      key_value_store::transaction tr(store);
+      for(uint64_t n = 0; n < keys; n++)
+      {
+        tr.update_unsafe(n, value_of(round));
+      }
+      tr.commit();
+    };
+    update_all(0);
+    {
+      auto view = store.find(0);
+      // Supersede every value the view's region holds, then compact it
+      for(uint64_t round = 1; round < 5; round++)
+      {
+        update_all(round);
+      }
+      const auto stats = store.compact();
+      if(stats.regions_reclaimed == 0)
+      {
+        std::cerr << "FAILURE: Compaction reclaimed no regions of superseded values!" << std::endl;
+      }
+      if(stats.bytes_punched != 0 || store.pending_reclamations() == 0)
+      {
+        std::cerr << "FAILURE: A region was punched whilst a view into it was held!" << std::endl;
+      }
+      if(!view || LLFIO_V2_NAMESPACE::string_view(view.value.data(), view.value.size()) != value_of(0))
+      {
+        std::cerr << "FAILURE: A view did not keep its value whilst it was superseded and compacted!" << std::endl;
+      }
+    }
+    // Releasing the view lets the reader epoch advance, so the next compaction step punches the region
+    const auto stats = store.compact();
+    if(stats.bytes_punched == 0 || store.pending_reclamations() != 0)
+    {
+      std::cerr << "FAILURE: Compacted regions were not reclaimed once the views into them were released!" << std::endl;
+    }
+    std::cout << "  " << stats.bytes_punched << " bytes punched once the view was released" << std::endl;
+  }
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("viewstore", ec);
+  }
+}
+
+// Compacts a store whose oldest values have all been superseded whilst another handle to it writes
+void compaction()
+{
+  std::cout << "\nCompaction:" << std::endl;
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("compactstore", ec);
+  }
+  static constexpr uint64_t keys = 1024, writer_first_key = 100000;
+  auto value_of = [](uint64_t key, uint64_t round) {
+    std::string ret(4000, (char) ('a' + round % 26));
+    ret.replace(0, 16, std::to_string(key));
+    return ret;
+  };
+  {
+    key_value_store::basic_key_value_store store("compactstore", 100000);
+    // Five rounds of updates supersede the first round of values, as only four are kept in each key's history
+    for(uint64_t round = 0; round < 5; round++)
+    {
+      key_value_store::transaction tr(store);
+      for(uint64_t n = 0; n < keys; n++)
+      {
+        tr.update_unsafe(n, value_of(n, round));
+      }
+      tr.commit();
+    }
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+      key_value_store::basic_key_value_store other("compactstore", 0);
+      for(uint64_t t = 0; !done; t++)
+      {
+        key_value_store::transaction tr(other);
+        tr.update_unsafe(writer_first_key + t % keys, value_of(writer_first_key + t % keys, t / keys));
+        tr.commit();
+      }
+    });
+    const auto stats = store.compact();
+    done = true;
+    writer.join();
+    std::cout << "  Reclaimed " << stats.regions_reclaimed << " regions, moving " << stats.records_moved << " records of " << stats.bytes_moved
+              << " bytes, punched " << stats.bytes_punched << " bytes" << std::endl;
+    if(stats.regions_reclaimed == 0)
+    {
+      std::cerr << "FAILURE: Compaction reclaimed no regions of superseded values!" << std::endl;
+    }
+    for(uint64_t n = 0; n < keys; n++)
+    {
+      auto kvi = store.find(n);
+      if(!kvi || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != value_of(n, 4))
+      {
+        std::cerr << "FAILURE: Key " << n << " did not have its value after compaction!" << std::endl;
+        break;
+      }
+    }
+  }
+  {
+    // Everything the other handle wrote must be intact
+    key_value_store::basic_key_value_store store("compactstore", 0);
+    for(uint64_t n = 0; n < keys; n++)
+    {
+      auto kvi = store.find(writer_first_key + n);
+      if(kvi && (kvi.value.size() != 4000 || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != value_of(writer_first_key + n, kvi.value[4000 - 1] - 'a')))
+      {
+        std::cerr << "FAILURE: Key " << (writer_first_key + n) << " written during compaction was corrupted!" << std::endl;
+        break;
+      }
+    }
+  }
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("compactstore", ec);
+  }
+}
+
+// Checks a snapshot held by another handle keeps compaction from reclaiming the versions it retains
+void compaction_respects_snapshots_elsewhere()
+{
+  std::cout << "\nCompaction with a snapshot held elsewhere:" << std::endl;
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("snapshotstore", ec);
+  }
+  {
+    static constexpr uint64_t keys = 256;
+    auto value_of = [](uint64_t round) { return std::string(8000, (char) ('a' + round)); };
+    key_value_store::basic_key_value_store compactor("snapshotstore", 10000);
+    key_value_store::basic_key_value_store other("snapshotstore", 0);
+    auto update_all = [&](uint64_t round) {
+      key_value_store::transaction tr(other);
+      for(uint64_t n = 0; n < keys; n++)
+      {
+        tr.update_unsafe(n, value_of(round));
+      }
+      tr.commit();
+    };
+    update_all(0);
+    {
+      // The other handle retains the first values, superseded by its own writes, for its snapshot
+      auto snapshot = other.take_snapshot(true);
+      for(uint64_t round = 1; round < 5; round++)
+      {
+        update_all(round);
+      }
+      const auto stats = compactor.compact();
+      if(stats.regions_reclaimed != 0)
+      {
+        std::cerr << "FAILURE: Compaction reclaimed regions whilst another handle held a snapshot!" << std::endl;
+      }
+      auto kvi = other.find(0, snapshot);
+      if(!kvi || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != value_of(0))
+      {
+        std::cerr << "FAILURE: A snapshot held by another handle lost its version to compaction!" << std::endl;
+      }
+    }
+    const auto stats = compactor.compact();
+    if(stats.regions_reclaimed == 0)
+    {
+      std::cerr << "FAILURE: Compaction reclaimed nothing once the snapshot elsewhere was released!" << std::endl;
+    }
+    std::cout << "  Reclaimed " << stats.regions_reclaimed << " regions once the snapshot elsewhere was released" << std::endl;
+  }
+  {
+    std::error_code ec;
+    LLFIO_V2_NAMESPACE::filesystem::remove_all("snapshotstore", ec);
+  }
 }
 
 int main()
@@ -150,6 +712,15 @@ int main()
 #endif
   try
   {
+#ifndef _WIN32
+    // Forks, so run before anything else starts threads
+    crash_recovery();
+#endif
+    compression_round_trips();
+    old_stores_refused();
+    compaction();
+    views_outlive_compaction();
+    compaction_respects_snapshots_elsewhere();
     {
       std::error_code ec;
       LLFIO_V2_NAMESPACE::filesystem::remove_all("teststore", ec);
@@ -214,6 +785,83 @@ int main()
           std::cerr << "FAILURE: Revision 1Key 78 was not found!" << std::endl;
         }
       }
+      {
+        store.use_ordered_index();
+        key_value_store::transaction tr(store);
+        tr.fetch(80);
+        tr.update(80, "carol");
+        tr.commit();
+        size_t count = 0;
+        store.for_each_in_range(0, 100, [&](const key_value_store::key_type &k) {
+          std::cout << "Key " << k.as_longlongs[0] << " is in the range [0, 100]" << std::endl;
+          ++count;
+          return true;
+        });
+        if(count != 2)
+        {
+          std::cerr << "FAILURE: Range [0, 100] should contain exactly keys 79 and 80!" << std::endl;
+        }
+      }
+      {
+        // The hash index was created with 10 entries, so this grows it online several times
+        key_value_store::transaction tr(store);
+        for(uint64_t n = 1000; n < 1100; n++)
+        {
+          tr.update_unsafe(n, "grown");
+        }
+        tr.commit();
+        for(uint64_t n = 1000; n < 1100; n++)
+        {
+          if(!store.find(n))
+          {
+            std::cerr << "FAILURE: Key " << n << " was not found after growing the index!" << std::endl;
+          }
+        }
+      }
+      {
+        // Values resembling the samples compress well with the trained dictionary
+        std::vector<std::string> values;
+        for(size_t n = 0; n < 64; n++)
+        {
+          values.push_back("{\"id\": " + std::to_string(n) + ", \"name\": \"customer" + std::to_string(n * 7) + "\", \"status\": \"active\", \"tags\": [\"retail\", \"priority\"]}");
+        }
+        std::vector<LLFIO_V2_NAMESPACE::span<const char>> samples(values.begin(), values.begin() + 32);
+        store.use_compression(samples);
+        key_value_store::transaction tr(store);
+        for(size_t n = 0; n < values.size(); n++)
+        {
+          tr.update_unsafe(2000 + n, values[n]);
+        }
+        tr.commit();
+        for(size_t n = 0; n < values.size(); n++)
+        {
+          auto kvi = store.find(2000 + n);
+          if(!kvi || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != values[n])
+          {
+            std::cerr << "FAILURE: Compressed key " << (2000 + n) << " did not have its value!" << std::endl;
+          }
+        }
+      }
+      {
+        // A held snapshot still sees the value of key 79 after it has been updated more times than the history keeps
+        auto snapshot = store.take_snapshot(true);
+        for(int n = 0; n < 6; n++)
+        {
+          key_value_store::transaction tr(store);
+          tr.fetch(79);
+          tr.update(79, "updated");
+          tr.commit();
+        }
+        auto kvi = store.find(79, snapshot);
+        if(!kvi || LLFIO_V2_NAMESPACE::string_view(kvi.value.data(), kvi.value.size()) != "douglas")
+        {
+          std::cerr << "FAILURE: Key 79 did not have its value at the snapshot!" << std::endl;
+        }
+        if(store.find(80, snapshot).transaction_counter != store.find(80).transaction_counter)
+        {
+          std::cerr << "FAILURE: Key 80 did not have its latest value at the snapshot!" << std::endl;
+        }
+      }
     }
     // test read only
     {
@@ -273,6 +921,25 @@ int main()
       store.use_mmaps();
       benchmark(store, "integrity, durability, mmaps");
     }
+    {
+      std::error_code ec;
+      LLFIO_V2_NAMESPACE::filesystem::remove_all("teststore", ec);
+    }
+    {
+      auto store = KVSTORE_V1_NAMESPACE::create_kvstore("file://teststore", sizeof(uint64_t), KVSTORE_V1_NAMESPACE::basic_key_value_store::features::atomic_transactions).value();
+      benchmark(*store, "kvstore mapped_files, no durability");
+    }
+    {
+      std::error_code ec;
+      LLFIO_V2_NAMESPACE::filesystem::remove_all("teststore", ec);
+    }
+    {
+      auto store = KVSTORE_V1_NAMESPACE::create_kvstore("file://teststore", sizeof(uint64_t), KVSTORE_V1_NAMESPACE::basic_key_value_store::features::atomic_transactions,
+                                                        KVSTORE_V1_NAMESPACE::basic_key_value_store::mode::write, KVSTORE_V1_NAMESPACE::basic_key_value_store::creation::if_needed,
+                                                        KVSTORE_V1_NAMESPACE::basic_key_value_store::caching::reads)
+                   .value();
+      benchmark(*store, "kvstore mapped_files, durability");
+    }
   }
   catch(const std::exception &e)
   {
@@ -5,3 +5,4 @@
 #error This should not occur
 #endif
 #include "../include/llfio/llfio.hpp"
+#include "../include/kvstore/kvstore.hpp"
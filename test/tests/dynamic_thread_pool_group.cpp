@@ -29,6 +29,13 @@ Distributed under the Boost Software License, Version 1.0.
 #include "quickcpplib/algorithm/small_prng.hpp"
 
 #include <cmath>  // for sqrt
+#include <fstream>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 static inline void TestDynamicThreadPoolGroupWorks()
 {
@@ -515,6 +522,7 @@ static inline void TestDynamicThreadPoolGroupIoAwareWorks()
       std::cout << "\n directory on which mounted = " << statfs.f_mntonname;
       std::cout << "\n i/o's currently in progress (i.e. queue depth) = " << statfs.f_iosinprogress;
       std::cout << "\n percentage of time spent doing i/o (1.0 = 100%) = " << statfs.f_iosbusytime;
+      std::cout << "\n mean seconds to complete each i/o = " << statfs.f_ioslatency;
       std::cout << std::endl;
     };
     llfio::statfs_t s;
@@ -535,7 +543,7 @@ static inline void TestDynamicThreadPoolGroupIoAwareWorks()
   catch(const std::runtime_error &e)
   {
     std::cout << "\nNOTE: Received exception '" << e.what()
-              << "' when trying to construct dynamic_thread_pool_group::io_aware_work_item, assuming this platform does not implement statfs::f_iosinprogress "
+              << "' when trying to construct dynamic_thread_pool_group::io_aware_work_item, assuming this platform does not implement statfs::f_ioslatency "
                  "and skipping test."
               << std::endl;
     return;
@@ -547,9 +555,13 @@ static inline void TestDynamicThreadPoolGroupIoAwareWorks()
   while(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - begin) < std::chrono::seconds(60))
   {
     llfio::statfs_t statfs;
-    statfs.fill(shared_state.h, llfio::statfs_t::want::iosinprogress | llfio::statfs_t::want::iosbusytime | llfio::statfs_t::want::mntonname).value();
+    statfs
+    .fill(shared_state.h,
+          llfio::statfs_t::want::iosinprogress | llfio::statfs_t::want::iosbusytime | llfio::statfs_t::want::ioslatency | llfio::statfs_t::want::mntonname)
+    .value();
     std::cout << "\nStorage device at " << statfs.f_mntonname << " is at " << (100.0f * statfs.f_iosbusytime) << "% utilisation and has an i/o queue depth of "
-              << statfs.f_iosinprogress << ". Current concurrency is " << shared_state.concurrency.load(std::memory_order_relaxed) << " and current pacing is "
+              << statfs.f_iosinprogress << " with " << (statfs.f_ioslatency * 1000000.0f) << " microseconds mean i/o latency. Current concurrency is "
+              << shared_state.concurrency.load(std::memory_order_relaxed) << " and current pacing is "
               << (shared_state.current_pacing.load(std::memory_order_relaxed) / 1000.0) << " microseconds." << std::endl;
     if(shared_state.current_pacing.load(std::memory_order_relaxed) > 0)
     {
@@ -573,6 +585,655 @@ static inline void TestDynamicThreadPoolGroupIoAwareWorks()
   BOOST_CHECK(paced > 0);
 }
 
+static inline void TestDynamicThreadPoolGroupPriorityClassesWork()
+{
+  static constexpr size_t WORKITEMS = 1024;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct shared_state_t
+  {
+    std::atomic<size_t> sequence{0};
+    std::atomic<uint64_t> background_sum{0}, critical_sum{0};
+    std::atomic<size_t> background_done{0}, critical_done{0};
+  } shared_state;
+  struct work_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    using _base = llfio::dynamic_thread_pool_group::work_item;
+    shared_state_t *shared{nullptr};
+    bool critical{false}, done{false};
+
+    work_item() = default;
+    explicit work_item(shared_state_t *_shared, bool _critical)
+        : shared(_shared)
+        , critical(_critical)
+    {
+    }
+    work_item(work_item &&o) noexcept
+        : _base(std::move(o))
+        , shared(o.shared)
+        , critical(o.critical)
+    {
+    }
+
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+    {
+      if(done)
+      {
+        return -1;
+      }
+      done = true;
+      return 1;
+    }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      auto begin = std::chrono::steady_clock::now();
+      while(std::chrono::steady_clock::now() - begin < std::chrono::microseconds(100))
+      {
+      }
+      auto seq = shared->sequence.fetch_add(1, std::memory_order_relaxed);
+      if(critical)
+      {
+        shared->critical_sum.fetch_add(seq, std::memory_order_relaxed);
+        shared->critical_done.fetch_add(1, std::memory_order_relaxed);
+      }
+      else
+      {
+        shared->background_sum.fetch_add(seq, std::memory_order_relaxed);
+        shared->background_done.fetch_add(1, std::memory_order_relaxed);
+      }
+      return llfio::success();
+    }
+  };
+  std::vector<work_item> background, critical;
+  background.reserve(WORKITEMS);
+  critical.reserve(WORKITEMS);
+  for(size_t n = 0; n < WORKITEMS; n++)
+  {
+    background.emplace_back(&shared_state, false);
+    critical.emplace_back(&shared_state, true);
+  }
+  auto backgroundtpg = llfio::make_dynamic_thread_pool_group().value();
+  auto criticaltpg = llfio::make_dynamic_thread_pool_group().value();
+  BOOST_CHECK(backgroundtpg->priority() == llfio::dynamic_thread_pool_group::priority_class::normal);
+  backgroundtpg->set_priority(llfio::dynamic_thread_pool_group::priority_class::background).value();
+  criticaltpg->set_priority(llfio::dynamic_thread_pool_group::priority_class::latency_critical).value();
+  BOOST_CHECK(backgroundtpg->priority() == llfio::dynamic_thread_pool_group::priority_class::background);
+  BOOST_CHECK(criticaltpg->priority() == llfio::dynamic_thread_pool_group::priority_class::latency_critical);
+  // Submit the background work first, so if priority classes were ignored it would tend to execute first
+  backgroundtpg->submit(llfio::span<work_item>(background)).value();
+  criticaltpg->submit(llfio::span<work_item>(critical)).value();
+  criticaltpg->wait().value();
+  backgroundtpg->wait().value();
+  BOOST_CHECK(shared_state.background_done == WORKITEMS);
+  BOOST_CHECK(shared_state.critical_done == WORKITEMS);
+  const auto background_mean = (double) shared_state.background_sum / WORKITEMS, critical_mean = (double) shared_state.critical_sum / WORKITEMS;
+  std::cout << "  Mean completion order of latency critical work was " << critical_mean << ", of background work was " << background_mean << std::endl;
+  if(0 == strcmp(llfio::dynamic_thread_pool_group::implementation_description(), "Linux native"))
+  {
+    BOOST_CHECK(critical_mean < background_mean);
+  }
+}
+
+static inline void TestDynamicThreadPoolGroupParallelForWorks()
+{
+  static constexpr size_t ELEMENTS = 1000000;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  std::vector<uint8_t> visited(ELEMENTS, 0);
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  // Per element form
+  {
+    auto pf = llfio::dynamic_thread_pool_group::make_parallel_for(0, ELEMENTS, [&](size_t i) { visited[i]++; });
+    auto begin = std::chrono::steady_clock::now();
+    pf->submit(tpg.get()).value();
+    tpg->wait().value();
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "  Per element parallel for of " << ELEMENTS << " elements using " << pf->concurrency() << " work items took "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " microseconds." << std::endl;
+    BOOST_CHECK(pf->completed() == ELEMENTS);
+    size_t wrong = 0;
+    for(auto i : visited)
+    {
+      if(i != 1)
+      {
+        wrong++;
+      }
+    }
+    BOOST_CHECK(wrong == 0);
+  }
+  // Per chunk form, with a minimum chunk size, resubmitting the same group
+  {
+    std::atomic<uint64_t> sum{0};
+    std::atomic<size_t> chunks{0};
+    auto pf = llfio::dynamic_thread_pool_group::make_parallel_for(
+    0, ELEMENTS,
+    [&](size_t begin, size_t end) {
+      uint64_t s = 0;
+      for(; begin < end; ++begin)
+      {
+        s += begin;
+      }
+      sum.fetch_add(s, std::memory_order_relaxed);
+      chunks.fetch_add(1, std::memory_order_relaxed);
+    },
+    1000);
+    pf->submit(tpg.get()).value();
+    tpg->wait().value();
+    std::cout << "  Per chunk parallel for of " << ELEMENTS << " elements executed " << chunks << " chunks." << std::endl;
+    BOOST_CHECK(pf->completed() == ELEMENTS);
+    BOOST_CHECK(sum == (uint64_t) ELEMENTS * (ELEMENTS - 1) / 2);
+    BOOST_CHECK(chunks <= ELEMENTS / 1000);
+  }
+  // Empty range
+  {
+    auto pf = llfio::dynamic_thread_pool_group::make_parallel_for(5, 5, [&](size_t /*unused*/) { abort(); });
+    pf->submit(tpg.get()).value();
+    tpg->wait().value();
+    BOOST_CHECK(pf->completed() == 0);
+  }
+}
+
+static inline void TestDynamicThreadPoolGroupSpinWakeupWorks()
+{
+  static constexpr size_t ROUNDTRIPS = 2000;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct roundtrip_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    std::atomic<size_t> &executed;
+    bool done{false};
+    explicit roundtrip_item(std::atomic<size_t> &_executed)
+        : executed(_executed)
+    {
+    }
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+    {
+      if(done)
+      {
+        return -1;
+      }
+      done = true;
+      return 1;
+    }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      executed.fetch_add(1, std::memory_order_relaxed);
+      return llfio::success();
+    }
+  };
+  const auto original_spin = llfio::dynamic_thread_pool_group::us_spin_for_more_work();
+  std::cout << "Implementation default spin for more work is " << original_spin << " microseconds." << std::endl;
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  auto measure = [&](uint32_t spin) {
+    llfio::dynamic_thread_pool_group::us_spin_for_more_work(spin);
+    std::atomic<size_t> executed{0};
+    auto begin = std::chrono::steady_clock::now();
+    for(size_t n = 0; n < ROUNDTRIPS; n++)
+    {
+      roundtrip_item item(executed);
+      tpg->submit(&item).value();
+      tpg->wait().value();
+    }
+    auto end = std::chrono::steady_clock::now();
+    BOOST_CHECK(executed == ROUNDTRIPS);
+    std::cout << "  With spin for more work of " << spin << " microseconds, the mean submit to completion round trip was "
+              << (std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / ROUNDTRIPS) << " nanoseconds." << std::endl;
+  };
+  measure(0);
+  measure(std::max(original_spin, (uint32_t) 50));
+  // Many items submitted at once by a single submitter must all get executed
+  {
+    std::atomic<size_t> executed{0};
+    std::vector<roundtrip_item> items;
+    items.reserve(1000);
+    for(size_t n = 0; n < 1000; n++)
+    {
+      items.emplace_back(executed);
+    }
+    for(auto &i : items)
+    {
+      tpg->submit(&i).value();
+    }
+    tpg->wait().value();
+    BOOST_CHECK(executed == 1000);
+  }
+  llfio::dynamic_thread_pool_group::us_spin_for_more_work(original_spin);
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::us_spin_for_more_work() == original_spin);
+}
+
+static inline void TestDynamicThreadPoolGroupWorkStealingWorks()
+{
+  // Well beyond the capacity of a worker's deque, so it overflows into the injection queue
+  static constexpr size_t CHILDREN = 8192;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct child_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    std::atomic<unsigned> executed{0};
+    std::thread::id ran_on;
+    bool done{false};
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+    {
+      if(done)
+      {
+        return -1;
+      }
+      done = true;
+      return 1;
+    }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      ran_on = std::this_thread::get_id();
+      // Take long enough that idle workers have time to steal
+      const auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+      while(std::chrono::steady_clock::now() < until)
+      {
+      }
+      executed.fetch_add(1, std::memory_order_relaxed);
+      return llfio::success();
+    }
+  };
+  // Submits every child from within a pool worker, so they all go onto its own deque
+  struct flood_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    std::vector<child_item> &children;
+    std::thread::id ran_on;
+    bool done{false};
+    explicit flood_item(std::vector<child_item> &_children)
+        : children(_children)
+    {
+    }
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+    {
+      if(done)
+      {
+        return -1;
+      }
+      done = true;
+      return 1;
+    }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      ran_on = std::this_thread::get_id();
+      std::vector<llfio::dynamic_thread_pool_group::work_item *> ptrs;
+      for(auto &i : children)
+      {
+        ptrs.push_back(&i);
+      }
+      return parent()->submit(ptrs);
+    }
+  };
+  std::vector<child_item> children(CHILDREN);
+  flood_item flooder(children);
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  tpg->submit(&flooder).value();
+  tpg->wait().value();
+  size_t wrong = 0, stolen = 0;
+  for(auto &i : children)
+  {
+    if(i.executed != 1)
+    {
+      wrong++;
+    }
+    if(i.ran_on != flooder.ran_on)
+    {
+      stolen++;
+    }
+  }
+  std::cout << "  Of " << CHILDREN << " work items submitted by one worker, " << stolen << " were executed by other workers." << std::endl;
+  BOOST_CHECK(wrong == 0);
+  if(0 == strcmp(llfio::dynamic_thread_pool_group::implementation_description(), "Linux native") && std::thread::hardware_concurrency() > 1)
+  {
+    BOOST_CHECK(stolen > 0);
+  }
+}
+
+#ifdef __linux__
+static inline void TestDynamicThreadPoolGroupPartitioningWorks()
+{
+  static constexpr size_t WORKITEMS = 256;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  if(0 != strcmp(llfio::dynamic_thread_pool_group::implementation_description(), "Linux native"))
+  {
+    std::cout << "  Skipping as CPU partitioning is only implemented by the Linux native implementation." << std::endl;
+    return;
+  }
+  // The NUMA nodes with CPUs this process may run upon, from sysfs
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  BOOST_REQUIRE(-1 != ::sched_getaffinity(::getpid(), sizeof(allowed), &allowed));
+  std::vector<int> nodes;
+  for(int node = 0; node < 1024; node++)
+  {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if(!in || !std::getline(in, list))
+    {
+      continue;
+    }
+    bool usable = false;
+    for(const char *p = list.c_str(); *p != 0;)
+    {
+      char *e = nullptr;
+      unsigned long first = strtoul(p, &e, 10), last = first;
+      if(e == p)
+      {
+        break;
+      }
+      if(*e == '-')
+      {
+        p = e + 1;
+        last = strtoul(p, &e, 10);
+      }
+      for(auto cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+      {
+        usable = usable || CPU_ISSET(cpu, &allowed);
+      }
+      p = (*e == ',') ? e + 1 : e;
+    }
+    if(usable)
+    {
+      nodes.push_back(node);
+    }
+  }
+  std::cout << "  sysfs reports " << nodes.size() << " NUMA nodes with CPUs this process may use." << std::endl;
+
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::partitioning(llfio::dynamic_thread_pool_group::cpu_partitioning::numa_node).value() ==
+              llfio::dynamic_thread_pool_group::cpu_partitioning::numa_node);
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::partitioning() == llfio::dynamic_thread_pool_group::cpu_partitioning::numa_node);
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::pool_statistics().value().cpu_domains == std::max((size_t) 1, std::min(nodes.size(), (size_t) 64)));
+
+  // Memory we have touched resides on some node
+  std::vector<char> memory(65536, 1);
+  auto node = llfio::dynamic_thread_pool_group::numa_node_of(memory.data());
+  BOOST_REQUIRE(node);
+  BOOST_CHECK(nodes.empty() || std::find(nodes.begin(), nodes.end(), node.value()) != nodes.end());
+
+  if(nodes.size() < 2)
+  {
+    std::cout << "  Skipping the locality hint check as there are fewer than two NUMA nodes." << std::endl;
+  }
+  else
+  {
+    struct work_item final : public llfio::dynamic_thread_pool_group::work_item
+    {
+      int ran_on{-1};
+      bool done{false};
+      virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override
+      {
+        if(done)
+        {
+          return -1;
+        }
+        done = true;
+        return 1;
+      }
+      virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+      {
+        unsigned cpu = 0, node = 0;
+        if(-1 != ::syscall(SYS_getcpu, &cpu, &node, nullptr))
+        {
+          ran_on = (int) node;
+        }
+        // Long enough that the kernel threads of each domain are busy
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return llfio::success();
+      }
+    };
+    std::vector<work_item> workitems(WORKITEMS);
+    for(size_t n = 0; n < WORKITEMS; n++)
+    {
+      workitems[n].set_locality_hint(nodes[n % nodes.size()]);
+    }
+    auto tpg = llfio::make_dynamic_thread_pool_group().value();
+    tpg->submit(llfio::span<work_item>(workitems)).value();
+    tpg->wait().value();
+    // Kernel threads with nothing to do in their own domain may steal, so most rather than all must run where hinted
+    size_t hinted = 0;
+    for(auto &i : workitems)
+    {
+      if(i.ran_on == i.locality_hint())
+      {
+        hinted++;
+      }
+    }
+    std::cout << "  " << hinted << " of " << WORKITEMS << " locality hinted work items executed on their hinted NUMA node." << std::endl;
+    BOOST_CHECK(hinted > WORKITEMS / 2);
+  }
+
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::partitioning(llfio::dynamic_thread_pool_group::cpu_partitioning::none).value() ==
+              llfio::dynamic_thread_pool_group::cpu_partitioning::none);
+  BOOST_CHECK(llfio::dynamic_thread_pool_group::pool_statistics().value().cpu_domains == 1);
+}
+#endif
+
+static inline void TestDynamicThreadPoolGroupIntrospectionWorks()
+{
+  static constexpr size_t WORKITEMS = 256, EXECUTIONS = 4;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct work_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    using _base = llfio::dynamic_thread_pool_group::work_item;
+    size_t remaining{EXECUTIONS};
+
+    work_item() = default;
+    work_item(work_item &&o) noexcept
+        : _base(std::move(o))
+        , remaining(o.remaining)
+    {
+    }
+
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override { return (remaining-- > 0) ? 1 : -1; }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      auto begin = std::chrono::steady_clock::now();
+      while(std::chrono::steady_clock::now() - begin < std::chrono::microseconds(50))
+      {
+      }
+      return llfio::success();
+    }
+  };
+  llfio::dynamic_thread_pool_group::trace_events(65536).value();
+  std::vector<work_item> workitems(WORKITEMS);
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  tpg->submit(llfio::span<work_item>(workitems)).value();
+  tpg->wait().value();
+  auto stats = tpg->statistics();
+  std::cout << "  Group executed " << stats.work_items_executed << " work items, with mean wait of "
+            << (stats.total_wait_time.count() / 1000.0 / (double) stats.work_items_executed) << " microseconds, maximum wait of "
+            << (stats.max_wait_time.count() / 1000.0) << " microseconds, and mean execution of "
+            << (stats.total_execution_time.count() / 1000.0 / (double) stats.work_items_executed) << " microseconds." << std::endl;
+  BOOST_CHECK(stats.work_items_executed == WORKITEMS * EXECUTIONS);
+  BOOST_CHECK(stats.work_items_active == 0);
+  BOOST_CHECK(stats.max_wait_time <= stats.total_wait_time);
+  BOOST_CHECK(stats.total_execution_time >= std::chrono::microseconds(50 * WORKITEMS * EXECUTIONS));
+
+  auto poolstats = llfio::dynamic_thread_pool_group::pool_statistics().value();
+  std::cout << "  Pool has added " << poolstats.threads_added << " and removed " << poolstats.threads_removed << " kernel threads, which were busy for "
+            << (poolstats.busy_time.count() / 1000000.0) << " ms, blocked for " << (poolstats.blocked_time.count() / 1000000.0) << " ms, idle for "
+            << (poolstats.idle_time.count() / 1000000.0) << " ms." << std::endl;
+  for(auto &i : poolstats.threads)
+  {
+    std::cout << "    Thread " << i.thread_id << (i.sleeping ? " (sleeping)" : "") << " busy " << (i.busy_time.count() / 1000000.0) << " ms, blocked "
+              << (i.blocked_time.count() / 1000000.0) << " ms, idle " << (i.idle_time.count() / 1000000.0) << " ms." << std::endl;
+  }
+  if(0 == strcmp(llfio::dynamic_thread_pool_group::implementation_description(), "Linux native"))
+  {
+    BOOST_CHECK(poolstats.threads_added > 0);
+    BOOST_CHECK(poolstats.threads_added >= poolstats.threads_removed);
+  }
+
+  auto events = llfio::dynamic_thread_pool_group::traced_events().value();
+  auto json = llfio::dynamic_thread_pool_group::traced_events_as_chrome_json().value();
+  llfio::dynamic_thread_pool_group::trace_events(0).value();
+  BOOST_CHECK(json.compare(0, 16, "{\"traceEvents\":[") == 0);
+  BOOST_CHECK(json.back() == '}');
+  size_t begins = 0, ends = 0;
+  for(auto &i : events)
+  {
+    if(i.group == tpg.get())
+    {
+      if(i.kind == llfio::dynamic_thread_pool_group::trace_event_kind::work_item_begin)
+      {
+        begins++;
+      }
+      else if(i.kind == llfio::dynamic_thread_pool_group::trace_event_kind::work_item_end)
+      {
+        ends++;
+      }
+    }
+  }
+  std::cout << "  Traced " << events.size() << " events, of which " << begins << " were work item beginnings." << std::endl;
+  BOOST_CHECK(begins == WORKITEMS * EXECUTIONS);
+  BOOST_CHECK(ends == WORKITEMS * EXECUTIONS);
+}
+
+#if LLFIO_ENABLE_COROUTINES
+static inline void TestDynamicThreadPoolGroupCoroutinesWork()
+{
+  static constexpr size_t COROUTINES = 64;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct shared_state_t
+  {
+    std::atomic<int> within_pool{0}, delayed{0}, completed{0};
+    std::atomic<bool> all_stopped{false};
+  } shared_state;
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  auto coroutine = [&]() -> llfio::eager<llfio::result<void>> {
+    OUTCOME_CO_TRY(co_await tpg->schedule());
+    if(llfio::dynamic_thread_pool_group::current_work_item() != nullptr)
+    {
+      shared_state.within_pool.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    OUTCOME_CO_TRY(co_await tpg->schedule_after(std::chrono::milliseconds(10)));
+    if(std::chrono::steady_clock::now() - begin >= std::chrono::milliseconds(9))
+    {
+      shared_state.delayed.fetch_add(1, std::memory_order_relaxed);
+    }
+    shared_state.completed.fetch_add(1, std::memory_order_relaxed);
+    co_return llfio::success();
+  };
+  std::vector<llfio::eager<llfio::result<void>>> states;
+  states.reserve(COROUTINES);
+  for(size_t n = 0; n < COROUTINES; n++)
+  {
+    states.push_back(coroutine());
+  }
+  auto waiter = [&]() -> llfio::eager<llfio::result<void>> {
+    llfio::dynamic_thread_pool_group *groups[] = {tpg.get()};
+    OUTCOME_CO_TRY(co_await llfio::dynamic_thread_pool_group::when_all(groups));
+    shared_state.all_stopped = true;
+    co_return llfio::success();
+  };
+  auto waiterstate = waiter();
+  tpg->wait().value();
+  while(!shared_state.all_stopped)
+  {
+    std::this_thread::yield();
+  }
+  std::cout << "  " << shared_state.within_pool << " coroutines were resumed within the pool, " << shared_state.delayed << " were delayed correctly, "
+            << shared_state.completed << " completed." << std::endl;
+  BOOST_CHECK(shared_state.within_pool == COROUTINES);
+  BOOST_CHECK(shared_state.delayed == COROUTINES);
+  BOOST_CHECK(shared_state.completed == COROUTINES);
+}
+
+static inline void TestDynamicThreadPoolGroupCoroutineLifetimesWork()
+{
+  static constexpr size_t RESCHEDULES = 10000;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  // resume_after() of a co_read(), which without a multiplexer completes immediately
+  {
+    auto fh = llfio::file_handle::temp_file().value();
+    fh.write(0, {{reinterpret_cast<const llfio::byte *>("hello"), 5}}).value();
+    std::atomic<bool> done{false};
+    bool within_pool = false;
+    size_t bytesread = 0;
+    auto coroutine = [&]() -> llfio::eager<llfio::result<void>> {
+      llfio::byte buffer[16];
+      llfio::file_handle::buffer_type b{buffer, sizeof(buffer)};
+      auto r = co_await tpg->resume_after(fh.co_read({{&b, 1}, 0}));
+      within_pool = (llfio::dynamic_thread_pool_group::current_work_item() != nullptr);
+      if(r)
+      {
+        bytesread = r.value()[0].size();
+      }
+      done = true;
+      co_return llfio::success();
+    };
+    auto state = coroutine();
+    while(!done)
+    {
+      std::this_thread::yield();
+    }
+    tpg->wait().value();
+    BOOST_CHECK(within_pool);
+    BOOST_CHECK(bytesread == 5);
+  }
+  // Many reschedules within a long lived group, each of whose work items is released as it completes
+  {
+    std::atomic<size_t> resumed{0};
+    std::atomic<bool> done{false};
+    auto coroutine = [&]() -> llfio::eager<llfio::result<void>> {
+      for(size_t n = 0; n < RESCHEDULES; n++)
+      {
+        OUTCOME_CO_TRY(co_await tpg->schedule());
+        resumed.fetch_add(1, std::memory_order_relaxed);
+      }
+      done = true;
+      co_return llfio::success();
+    };
+    auto state = coroutine();
+    while(!done)
+    {
+      std::this_thread::yield();
+    }
+    tpg->wait().value();
+    BOOST_CHECK(resumed == RESCHEDULES);
+  }
+  // Stopping the group resumes a coroutine not yet resumed with the cause
+  {
+    std::atomic<bool> done{false};
+    llfio::result<void> cause(llfio::success());
+    auto coroutine = [&]() -> llfio::eager<llfio::result<void>> {
+      cause = co_await tpg->schedule_after(std::chrono::milliseconds(200));
+      done = true;
+      co_return llfio::success();
+    };
+    auto state = coroutine();
+    tpg->stop().value();
+    while(!done)
+    {
+      std::this_thread::yield();
+    }
+    (void) tpg->wait();
+    BOOST_REQUIRE(!cause);
+    BOOST_CHECK(cause.error() == llfio::errc::operation_canceled);
+  }
+  // A coroutine resumed by a group stopping may destroy that group
+  {
+    auto owned = llfio::make_dynamic_thread_pool_group().value();
+    std::atomic<bool> destroyed{false};
+    auto coroutine = [&]() -> llfio::eager<llfio::result<void>> {
+      OUTCOME_CO_TRY(co_await owned->schedule());
+      co_return llfio::success();
+    };
+    auto waiter = [&]() -> llfio::eager<llfio::result<void>> {
+      llfio::dynamic_thread_pool_group *groups[] = {owned.get()};
+      auto r = co_await llfio::dynamic_thread_pool_group::when_all(groups);
+      owned.reset();
+      destroyed = true;
+      co_return r;
+    };
+    auto state = coroutine();
+    auto waiterstate = waiter();
+    while(!destroyed)
+    {
+      std::this_thread::yield();
+    }
+    BOOST_CHECK(owned == nullptr);
+  }
+}
+#endif
+
 KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, works, "Tests that llfio::dynamic_thread_pool_group works as expected",
                        TestDynamicThreadPoolGroupWorks())
 KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, delay,
@@ -582,3 +1243,25 @@ KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, nested, "T
                        TestDynamicThreadPoolGroupNestingWorks())
 KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, io_aware_work_item,
                        "Tests that llfio::dynamic_thread_pool_group::io_aware_work_item works as expected", TestDynamicThreadPoolGroupIoAwareWorks())
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, priority_classes,
+                       "Tests that llfio::dynamic_thread_pool_group priority classes work as expected", TestDynamicThreadPoolGroupPriorityClassesWork())
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, parallel_for,
+                       "Tests that llfio::dynamic_thread_pool_group::parallel_for_work_items works as expected", TestDynamicThreadPoolGroupParallelForWorks())
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, work_stealing,
+                       "Tests that llfio::dynamic_thread_pool_group work stealing executes every work item exactly once", TestDynamicThreadPoolGroupWorkStealingWorks())
+#ifdef __linux__
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, partitioning,
+                       "Tests that llfio::dynamic_thread_pool_group CPU partitioning and locality hints work as expected",
+                       TestDynamicThreadPoolGroupPartitioningWorks())
+#endif
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, introspection,
+                       "Tests that llfio::dynamic_thread_pool_group statistics and tracing work as expected", TestDynamicThreadPoolGroupIntrospectionWorks())
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, spin_wakeup,
+                       "Tests that llfio::dynamic_thread_pool_group spin then park wakeup works as expected", TestDynamicThreadPoolGroupSpinWakeupWorks())
+#if LLFIO_ENABLE_COROUTINES
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, coroutines,
+                       "Tests that llfio::dynamic_thread_pool_group coroutine scheduling works as expected", TestDynamicThreadPoolGroupCoroutinesWork())
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group, coroutine_lifetimes,
+                       "Tests that llfio::dynamic_thread_pool_group coroutine resume_after, cancellation and work item release work as expected",
+                       TestDynamicThreadPoolGroupCoroutineLifetimesWork())
+#endif
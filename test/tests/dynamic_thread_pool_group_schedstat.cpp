@@ -0,0 +1,92 @@
+/* Integration test kernel for the schedstat concurrency controller of dynamic_thread_pool_group
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+// The build system defines LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT=1 for the
+// header only edition of this test. The other editions test the default controller.
+#include "../test_kernel_decl.hpp"
+
+static inline void TestDynamicThreadPoolGroupSchedstatReplacesBlockedWorkers()
+{
+  static constexpr size_t EXECUTIONS = 4;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  const size_t workitems = 2 * llfio::utils::effective_cpu_concurrency();
+  struct shared_state_t
+  {
+    std::atomic<size_t> concurrency{0}, max_concurrency{0}, executed{0};
+  } shared_state;
+  struct work_item final : public llfio::dynamic_thread_pool_group::work_item
+  {
+    using _base = llfio::dynamic_thread_pool_group::work_item;
+    shared_state_t *shared{nullptr};
+    size_t remaining{EXECUTIONS};
+
+    explicit work_item(shared_state_t *_shared)
+        : shared(_shared)
+    {
+    }
+    work_item(work_item &&o) noexcept
+        : _base(std::move(o))
+        , shared(o.shared)
+        , remaining(o.remaining)
+    {
+    }
+
+    virtual intptr_t next(llfio::deadline & /*unused*/) noexcept override { return (remaining-- > 0) ? 1 : -1; }
+    virtual llfio::result<void> operator()(intptr_t /*unused*/) noexcept override
+    {
+      auto now = shared->concurrency.fetch_add(1, std::memory_order_relaxed) + 1;
+      for(auto v = shared->max_concurrency.load(std::memory_order_relaxed); v < now && !shared->max_concurrency.compare_exchange_weak(v, now);)
+      {
+      }
+      // Every worker blocks, so none of them can sample the others
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      shared->concurrency.fetch_sub(1, std::memory_order_relaxed);
+      shared->executed.fetch_add(1, std::memory_order_relaxed);
+      return llfio::success();
+    }
+  };
+  std::vector<work_item> items;
+  items.reserve(workitems);
+  for(size_t n = 0; n < workitems; n++)
+  {
+    items.emplace_back(&shared_state);
+  }
+  auto tpg = llfio::make_dynamic_thread_pool_group().value();
+  tpg->submit(llfio::span<work_item>(items)).value();
+  tpg->wait().value();
+  std::cout << "  With " << llfio::utils::effective_cpu_concurrency() << " CPUs and " << workitems << " blocking work items, maximum concurrency was "
+            << shared_state.max_concurrency << "." << std::endl;
+  BOOST_CHECK(shared_state.executed == workitems * EXECUTIONS);
+#if defined(LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT) && LLFIO_DYNAMIC_THREAD_POOL_GROUP_USE_SCHEDSTAT
+  if(0 == strcmp(llfio::dynamic_thread_pool_group::implementation_description(), "Linux native"))
+  {
+    // Blocked workers were replaced by the sampler thread
+    BOOST_CHECK(shared_state.max_concurrency > llfio::utils::effective_cpu_concurrency());
+  }
+#endif
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, dynamic_thread_pool_group_schedstat, blocked_workers,
+                       "Tests that the schedstat controller of llfio::dynamic_thread_pool_group replaces blocked workers",
+                       TestDynamicThreadPoolGroupSchedstatReplacesBlockedWorkers())
@@ -0,0 +1,79 @@
+/* Integration test kernel for the i/o trace hook
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#include "../test_kernel_decl.hpp"
+
+#include <vector>
+
+static inline void TestIoTraceHook()
+{
+#if LLFIO_LOGGING_LEVEL
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  struct traced
+  {
+    llfio::io_trace_op op;
+    unsigned long long offset, bytes;
+  };
+  std::vector<traced> seen;
+  llfio::set_io_trace_hook(
+  [](void *context, llfio::io_trace_op op, const llfio::handle &h, unsigned long long offset, unsigned long long bytes, std::chrono::nanoseconds /*unused*/) {
+    if(h.is_regular())
+    {
+      static_cast<std::vector<traced> *>(context)->push_back({op, offset, bytes});
+      // i/o by the hook is not reported
+      llfio::stat_t s(nullptr);
+      s.fill(h).value();
+    }
+  },
+  &seen);
+  {
+    auto fh = llfio::file_handle::file({}, "io_trace_hook_testfile", llfio::file_handle::mode::write, llfio::file_handle::creation::if_needed).value();
+    char buffer[100] = "hello";
+    fh.write(10, {{reinterpret_cast<llfio::byte *>(buffer), 5}}).value();
+    fh.read(8, {{reinterpret_cast<llfio::byte *>(buffer), 100}}).value();
+    fh.barrier({}, llfio::file_handle::barrier_kind::wait_all).value();
+    llfio::stat_t s(nullptr);
+    s.fill(fh).value();
+    // Fetching the inode to unlink is internal to LLFIO, so only the stat above is reported
+    fh.unlink().value();
+    fh.close().value();
+  }
+  llfio::set_io_trace_hook(nullptr);
+  // Not reported once the hook is removed
+  auto fh = llfio::file_handle::temp_file().value();
+
+  const traced expected[] = {{llfio::io_trace_op::open, 0, 0},         {llfio::io_trace_op::write, 10, 5}, {llfio::io_trace_op::read, 8, 7},
+                             {llfio::io_trace_op::barrier_all, 0, 0}, {llfio::io_trace_op::stat, 0, 0},  {llfio::io_trace_op::unlink, 0, 0},
+                             {llfio::io_trace_op::close, 0, 0}};
+  BOOST_REQUIRE(seen.size() == sizeof(expected) / sizeof(expected[0]));
+  for(size_t n = 0; n < seen.size(); n++)
+  {
+    BOOST_CHECK(seen[n].op == expected[n].op);
+    BOOST_CHECK(seen[n].offset == expected[n].offset);
+    BOOST_CHECK(seen[n].bytes == expected[n].bytes);
+  }
+#endif
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, io_trace_hook, trace, "Tests that the i/o trace hook reports each operation", TestIoTraceHook())
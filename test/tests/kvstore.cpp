@@ -0,0 +1,209 @@
+/* Integration test kernel for the kvstore implementation
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#include "../test_kernel_decl.hpp"
+
+#include "../../include/kvstore/kvstore.hpp"
+
+static inline void TestKVStoreMappedFiles()
+{
+  namespace kvstore = KVSTORE_V1_NAMESPACE;
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  using llfio::byte;
+  using store_type = kvstore::basic_key_value_store;
+  {
+    std::error_code ec;
+    llfio::filesystem::remove_all("testkvstore", ec);
+  }
+  auto key = [](uint64_t &v) { return store_type::key_type(reinterpret_cast<const byte *>(&v), sizeof(v)); };
+  auto write = [&](store_type &store, uint64_t k, const char *value) {
+    store_type::const_buffer_type b{reinterpret_cast<const byte *>(value), strlen(value)};
+    return store.write(key(k), {{&b, 1}, 0});
+  };
+  auto read = [&](store_type &store, uint64_t k) -> std::string {
+    byte buffer[64];
+    store_type::buffer_type b{buffer, sizeof(buffer)};
+    auto r = store.read({{&b, 1}, 0}, key(k));
+    if(!r)
+    {
+      return "<missing>";
+    }
+    return std::string(reinterpret_cast<const char *>(r.value()[0].data()), r.value()[0].size());
+  };
+
+  auto store = kvstore::create_kvstore("file://testkvstore", sizeof(uint64_t), store_type::features::atomic_transactions).value();
+  BOOST_CHECK(store->empty());
+  BOOST_CHECK(write(*store, 78, "niall"));
+  BOOST_CHECK(write(*store, 79, "douglas"));
+  BOOST_CHECK(read(*store, 78) == "niall");
+  BOOST_CHECK(read(*store, 80) == "<missing>");
+  BOOST_CHECK(store->size().value() == 2);
+
+  // Snapshots do not see later updates
+  auto snapshot = store->snapshot().value();
+  BOOST_CHECK(write(*store, 78, "carol"));
+  BOOST_CHECK(write(*store, 80, "new"));
+  BOOST_CHECK(read(*store, 78) == "carol");
+  BOOST_CHECK(read(*snapshot, 78) == "niall");
+  BOOST_CHECK(read(*snapshot, 80) == "<missing>");
+
+  // Transactions abort if a dependency was updated since they began
+  {
+    auto tr = store->begin_transaction().value();
+    BOOST_CHECK(read(*tr, 79) == "douglas");
+    BOOST_CHECK(write(*tr, 81, "first"));
+    BOOST_CHECK(read(*tr, 81) == "first");
+    BOOST_CHECK(read(*store, 81) == "<missing>");
+    BOOST_CHECK(tr->commit());
+    BOOST_CHECK(read(*store, 81) == "first");
+  }
+  {
+    auto tr = store->begin_transaction().value();
+    BOOST_CHECK(read(*tr, 79) == "douglas");
+    BOOST_CHECK(write(*tr, 82, "second"));
+    BOOST_CHECK(write(*store, 79, "changed"));
+    auto r = tr->commit();
+    BOOST_CHECK(!r);
+    BOOST_CHECK(r.error() == llfio::errc::resource_unavailable_try_again);
+    BOOST_CHECK(read(*store, 82) == "<missing>");
+  }
+
+  // Enumerate all the keys
+  {
+    size_t count = 0;
+    store_type::filter_state_type state{};
+    while(store->match(state))
+    {
+      BOOST_CHECK(store->matched_key(state).value().size() == sizeof(uint64_t));
+      ++count;
+    }
+    BOOST_CHECK(count == 4);
+  }
+
+  // A snapshot outliving both retained versions of a key is too old to read it
+  {
+    BOOST_CHECK(write(*store, 90, "one"));
+    auto old = store->snapshot().value();
+    BOOST_CHECK(write(*store, 90, "two"));
+    BOOST_CHECK(write(*store, 91, "new"));
+    BOOST_CHECK(read(*old, 90) == "one");
+    BOOST_CHECK(write(*store, 90, "three"));
+    BOOST_CHECK(write(*store, 91, "newer"));
+    byte buffer[64];
+    store_type::buffer_type b{buffer, sizeof(buffer)};
+    uint64_t k = 90;
+    auto r = old->read({{&b, 1}, 0}, key(k));
+    BOOST_CHECK(!r);
+    BOOST_CHECK(r.error() == llfio::errc::identifier_removed);
+    // Keys created after the snapshot still do not exist in it
+    k = 91;
+    r = old->read({{&b, 1}, 0}, key(k));
+    BOOST_CHECK(!r);
+    BOOST_CHECK(r.error() == llfio::errc::no_such_file_or_directory);
+    BOOST_CHECK(read(*store, 90) == "three");
+    // Clearing is refused whilst snapshots exist
+    auto cleared = store->clear();
+    BOOST_CHECK(!cleared);
+    BOOST_CHECK(cleared.error() == llfio::errc::device_or_resource_busy);
+  }
+
+  // Masks with leading one bits walk the ordered index, returning keys in order
+  {
+    auto matched = [&](byte maskbyte, byte bitsbyte) {
+      std::vector<uint64_t> ret;
+      byte mask[sizeof(uint64_t)] = {maskbyte}, bits[sizeof(uint64_t)] = {bitsbyte};
+      store_type::filter_state_type state{};
+      while(store->match(state, {mask, sizeof(mask)}, {bits, sizeof(bits)}))
+      {
+        uint64_t k;
+        memcpy(&k, store->matched_key(state).value().data(), sizeof(k));
+        ret.push_back(k);
+      }
+      return ret;
+    };
+    BOOST_CHECK(matched(byte(0xff), byte(79)) == std::vector<uint64_t>({79}));
+    BOOST_CHECK(matched(byte(0xf0), byte(0x50)) == std::vector<uint64_t>({80, 81, 90, 91}));
+    BOOST_CHECK(matched(byte(0xff), byte(82)).empty());
+  }
+
+  // Reopening sees the same contents
+  store.reset();
+  snapshot.reset();
+  store = kvstore::open_kvstore("file://testkvstore").value();
+  BOOST_CHECK(read(*store, 78) == "carol");
+  BOOST_CHECK(read(*store, 81) == "first");
+  BOOST_CHECK(store->clear());
+  BOOST_CHECK(store->empty());
+  BOOST_CHECK(read(*store, 78) == "<missing>");
+  // Clearing rewinds the values log, which is then reused
+  BOOST_CHECK(store->bytes_stored().value() == 0);
+  BOOST_CHECK(write(*store, 78, "reused"));
+  BOOST_CHECK(read(*store, 78) == "reused");
+
+  // Commits which would exceed the table or the quota fail, and the table cannot grow once populated
+  {
+    auto grown = store->max_size(store_type::capacity_type(uint64_t(1000000)));
+    BOOST_CHECK(!grown);
+    BOOST_CHECK(grown.error() == llfio::errc::operation_not_supported);
+    BOOST_CHECK(store->max_size(store_type::capacity_type(uint64_t(4))));
+    BOOST_CHECK(write(*store, 1, "one"));
+    BOOST_CHECK(write(*store, 2, "two"));
+    BOOST_CHECK(write(*store, 3, "three"));
+    auto full = write(*store, 4, "four");
+    BOOST_CHECK(!full);
+    BOOST_CHECK(full.error() == llfio::errc::no_space_on_device);
+    // Updating an existing key needs no more space in the table
+    BOOST_CHECK(write(*store, 3, "changed"));
+    BOOST_CHECK(store->max_size(store_type::capacity_type(uint64_t(0))));
+    BOOST_CHECK(store->max_size().value() == 49152);
+    uint64_t k = 100;
+    while(k < 100000 && write(*store, k, "x"))
+    {
+      k++;
+    }
+    BOOST_CHECK(store->size().value() == 49152);
+    full = write(*store, k, "x");
+    BOOST_CHECK(!full);
+    BOOST_CHECK(full.error() == llfio::errc::no_space_on_device);
+  }
+  store.reset();
+
+  // Truncating an existing store empties its ordered index too
+  store = kvstore::create_kvstore("file://testkvstore", sizeof(uint64_t), store_type::features::atomic_transactions, store_type::mode::write,
+                                  store_type::creation::truncate_existing)
+          .value();
+  BOOST_CHECK(store->empty());
+  {
+    byte mask[sizeof(uint64_t)] = {byte(0xff)}, bits[sizeof(uint64_t)] = {byte(3)};
+    store_type::filter_state_type state{};
+    BOOST_CHECK(!store->match(state, {mask, sizeof(mask)}, {bits, sizeof(bits)}));
+  }
+  store.reset();
+  {
+    std::error_code ec;
+    llfio::filesystem::remove_all("testkvstore", ec);
+  }
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, kvstore, mapped_files, "Tests that the mapped_files kvstore works as expected", TestKVStoreMappedFiles())
@@ -50,6 +50,7 @@ static inline void TestStatfsIosInProgress()
     std::cout << "\n directory on which mounted = " << statfs.f_mntonname;
     std::cout << "\n i/o's currently in progress (i.e. queue depth) = " << statfs.f_iosinprogress;
     std::cout << "\n percentage of time spent doing i/o (1.0 = 100%) = " << statfs.f_iosbusytime;
+    std::cout << "\n mean seconds to complete each i/o = " << statfs.f_ioslatency;
     std::cout << std::endl;
   };
   llfio::statfs_t s1base, s2base;
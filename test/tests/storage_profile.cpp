@@ -0,0 +1,62 @@
+/* Integration test kernel for the storage profile
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+
+#include "../test_kernel_decl.hpp"
+
+static inline void TestStorageProfileQueueDepth()
+{
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  namespace sp = llfio::storage_profile;
+  auto fh = llfio::file_handle::uniquely_named_file({}, llfio::file_handle::mode::write, llfio::file_handle::caching::all, llfio::file_handle::flag::unlink_on_first_close)
+            .value();
+  // A small file is enough, the offsets are drawn from whatever extent it has
+  fh.truncate(1024 * 1024).value();
+  std::vector<llfio::byte> buffer(1024 * 1024, llfio::to_byte(0x78));
+  fh.write(0, {{buffer.data(), buffer.size()}}).value();
+
+  sp::storage_profile profile;
+  auto r = profile.read_qd32(profile, fh);
+  if(r.has_error() && r.error() == llfio::errc::operation_not_supported)
+  {
+    // No i/o multiplexer on this platform, so the item must be left unavailable
+    std::cout << "NOTE: No i/o multiplexer is available, so queue depth 32 is reported as unavailable" << std::endl;
+    BOOST_CHECK(profile.read_qd32_mean.value == static_cast<unsigned long long>(-1));
+    BOOST_CHECK(profile.read_qd32_iops.value == static_cast<unsigned long long>(-1));
+  }
+  else
+  {
+    r.value();
+    std::cout << "Read at queue depth 32: mean " << profile.read_qd32_mean.value << "ns, " << profile.read_qd32_iops.value << " iops" << std::endl;
+    BOOST_CHECK(profile.read_qd32_iops.value > 0);
+    BOOST_CHECK(profile.read_qd32_min.value <= profile.read_qd32_50.value);
+    BOOST_CHECK(profile.read_qd32_min.value <= profile.read_qd32_mean.value);
+    BOOST_CHECK(profile.read_qd32_mean.value <= profile.read_qd32_max.value);
+    BOOST_CHECK(profile.read_qd32_50.value <= profile.read_qd32_99.value);
+    BOOST_CHECK(profile.read_qd32_99.value <= profile.read_qd32_max.value);
+  }
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, storage_profile, queue_depth, "Tests that a queue depth item is profiled on a small file, or reported as unavailable",
+                       TestStorageProfileQueueDepth())
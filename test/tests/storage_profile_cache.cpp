@@ -0,0 +1,96 @@
+/* Integration test kernel for the storage profile cache
+(C) 2026 Niall Douglas <http://www.nedproductions.biz/> (1 commit)
+File Created: Oct 2026
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License in the accompanying file
+Licence.txt or at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Distributed under the Boost Software License, Version 1.0.
+    (See accompanying file Licence.txt or copy at
+          http://www.boost.org/LICENSE_1_0.txt)
+*/
+
+#include "../test_kernel_decl.hpp"
+
+static inline void TestStorageProfileCacheRecommendations()
+{
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  namespace sp = llfio::storage_profile;
+  auto dirh = llfio::directory({}, "storage_profile_cache_testdir", llfio::directory_handle::mode::write, llfio::directory_handle::creation::if_needed).value();
+  sp::set_profile_cache_directory(dirh).value();
+  auto fh = llfio::file_handle::uniquely_named_file(dirh, llfio::file_handle::mode::write, llfio::file_handle::caching::all,
+                                                     llfio::file_handle::flag::unlink_on_first_close)
+            .value();
+
+  // Nothing cached yet, so the defaults
+  auto params = sp::recommended_parameters(fh).value();
+  BOOST_CHECK(!params.profiled);
+  BOOST_CHECK(params.io_size == llfio::utils::file_buffer_default_size());
+  BOOST_CHECK(params.queue_depth == 0);
+
+  // Cached i/o peaks at 1Mb, but 64Kb reaches within a tenth of it. Direct i/o is slower.
+  sp::store_cached_profile(fh, "system:\n"
+                               "    os:\n"
+                               "        name: Test\n"
+                               "direct=0 sync=0:\n"
+                               "    concurrency:\n"
+                               "        # The i/o modify quantum guaranteed to be atomically visible to readers\n"
+                               "        atomic_rewrite_quantum: 4096\n"
+                               "    latency:\n"
+                               "        read:\n"
+                               "            qd1:\n"
+                               "                50%: 85000\n"
+                               "    throughput:\n"
+                               "        read:\n"
+                               "            sweep: {4096: {1: [4096000, 900, 1500]}}\n"
+                               "            4k:\n"
+                               "                knee_qd: 32\n"
+                               "                knee_bytes_per_sec: 400000000\n"
+                               "            64k:\n"
+                               "                knee_qd: 8\n"
+                               "                knee_bytes_per_sec: 1900000000\n"
+                               "            1m:\n"
+                               "                knee_qd: 4\n"
+                               "                knee_bytes_per_sec: 2000000000\n"
+                               "direct=1 sync=0:\n"
+                               "    throughput:\n"
+                               "        read:\n"
+                               "            1m:\n"
+                               "                knee_qd: 4\n"
+                               "                knee_bytes_per_sec: 1500000000\n")
+  .value();
+  auto check = [&] {
+    auto params = sp::recommended_parameters(fh).value();
+    BOOST_CHECK(params.profiled);
+    BOOST_CHECK(params.io_size == 65536);
+    BOOST_CHECK(params.queue_depth == 8);
+    BOOST_CHECK(params.atomic_rewrite_quantum == 4096);
+    BOOST_CHECK(!params.direct_io_wins);
+    BOOST_CHECK(params.unqueued_read_latency == 85000);
+    BOOST_CHECK(sp::recommended_parameters().queue_depth == 8);
+  };
+  check();
+  // Discard what is in memory, so the cache is reloaded from disc
+  sp::set_profile_cache_directory(dirh).value();
+  check();
+
+  llfio::file_handle::file(dirh, "llfio_storage_profiles.yaml", llfio::file_handle::mode::write).value().unlink().value();
+  sp::set_profile_cache_directory({}).value();
+  fh.close().value();
+  dirh.unlink().value();
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, storage_profile_cache, recommendations, "Tests that recommended i/o parameters are derived from a cached storage profile",
+                       TestStorageProfileCacheRecommendations())
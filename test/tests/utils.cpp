@@ -216,3 +216,19 @@ static inline void TestCurrentProcessMemoryUsage()
 }
 
 KERNELTEST_TEST_KERNEL(integration, llfio, utils, current_process_memory_usage, "Tests that llfio::utils::current_process_memory_usage() works as expected", TestCurrentProcessMemoryUsage())
+
+static inline void TestEffectiveCpuConcurrency()
+{
+  namespace llfio = LLFIO_V2_NAMESPACE;
+  const auto effective = llfio::utils::effective_cpu_concurrency();
+  std::cout << "Effective CPU concurrency is " << effective << " of " << std::thread::hardware_concurrency() << " hardware concurrency." << std::endl;
+  BOOST_CHECK(effective >= 1);
+  if(std::thread::hardware_concurrency() > 0)
+  {
+    BOOST_CHECK(effective <= std::thread::hardware_concurrency());
+  }
+  // Cached value must be stable
+  BOOST_CHECK(llfio::utils::effective_cpu_concurrency() == effective);
+}
+
+KERNELTEST_TEST_KERNEL(integration, llfio, utils, effective_cpu_concurrency, "Tests that llfio::utils::effective_cpu_concurrency() works as expected", TestEffectiveCpuConcurrency())